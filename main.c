@@ -1,22 +1,35 @@
 #include "spymodel.h"
 #include "spywindow.h"
 #include "spycontroller.h"
+#include "spybench.h"
+#include "spyexport.h"
 
 
 void usage()
 {
-	printf("usage: redisspy [-h <host>] [-p <port>] [-k <pattern>] [-a <interval>]\n");
-	printf("                [-o] [-u] [-d<delimiter>]\n");
+	printf("usage: redisspy [-h <host>] [-p <port>] [-s <socket>] [-k <pattern>] [-a <interval>] [-l] [-t]\n");
+	printf("                [-D <delimiter>] [-M <megabytes>] [-P]\n");
+	printf("                [-o] [-u] [-e] [-d<delimiter>] [-b <count>]\n");
 	printf("\n");
 	printf("    -h : Specify host. Default is localhost.\n");
 	printf("    -p : Specify port. Default is 6379.\n");
+	printf("    -s : Connect through a Unix domain socket instead of TCP.\n");
 	printf("    -k : Specify key pattern. Default is '*' (all keys).\n");
 	printf("    -a : Refresh every <interval> seconds. Default is manual refresh.\n");
+	printf("    -l : Read key details with a server-side Lua script, one call per batch.\n");
+	printf("    -t : Index key names for the goto prompt (g) as they load.\n");
+	printf("    -D : Split key names on <delimiter> in the namespace tree (T). Default is ':'.\n");
+	printf("    -M : Keep at most <megabytes> of previews and detail pages together, 1/%d of it for\n",
+		   REDISSPY_DETAIL_BUDGET_SHARE);
+	printf("         detail pages; 0 for no cap. Default is %d.\n", REDISSPY_DEFAULT_VALUE_BUDGET_MB);
 	printf("\n");
 	printf("  redisspy can also run in non-interactive mode.\n");
 	printf("    -o : output formatted dump of keys/values to stdout and exit\n");
 	printf("	-u : output delimited dump of keys/values to stdout and exit\n");
+	printf("    -e : export every element of every key, one per line, and exit\n");
 	printf("    -d : change the output delimiter to <delimiter>. Default is '|'\n");
+	printf("    -b : benchmark <count> round trips over TCP (and the -s socket) and exit\n");
+	printf("    -P : report the key templates (user:{int}:name, ...) with counts and sizes, and exit\n");
 }
 
 
@@ -24,15 +37,21 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 {
 	strcpy(redis->host, REDISSPY_DEFAULT_HOST);
 	redis->port = REDISSPY_DEFAULT_PORT;
+	strcpy(redis->keyPattern, REDISSPY_DEFAULT_FILTER_PATTERN);
 	strcpy(redis->pattern, REDISSPY_DEFAULT_FILTER_PATTERN);
 
 	int dump = 0;
+	int exportValues = 0;
 	int unaligned = 0;
+	int bench = 0;
+	int schema = 0;
+	unsigned int benchIterations = 0;
+	int budget = REDISSPY_DEFAULT_VALUE_BUDGET_MB;
 	char delimiter[8];
 	strcpy(delimiter, "|"); // default
 
 	int c; 
-	while ((c = getopt(argc, argv, "h:p:a:k:?oud:")) != -1)
+	while ((c = getopt(argc, argv, "h:p:s:a:k:ltD:M:?oued:b:P")) != -1)
 	{
 		switch (c)
 		{
@@ -44,7 +63,12 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 				redis->port = atoi(optarg);
 				break;
 
+			case 's':
+				strncpy(redis->socketPath, optarg, sizeof(redis->socketPath) - 1);
+				break;
+
 			case 'k':
+				strcpy(redis->keyPattern, optarg);
 				strcpy(redis->pattern, optarg);
 				break;
 
@@ -52,6 +76,22 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 				redis->refreshInterval = atoi(optarg);
 				break;
 
+			case 'l':
+				redis->probeMode = REDISSPY_PROBE_SCRIPT;
+				break;
+
+			case 't':
+				redisSpyEnableKeyIndex(redis);
+				break;
+
+			case 'D':
+				redisSpySetTreeDelimiter(redis, optarg);
+				break;
+
+			case 'M':
+				budget = atoi(optarg);
+				break;
+
 			// The o,u,d options replace redisdump
 			case 'o':
 				dump = 1;
@@ -61,10 +101,23 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 				unaligned = 1;
 				break;
 
+			case 'e':
+				exportValues = 1;
+				break;
+
 			case 'd':
 				strncpy(delimiter, optarg, sizeof(delimiter) - 1);
 				break;
 
+			case 'b':
+				bench = 1;
+				benchIterations = (unsigned int)atoi(optarg);
+				break;
+
+			case 'P':
+				schema = 1;
+				break;
+
 			case '?':
 			default:
 				usage();
@@ -76,6 +129,32 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 	argc -= optind;
 	argv += optind;
 
+	if (bench)
+	{
+		int r = spyBenchRun(redis, benchIterations);
+		exit(r == 0 ? 0 : 1);
+	}
+
+	if (schema)
+	{
+		int r = spyExportSchemaRun(redis);
+
+		if (r != 0)
+			fprintf(stderr, "Template report failed.\n");
+
+		exit(r == 0 ? 0 : 1);
+	}
+
+	if (exportValues)
+	{
+		int r = spyExportRun(redis, delimiter);
+
+		if (r != 0)
+			fprintf(stderr, "Export failed.\n");
+
+		exit(r == 0 ? 0 : 1);
+	}
+
 	if (dump)
 	{
 		redisSpyServerRefresh(redis);
@@ -83,6 +162,10 @@ int redisSpyGetOptions(int argc, char* argv[], REDIS* redis)
 		exit(0);
 	}
 
+	// Only the interactive views keep values around to drop
+	if (budget > 0)
+		redisSpySetValueBudget(redis, (size_t)budget * 1024 * 1024);
+
 	return 0;
 }
 
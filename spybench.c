@@ -0,0 +1,216 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "spybench.h"
+
+
+static double spyBenchNow(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+// One PING at a time: what every interactive command pays.
+static int spyBenchLatency(redisContext* c, unsigned int iterations, double* latencyUs)
+{
+	double start = spyBenchNow();
+
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		redisReply* r = redisCommand(c, "PING");
+		if (r == NULL)
+			return -1;
+
+		freeReplyObject(r);
+	}
+
+	*latencyUs = (spyBenchNow() - start) * 1e6 / iterations;
+
+	return 0;
+}
+
+
+// PINGs pipelined in refresh-sized batches.
+static int spyBenchThroughput(redisContext* c, unsigned int iterations, double* opsPerSec)
+{
+	double start = spyBenchNow();
+
+	for (unsigned int first = 0; first < iterations; first += REDISSPY_PIPELINE_BATCH_SIZE)
+	{
+		unsigned int n = MIN(REDISSPY_PIPELINE_BATCH_SIZE, iterations - first);
+
+		for (unsigned int i = 0; i < n; i++)
+			redisAppendCommand(c, "PING");
+
+		for (unsigned int i = 0; i < n; i++)
+		{
+			redisReply* r = NULL;
+
+			if (redisGetReply(c, (void**)&r) != REDIS_OK)
+				return -1;
+
+			freeReplyObject(r);
+		}
+	}
+
+	*opsPerSec = iterations / (spyBenchNow() - start);
+
+	return 0;
+}
+
+
+// Re-read every row of the last refresh with the given probe mode
+static int spyBenchRowReads(REDIS* redis, int probeMode, double* ms)
+{
+	int savedMode = redis->probeMode;
+	redis->probeMode = probeMode;
+
+	double start = spyBenchNow();
+	int ret = redisSpyServerRefreshRange(redis, 0, redis->keyCount);
+
+	*ms = (spyBenchNow() - start) * 1e3;
+	redis->probeMode = savedMode;
+
+	return ret;
+}
+
+
+static int spyBenchTransport(REDIS* redis, unsigned int iterations, SPY_BENCH_RESULT* result)
+{
+	if (redisSpyEnsureConnected(redis) != 0)
+		return -1;
+
+	if (   (spyBenchLatency(redis->context, iterations, &result->latencyUs) != 0)
+		|| (spyBenchThroughput(redis->context, iterations, &result->opsPerSec) != 0))
+	{
+		return -1;
+	}
+
+	double start = spyBenchNow();
+
+	if (redisSpyServerRefresh(redis) != 0)
+		return -1;
+
+	result->refreshMs = (spyBenchNow() - start) * 1e3;
+	result->keyCount = redis->keyCount;
+
+	// The first script pass loads the script, outside the timing
+	double loadMs;
+	if (   (spyBenchRowReads(redis, REDISSPY_PROBE_SCRIPT, &loadMs) != 0)
+		|| (spyBenchRowReads(redis, REDISSPY_PROBE_PIPELINE, &result->pipelineMs) != 0)
+		|| (spyBenchRowReads(redis, REDISSPY_PROBE_SCRIPT, &result->scriptMs) != 0))
+	{
+		return -1;
+	}
+
+	if (redis->scriptingDisabled)
+		result->scriptMs = -1;
+
+	redisSpyServerClearCache(redis);
+
+	return 0;
+}
+
+
+static void spyBenchPrint(REDIS* redis, SPY_BENCH_RESULT* result)
+{
+	char address[REDISSPY_MAX_HOST_LEN + 16];
+	redisSpyServerAddress(redis, address, sizeof(address));
+
+	printf("%-5s %-28s %12.1f %14.0f %12.1f %8u\n",
+		   redis->socketPath[0] ? "unix" : "tcp",
+		   address,
+		   result->latencyUs,
+		   result->opsPerSec,
+		   result->refreshMs,
+		   result->keyCount);
+}
+
+
+static void spyBenchPrintRowReads(const char* transport, SPY_BENCH_RESULT* result)
+{
+	if (result->scriptMs < 0)
+	{
+		printf("%-5s row reads: pipelined %.1fms, script unavailable\n",
+			   transport, result->pipelineMs);
+	}
+	else
+	{
+		printf("%-5s row reads: pipelined %.1fms, script %.1fms (%.2fx)\n",
+			   transport, result->pipelineMs, result->scriptMs,
+			   result->pipelineMs / result->scriptMs);
+	}
+}
+
+
+// Runs over TCP to host:port, then over the socket path if set.
+// Returns 0, or -1 if a transport could not be benchmarked.
+int spyBenchRun(REDIS* redis, unsigned int iterations)
+{
+	SPY_BENCH_RESULT tcpResult;
+	SPY_BENCH_RESULT unixResult;
+
+	if (iterations == 0)
+		iterations = SPY_BENCH_DEFAULT_ITERATIONS;
+
+	REDIS* tcpRedis = redisSpyCreate();
+
+	strcpy(tcpRedis->host, redis->host);
+	tcpRedis->port = redis->port;
+	strcpy(tcpRedis->pattern, redis->pattern);
+	tcpRedis->probeMode = redis->probeMode;
+
+	printf("%d round trips per test, pattern '%s'\n\n", iterations, redis->pattern);
+	printf("%-5s %-28s %12s %14s %12s %8s\n",
+		   "", "server", "latency(us)", "pipelined/s", "refresh(ms)", "keys");
+
+	int ret = spyBenchTransport(tcpRedis, iterations, &tcpResult);
+
+	if (ret == 0)
+		spyBenchPrint(tcpRedis, &tcpResult);
+	else
+		fprintf(stderr, "Could not benchmark %s:%d\n", tcpRedis->host, tcpRedis->port);
+
+	redisSpyDelete(tcpRedis);
+
+	if (redis->socketPath[0] == '\0')
+	{
+		if (ret == 0)
+		{
+			printf("\n");
+			spyBenchPrintRowReads("tcp", &tcpResult);
+		}
+
+		return ret;
+	}
+
+	if (spyBenchTransport(redis, iterations, &unixResult) != 0)
+	{
+		fprintf(stderr, "Could not benchmark %s\n", redis->socketPath);
+		return -1;
+	}
+
+	spyBenchPrint(redis, &unixResult);
+	printf("\n");
+
+	if (ret == 0)
+		spyBenchPrintRowReads("tcp", &tcpResult);
+
+	spyBenchPrintRowReads("unix", &unixResult);
+
+	if (ret == 0)
+	{
+		printf("\nunix socket vs tcp: latency %.2fx lower, throughput %.2fx higher, refresh %.2fx faster\n",
+			   tcpResult.latencyUs / unixResult.latencyUs,
+			   unixResult.opsPerSec / tcpResult.opsPerSec,
+			   tcpResult.refreshMs / unixResult.refreshMs);
+	}
+
+	return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef _SPYBENCH_H_
+#define _SPYBENCH_H_
+
+#include "spymodel.h"
+
+// Headless benchmark (-b). Measures round trip latency, pipelined
+// throughput and a full refresh over loopback TCP, and over the Unix
+// socket as well when one was given with -s, so the two can be compared.
+// The row reads of the refresh are then repeated with pipelined commands
+// and with the probe script.
+
+#define SPY_BENCH_DEFAULT_ITERATIONS	10000
+
+typedef struct _spy_bench_result
+{
+	double			latencyUs;		// one command in flight at a time
+	double			opsPerSec;		// pipelined, as a refresh issues them
+	double			refreshMs;		// SCAN + TYPE + value reads for the pattern
+	unsigned int	keyCount;
+	double			pipelineMs;		// row reads only, pipelined commands
+	double			scriptMs;		// row reads only, EVALSHA per batch; < 0 if unavailable
+} SPY_BENCH_RESULT;
+
+int spyBenchRun(REDIS* redis, unsigned int iterations);
+
+#endif
@@ -9,6 +9,7 @@
 //
 //   l : redraw screen
 //   r : refresh
+// Esc : cancel refresh
 //   a : toggle autorefresh
 //
 //   q : quit
@@ -27,6 +28,13 @@
 
 #include "spymodel.h"
 #include "spywindow.h"
+#include "spyfetch.h"
+#include "spystats.h"
+#include "spysearch.h"
+#include "spyfind.h"
+#include "spytrigram.h"
+#include "spytree.h"
+#include "spyglob.h"
 
 #include "spycontroller.h"
 #include "spydetailcontroller.h"
@@ -35,25 +43,299 @@
 static SPY_WINDOW* g_redisSpyWindow;
 static REDIS* g_redis;
 static SPY_WINDOW_DELEGATE* g_spyWindowDelegate;
+static SPY_FETCH* g_fetch;
+
+static char g_findText[SPY_WINDOW_MAX_COMMAND_LEN];
+
+// The namespace tree and key templates replace the key list in the
+// same window, through their own delegates. The list's cursor is put
+// back on the way out.
+#define SPY_CONTROLLER_VIEW_LIST		0
+#define SPY_CONTROLLER_VIEW_TREE		1
+#define SPY_CONTROLLER_VIEW_SCHEMA		2
+
+static int g_viewMode;
+static SPY_WINDOW_DELEGATE* g_treeWindowDelegate;
+static SPY_WINDOW_DELEGATE* g_schemaWindowDelegate;
+static unsigned int g_listStartIndex;
+static unsigned int g_listCurrentRow;
+
+static unsigned int g_refreshTick;
+static volatile sig_atomic_t g_refreshDue;
 
 static int REDIS_SPY_DISPATCH_COMMAND_QUIT = -999999;
 
 // Driver
+//
+// All refresh traffic goes through the fetch thread. Requests are
+// posted here and their results are merged into the model between
+// keystrokes by spyControllerApplyResults.
+
+static void spyControllerPostInfo(void)
+{
+	spyFetchPost(g_fetch, spyFetchRequestCreate(SPY_FETCH_REQUEST_INFO, 0));
+}
+
+// first and count are window rows, so under a local filter they go
+// through the view.
+static void spyControllerPostRows(REDIS* redis, unsigned int first, unsigned int count)
+{
+	unsigned int rows = redisSpyViewCount(redis);
+
+	if ((first >= rows) || (count == 0))
+		return;
+
+	count = MIN(count, rows - first);
+
+	SPY_FETCH_REQUEST* request = spyFetchRequestCreate(SPY_FETCH_REQUEST_ROWS, count);
+
+	for (unsigned int i = 0; i < count; i++)
+		redisSpyKeyAtIndex(redis, redisSpyViewRow(redis, first + i), request->rows[i].key);
+
+	spyFetchPost(g_fetch, request);
+}
+
+// Mark the rows on screen as used by the preview cache, and read again
+// the previews of any that were dropped
+static void spyControllerTouchVisibleRows(SPY_WINDOW* window, REDIS* redis)
+{
+	unsigned int rows = redisSpyViewCount(redis);
+	unsigned int first = window->startIndex;
+
+	if ((g_viewMode != SPY_CONTROLLER_VIEW_LIST) || (first >= rows))
+		return;
+
+	unsigned int count = MIN(window->displayRows, rows - first);
+	unsigned int* visible = malloc(2 * count * sizeof(unsigned int));
+	unsigned int* evicted = visible + count;
+
+	for (unsigned int i = 0; i < count; i++)
+		visible[i] = redisSpyViewRow(redis, first + i);
+
+	unsigned int n = redisSpyTouchRows(redis, visible, count, evicted);
+
+	if (n > 0)
+	{
+		SPY_FETCH_REQUEST* request = spyFetchRequestCreate(SPY_FETCH_REQUEST_ROWS, n);
+
+		for (unsigned int i = 0; i < n; i++)
+			redisSpyKeyAtIndex(redis, evicted[i], request->rows[i].key);
+
+		spyFetchPost(g_fetch, request);
+		spyWindowSetBusySignal(window, 1);
+	}
+
+	free(visible);
+}
+
+static void spyControllerPostKeyspace(REDIS* redis)
+{
+	SPY_FETCH_REQUEST* request = spyFetchRequestCreate(SPY_FETCH_REQUEST_KEYSPACE, 0);
+
+	strcpy(request->pattern, redis->pattern);
+	strcpy(request->scanType, redis->scanType);
+	strcpy(request->search, redis->search);
+
+	spyFetchPost(g_fetch, request);
+}
+
+// Returns the number of results applied. Stops after
+// SPY_CONTROLLER_RESULTS_PER_PASS so a long scan renders as it
+// arrives and keystrokes (Esc in particular) still get through.
+int spyControllerApplyResults(SPY_WINDOW* window, REDIS* redis)
+{
+	SPY_FETCH_RESULT* result;
+	int applied = 0;
+
+	while (   (applied < SPY_CONTROLLER_RESULTS_PER_PASS)
+		   && ((result = spyFetchNextResult(g_fetch)) != NULL))
+	{
+		switch (result->kind)
+		{
+			case SPY_FETCH_RESULT_INFO:
+				redis->infoConnectedClients = result->infoConnectedClients;
+				strcpy(redis->infoUsedMemoryHuman, result->infoUsedMemoryHuman);
+				break;
+
+			case SPY_FETCH_RESULT_ROWS_UPDATED:
+				redisSpyMergeRows(redis, result->rows, result->count, 0);
+				break;
+
+			case SPY_FETCH_RESULT_ROWS_TOUCHED:
+				// Kept in order as they go in
+				redisSpySpliceRows(redis, result->rows, result->count);
+				break;
+
+			case SPY_FETCH_RESULT_KEYSPACE_BEGIN:
+				redisSpyBeginGeneration(redis);
+				redis->scanInProgress = 1;
+				redis->scanProgress = 0;
+				redis->scanDbSize = result->dbSize;
+				break;
+
+			case SPY_FETCH_RESULT_ROWS_NEW:
+				redisSpyMergeRows(redis, result->rows, result->count, 1);
+				redis->scanProgress = result->progress;
+				break;
+
+			case SPY_FETCH_RESULT_KEYSPACE_END:
+				redisSpyEndGeneration(redis);
+				redis->scanInProgress = 0;
+				break;
+
+			case SPY_FETCH_RESULT_KEYSPACE_CANCELLED:
+				// Keep what has arrived; skip the stale-row sweep since
+				// the scan didn't see the whole keyspace.
+				redis->scanInProgress = 0;
+				spyWindowSetCommandLineText(window,
+					redis->search[0] ? "Search cancelled." : "Refresh cancelled.");
+				break;
+
+			case SPY_FETCH_RESULT_ERROR:
+				// Searching needs scripting on the server. A scan fails
+				// on errors such as LOADING or NOPERM.
+				if (redis->scanInProgress && redis->search[0])
+					spyWindowSetCommandLineText(window, "Search failed.");
+				else if (redis->scanInProgress)
+					spyWindowSetCommandLineText(window, "Refresh failed.");
+
+				redis->scanInProgress = 0;
+				break;
+
+			default:
+				break;
+		}
+
+		spyFetchResultDelete(result);
+		applied++;
+	}
+
+	if (applied)
+	{
+		// New rows are sorted in a batch at a time while the scan runs,
+		// and all of them once it is over
+		redisSpySortNewRows(redis, !redis->scanInProgress);
+
+		spyWindowDraw(window);
+		spyWindowSetBusySignal(window, spyFetchIsBusy(g_fetch));
+	}
+
+	return applied;
+}
 
 int spyControllerEventRefresh(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowSetBusySignal(window, 1);
-	redisSpyServerRefresh(redis);
-	spyWindowSetBusySignal(window, 0);
-	redisSpySort(redis, 0);
+	spyControllerPostInfo();
+	spyControllerPostKeyspace(redis);
+
 	spyWindowDraw(window);
+	spyWindowSetBusySignal(window, 1);
+
+	return 0;
+}
+
+// After a command, refresh only the keys it touched and splice them
+// into the sorted list. A negative count means the touched keys aren't
+// known, so fall back to a full refresh.
+static void spyControllerRefreshTouched(SPY_WINDOW* window, REDIS* redis,
+										char keys[][REDISSPY_MAX_KEY_LEN], int count)
+{
+	if (count < 0)
+	{
+		spyControllerEventRefresh(window, redis);
+		return;
+	}
+
+	spyControllerPostInfo();
+
+	if (count > 0)
+	{
+		SPY_FETCH_REQUEST* request = spyFetchRequestCreate(SPY_FETCH_REQUEST_TOUCHED, count);
+
+		for (int i = 0; i < count; i++)
+			strcpy(request->rows[i].key, keys[i]);
+
+		spyFetchPost(g_fetch, request);
+	}
+
+	spyWindowSetBusySignal(window, 1);
+}
+
+// Add the keys a command touches to keys[0..count). Returns the new
+// count, or -1 once they can't all be known.
+static int spyControllerAddCommandKeys(REDIS* redis, char* command,
+									   char keys[][REDISSPY_MAX_KEY_LEN], int count)
+{
+	if (count < 0)
+		return -1;
+
+	int n = redisSpyServerCommandKeys(redis, command, &keys[count],
+									  REDISSPY_MAX_TOUCHED_KEYS - count);
+
+	return (n < 0) ? -1 : count + n;
+}
+
+int spyControllerEventCancelRefresh(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	if (!spyFetchIsBusy(g_fetch))
+	{
+		beep();
+		return 0;
+	}
+
+	spyFetchCancel(g_fetch);
+
+	// Batches already queued still get merged; the scan stops
+	// after the step it is on.
+	spyWindowSetCommandLineText(window, "Cancelling refresh...");
+
+	return 0;
+}
+
+int spyControllerScheduledRefresh(SPY_WINDOW* window, REDIS* redis)
+{
+	// Don't let ticks pile up behind a slow server
+	if (spyFetchIsBusy(g_fetch))
+		return 0;
+
+	g_refreshTick++;
+
+	if ((g_refreshTick % SPY_REFRESH_KEYSPACE_TICKS) == 0)
+		return spyControllerEventRefresh(window, redis);
+
+	// Tree and template rows aren't keys, so there is no viewport to
+	// re-read; they are fed by the keyspace rescans.
+	if (g_viewMode != SPY_CONTROLLER_VIEW_LIST)
+	{
+		spyControllerPostInfo();
+		return 0;
+	}
+
+	// Each tier goes out as its own pipelined batch
+	unsigned int first = window->startIndex;
+	unsigned int count = window->displayRows;
+	unsigned int nearby = SPY_REFRESH_NEARBY_PAGES * window->displayRows;
+
+	spyControllerPostInfo();
+	spyControllerPostRows(redis, first, count);
+
+	if ((g_refreshTick % SPY_REFRESH_NEARBY_TICKS) == 0)
+	{
+		unsigned int above = MIN(first, nearby);
+
+		spyControllerPostRows(redis, first - above, above);
+		spyControllerPostRows(redis, first + count, nearby);
+	}
+
+	spyWindowSetBusySignal(window, 1);
 
 	return 0;
 }
 
+// Only flag the tick here. The refresh is posted from the event loop.
 void timerExpired(int UNUSED(i))
 {
-	spyControllerEventRefresh(g_redisSpyWindow, g_redis);
+	g_refreshDue = 1;
 }
 
 void spyControllerResetTimer(REDIS* redis, int interval)
@@ -92,6 +374,15 @@ int spyControllerGetCommand(SPY_WINDOW* w, REDIS* redis, const char* prompt, cha
 }
 
 
+// The model row under the cursor, or -1
+static int spyControllerCurrentRow(SPY_WINDOW* w, REDIS* redis)
+{
+	int i = spyWindowGetCurrentRow(w);
+
+	return (i < 0) ? -1 : redisSpyViewRow(redis, i);
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 //
 // Event Handlers
@@ -110,34 +401,63 @@ int spyControllerEventConnectToHost(SPY_WINDOW* window, REDIS* redis)
 	char hostPrompt[REDISSPY_MAX_COMMAND_LEN];
 	char hostBuffer[REDISSPY_MAX_COMMAND_LEN];
 	char portBuffer[REDISSPY_MAX_COMMAND_LEN];
+	char address[REDISSPY_MAX_HOST_LEN + 16];
 	unsigned int port;
+	int r;
 
-	sprintf(hostPrompt, "Host: (Default is %s): ", redis->host);
+	redisSpyServerAddress(redis, address, sizeof(address));
+	snprintf(hostPrompt, sizeof(hostPrompt), "Host or socket path: (Default is %s): ", address);
 
 	if (spyControllerGetCommand(window, redis, 
 				hostPrompt,
-				hostBuffer, sizeof(hostBuffer)) == 0)
+				hostBuffer, sizeof(hostBuffer)) != 0)
+	{
+		return 0;
+	}
+
+	if (hostBuffer[0] == '\0')
+	{
+		if (redis->socketPath[0] != '\0')
+			strcpy(hostBuffer, redis->socketPath);
+		else
+			strncpy(hostBuffer, redis->host, sizeof(hostBuffer));
+	}
+
+	if (hostBuffer[0] == '/')
+	{
+		// A path means a Unix domain socket; no port to ask for
+		r = redisSpyConnectUnix(redis, hostBuffer);
+	}
+	else
 	{
 		if (spyControllerGetCommand(window, redis,
 				"Port (Default is 6379): ",
-				portBuffer, sizeof(portBuffer)) == 0)
+				portBuffer, sizeof(portBuffer)) != 0)
 		{
-			if (hostBuffer[0] == '\0')
-				strncpy(hostBuffer, redis->host, sizeof(hostBuffer));
+			return 0;
+		}
 
-			if (portBuffer[0] == '\0')
-				port = REDISSPY_DEFAULT_PORT;
-			else
-				port = (unsigned int)atoi(portBuffer);
+		if (portBuffer[0] == '\0')
+			port = REDISSPY_DEFAULT_PORT;
+		else
+			port = (unsigned int)atoi(portBuffer);
 
-			int r = redisSpyConnect(redis, hostBuffer, port);
+		r = redisSpyConnect(redis, hostBuffer, port);
+	}
 
-			if (r != 0)
-				redisSpyServerClearCache(redis);
+	if (r != 0)
+		redisSpyServerClearCache(redis);
 
-			spyControllerEventRefresh(window, redis);
-		}
-	}
+	// The fetch thread keeps its own connection
+	SPY_FETCH_REQUEST* request = spyFetchRequestCreate(SPY_FETCH_REQUEST_CONNECT, 0);
+
+	strcpy(request->host, redis->host);
+	request->port = redis->port;
+	strcpy(request->socketPath, redis->socketPath);
+
+	spyFetchPost(g_fetch, request);
+
+	spyControllerEventRefresh(window, redis);
 
 	return 0;
 }
@@ -161,7 +481,10 @@ int spyControllerEventCommand(SPY_WINDOW* window, REDIS* redis)
 		redisSpySendCommandToServer(redis, serverCommand, 
 					serverReply, sizeof(serverReply));
 
-		spyControllerEventRefresh(window, redis);
+		char keys[REDISSPY_MAX_TOUCHED_KEYS][REDISSPY_MAX_KEY_LEN];
+		int count = spyControllerAddCommandKeys(redis, serverCommand, keys, 0);
+
+		spyControllerRefreshTouched(window, redis, keys, count);
 
 		spyWindowSetCommandLineText(window, serverReply);
 	}
@@ -183,7 +506,10 @@ int spyControllerEventRepeatCommand(SPY_WINDOW* window, REDIS* redis)
 					lastCommand, 
 					serverReply, sizeof(serverReply));
 
-		spyControllerEventRefresh(window, redis);
+		char keys[REDISSPY_MAX_TOUCHED_KEYS][REDISSPY_MAX_KEY_LEN];
+		int count = spyControllerAddCommandKeys(redis, lastCommand, keys, 0);
+
+		spyControllerRefreshTouched(window, redis, keys, count);
 
 		spyWindowSetCommandLineText(window, serverReply);
 	}
@@ -212,18 +538,25 @@ int spyControllerEventBatchFile(SPY_WINDOW* window, REDIS* redis)
 		char s[REDISSPY_MAX_COMMAND_LEN];
 		char serverReply[REDISSPY_MAX_SERVER_REPLY_LEN];
 
+		char keys[REDISSPY_MAX_TOUCHED_KEYS][REDISSPY_MAX_KEY_LEN];
+		int count = 0;
+
 		while (fgets(s, sizeof(s), fp) != NULL)
 		{
 			s[strlen(s)- 1] = '\0';
 			
 			if (s[0] != '\0' && s[0] != '#')
+			{
 				redisSpySendCommandToServer(redis, s,
 						serverReply, sizeof(serverReply));
+
+				count = spyControllerAddCommandKeys(redis, s, keys, count);
+			}
 		}
 
 		fclose(fp);
 
-		spyControllerEventRefresh(window, redis);
+		spyControllerRefreshTouched(window, redis, keys, count);
 
 		spyWindowSetCommandLineText(window, "File processed.");
 	}
@@ -236,21 +569,24 @@ int spyControllerEventDeleteKey(SPY_WINDOW* w, REDIS* redis)
 	char serverCommand[REDISSPY_MAX_COMMAND_LEN];
 	char serverReply[REDISSPY_MAX_SERVER_REPLY_LEN];
 
-	int i = spyWindowGetCurrentRow(w);
+	int row = spyControllerCurrentRow(w, redis);
 
-	if (i < 0)
+	if (row < 0)
 	{
 		beep();
 		return 0;
 	}
 
+	char keys[1][REDISSPY_MAX_KEY_LEN];
+	redisSpyKeyAtIndex(redis, row, keys[0]);
+
 	snprintf(serverCommand, sizeof(serverCommand),
-				"DEL %s", redis->data[i].key);
+				"DEL %s", keys[0]);
 
 	redisSpySendCommandToServer(redis, serverCommand,
 					serverReply, sizeof(serverReply));
 
-	spyControllerEventRefresh(w, redis);
+	spyControllerRefreshTouched(w, redis, keys, 1);
 
 	spyWindowSetCommandLineText(w, serverReply);
 
@@ -263,28 +599,31 @@ int spyControllerEventListPop(SPY_WINDOW* w, REDIS* redis, const char* command)
 	char serverCommand[REDISSPY_MAX_COMMAND_LEN];
 	char serverReply[REDISSPY_MAX_SERVER_REPLY_LEN];
 
-	int i = spyWindowGetCurrentRow(w);
+	int row = spyControllerCurrentRow(w, redis);
 
-	if (i < 0)
+	if (row < 0)
 	{
 		beep();
 		return 0;
 	}
 
-	if (strcmp(redis->data[i].type, "list") != 0)
+	if (strcmp(redisSpyRowType(redis, row), "list") != 0)
 	{
 		beep();
 		spyWindowSetCommandLineText(w, "Not a list.");
 		return 0;
 	}
 
+	char keys[1][REDISSPY_MAX_KEY_LEN];
+	redisSpyKeyAtIndex(redis, row, keys[0]);
+
 	snprintf(serverCommand, sizeof(serverCommand),
-				"%s %s", command, redis->data[i].key);
+				"%s %s", command, keys[0]);
 
 	redisSpySendCommandToServer(redis, serverCommand,
 					serverReply, sizeof(serverReply));
 
-	spyControllerEventRefresh(w, redis);
+	spyControllerRefreshTouched(w, redis, keys, 1);
 
 	spyWindowSetCommandLineText(w, serverReply);
 
@@ -307,15 +646,19 @@ int spyControllerEventViewDetails(SPY_WINDOW* w, REDIS* redis)
 {
 	signal(SIGALRM, SIG_IGN);
 
-	int index = spyWindowGetCurrentRow(w);
+	int row = spyControllerCurrentRow(w, redis);
 
-	if (index < 0)
+	if (row < 0)
 	{
 		beep();
 		return 0;
 	}
 
-	spyDetailControllerRun(w, redis, index);
+	// The row can move while the detail view is up
+	char key[REDISSPY_MAX_KEY_LEN];
+	redisSpyKeyAtIndex(redis, row, key);
+
+	spyDetailControllerRun(w, redis, key);
 
 	spyControllerEventRefresh(w, redis);
 
@@ -326,128 +669,965 @@ int spyControllerEventViewDetails(SPY_WINDOW* w, REDIS* redis)
 }
 
 
+// SCAN MATCH is the key pattern, or the query's key glob if every key it
+// matches also matches the pattern. Otherwise the query can only be
+// applied to the rows the pattern brings in. Returns 1 if it changed.
+static int spyControllerUpdateScanPattern(REDIS* redis, SPY_QUERY* query)
+{
+	const char* pattern = redis->keyPattern;
+
+	if (query && (query->pattern[0] != '\0'))
+	{
+		SPY_GLOB keys;
+		SPY_GLOB glob;
+
+		if (   (spyGlobCompile(&keys, redis->keyPattern) == 0)
+			&& (spyGlobCompile(&glob, query->pattern) == 0)
+			&& spyGlobContains(&keys, &glob))
+		{
+			pattern = query->pattern;
+		}
+	}
+
+	if (strcmp(pattern, redis->pattern) == 0)
+		return 0;
+
+	snprintf(redis->pattern, sizeof(redis->pattern), "%s", pattern);
+
+	return 1;
+}
+
+
+// Filter the loaded rows as the pattern is typed. Until Enter the text
+// is taken as a prefix (an implied trailing *), so each keystroke only
+// narrows and filters the rows already shown.
+static void spyControllerFilterEdited(SPY_WINDOW* window, const char* text, void* context)
+{
+	REDIS* redis = (REDIS*)context;
+	char filter[REDISSPY_MAX_PATTERN_LEN];
+	size_t length = strlen(text);
+	const char* star = ((length > 0) && (text[length - 1] == '*')) ? "" : "*";
+
+	if (   (length == 0)
+		|| (snprintf(filter, sizeof(filter), "%s%s", text, star) >= (int)sizeof(filter))
+		|| (redisSpySetFilter(redis, filter) != 0))
+	{
+		redisSpySetFilter(redis, NULL);
+	}
+
+	spyWindowResetCursor(window);
+	spyWindowDraw(window);
+}
+
+// Change key filter pattern. Keys the loaded rows already cover are
+// filtered locally; only a pattern wider than the last scan goes back
+// to the server.
 int spyControllerEventFilterKeys(SPY_WINDOW* window, REDIS* redis)
 {
-	// Change key filter pattern
-	if (spyControllerGetCommand(window, redis, 
-				"Pattern: ", 
-				redis->pattern, sizeof(redis->pattern)) == 0)
+	char text[REDISSPY_MAX_PATTERN_LEN];
+	char previous[REDISSPY_MAX_PATTERN_LEN];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+
+	memset(text, 0, sizeof(text));
+	strcpy(previous, redis->filter);
+
+	signal(SIGALRM, SIG_IGN);
+
+	int result = spyWindowGetCommandLive(window, "Pattern: ", text, sizeof(text),
+										 spyControllerFilterEdited, redis);
+
+	if (redis->refreshInterval)
+		signal(SIGALRM, timerExpired);
+
+	if (result != 0)
 	{
-		spyWindowSetBusySignal(window, 1);
-		redisSpyServerRefresh(redis);
-		spyWindowSetBusySignal(window, 0);
-		redisSpySort(redis, 0);
+		redisSpySetFilter(redis, previous);
+		spyWindowResetCursor(window);
+		spyWindowDraw(window);
+		return 0;
+	}
 
+	if ((text[0] == '\0') || (strcmp(text, redis->keyPattern) == 0))
+	{
+		redisSpySetFilter(redis, NULL);
 		spyWindowResetCursor(window);
+		spyWindowDraw(window);
+		return 0;
+	}
+
+	if (redisSpyFilterIsLoaded(redis, text) && (redisSpySetFilter(redis, text) == 0))
+	{
+		snprintf(message, sizeof(message), "%u of %u loaded keys match.",
+				 redisSpyViewCount(redis), redisSpyKeyCount(redis));
+		spyWindowSetCommandLineText(window, message);
 
+		spyWindowResetCursor(window);
 		spyWindowDraw(window);
+		return 0;
 	}
 
+	// Rows under the old pattern are no use; start from empty
+	// and let the new rows stream in.
+	redisSpySetFilter(redis, NULL);
+	strcpy(redis->keyPattern, text);
+	spyControllerUpdateScanPattern(redis, redis->query);
+
+	redisSpyServerClearCache(redis);
+
+	spyWindowResetCursor(window);
+
+	spyControllerEventRefresh(window, redis);
+
 	return 0;
 }
 
 
-int spyControllerEventAutoRefresh(SPY_WINDOW* window, REDIS* redis)
+// Keep only keys whose values contain the text, or match it as a glob
+// if it has *, ? or [. The matching runs on the server; only matching
+// keys come back. An empty search shows every key again.
+int spyControllerEventSearchValues(SPY_WINDOW* window, REDIS* redis)
 {
-	char refreshIntervalBuffer[80];
-	redis->refreshInterval = 0;
+	char search[REDISSPY_MAX_PATTERN_LEN];
+	memset(search, 0, sizeof(search));
 
-	// Auto-refresh
-	if (spyControllerGetCommand(window, redis, 
-				"Refresh Interval (0 to turn off): ", 
-				refreshIntervalBuffer, 
-				sizeof(refreshIntervalBuffer)) == 0)
+	if (spyControllerGetCommand(window, redis,
+				"Search values (empty to clear): ",
+				search, sizeof(search)) != 0)
 	{
-		int interval = atoi(refreshIntervalBuffer);
-		spyControllerResetTimer(redis, interval);
+		return 0;
 	}
 
-	return 0;
-}
+	SPY_SEARCH check;
+
+	if (spySearchBegin(&check, search, NULL, 0) != 0)
+	{
+		spyWindowSetCommandLineText(window, "Bad search pattern.");
+		beep();
+		return 0;
+	}
 
+	strcpy(redis->search, search);
 
+	redisSpyServerClearCache(redis);
 
-// Sorting commands:
-// Repeated presses will toggle asc/desc
-//  s - sort by key
-//  t - type
-//  l - length
-//  v - value
-int spyControllerEventSortByKey(SPY_WINDOW* window, REDIS* redis)
-{
-	redisSpySort(redis, sortByKey);
-	spyWindowDraw(window);
+	spyWindowResetCursor(window);
+
+	spyControllerEventRefresh(window, redis);
 
 	return 0;
 }
 
 
-int spyControllerEventSortByType(SPY_WINDOW* window, REDIS* redis)
+// SCAN TYPE is the type filter if one is set, or else a type the query
+// needs. Returns 1 if it changed and the keys need scanning again.
+static int spyControllerUpdateScanType(REDIS* redis, SPY_QUERY* query)
 {
-	redisSpySort(redis, sortByType);
-	spyWindowDraw(window);
+	const char* type = redis->typeFilter;
 
-	return 0;
-}
+	if ((type[0] == '\0') && query)
+		type = query->type;
 
+	// No type is that long; the query will just match nothing
+	if (strlen(type) >= sizeof(redis->scanType))
+		type = "";
 
-int spyControllerEventSortByLength(SPY_WINDOW* window, REDIS* redis)
-{
-	redisSpySort(redis, sortByLength);
-	spyWindowDraw(window);
+	if (strcmp(type, redis->scanType) == 0)
+		return 0;
 
-	return 0;
+	strcpy(redis->scanType, type);
+
+	return 1;
 }
 
 
-int spyControllerEventSortByValue(SPY_WINDOW* window, REDIS* redis)
+// Show only keys of one type. The server does the filtering with SCAN
+// ... TYPE, so keys of other types are never read. The prompt lists how
+// many loaded keys there are of each type.
+int spyControllerEventFilterType(SPY_WINDOW* window, REDIS* redis)
 {
-	redisSpySort(redis, sortByValue);
+	char counts[SPY_WINDOW_MAX_COMMAND_LEN / 2];
+	char prompt[SPY_WINDOW_MAX_COMMAND_LEN];
+	char type[REDISSPY_MAX_ENCODING_LEN];
+
+	redisSpyFormatTypeCounts(redis, counts, sizeof(counts));
+
+	if (counts[0] != '\0')
+		snprintf(prompt, sizeof(prompt), "Type (%s; empty for all): ", counts);
+	else
+		snprintf(prompt, sizeof(prompt), "Type (empty for all): ");
+
+	memset(type, 0, sizeof(type));
+
+	if (spyControllerGetCommand(window, redis, prompt, type, sizeof(type)) != 0)
+		return 0;
+
+	if (strpbrk(type, " \t") != NULL)
+	{
+		spyWindowSetCommandLineText(window, "Bad type.");
+		beep();
+		return 0;
+	}
+
+	strcpy(redis->typeFilter, type);
+
+	spyWindowResetCursor(window);
+
+	if (spyControllerUpdateScanType(redis, redis->query))
+	{
+		redisSpyServerClearCache(redis);
+		spyControllerEventRefresh(window, redis);
+		return 0;
+	}
+
 	spyWindowDraw(window);
 
 	return 0;
 }
 
-int spyControllerRedraw(SPY_WINDOW* window, REDIS* UNUSED(redis))
+
+// Query the loaded rows, as in type==hash && len>10000 && key~"cache:*".
+// The rows that match become the list. A key glob or a type that every
+// match must have also goes into the SCAN, if the loaded rows don't
+// already cover it, so the server leaves out keys that can't match.
+int spyControllerEventQuery(SPY_WINDOW* window, REDIS* redis)
+{
+	char text[SPY_QUERY_MAX_TEXT];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+	int rescan = 0;
+
+	memset(text, 0, sizeof(text));
+
+	if (spyControllerGetCommand(window, redis,
+				"Query (empty to clear): ",
+				text, sizeof(text)) != 0)
+	{
+		return 0;
+	}
+
+	SPY_QUERY* query = NULL;
+
+	if (text[0] != '\0')
+	{
+		query = spyQueryCompile(text, message, sizeof(message));
+
+		if (query == NULL)
+		{
+			spyWindowSetCommandLineText(window, message);
+			beep();
+			return 0;
+		}
+	}
+
+	// Clearing the query brings back types it left out
+	if (spyControllerUpdateScanType(redis, query))
+		rescan = 1;
+
+	// ... and keys. Narrowing to a glob the loaded rows already cover
+	// needs no new scan.
+	int covered = query && (query->pattern[0] != '\0') && redisSpyFilterIsLoaded(redis, query->pattern);
+
+	if (spyControllerUpdateScanPattern(redis, query) && !covered)
+	{
+		redisSpySetFilter(redis, NULL);
+		rescan = 1;
+	}
+
+	redisSpySetQuery(redis, query);
+	spyWindowResetCursor(window);
+
+	if (rescan)
+	{
+		redisSpyServerClearCache(redis);
+		spyControllerEventRefresh(window, redis);
+		return 0;
+	}
+
+	if (query)
+	{
+		int len = snprintf(message, sizeof(message), "%u of %u loaded keys match.",
+						   redisSpyViewCount(redis), redisSpyKeyCount(redis));
+
+		if ((redis->viewDropped > 0) && (len < (int)sizeof(message)))
+		{
+			snprintf(message + len, sizeof(message) - len,
+					 " %u with dropped previews (see -M) were left out.", redis->viewDropped);
+		}
+
+		spyWindowSetCommandLineText(window, message);
+	}
+
+	spyWindowDraw(window);
+
+	return 0;
+}
+
+
+int spyControllerEventAutoRefresh(SPY_WINDOW* window, REDIS* redis)
+{
+	char refreshIntervalBuffer[80];
+	redis->refreshInterval = 0;
+
+	// Auto-refresh
+	if (spyControllerGetCommand(window, redis, 
+				"Refresh Interval (0 to turn off): ", 
+				refreshIntervalBuffer, 
+				sizeof(refreshIntervalBuffer)) == 0)
+	{
+		int interval = atoi(refreshIntervalBuffer);
+		spyControllerResetTimer(redis, interval);
+	}
+
+	return 0;
+}
+
+
+
+// Sorting commands:
+// Repeated presses will toggle asc/desc
+//  s - sort by key
+//  t - type
+//  l - length
+//  v - value
+int spyControllerEventSortByKey(SPY_WINDOW* window, REDIS* redis)
+{
+	redisSpySort(redis, sortByKey);
+	spyWindowDraw(window);
+
+	return 0;
+}
+
+
+int spyControllerEventSortByType(SPY_WINDOW* window, REDIS* redis)
+{
+	redisSpySort(redis, sortByType);
+	spyWindowDraw(window);
+
+	return 0;
+}
+
+
+int spyControllerEventSortByLength(SPY_WINDOW* window, REDIS* redis)
+{
+	redisSpySort(redis, sortByLength);
+	spyWindowDraw(window);
+
+	return 0;
+}
+
+
+int spyControllerEventSortByValue(SPY_WINDOW* window, REDIS* redis)
+{
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+	unsigned int dropped = redisSpyDroppedValueCount(redis);
+
+	redisSpySort(redis, sortByValue);
+	spyWindowDraw(window);
+
+	if (dropped > 0)
+	{
+		snprintf(message, sizeof(message),
+				 "%u rows with dropped previews (see -M) are sorted last, by key.", dropped);
+		spyWindowSetCommandLineText(window, message);
+	}
+
+	return 0;
+}
+
+int spyControllerRedraw(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowDraw(window);
 
 	return 0;
 }
 
-int spyControllerEventMoveDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
+int spyControllerEventMoveDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowMoveDown(window);
+	return 0;
+}
+
+int spyControllerEventMoveUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowMoveUp(window);
+	return 0;
+}
+
+int spyControllerEventPageDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowPageDown(window);
+	return 0;
+}
+
+int spyControllerEventPageUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowPageUp(window);
+	return 0;
+}
+
+int spyControllerEventMoveToTop(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowMoveToTop(window);
+	return 0;
+}
+
+int spyControllerEventMoveToBottom(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	spyWindowMoveToBottom(window);
+	return 0;
+}
+
+
+// Find in the loaded rows
+//
+//   / : find text in keys and value previews, highlight it and jump to
+//       the first row at or after the cursor that has it
+//   n : next row with it
+//   N : previous row with it
+
+// 1 if the row has the text, 0 if not, -1 if its key doesn't and its
+// preview was dropped, so it can't be told
+static int spyControllerRowHasText(REDIS* redis, unsigned int row)
+{
+	int r = redisSpyViewRow(redis, row);
+	char key[REDISSPY_MAX_KEY_LEN];
+	redisSpyKeyAtIndex(redis, r, key);
+	const char* value = redisSpyRowValue(redis, r);
+	size_t length = strlen(g_findText);
+
+	if (spyFindBytes(key, strlen(key), g_findText, length) >= 0)
+		return 1;
+
+	if (redisSpyRowValueDropped(redis, r))
+		return -1;
+
+	return spyFindBytes(value, strlen(value), g_findText, length) >= 0;
+}
+
+// Search from the row after the cursor (or before it, going backwards),
+// wrapping around. Returns the row, or -1.
+static int spyControllerFindRow(SPY_WINDOW* window, REDIS* redis, int forward, int includeCurrent)
+{
+	unsigned int count = redisSpyViewCount(redis);
+	int current = spyWindowGetCurrentRow(window);
+
+	if ((count == 0) || (g_findText[0] == '\0'))
+		return -1;
+
+	if (current < 0)
+		current = 0;
+
+	for (unsigned int step = includeCurrent ? 0 : 1; step <= count; step++)
+	{
+		unsigned int row = forward ? (current + step) % count
+								   : (current + count - step % count) % count;
+
+		if (spyControllerRowHasText(redis, row) > 0)
+			return row;
+	}
+
+	return -1;
+}
+
+int spyControllerEventFind(SPY_WINDOW* window, REDIS* redis)
+{
+	char text[SPY_WINDOW_MAX_COMMAND_LEN];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+	memset(text, 0, sizeof(text));
+
+	if (spyControllerGetCommand(window, redis, "/", text, sizeof(text)) != 0)
+		return 0;
+
+	strcpy(g_findText, text);
+	spyWindowSetHighlight(window, g_findText);
+
+	if (g_findText[0] == '\0')
+	{
+		spyWindowDraw(window);
+		return 0;
+	}
+
+	// Count them all, and find the first at or after the cursor, in one
+	// pass over the shown rows
+	struct timeval start;
+	struct timeval end;
+	unsigned int matches = 0;
+	unsigned int skipped = 0;
+	unsigned int rows = redisSpyViewCount(redis);
+	int current = MAX(spyWindowGetCurrentRow(window), 0);
+	int first = -1;
+	int row = -1;
+
+	gettimeofday(&start, NULL);
+
+	unsigned char* found = malloc(redisSpyKeyCount(redis) + 1);
+
+	redisSpyFindText(redis, g_findText, found);
+
+	for (unsigned int i = 0; i < rows; i++)
+	{
+		unsigned char f = found[redisSpyViewRow(redis, i)];
+
+		skipped += (f == REDISSPY_FIND_DROPPED);
+
+		if (f != REDISSPY_FIND_HIT)
+			continue;
+
+		matches++;
+
+		if (first < 0)
+			first = i;
+
+		if ((row < 0) && ((int)i >= current))
+			row = i;
+	}
+
+	free(found);
+
+	if (row < 0)
+		row = first;
+
+	gettimeofday(&end, NULL);
+
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) / 1e3;
+
+	if (row >= 0)
+		spyWindowMoveToIndex(window, row);
+	else
+		beep();
+
+	int len = snprintf(message, sizeof(message), "%u of %u rows match (%.1fms, %s)",
+					   matches, rows, ms, spyFindImplementation());
+
+	if ((skipped > 0) && (len < (int)sizeof(message)))
+	{
+		snprintf(message + len, sizeof(message) - len,
+				 "; %u with dropped previews (see -M) not searched", skipped);
+	}
+
+	spyWindowSetCommandLineText(window, message);
+
+	return 0;
+}
+
+static int spyControllerFindNext(SPY_WINDOW* window, REDIS* redis, int forward)
+{
+	int row = spyControllerFindRow(window, redis, forward, 0);
+
+	if (row < 0)
+	{
+		beep();
+		return 0;
+	}
+
+	spyWindowMoveToIndex(window, row);
+
+	return 0;
+}
+
+int spyControllerEventFindNext(SPY_WINDOW* window, REDIS* redis)
+{
+	return spyControllerFindNext(window, redis, 1);
+}
+
+int spyControllerEventFindPrevious(SPY_WINDOW* window, REDIS* redis)
+{
+	return spyControllerFindNext(window, redis, 0);
+}
+
+
+// Goto key
+//
+//   g : type part of a key name, not necessarily exactly. The cursor
+//       follows the best match and the status line lists the runners
+//       up. Enter stays there; Esc goes back.
+
+// Window rows of the best matches for text, best first. Keys that are
+// gone or hidden by the local filter are skipped, as are repeats (a key
+// removed and loaded again is in the index twice).
+static unsigned int spyControllerGotoMatches(REDIS* redis, const char* text,
+											 int* rows, unsigned int max)
+{
+	unsigned int ids[4 * SPY_CONTROLLER_GOTO_MATCHES];
+	unsigned int count = spyTrigramLookup(redis->trigrams, text, ids, sizeof(ids) / sizeof(ids[0]));
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; (i < count) && (n < max); i++)
+	{
+		int row = redisSpyFindKey(redis, spyTrigramKey(redis->trigrams, ids[i]));
+		if (row < 0)
+			continue;
+
+		int index = redisSpyViewIndexOfRow(redis, row);
+		if (index < 0)
+			continue;
+
+		unsigned int j = 0;
+		while ((j < n) && (rows[j] != index))
+			j++;
+
+		if (j == n)
+			rows[n++] = index;
+	}
+
+	return n;
+}
+
+static void spyControllerGotoEdited(SPY_WINDOW* window, const char* text, void* context)
+{
+	REDIS* redis = (REDIS*)context;
+	int rows[SPY_CONTROLLER_GOTO_MATCHES];
+	char status[SPY_WINDOW_MAX_COMMAND_LEN];
+
+	unsigned int n = spyControllerGotoMatches(redis, text, rows, SPY_CONTROLLER_GOTO_MATCHES);
+
+	if (n == 0)
+	{
+		spyWindowDraw(window);
+
+		if (text[0])
+			spyWindowSetStatusLineText(window, "No matching key.");
+
+		return;
+	}
+
+	spyWindowMoveToIndex(window, rows[0]);
+
+	int len = snprintf(status, sizeof(status), "Best %u:", n);
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	for (unsigned int i = 0; (i < n) && (len < (int)sizeof(status)); i++)
+		len += snprintf(status + len, sizeof(status) - len, "  %s",
+						redisSpyKeyAtIndex(redis, redisSpyViewRow(redis, rows[i]), key));
+
+	spyWindowSetStatusLineText(window, status);
+}
+
+int spyControllerEventGotoKey(SPY_WINDOW* window, REDIS* redis)
+{
+	char text[SPY_WINDOW_MAX_COMMAND_LEN];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+	int current = spyWindowGetCurrentRow(window);
+
+	memset(text, 0, sizeof(text));
+
+	// The index is built on first use, all at once; after that the
+	// event loop keeps it up to date between keystrokes.
+	redisSpyEnableKeyIndex(redis);
+
+	if (spyTrigramPending(redis->trigrams))
+	{
+		spyWindowSetCommandLineText(window, "Indexing keys...");
+		wrefresh(window->window);
+
+		while (redisSpyIndexKeys(redis, SPY_CONTROLLER_INDEX_SLICE_MS))
+			;
+	}
+
+	signal(SIGALRM, SIG_IGN);
+
+	int result = spyWindowGetCommandLive(window, "Goto: ", text, sizeof(text),
+										 spyControllerGotoEdited, redis);
+
+	if (redis->refreshInterval)
+		signal(SIGALRM, timerExpired);
+
+	if (result != 0)
+	{
+		if (current >= 0)
+			spyWindowMoveToIndex(window, current);
+		else
+			spyWindowDraw(window);
+
+		return 0;
+	}
+
+	struct timeval start;
+	struct timeval end;
+	int rows[1];
+
+	gettimeofday(&start, NULL);
+	unsigned int n = spyControllerGotoMatches(redis, text, rows, 1);
+	gettimeofday(&end, NULL);
+
+	if (n == 0)
+	{
+		beep();
+		spyWindowDraw(window);
+		spyWindowSetCommandLineText(window, "No matching key.");
+		return 0;
+	}
+
+	double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) / 1e3;
+
+	spyWindowMoveToIndex(window, rows[0]);
+
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	snprintf(message, sizeof(message), "%s (%.2fms over %u indexed names)",
+			 redisSpyKeyAtIndex(redis, redisSpyViewRow(redis, rows[0]), key), ms,
+			 spyTrigramCount(redis->trigrams));
+	spyWindowSetCommandLineText(window, message);
+
+	return 0;
+}
+
+
+// Namespace tree
+//
+//   T : show the keys as a tree of namespaces split on the delimiter,
+//       with the keys, summed length and summed memory under each
+//   o : expand or collapse a namespace, or view the details of a key
+//   s, c, l, m : sort by name, keys, length or memory
+//   D : change the delimiter
+//   T, q : back to the key list
+
+static void spyControllerShowView(SPY_WINDOW* window, int mode, SPY_WINDOW_DELEGATE* delegate)
+{
+	if (g_viewMode == SPY_CONTROLLER_VIEW_LIST)
+	{
+		g_listStartIndex = window->startIndex;
+		g_listCurrentRow = window->currentRow;
+	}
+
+	g_viewMode = mode;
+
+	spyWindowSetDelegate(window, delegate);
+	spyWindowResetCursor(window);
+	spyWindowDraw(window);
+}
+
+int spyControllerEventTreeView(SPY_WINDOW* window, REDIS* redis)
+{
+	redisSpyEnableTree(redis);
+
+	spyControllerShowView(window, SPY_CONTROLLER_VIEW_TREE, g_treeWindowDelegate);
+
+	return 0;
+}
+
+int spyControllerEventListView(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	g_viewMode = SPY_CONTROLLER_VIEW_LIST;
+
+	spyWindowSetDelegate(window, g_spyWindowDelegate);
+
+	window->startIndex = g_listStartIndex;
+	window->currentRow = g_listCurrentRow;
+	window->currentColumn = 0;
+
+	spyWindowDraw(window);
+
+	return 0;
+}
+
+int spyControllerEventTreeOpen(SPY_WINDOW* window, REDIS* redis)
+{
+	int row = spyWindowGetCurrentRow(window);
+
+	if (row < 0)
+	{
+		beep();
+		return 0;
+	}
+
+	unsigned int node = spyTreeRowNode(redis->tree, row);
+
+	if (spyTreeToggle(redis->tree, node) == 0)
+	{
+		spyWindowDraw(window);
+		return 0;
+	}
+
+	// A key with nothing below it
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	if (spyTreePath(redis->tree, node, key, sizeof(key)) != 0)
+	{
+		beep();
+		return 0;
+	}
+
+	signal(SIGALRM, SIG_IGN);
+
+	spyDetailControllerRun(window, redis, key);
+
+	spyControllerEventRefresh(window, redis);
+
+	if (redis->refreshInterval)
+		signal(SIGALRM, timerExpired);
+
+	return 0;
+}
+
+static int spyControllerTreeSort(SPY_WINDOW* window, REDIS* redis, int sortBy)
 {
-	spyWindowMoveDown(window);
+	spyTreeSort(redis->tree, sortBy);
+	spyWindowDraw(window);
+
 	return 0;
 }
 
-int spyControllerEventMoveUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
+int spyControllerEventTreeSortByName(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowMoveUp(window);
-	return 0;
+	return spyControllerTreeSort(window, redis, SPY_TREE_SORT_NAME);
 }
 
-int spyControllerEventPageDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
+int spyControllerEventTreeSortByKeys(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowPageDown(window);
+	return spyControllerTreeSort(window, redis, SPY_TREE_SORT_KEYS);
+}
+
+int spyControllerEventTreeSortByLength(SPY_WINDOW* window, REDIS* redis)
+{
+	return spyControllerTreeSort(window, redis, SPY_TREE_SORT_LENGTH);
+}
+
+int spyControllerEventTreeSortByMemory(SPY_WINDOW* window, REDIS* redis)
+{
+	return spyControllerTreeSort(window, redis, SPY_TREE_SORT_MEMORY);
+}
+
+int spyControllerEventTreeDelimiter(SPY_WINDOW* window, REDIS* redis)
+{
+	char delimiter[SPY_TREE_MAX_DELIMITER_LEN];
+	memset(delimiter, 0, sizeof(delimiter));
+
+	if (spyControllerGetCommand(window, redis, "Delimiter: ", delimiter, sizeof(delimiter)) != 0)
+		return 0;
+
+	if (delimiter[0] == '\0')
+	{
+		beep();
+		return 0;
+	}
+
+	redisSpySetTreeDelimiter(redis, delimiter);
+
+	spyWindowResetCursor(window);
+	spyWindowDraw(window);
+
 	return 0;
 }
 
-int spyControllerEventPageUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
+
+// Key templates
+//
+//   P : list the templates the loaded keys fall into, user:{int}:name
+//       and so on, most keys first, with the type mix and length and
+//       memory percentiles of each
+//   o : show the keys of a template in the list, as a local filter
+//   P, q : back to the key list
+
+int spyControllerEventSchemaView(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowPageUp(window);
+	redisSpyEnableSchema(redis);
+
+	spyControllerShowView(window, SPY_CONTROLLER_VIEW_SCHEMA, g_schemaWindowDelegate);
+
 	return 0;
 }
 
-int spyControllerEventMoveToTop(SPY_WINDOW* window, REDIS* UNUSED(redis))
+int spyControllerEventSchemaOpen(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowMoveToTop(window);
+	int row = spyWindowGetCurrentRow(window);
+	char glob[REDISSPY_MAX_PATTERN_LEN];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+
+	// (other) has no pattern
+	if (   (row < 0)
+		|| (spySchemaTemplateGlob(redis->schema, spySchemaTemplate(redis->schema, row),
+								  glob, sizeof(glob)) != 0)
+		|| (redisSpySetFilter(redis, glob) != 0))
+	{
+		beep();
+		return 0;
+	}
+
+	spyControllerEventListView(window, redis);
+
+	snprintf(message, sizeof(message), "%u of %u loaded keys match %s.",
+			 redisSpyViewCount(redis), redisSpyKeyCount(redis), glob);
+	spyWindowSetCommandLineText(window, message);
+
+	spyWindowResetCursor(window);
+	spyWindowDraw(window);
+
 	return 0;
 }
 
-int spyControllerEventMoveToBottom(SPY_WINDOW* window, REDIS* UNUSED(redis))
+
+// Client memory. Rows hold a bounded preview, so this should track the
+// key count, not the size of the values.
+int spyControllerEventInstrumentation(SPY_WINDOW* window, REDIS* redis)
 {
-	spyWindowMoveToBottom(window);
+	char rss[32];
+	char peak[32];
+	char rows[32];
+	char keys[32];
+	char previews[32];
+	char budget[32];
+	char cap[32];
+	char trigrams[32];
+	char tree[32];
+	char schema[32];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+
+	spyStatsFormatBytes(spyStatsResidentBytes(), rss, sizeof(rss));
+	spyStatsFormatBytes(spyStatsPeakResidentBytes(), peak, sizeof(peak));
+	spyStatsFormatBytes(redisSpyRowStoreMemory(redis), rows, sizeof(rows));
+	spyStatsFormatBytes(redisSpyKeyMemory(redis), keys, sizeof(keys));
+
+	int len = snprintf(message, sizeof(message),
+					   "[rss=%s] [peak=%s] [rows=%u in %s] [key names=%s]",
+					   rss, peak, redis->keyCount, rows, keys);
+
+	spyStatsFormatBytes((long long)redis->valueBytes, previews, sizeof(previews));
+
+	if (redis->memoryBudget)
+	{
+		spyStatsFormatBytes((long long)redis->memoryBudget, cap, sizeof(cap));
+		spyStatsFormatBytes((long long)redis->valueBudget, budget, sizeof(budget));
+	}
+	else
+	{
+		strcpy(cap, "none");
+		strcpy(budget, "no cap");
+	}
+
+	if (len < (int)sizeof(message))
+	{
+		len += snprintf(message + len, sizeof(message) - len,
+						" [cap=%s] [previews=%s of %s] [hits=%u] [misses=%u] [evicted=%u]",
+						cap, previews, budget, redis->valueHits, redis->valueMisses,
+						redis->valueEvictions);
+	}
+
+	if (redis->trigrams && (len < (int)sizeof(message)))
+	{
+		spyStatsFormatBytes((long long)spyTrigramMemory(redis->trigrams), trigrams, sizeof(trigrams));
+
+		len += snprintf(message + len, sizeof(message) - len, " [key index=%u in %s]",
+						spyTrigramCount(redis->trigrams), trigrams);
+	}
+
+	if (redis->tree && (len < (int)sizeof(message)))
+	{
+		spyStatsFormatBytes((long long)spyTreeMemory(redis->tree), tree, sizeof(tree));
+
+		len += snprintf(message + len, sizeof(message) - len, " [tree=%u nodes in %s]",
+						redis->tree->nodeCount - 1, tree);
+	}
+
+	if (redis->schema && (len < (int)sizeof(message)))
+	{
+		spyStatsFormatBytes((long long)spySchemaMemory(redis->schema), schema, sizeof(schema));
+
+		snprintf(message + len, sizeof(message) - len, " [templates=%u in %s]",
+				 spySchemaTemplateCount(redis->schema), schema);
+	}
+
+	spyWindowSetCommandLineText(window, message);
+
 	return 0;
 }
 
@@ -476,6 +1656,7 @@ static SPY_DISPATCH g_dispatchTable[] =
 	{ KEY_SEPARATOR,	"",								 NULL },
 
 	{ 'r',				"refresh",                       spyControllerEventRefresh },
+	{ 27,				"cancel refresh",                spyControllerEventCancelRefresh },
 	{ 'a',				"auto-refresh",                  spyControllerEventAutoRefresh },
 	{ KEY_SEPARATOR,	"",								 NULL },
 
@@ -485,6 +1666,19 @@ static SPY_DISPATCH g_dispatchTable[] =
 	{ KEY_SEPARATOR,	"",								 NULL },
 
 	{ 'f',				"filter keys",                   spyControllerEventFilterKeys },
+	{ 'S',				"search values on server",       spyControllerEventSearchValues },
+	{ 'Q',				"query loaded rows",             spyControllerEventQuery },
+	{ 'F',				"filter by type on server",      spyControllerEventFilterType },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ '/',				"find in loaded rows",           spyControllerEventFind },
+	{ 'n',				"find next",                     spyControllerEventFindNext },
+	{ 'N',				"find previous",                 spyControllerEventFindPrevious },
+	{ 'g',				"goto key",                      spyControllerEventGotoKey },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'T',				"namespace tree",                spyControllerEventTreeView },
+	{ 'P',				"key templates",                 spyControllerEventSchemaView },
 	{ KEY_SEPARATOR,	"",								 NULL },
 
 	{ 's',				"sort by key",                   spyControllerEventSortByKey },
@@ -513,21 +1707,126 @@ static SPY_DISPATCH g_dispatchTable[] =
 	{ 'G',				"goto bottom",                   spyControllerEventMoveToBottom },
 	{ KEY_SEPARATOR,	"",								 NULL },
 
+	{ 'i',				"client memory",                 spyControllerEventInstrumentation },
 	{ '?',				"help",                          spyControllerEventHelp }
 };
 
 static unsigned int g_dispatchTableSize = sizeof(g_dispatchTable)/sizeof(SPY_DISPATCH);
 
+// Used instead of g_dispatchTable while the tree is shown. Commands on
+// the current key don't apply to a namespace.
+static SPY_DISPATCH g_treeDispatchTable[] = 
+{
+	{ KEY_RESIZE,		"resize",                        spyControllerRedraw },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'o',				"expand/collapse or view key",   spyControllerEventTreeOpen },
+	{ CTRL('j'),		"expand/collapse or view key",   spyControllerEventTreeOpen },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'T',				"back to key list",              spyControllerEventListView },
+	{ 'q',				"back to key list",              spyControllerEventListView },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'r',				"refresh",                       spyControllerEventRefresh },
+	{ 27,				"cancel refresh",                spyControllerEventCancelRefresh },
+	{ 'a',				"auto-refresh",                  spyControllerEventAutoRefresh },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 's',				"sort by name",                  spyControllerEventTreeSortByName },
+	{ 'c',				"sort by key count",             spyControllerEventTreeSortByKeys },
+	{ 'l',				"sort by length",                spyControllerEventTreeSortByLength },
+	{ 'm',				"sort by memory",                spyControllerEventTreeSortByMemory },
+	{ 'D',				"change delimiter",              spyControllerEventTreeDelimiter },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'j',				"move down",                     spyControllerEventMoveDown },
+	{ KEY_DOWN,			"move down",                     spyControllerEventMoveDown },
+	{ 'k',				"move up",                       spyControllerEventMoveUp },
+	{ KEY_UP,			"move up",                       spyControllerEventMoveUp },
+	{ CTRL('f'),		"page down",                     spyControllerEventPageDown },
+	{ ' ',				"page down",                     spyControllerEventPageDown },
+	{ CTRL('b'),		"page up",                       spyControllerEventPageUp },
+	{ '^',				"goto top",                      spyControllerEventMoveToTop },
+	{ '$',				"goto bottom",                   spyControllerEventMoveToBottom },
+	{ 'G',				"goto bottom",                   spyControllerEventMoveToBottom },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'i',				"client memory",                 spyControllerEventInstrumentation },
+	{ '?',				"help",                          spyControllerEventHelp }
+};
+
+static unsigned int g_treeDispatchTableSize = sizeof(g_treeDispatchTable)/sizeof(SPY_DISPATCH);
+
+// Used while the key templates are shown
+static SPY_DISPATCH g_schemaDispatchTable[] = 
+{
+	{ KEY_RESIZE,		"resize",                        spyControllerRedraw },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'o',				"list the template's keys",      spyControllerEventSchemaOpen },
+	{ CTRL('j'),		"list the template's keys",      spyControllerEventSchemaOpen },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'P',				"back to key list",              spyControllerEventListView },
+	{ 'q',				"back to key list",              spyControllerEventListView },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'r',				"refresh",                       spyControllerEventRefresh },
+	{ 27,				"cancel refresh",                spyControllerEventCancelRefresh },
+	{ 'a',				"auto-refresh",                  spyControllerEventAutoRefresh },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'j',				"move down",                     spyControllerEventMoveDown },
+	{ KEY_DOWN,			"move down",                     spyControllerEventMoveDown },
+	{ 'k',				"move up",                       spyControllerEventMoveUp },
+	{ KEY_UP,			"move up",                       spyControllerEventMoveUp },
+	{ CTRL('f'),		"page down",                     spyControllerEventPageDown },
+	{ ' ',				"page down",                     spyControllerEventPageDown },
+	{ CTRL('b'),		"page up",                       spyControllerEventPageUp },
+	{ '^',				"goto top",                      spyControllerEventMoveToTop },
+	{ '$',				"goto bottom",                   spyControllerEventMoveToBottom },
+	{ 'G',				"goto bottom",                   spyControllerEventMoveToBottom },
+	{ KEY_SEPARATOR,	"",								 NULL },
+
+	{ 'i',				"client memory",                 spyControllerEventInstrumentation },
+	{ '?',				"help",                          spyControllerEventHelp }
+};
+
+static unsigned int g_schemaDispatchTableSize = sizeof(g_schemaDispatchTable)/sizeof(SPY_DISPATCH);
+
+// The table for the current view
+static SPY_DISPATCH* spyControllerDispatchTable(unsigned int* size)
+{
+	switch (g_viewMode)
+	{
+		case SPY_CONTROLLER_VIEW_TREE:
+			*size = g_treeDispatchTableSize;
+			return g_treeDispatchTable;
+
+		case SPY_CONTROLLER_VIEW_SCHEMA:
+			*size = g_schemaDispatchTableSize;
+			return g_schemaDispatchTable;
+
+		default:
+			*size = g_dispatchTableSize;
+			return g_dispatchTable;
+	}
+}
+
 int redisSpyDispatchCommand(int command, SPY_WINDOW* w, REDIS* r)
 {
+	unsigned int size;
+	SPY_DISPATCH* table = spyControllerDispatchTable(&size);
+
 	// Naive dispatching. 
-	for (unsigned int i = 0; i < g_dispatchTableSize; i++)
+	for (unsigned int i = 0; i < size; i++)
 	{
-		if (g_dispatchTable[i].key == command)
+		if (table[i].key == command)
 		{
-			if (g_dispatchTable[i].handler)
+			if (table[i].handler)
 			{
-				return (*(g_dispatchTable[i].handler))(w, r);
+				return (*(table[i].handler))(w, r);
 			}
 			else
 			{
@@ -547,21 +1846,46 @@ int redisSpyDispatchCommand(int command, SPY_WINDOW* w, REDIS* r)
 unsigned int spyWindowDelegateRowCount(void* UNUSED(delegate))
 {
 	//SPY_CONTROLLER* self = (SPY_CONTROLLER*)delegate;
-	return g_redis->keyCount;
+	return redisSpyViewCount(g_redis);
+}
+
+// Seconds, or ms for the last second. "-" for keys that do not expire.
+static void spyControllerFormatTtl(long long ttl, char* buffer, unsigned int size)
+{
+	if (ttl < 0)
+		snprintf(buffer, size, "-");
+	else if (ttl < 1000)
+		snprintf(buffer, size, "%lldms", ttl);
+	else
+		snprintf(buffer, size, "%llds", ttl / 1000);
 }
 
 int spyWindowDelegateValueForRow(void* UNUSED(delegate), int row, char* buffer, unsigned int bufferSize)
 {
 	char format[64];
+	char ttl[24];
 	int keyFieldWidth = MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength);
-	sprintf(format, "%%-%ds  %%-6s  %%6d  ", keyFieldWidth);
+	sprintf(format, "%%-%ds  %%-6s  %%6d  %%-9s  %%8s  ", keyFieldWidth);
+
+	int r = redisSpyViewRow(g_redis, row);
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	spyControllerFormatTtl(redisSpyRowTtl(g_redis, r), ttl, sizeof(ttl));
 
 	int len = snprintf(buffer, bufferSize, format,
-					   g_redis->data[row].key,
-					   g_redis->data[row].type,
-					   g_redis->data[row].length);
+					   redisSpyKeyAtIndex(g_redis, r, key),
+					   redisSpyRowType(g_redis, r),
+					   redisSpyRowLength(g_redis, r),
+					   redisSpyRowEncoding(g_redis, r),
+					   ttl);
+
+	// Lead with where the search matched
+	const char* match = redisSpyRowMatch(g_redis, r);
 
-	strncat(buffer, g_redis->data[row].value, bufferSize - len);
+	if (g_redis->search[0] && match[0] && (len < (int)bufferSize))
+		len += snprintf(buffer + len, bufferSize - len, "{%s} ", match);
+
+	strncat(buffer, redisSpyRowValue(g_redis, r), bufferSize - len);
 
 	return 0;
 }
@@ -571,8 +1895,8 @@ int spyWindowDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsigned i
 	char format[64];
 	int keyFieldWidth = MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength);
 
-	sprintf(format, "%%-%ds  %%-6s  %%6s  %%s", keyFieldWidth);
-	snprintf(buffer, bufferSize, format, "Key", "Type", "Length", "Value");
+	sprintf(format, "%%-%ds  %%-6s  %%6s  %%-9s  %%8s  %%s", keyFieldWidth);
+	snprintf(buffer, bufferSize, format, "Key", "Type", "Length", "Encoding", "TTL", "Value");
 
 	return 0;
 }
@@ -580,22 +1904,68 @@ int spyWindowDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsigned i
 int spyWindowDelegateStatusText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize, 
 		                        unsigned int cursorIndex)
 {
+	char address[REDISSPY_MAX_HOST_LEN + 16];
+	redisSpyServerAddress(g_redis, address, sizeof(address));
+
+	char search[REDISSPY_MAX_PATTERN_LEN + 16];
+	search[0] = '\0';
+
+	if (g_redis->search[0])
+		snprintf(search, sizeof(search), " [search=%s]", g_redis->search);
+
+	char query[SPY_QUERY_MAX_TEXT + REDISSPY_MAX_ENCODING_LEN + 32];
+	query[0] = '\0';
+
+	if (g_redis->scanType[0])
+		snprintf(query, sizeof(query), " [type=%s]", g_redis->scanType);
+
+	if (g_redis->query)
+	{
+		size_t len = strlen(query);
+		snprintf(query + len, sizeof(query) - len, " [query=%s]", g_redis->query->text);
+	}
+
+	// Under a local filter or query, "shown of loaded"
+	unsigned int rows = redisSpyViewCount(g_redis);
+	char keys[32];
+
+	if (g_redis->filter[0] || g_redis->query)
+		snprintf(keys, sizeof(keys), "%u of %u", rows, g_redis->keyCount);
+	else
+		snprintf(keys, sizeof(keys), "%u", g_redis->keyCount);
+
+	const char* filter = g_redis->filter[0] ? g_redis->filter : g_redis->keyPattern;
+
 	if (g_redis->context == NULL)
 	{
 		snprintf(buffer, bufferSize,
-				 "[host=%s:%d] No Connection.", 
-				 g_redis->host, 
-				 g_redis->port); 
+				 "[host=%s] No Connection.", 
+				 address); 
+	}
+	else if (g_redis->scanInProgress)
+	{
+		snprintf(buffer, bufferSize,
+				 "[host=%s] [filter=%s]%s%s [keys=%s] [scan %d%% of ~%lld] [clients=%d] [mem=%s]", 
+				 address,
+				 filter,
+				 search,
+				 query,
+				 keys, 
+				 g_redis->scanProgress / 10,
+				 g_redis->scanDbSize,
+				 g_redis->infoConnectedClients, 
+				 g_redis->infoUsedMemoryHuman);
 	}
 	else
 	{
 		snprintf(buffer, bufferSize,
-				 "[host=%s:%d] [filter=%s] [keys=%d] [%d%%] [clients=%d] [mem=%s]", 
-				 g_redis->host, 
-				 g_redis->port,
-				 g_redis->pattern,
-				 g_redis->keyCount, 
-				 g_redis->keyCount ? cursorIndex*100/g_redis->keyCount : 0,
+				 "[host=%s] [filter=%s]%s%s [keys=%s] [%d%%] [clients=%d] [mem=%s]", 
+				 address,
+				 filter,
+				 search,
+				 query,
+				 keys, 
+				 rows ? cursorIndex*100/rows : 0,
 				 g_redis->infoConnectedClients, 
 				 g_redis->infoUsedMemoryHuman);
 	}
@@ -603,6 +1973,148 @@ int spyWindowDelegateStatusText(void* UNUSED(delegate), char* buffer, unsigned i
 	return 0;
 }
 
+///////////////////////////////////////////////////////////////////////
+//
+// Tree Window Delegate Methods
+//
+unsigned int spyTreeDelegateRowCount(void* UNUSED(delegate))
+{
+	return spyTreeRowCount(g_redis->tree);
+}
+
+int spyTreeDelegateValueForRow(void* UNUSED(delegate), int row, char* buffer, unsigned int bufferSize)
+{
+	SPY_TREE_NODE* node = spyTreeRow(g_redis->tree, row);
+	unsigned int nameLength;
+	const char* name = spyTreeName(g_redis->tree, node, &nameLength);
+
+	char namespace[REDISSPY_MAX_KEY_LEN];
+	char memory[32];
+	const char* marker = "  ";
+
+	if (node->firstChild)
+		marker = node->expanded ? "- " : "+ ";
+
+	snprintf(namespace, sizeof(namespace), "%*s%s%.*s",
+			 (int)node->depth * 2, "", marker, (int)nameLength, name);
+
+	spyStatsFormatBytes(node->memory, memory, sizeof(memory));
+
+	snprintf(buffer, bufferSize, "%-*s  %10lld  %12lld  %10s",
+			 MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength + 4),
+			 namespace,
+			 node->keys,
+			 node->length,
+			 memory);
+
+	return 0;
+}
+
+int spyTreeDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize)
+{
+	snprintf(buffer, bufferSize, "%-*s  %10s  %12s  %10s",
+			 MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength + 4),
+			 "Namespace", "Keys", "Length", "Memory");
+
+	return 0;
+}
+
+int spyTreeDelegateStatusText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize, 
+		                      unsigned int UNUSED(cursorIndex))
+{
+	static const char* sortNames[] = { "name", "keys", "length", "memory" };
+
+	char address[REDISSPY_MAX_HOST_LEN + 16];
+	redisSpyServerAddress(g_redis, address, sizeof(address));
+
+	char scan[64];
+	scan[0] = '\0';
+
+	if (g_redis->scanInProgress)
+	{
+		snprintf(scan, sizeof(scan), " [scan %d%% of ~%lld]",
+				 g_redis->scanProgress / 10, g_redis->scanDbSize);
+	}
+
+	snprintf(buffer, bufferSize,
+			 "[host=%s] [tree on '%s' by %s] [keys=%u]%s [clients=%d] [mem=%s]",
+			 address,
+			 g_redis->tree->delimiter,
+			 sortNames[g_redis->tree->sortBy],
+			 g_redis->keyCount,
+			 scan,
+			 g_redis->infoConnectedClients,
+			 g_redis->infoUsedMemoryHuman);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Template Window Delegate Methods
+//
+unsigned int spySchemaDelegateRowCount(void* UNUSED(delegate))
+{
+	return spySchemaTemplateCount(g_redis->schema);
+}
+
+int spySchemaDelegateValueForRow(void* UNUSED(delegate), int row, char* buffer, unsigned int bufferSize)
+{
+	SPY_SCHEMA_STATS* t = spySchemaTemplate(g_redis->schema, row);
+
+	char text[SPY_SCHEMA_MAX_TEMPLATE_LEN];
+	char types[64];
+	char length[64];
+	char memory[64];
+
+	spySchemaTemplateText(g_redis->schema, t, text, sizeof(text));
+	spySchemaFormatTypes(t, types, sizeof(types));
+	spySchemaFormatPercentiles(t->length, 0, length, sizeof(length));
+	spySchemaFormatPercentiles(t->memory, 1, memory, sizeof(memory));
+
+	snprintf(buffer, bufferSize, "%-*s  %10lld  %-24s  %-20s  %s",
+			 MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength),
+			 text, t->keys, types, length, memory);
+
+	return 0;
+}
+
+int spySchemaDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize)
+{
+	snprintf(buffer, bufferSize, "%-*s  %10s  %-24s  %-20s  %s",
+			 MAX(SPY_WINDOW_MIN_KEY_FIELD_WIDTH, g_redis->longestKeyLength),
+			 "Template", "Keys", "Types", "Length p50/p90/p99", "Memory p50/p90/p99");
+
+	return 0;
+}
+
+int spySchemaDelegateStatusText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize, 
+		                        unsigned int UNUSED(cursorIndex))
+{
+	char address[REDISSPY_MAX_HOST_LEN + 16];
+	redisSpyServerAddress(g_redis, address, sizeof(address));
+
+	char scan[64];
+	scan[0] = '\0';
+
+	if (g_redis->scanInProgress)
+	{
+		snprintf(scan, sizeof(scan), " [scan %d%% of ~%lld]",
+				 g_redis->scanProgress / 10, g_redis->scanDbSize);
+	}
+
+	snprintf(buffer, bufferSize,
+			 "[host=%s] [templates=%u] [keys=%u]%s [clients=%d] [mem=%s]",
+			 address,
+			 spySchemaTemplateCount(g_redis->schema),
+			 g_redis->keyCount,
+			 scan,
+			 g_redis->infoConnectedClients,
+			 g_redis->infoUsedMemoryHuman);
+
+	return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////
 //
 // Main event loop
@@ -618,8 +2130,26 @@ int spyControllerEventLoop(SPY_WINDOW* w, REDIS* redis)
 								spyWindowDelegateHeaderText,
 								spyWindowDelegateStatusText);
 
+	g_treeWindowDelegate = spyWindowDelegateCreate(
+								spyTreeDelegateRowCount,
+								spyTreeDelegateValueForRow,
+								spyTreeDelegateHeaderText,
+								spyTreeDelegateStatusText);
+
+	g_schemaWindowDelegate = spyWindowDelegateCreate(
+								spySchemaDelegateRowCount,
+								spySchemaDelegateValueForRow,
+								spySchemaDelegateHeaderText,
+								spySchemaDelegateStatusText);
+
 	spyWindowSetDelegate(w, g_spyWindowDelegate);
 
+	g_fetch = spyFetchCreate(redis);
+
+	// Interactive commands use this connection; refreshes use the
+	// fetch thread's.
+	redisSpyEnsureConnected(redis);
+
     // Do initial manual refresh
 	// Set Reverse on so it toggles back to ascending
 	redis->sortReverse = 0;
@@ -633,13 +2163,43 @@ int spyControllerEventLoop(SPY_WINDOW* w, REDIS* redis)
 		spyControllerResetTimer(redis, redis->refreshInterval);
 	}
 
+	int pending = 0;
+
 	while (1)
 	{
+		// Wake up periodically to pick up fetch results, or straight
+		// away if the last pass left some behind.
+		wtimeout(w->window, pending ? 0 : SPY_CONTROLLER_POLL_MS);
+
 		int key = wgetch(w->window);
+
+		// Prompts read from the same window
+		wtimeout(w->window, SPY_CONTROLLER_POLL_MS);
+
+		if (g_refreshDue)
+		{
+			g_refreshDue = 0;
+			spyControllerScheduledRefresh(w, redis);
+		}
+
+		pending = (spyControllerApplyResults(w, redis) == SPY_CONTROLLER_RESULTS_PER_PASS);
+
+		spyControllerTouchVisibleRows(w, redis);
+
+		// Catch the key index up with the rows while there is time
+		if (key == ERR)
+			pending |= redisSpyIndexKeys(redis, SPY_CONTROLLER_INDEX_SLICE_MS);
+
+		if (key == ERR)
+			continue;
+
 		int result = redisSpyDispatchCommand(key, w, redis);
 
 		if (result == REDIS_SPY_DISPATCH_COMMAND_QUIT)
 		{
+			spyFetchDelete(g_fetch);
+			g_fetch = NULL;
+
 			return 0;
 		}
 		else if (result != 0)
@@ -661,7 +2221,10 @@ int spyControllerEventHelp(SPY_WINDOW* w, REDIS* redis)
 
 	signal(SIGALRM, SIG_IGN);
 
-	spyHelpControllerRun(w, g_dispatchTable, g_dispatchTableSize);
+	unsigned int size;
+	SPY_DISPATCH* table = spyControllerDispatchTable(&size);
+
+	spyHelpControllerRun(w, table, size);
 
 	spyControllerEventRefresh(w, redis);
 
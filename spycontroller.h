@@ -15,6 +15,25 @@ typedef struct
 	int	(*handler)(SPY_WINDOW* w, REDIS* redis);
 } SPY_DISPATCH;
 
+// Auto-refresh tiers, in refresh ticks. The viewport is re-read on
+// every tick, the rows within SPY_REFRESH_NEARBY_PAGES pages of it
+// less often, and the full key list is rescanned on a long period.
+#define SPY_REFRESH_NEARBY_TICKS		5
+#define SPY_REFRESH_NEARBY_PAGES		2
+#define SPY_REFRESH_KEYSPACE_TICKS		30
+
+// How often the event loop checks for fetch results while idle
+#define SPY_CONTROLLER_POLL_MS			100
+
+// Fetch results merged between keystrokes before redrawing
+#define SPY_CONTROLLER_RESULTS_PER_PASS	8
+
+// Time spent indexing key names per pass of the event loop
+#define SPY_CONTROLLER_INDEX_SLICE_MS	10
+
+// Ranked matches listed by the goto prompt
+#define SPY_CONTROLLER_GOTO_MATCHES		8
+
 typedef struct _spy_controller
 {
 	REDIS*					redis;
@@ -9,14 +9,18 @@
 #include <signal.h>
 
 #include "spymodel.h"
+#include "spydetailmodel.h"
 #include "spywindow.h"
+#include "spystats.h"
 
 #include "spydetailcontroller.h"
 
 static SPY_WINDOW* g_redisSpyDetailWindow;
 
 static REDIS* g_redisDetail;
-static REDISDATA*	g_redisDetailData;
+static REDISDETAIL* g_detail;
+
+static volatile sig_atomic_t g_detailRefreshDue;
 
 static SPY_WINDOW_DELEGATE* g_spyDetailWindowDelegate;
 
@@ -25,7 +29,14 @@ static int REDIS_SPY_DISPATCH_COMMAND_QUIT = -999999;
 
 int spyDetailControllerEventHelp(SPY_WINDOW* w, REDIS* UNUSED(redis))
 {
-	spyWindowSetCommandLineText(w, "r=refresh q=quit ?=help");
+	if (strcmp(g_detail->type, "zset") == 0)
+		spyWindowSetCommandLineText(w, "g=go to rank s=go to score m=go to member i=memory r=refresh q=quit ?=help");
+	else if (strcmp(g_detail->type, "stream") == 0)
+		spyWindowSetCommandLineText(w, "g=go to ID or time v=reverse order i=memory r=refresh q=quit ?=help");
+	else if (strcmp(g_detail->type, "string") == 0)
+		spyWindowSetCommandLineText(w, "g=go to offset x=hex/text i=memory r=refresh q=quit ?=help");
+	else
+		spyWindowSetCommandLineText(w, "g=go to row i=memory r=refresh q=quit ?=help");
 
 	return 0;
 }
@@ -33,19 +44,28 @@ int spyDetailControllerEventHelp(SPY_WINDOW* w, REDIS* UNUSED(redis))
 
 // Driver
 
-int spyDetailControllerEventRefresh(SPY_WINDOW* window, REDIS* redis)
+// Draw, then read ahead if the view is near the edge of what's cached
+static void spyDetailControllerDraw(SPY_WINDOW* window)
+{
+	spyWindowDraw(window);
+
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
+}
+
+int spyDetailControllerEventRefresh(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowSetBusySignal(window, 1);
-	redisSpyServerRefreshKey(redis, g_redisDetailData);
+	redisDetailRefresh(g_detail);
 	spyWindowSetBusySignal(window, 0);
-	spyWindowDraw(window);
+	spyDetailControllerDraw(window);
 
 	return 0;
 }
 
+// Only flag the tick here. The refresh runs from the event loop.
 void detailTimerExpired(int UNUSED(i))
 {
-	spyDetailControllerEventRefresh(g_redisSpyDetailWindow, g_redisDetail);
+	g_detailRefreshDue = 1;
 }
 
 void spyDetailControllerResetTimer(REDIS* redis, int interval)
@@ -152,16 +172,8 @@ int spyDetailControllerEventDeleteKey(SPY_WINDOW* w, REDIS* redis)
 	char serverCommand[REDISSPY_MAX_COMMAND_LEN];
 	char serverReply[REDISSPY_MAX_SERVER_REPLY_LEN];
 
-	int i = spyWindowGetCurrentRow(w);
-
-	if (i < 0)
-	{
-		beep();
-		return 0;
-	}
-
 	snprintf(serverCommand, sizeof(serverCommand),
-				"DEL %s", redis->data[i].key);
+				"DEL %s", g_detail->key);
 
 	redisSpySendCommandToServer(redis, serverCommand,
 					serverReply, sizeof(serverReply));
@@ -179,15 +191,7 @@ int spyDetailControllerEventListPop(SPY_WINDOW* w, REDIS* redis, const char* com
 	char serverCommand[REDISSPY_MAX_COMMAND_LEN];
 	char serverReply[REDISSPY_MAX_SERVER_REPLY_LEN];
 
-	int i = spyWindowGetCurrentRow(w);
-
-	if (i < 0)
-	{
-		beep();
-		return 0;
-	}
-
-	if (strcmp(redis->data[i].type, "list") != 0)
+	if (strcmp(g_detail->type, "list") != 0)
 	{
 		beep();
 		spyWindowSetCommandLineText(w, "Not a list.");
@@ -195,7 +199,7 @@ int spyDetailControllerEventListPop(SPY_WINDOW* w, REDIS* redis, const char* com
 	}
 
 	snprintf(serverCommand, sizeof(serverCommand),
-				"%s %s", command, redis->data[i].key);
+				"%s %s", command, g_detail->key);
 
 	redisSpySendCommandToServer(redis, serverCommand,
 					serverReply, sizeof(serverReply));
@@ -219,127 +223,6 @@ int spyDetailControllerEventListRightPop(SPY_WINDOW* w, REDIS* redis)
 	return spyDetailControllerEventListPop(w, redis, "RPOP");
 }
 
-/* TODO jsb */
-int spyDetailControllerEventViewDetails(SPY_WINDOW* w, REDIS* redis)
-{
-	signal(SIGALRM, SIG_IGN);
-
-	int index = spyWindowGetCurrentRow(w);
-
-	if (index < 0)
-	{
-		beep();
-		return 0;
-	}
-
-	redisReply* r = NULL;
-	char serverCommand[SPY_WINDOW_MAX_COMMAND_LEN];
-
-	if (strcmp(redis->data[index].type, "string") == 0)
-	{
-		snprintf(serverCommand, SPY_WINDOW_MAX_COMMAND_LEN,
-				"GET %s", redis->data[index].key);
-
-		r = redisSpyGetServerResponse(redis, serverCommand);
-
-		if (r)
-		{
-			mvwaddstr(w->window, SPY_WINDOW_HEADER_ROWS, 0,
-					  r->str);
-		}
-	}
-	else if (   (strcmp(redis->data[index].type, "list") == 0)
-			 || (strcmp(redis->data[index].type, "set") == 0)
-			 || (strcmp(redis->data[index].type, "zset") == 0))
-	{
-		if (strcmp(redis->data[index].type, "list") == 0)
-		{
-			snprintf(serverCommand, SPY_WINDOW_MAX_COMMAND_LEN,
-					"LRANGE %s 0 -1", redis->data[index].key);
-		}
-		else if (strcmp(redis->data[index].type, "set") == 0)
-		{
-			snprintf(serverCommand, SPY_WINDOW_MAX_COMMAND_LEN,
-					"SMEMBERS %s", redis->data[index].key);
-		}
-		else if (strcmp(redis->data[index].type, "zset") == 0)
-		{
-			snprintf(serverCommand, SPY_WINDOW_MAX_COMMAND_LEN,
-					"ZRANGE %s 0 -1", redis->data[index].key);
-		}
-
-		r = redisSpyGetServerResponse(redis, serverCommand);
-
-		if (r)
-		{
-			for (unsigned int i = 0; i < MIN(r->elements, w->displayRows); i++)
-			{
-				mvwaddstr(w->window, i + SPY_WINDOW_HEADER_ROWS, 0,
-						  r->element[i]->str);
-			}
-		}
-	}
-	else if (strcmp(redis->data[index].type, "hash") == 0)
-	{
-		snprintf(serverCommand, SPY_WINDOW_MAX_COMMAND_LEN,
-				 "HGETALL %s", redis->data[index].key);
-
-		r = redisSpyGetServerResponse(redis, serverCommand);
-
-		if (r)
-		{
-			char displayRow[SPY_WINDOW_MAX_SCREEN_COLS];
-
-			for (unsigned int i = 0; i < MIN(r->elements/2, w->displayRows); i++)
-			{
-				snprintf(displayRow, SPY_WINDOW_MAX_SCREEN_COLS,
-					"%s  ->  %s",
-					r->element[2*i]->str,
-					r->element[2*i+1]->str);
-
-				mvwaddstr(w->window, i + SPY_WINDOW_HEADER_ROWS, 0,
-						  displayRow);
-			}
-		}
-	}
-	else
-	{
-		mvwaddstr(w->window, 1, 0, "Unsupported Type.");
-	}
-
-	if (r)
-		freeReplyObject(r);
-
-	wrefresh(w->window);
-
-	int done = 0;
-
-	while (!done)
-	{
-		char c = wgetch(w->window);
-
-		switch (c)
-		{
-			case 'q':
-			case 27:
-				spyWindowDeleteChild(w);
-				done = 1;
-				break;
-
-			default:
-				beep();
-		}
-	}
-
-	spyDetailControllerEventRefresh(w, redis);
-
-	if (redis->refreshInterval)
-		signal(SIGALRM, detailTimerExpired);
-
-	return 0;
-}
-
-
 int spyDetailControllerEventAutoRefresh(SPY_WINDOW* window, REDIS* redis)
 {
 	char refreshIntervalBuffer[80];
@@ -361,7 +244,7 @@ int spyDetailControllerEventAutoRefresh(SPY_WINDOW* window, REDIS* redis)
 
 int spyDetailControllerRedraw(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
-	spyWindowDraw(window);
+	spyDetailControllerDraw(window);
 
 	return 0;
 }
@@ -369,36 +252,243 @@ int spyDetailControllerRedraw(SPY_WINDOW* window, REDIS* UNUSED(redis))
 int spyDetailControllerEventMoveDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowMoveDown(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
 	return 0;
 }
 
 int spyDetailControllerEventMoveUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowMoveUp(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
 	return 0;
 }
 
 int spyDetailControllerEventPageDown(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowPageDown(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
 	return 0;
 }
 
 int spyDetailControllerEventPageUp(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowPageUp(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
 	return 0;
 }
 
 int spyDetailControllerEventMoveToTop(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowMoveToTop(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
 	return 0;
 }
 
 int spyDetailControllerEventMoveToBottom(SPY_WINDOW* window, REDIS* UNUSED(redis))
 {
 	spyWindowMoveToBottom(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
+	return 0;
+}
+
+static void spyDetailControllerMoveToIndex(SPY_WINDOW* window, long long index)
+{
+	if ((index < 0) || (index >= redisDetailRowCount(g_detail)))
+	{
+		beep();
+		spyWindowSetCommandLineText(window, "Not found.");
+		return;
+	}
+
+	spyWindowMoveToIndex(window, (unsigned int)index);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
+}
+
+// Streams have no rank. Re-read from the ID instead, so row 0 is the
+// first entry at or past it.
+static int spyDetailControllerGoToStreamId(SPY_WINDOW* window, REDIS* redis)
+{
+	char id[REDISDETAIL_MAX_STREAM_ID_LEN];
+
+	if (spyDetailControllerGetCommand(window, redis,
+				"Go to ID or timestamp in ms (- or + for either end): ",
+				id, sizeof(id)) == 0)
+	{
+		spyWindowSetBusySignal(window, 1);
+		redisDetailSetStreamStart(g_detail, id, g_detail->streamReverse);
+		spyWindowSetBusySignal(window, 0);
+
+		spyWindowMoveToTop(window);
+		redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
+	}
+
+	return 0;
+}
+
+int spyDetailControllerEventReverseStream(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	if (strcmp(g_detail->type, "stream") != 0)
+		return -1;
+
+	spyWindowSetBusySignal(window, 1);
+	redisDetailSetStreamStart(g_detail, NULL, !g_detail->streamReverse);
+	spyWindowSetBusySignal(window, 0);
+
+	spyWindowMoveToTop(window);
+	redisDetailPrefetch(g_detail, window->startIndex, window->displayRows);
+
+	return 0;
+}
+
+// Strings are laid out a fixed number of bytes per row
+static int spyDetailControllerGoToOffset(SPY_WINDOW* window, REDIS* redis)
+{
+	char offset[REDISSPY_MAX_COMMAND_LEN];
+
+	if (spyDetailControllerGetCommand(window, redis,
+				"Go to offset (0x for hex): ",
+				offset, sizeof(offset)) == 0)
+	{
+		if (offset[0] == '\0')
+		{
+			beep();
+			return 0;
+		}
+
+		spyDetailControllerMoveToIndex(window,
+				strtoll(offset, NULL, 0) / redisDetailStringRowBytes(g_detail));
+	}
+
+	return 0;
+}
+
+int spyDetailControllerEventToggleHex(SPY_WINDOW* window, REDIS* UNUSED(redis))
+{
+	if (strcmp(g_detail->type, "string") != 0)
+		return -1;
+
+	// Stay at the same offset
+	long long offset = (long long)window->startIndex * redisDetailStringRowBytes(g_detail);
+
+	spyWindowSetBusySignal(window, 1);
+	redisDetailSetHexMode(g_detail, !g_detail->hexMode);
+	spyWindowSetBusySignal(window, 0);
+
+	spyWindowMoveToTop(window);
+	spyDetailControllerMoveToIndex(window, offset / redisDetailStringRowBytes(g_detail));
+
+	return 0;
+}
+
+int spyDetailControllerEventGoToRank(SPY_WINDOW* window, REDIS* redis)
+{
+	char rank[REDISSPY_MAX_COMMAND_LEN];
+
+	if (strcmp(g_detail->type, "stream") == 0)
+		return spyDetailControllerGoToStreamId(window, redis);
+
+	if (strcmp(g_detail->type, "string") == 0)
+		return spyDetailControllerGoToOffset(window, redis);
+
+	if (spyDetailControllerGetCommand(window, redis,
+				strcmp(g_detail->type, "zset") == 0 ? "Go to rank: " : "Go to row: ",
+				rank, sizeof(rank)) == 0)
+	{
+		if (rank[0] == '\0')
+		{
+			beep();
+			return 0;
+		}
+
+		spyDetailControllerMoveToIndex(window, atoll(rank));
+	}
+
+	return 0;
+}
+
+// Sorted sets only. The lookups fetch one member, not the range before it.
+int spyDetailControllerEventGoToScore(SPY_WINDOW* window, REDIS* redis)
+{
+	char score[REDISSPY_MAX_COMMAND_LEN];
+
+	if (strcmp(g_detail->type, "zset") != 0)
+		return -1;
+
+	if (spyDetailControllerGetCommand(window, redis,
+				"Go to score: ",
+				score, sizeof(score)) == 0)
+	{
+		if (score[0] == '\0')
+		{
+			beep();
+			return 0;
+		}
+
+		spyDetailControllerMoveToIndex(window, redisDetailRankOfScore(g_detail, score));
+	}
+
+	return 0;
+}
+
+int spyDetailControllerEventGoToMember(SPY_WINDOW* window, REDIS* redis)
+{
+	char member[REDISSPY_MAX_COMMAND_LEN];
+
+	if (strcmp(g_detail->type, "zset") != 0)
+		return -1;
+
+	if (spyDetailControllerGetCommand(window, redis,
+				"Go to member: ",
+				member, sizeof(member)) == 0)
+	{
+		if (member[0] == '\0')
+		{
+			beep();
+			return 0;
+		}
+
+		spyDetailControllerMoveToIndex(window, redisDetailRankOfMember(g_detail, member));
+	}
+
+	return 0;
+}
+
+int spyDetailControllerEventInstrumentation(SPY_WINDOW* window, REDIS* redis)
+{
+	char rss[32];
+	char pages[32];
+	char budget[32];
+	char cap[32];
+	char message[SPY_WINDOW_MAX_COMMAND_LEN];
+
+	spyStatsFormatBytes(spyStatsResidentBytes(), rss, sizeof(rss));
+	spyStatsFormatBytes(redisDetailCachedBytes(g_detail), pages, sizeof(pages));
+
+	if (g_detail->budget)
+	{
+		spyStatsFormatBytes(g_detail->budget, budget, sizeof(budget));
+		spyStatsFormatBytes((long long)redis->memoryBudget, cap, sizeof(cap));
+	}
+	else
+	{
+		strcpy(budget, "no cap");
+		strcpy(cap, "none");
+	}
+
+	snprintf(message, sizeof(message),
+			 "[rss=%s] [cap=%s] [pages=%u/%u in %s of %s] [hits=%u] [misses=%u] [evicted=%u]",
+			 rss,
+			 cap,
+			 redisDetailCachedPages(g_detail),
+			 REDISDETAIL_CACHE_PAGES,
+			 pages,
+			 budget,
+			 g_detail->pageHits,
+			 g_detail->pageMisses,
+			 g_detail->pageEvictions);
+
+	spyWindowSetCommandLineText(window, message);
+
 	return 0;
 }
 
@@ -440,6 +530,14 @@ static SPY_DISPATCH g_detailDispatchTable[] =
 	{ '$',				spyDetailControllerEventMoveToBottom },
 	{ 'G',				spyDetailControllerEventMoveToBottom },
 
+	{ 'g',				spyDetailControllerEventGoToRank },
+	{ 's',				spyDetailControllerEventGoToScore },
+	{ 'm',				spyDetailControllerEventGoToMember },
+	{ 'v',				spyDetailControllerEventReverseStream },
+	{ 'x',				spyDetailControllerEventToggleHex },
+
+	{ 'i',				spyDetailControllerEventInstrumentation },
+
 	{ '?',				spyDetailControllerEventHelp }
 };
 
@@ -465,12 +563,12 @@ int spyDetailControllerDispatchCommand(int command, SPY_WINDOW* w, REDIS* r)
 //
 unsigned int spyDetailWindowDelegateRowCount(void* UNUSED(delegate))
 {
-	return redisSpyDetailElementCount(g_redisDetailData);
+	return redisDetailRowCount(g_detail);
 }
 
 int spyDetailWindowDelegateValueForRow(void* UNUSED(delegate), int row, char* buffer, unsigned int bufferSize)
 {
-	redisSpyDetailElementAtIndex(g_redisDetailData, row, buffer, bufferSize);
+	redisDetailRowAtIndex(g_detail, row, buffer, bufferSize);
 
 	return 0;
 }
@@ -479,7 +577,7 @@ int spyDetailWindowDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsi
 {
 	snprintf(buffer, bufferSize,
 			"Key Details: %s",
-			g_redisDetailData->key);
+			g_detail->key);
 
 	return 0;
 }
@@ -487,13 +585,42 @@ int spyDetailWindowDelegateHeaderText(void* UNUSED(delegate), char* buffer, unsi
 int spyDetailWindowDelegateStatusText(void* UNUSED(delegate), char* buffer, unsigned int bufferSize, 
 		                        unsigned int cursorIndex)
 {
+	unsigned int rows = redisDetailRowCount(g_detail);
+
+	if (strcmp(g_detail->type, "string") == 0)
+	{
+		snprintf(buffer, bufferSize,
+				"[type=string] [len=%lld] [offset=0x%llx] [%s] [pages=%u/%u]",
+				g_detail->length,
+				// Offset of the top row
+				(unsigned long long)g_redisSpyDetailWindow->startIndex * redisDetailStringRowBytes(g_detail),
+				g_detail->hexMode ? "hex" : "text",
+				redisDetailCachedPages(g_detail),
+				REDISDETAIL_CACHE_PAGES);
+
+		return 0;
+	}
+
+	if (strcmp(g_detail->type, "stream") == 0)
+	{
+		snprintf(buffer, bufferSize,
+				"[type=stream] [len=%lld] [from=%s] [%s first] [pages=%u/%u]",
+				g_detail->length,
+				g_detail->streamStart,
+				g_detail->streamReverse ? "newest" : "oldest",
+				redisDetailCachedPages(g_detail),
+				REDISDETAIL_CACHE_PAGES);
+
+		return 0;
+	}
+
 	snprintf(buffer, bufferSize,
-			"[type=%s] [len=%d] [%d%%]",
-			g_redisDetailData->type,
-			g_redisDetailData->length,
-			g_redisDetailData->reply->elements
-				? cursorIndex * 100 / redisSpyDetailElementCount(g_redisDetailData) 
-				: 100);
+			"[type=%s] [len=%lld] [%d%%] [pages=%u/%u]",
+			g_detail->type,
+			g_detail->length,
+			rows ? cursorIndex * 100 / rows : 100,
+			redisDetailCachedPages(g_detail),
+			REDISDETAIL_CACHE_PAGES);
 
 	return 0;
 }
@@ -512,9 +639,22 @@ int spyDetailControllerEventLoop(SPY_WINDOW* w, REDIS* redis)
 		spyDetailControllerResetTimer(redis, redis->refreshInterval);
 	}
 
+	// Wake up to run a refresh the timer flagged
+	wtimeout(w->window, SPY_DETAIL_CONTROLLER_POLL_MS);
+
 	while (1)
 	{
 		int key = wgetch(w->window);
+
+		if (g_detailRefreshDue)
+		{
+			g_detailRefreshDue = 0;
+			spyDetailControllerEventRefresh(w, redis);
+		}
+
+		if (key == ERR)
+			continue;
+
 		int result = spyDetailControllerDispatchCommand(key, w, redis);
 
 		if (result == REDIS_SPY_DISPATCH_COMMAND_QUIT)
@@ -536,11 +676,12 @@ int spyDetailControllerEventLoop(SPY_WINDOW* w, REDIS* redis)
 }
 
 
-int spyDetailControllerRun(SPY_WINDOW* parent, REDIS* redis, unsigned int index)
+int spyDetailControllerRun(SPY_WINDOW* parent, REDIS* redis, const char* key)
 {
 	g_redisSpyDetailWindow = spyWindowCreate(parent);
 	g_redisDetail = redis;
-	g_redisDetailData = &redis->data[index];
+	g_detail = redisDetailCreate(redis, key);
+	g_detailRefreshDue = 0;
 
 	g_spyDetailWindowDelegate = spyWindowDelegateCreate(
 									spyDetailWindowDelegateRowCount,
@@ -552,6 +693,8 @@ int spyDetailControllerRun(SPY_WINDOW* parent, REDIS* redis, unsigned int index)
 
 	spyDetailControllerEventLoop(g_redisSpyDetailWindow, redis);
 
+	redisDetailDelete(g_detail);
+	g_detail = NULL;
+
 	return 0;
 }
-
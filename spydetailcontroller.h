@@ -1,5 +1,8 @@
 
 
-int spyDetailControllerRun(SPY_WINDOW* parent, REDIS* redis, unsigned int index);
+// How often the detail loop checks for a due auto-refresh while idle
+#define SPY_DETAIL_CONTROLLER_POLL_MS	100
+
+int spyDetailControllerRun(SPY_WINDOW* parent, REDIS* redis, const char* key);
 
 
@@ -0,0 +1,930 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "hiredis.h"
+
+#include "spydetailmodel.h"
+
+
+static int redisDetailIsScanned(REDISDETAIL* d)
+{
+	return (strcmp(d->type, "set") == 0) || (strcmp(d->type, "hash") == 0);
+}
+
+
+static int redisDetailIsRanged(REDISDETAIL* d)
+{
+	return (strcmp(d->type, "list") == 0) || (strcmp(d->type, "zset") == 0);
+}
+
+
+static int redisDetailIsStream(REDISDETAIL* d)
+{
+	return strcmp(d->type, "stream") == 0;
+}
+
+
+static int redisDetailIsString(REDISDETAIL* d)
+{
+	return strcmp(d->type, "string") == 0;
+}
+
+
+static void redisDetailClearPage(REDISDETAILPAGE* p)
+{
+	for (unsigned int i = 0; i < p->count; i++)
+		free(p->rows[i]);
+
+	free(p->rows);
+
+	p->page = -1;
+	p->count = 0;
+	p->rows = NULL;
+	p->lastUsed = 0;
+}
+
+
+static void redisDetailClearCache(REDISDETAIL* d)
+{
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+		redisDetailClearPage(&d->pages[i]);
+}
+
+
+static REDISDETAILPAGE* redisDetailFindPage(REDISDETAIL* d, long long page)
+{
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+	{
+		if (d->pages[i].page == page)
+			return &d->pages[i];
+	}
+
+	return NULL;
+}
+
+
+// An empty slot, or else the least recently used one
+static REDISDETAILPAGE* redisDetailVictimPage(REDISDETAIL* d)
+{
+	REDISDETAILPAGE* victim = &d->pages[0];
+
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+	{
+		if (d->pages[i].page < 0)
+			return &d->pages[i];
+
+		if (d->pages[i].lastUsed < victim->lastUsed)
+			victim = &d->pages[i];
+	}
+
+	redisDetailClearPage(victim);
+
+	return victim;
+}
+
+
+// Drop the least recently used pages other than keep until the cache
+// fits the budget
+static void redisDetailTrimCache(REDISDETAIL* d, REDISDETAILPAGE* keep)
+{
+	if (d->budget == 0)
+		return;
+
+	while (redisDetailCachedBytes(d) > d->budget)
+	{
+		REDISDETAILPAGE* victim = NULL;
+
+		for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+		{
+			REDISDETAILPAGE* p = &d->pages[i];
+
+			if ((p->page < 0) || (p == keep))
+				continue;
+
+			if ((victim == NULL) || (p->lastUsed < victim->lastUsed))
+				victim = p;
+		}
+
+		if (victim == NULL)
+			return;
+
+		redisDetailClearPage(victim);
+		d->pageEvictions++;
+	}
+}
+
+
+static void redisDetailAddRow(REDISDETAILPAGE* p, const char* a, const char* b)
+{
+	char buffer[REDISSPY_MAX_VALUE_LEN];
+
+	if (b != NULL)
+		snprintf(buffer, sizeof(buffer), "%s  ->  %s", a, b);
+	else
+		snprintf(buffer, sizeof(buffer), "%s", a);
+
+	char* row = malloc(strlen(buffer) + 1);
+	strcpy(row, buffer);
+
+	p->rows[p->count++] = row;
+}
+
+
+static void redisDetailAddScanStart(REDISDETAIL* d, const char* cursor, unsigned int skip)
+{
+	if (d->scanStartCount == d->scanStartCapacity)
+	{
+		d->scanStartCapacity = d->scanStartCapacity ? d->scanStartCapacity * 2 : 64;
+		d->scanStarts = realloc(d->scanStarts, d->scanStartCapacity * sizeof(REDISDETAILSCANSTART));
+	}
+
+	REDISDETAILSCANSTART* start = &d->scanStarts[d->scanStartCount++];
+
+	strncpy(start->cursor, cursor, sizeof(start->cursor) - 1);
+	start->cursor[sizeof(start->cursor) - 1] = '\0';
+	start->skip = skip;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Page fetching
+//
+// A page is fetched in two halves: the command is appended and flushed,
+// then later its reply is read. In between, the reply can sit on the
+// connection as read-ahead.
+
+static int redisDetailAppendScan(REDISDETAIL* d, const char* cursor)
+{
+	return redisAppendCommand(d->redis->context,
+			strcmp(d->type, "set") == 0 ? "SSCAN %s %s COUNT %d" : "HSCAN %s %s COUNT %d",
+			d->key, cursor, REDISDETAIL_PAGE_SIZE);
+}
+
+
+// The ID just past id in reading order, so the next XRANGE/XREVRANGE
+// window starts after the last entry already read. Returns -1 if there
+// is no such ID.
+static int redisDetailNextStreamId(const char* id, int reverse, char* buffer, unsigned int size)
+{
+	unsigned long long ms = 0;
+	unsigned long long seq = 0;
+
+	sscanf(id, "%llu-%llu", &ms, &seq);
+
+	if (reverse ? (ms == 0 && seq == 0) : (ms == ULLONG_MAX && seq == ULLONG_MAX))
+		return -1;
+
+	if (!reverse)
+	{
+		if (seq == ULLONG_MAX)
+			snprintf(buffer, size, "%llu-0", ms + 1);
+		else
+			snprintf(buffer, size, "%llu-%llu", ms, seq + 1);
+	}
+	else
+	{
+		if (seq == 0)
+			snprintf(buffer, size, "%llu-%llu", ms - 1, ULLONG_MAX);
+		else
+			snprintf(buffer, size, "%llu-%llu", ms, seq - 1);
+	}
+
+	return 0;
+}
+
+
+static int redisDetailSendPage(REDISDETAIL* d, long long page)
+{
+	if (redisSpyEnsureConnected(d->redis) != 0)
+		return -1;
+
+	redisContext* c = d->redis->context;
+	long long first = page * REDISDETAIL_PAGE_SIZE;
+	long long last = first + REDISDETAIL_PAGE_SIZE - 1;
+
+	if (strcmp(d->type, "list") == 0)
+		redisAppendCommand(c, "LRANGE %s %lld %lld", d->key, first, last);
+	else if (strcmp(d->type, "zset") == 0)
+		redisAppendCommand(c, "ZRANGE %s %lld %lld WITHSCORES", d->key, first, last);
+	else if (redisDetailIsScanned(d))
+		redisDetailAppendScan(d, d->scanStarts[page].cursor);
+	else if (redisDetailIsStream(d) && d->streamReverse)
+		redisAppendCommand(c, "XREVRANGE %s %s - COUNT %d",
+						   d->key, d->scanStarts[page].cursor, REDISDETAIL_PAGE_SIZE);
+	else if (redisDetailIsStream(d))
+		redisAppendCommand(c, "XRANGE %s %s + COUNT %d",
+						   d->key, d->scanStarts[page].cursor, REDISDETAIL_PAGE_SIZE);
+	else
+	{
+		long long rowBytes = redisDetailStringRowBytes(d);
+		redisAppendCommand(c, "GETRANGE %s %lld %lld",
+						   d->key, first * rowBytes, (last + 1) * rowBytes - 1);
+	}
+
+	// Put it on the wire now rather than at the next read
+	int done = 0;
+
+	while (!done)
+	{
+		if (redisBufferWrite(c, &done) != REDIS_OK)
+		{
+			redisSpyCheckConnection(d->redis);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static redisReply* redisDetailReadReply(REDISDETAIL* d)
+{
+	redisReply* r = NULL;
+
+	if (redisGetReply(d->redis->context, (void**)&r) != REDIS_OK)
+	{
+		redisSpyCheckConnection(d->redis);
+		return NULL;
+	}
+
+	return r;
+}
+
+
+// Collect a SCAN-backed page from the reply already sent for it,
+// issuing further SCAN calls until the page is full or the scan ends.
+// Records where the following page starts.
+static int redisDetailReadScanPage(REDISDETAIL* d, long long page, REDISDETAILPAGE* p)
+{
+	char cursor[REDISDETAIL_MAX_STREAM_ID_LEN];
+	unsigned int skip = d->scanStarts[page].skip;
+	int pairs = (strcmp(d->type, "hash") == 0);
+
+	strcpy(cursor, d->scanStarts[page].cursor);
+
+	redisReply* r = redisDetailReadReply(d);
+
+	while (1)
+	{
+		if (r == NULL)
+			return -1;
+
+		if (   (r->type != REDIS_REPLY_ARRAY)
+			|| (r->elements != 2)
+			|| (r->element[1]->type != REDIS_REPLY_ARRAY))
+		{
+			freeReplyObject(r);
+			return -1;
+		}
+
+		redisReply* batch = r->element[1];
+		unsigned int items = pairs ? batch->elements / 2 : batch->elements;
+		unsigned int i;
+
+		for (i = skip; (i < items) && (p->count < REDISDETAIL_PAGE_SIZE); i++)
+		{
+			if (pairs)
+				redisDetailAddRow(p, batch->element[2*i]->str, batch->element[2*i+1]->str);
+			else
+				redisDetailAddRow(p, batch->element[i]->str, NULL);
+		}
+
+		char next[REDISDETAIL_MAX_STREAM_ID_LEN];
+		strncpy(next, r->element[0]->str, sizeof(next) - 1);
+		next[sizeof(next) - 1] = '\0';
+
+		freeReplyObject(r);
+
+		int atEnd = (strcmp(next, "0") == 0);
+
+		if (p->count == REDISDETAIL_PAGE_SIZE)
+		{
+			if (page + 1 == d->scanStartCount)
+			{
+				if (i < items)
+					redisDetailAddScanStart(d, cursor, i);
+				else if (!atEnd)
+					redisDetailAddScanStart(d, next, 0);
+				else
+					d->scanComplete = 1;
+			}
+
+			return 0;
+		}
+
+		if (atEnd)
+		{
+			d->scanComplete = 1;
+			return 0;
+		}
+
+		// The batch ran out before the page filled up
+		strcpy(cursor, next);
+		skip = 0;
+
+		redisDetailAppendScan(d, cursor);
+		r = redisDetailReadReply(d);
+	}
+}
+
+
+// Entries come back as [id, [field, value, ...]]. A short page is the
+// end of the stream; otherwise the next page starts past its last ID.
+static int redisDetailReadStreamPage(REDISDETAIL* d, long long page, REDISDETAILPAGE* p)
+{
+	redisReply* r = redisDetailReadReply(d);
+
+	if (r == NULL)
+		return -1;
+
+	if (r->type != REDIS_REPLY_ARRAY)
+	{
+		freeReplyObject(r);
+		return -1;
+	}
+
+	for (unsigned int i = 0; (i < r->elements) && (p->count < REDISDETAIL_PAGE_SIZE); i++)
+	{
+		redisReply* entry = r->element[i];
+		char fields[REDISSPY_MAX_VALUE_LEN];
+		unsigned int used = 0;
+
+		fields[0] = '\0';
+
+		if ((entry->type != REDIS_REPLY_ARRAY) || (entry->elements < 2))
+			continue;
+
+		redisReply* f = entry->element[1];
+
+		for (unsigned int j = 0; (j + 1 < f->elements) && (used < sizeof(fields)); j += 2)
+		{
+			used += snprintf(fields + used, sizeof(fields) - used, "%s%s=%s",
+							 j ? " " : "", f->element[j]->str, f->element[j+1]->str);
+		}
+
+		redisDetailAddRow(p, entry->element[0]->str, fields);
+	}
+
+	if (page + 1 == d->scanStartCount)
+	{
+		char next[REDISDETAIL_MAX_STREAM_ID_LEN];
+
+		if (   (p->count == REDISDETAIL_PAGE_SIZE)
+			&& (redisDetailNextStreamId(p->rows[p->count - 1], d->streamReverse, next, sizeof(next)) == 0))
+		{
+			redisDetailAddScanStart(d, next, 0);
+		}
+		else
+		{
+			d->scanComplete = 1;
+			d->streamTailCount = p->count;
+		}
+	}
+
+	freeReplyObject(r);
+
+	return 0;
+}
+
+
+// Lay a GETRANGE chunk out in rows, each starting with its offset.
+// Text rows replace unprintable bytes with '.'; hex rows show the bytes
+// in hex followed by the same as ASCII.
+static void redisDetailAddStringRows(REDISDETAIL* d, long long page, REDISDETAILPAGE* p,
+									 const char* chunk, size_t len)
+{
+	unsigned int rowBytes = redisDetailStringRowBytes(d);
+	long long offset = page * REDISDETAIL_PAGE_SIZE * rowBytes;
+
+	for (size_t start = 0; (start < len) && (p->count < REDISDETAIL_PAGE_SIZE); start += rowBytes)
+	{
+		char row[REDISSPY_MAX_VALUE_LEN];
+		unsigned int n = MIN(rowBytes, len - start);
+		int used = snprintf(row, sizeof(row), "%08llx  ", offset + (long long)start);
+
+		if (d->hexMode)
+		{
+			for (unsigned int i = 0; i < rowBytes; i++)
+			{
+				if (i < n)
+					used += sprintf(row + used, "%02x ", (unsigned char)chunk[start + i]);
+				else
+					used += sprintf(row + used, "   ");
+
+				if (i == rowBytes / 2 - 1)
+					row[used++] = ' ';
+			}
+
+			row[used++] = ' ';
+			row[used++] = '|';
+		}
+
+		for (unsigned int i = 0; i < n; i++)
+		{
+			unsigned char c = chunk[start + i];
+			row[used++] = (c >= 0x20 && c < 0x7f) ? c : '.';
+		}
+
+		if (d->hexMode)
+			row[used++] = '|';
+
+		row[used] = '\0';
+
+		redisDetailAddRow(p, row, NULL);
+	}
+}
+
+
+static int redisDetailReadPage(REDISDETAIL* d, long long page)
+{
+	REDISDETAILPAGE* p = redisDetailVictimPage(d);
+
+	p->rows = malloc(REDISDETAIL_PAGE_SIZE * sizeof(char*));
+	p->count = 0;
+
+	int ret = 0;
+
+	if (redisDetailIsScanned(d))
+	{
+		ret = redisDetailReadScanPage(d, page, p);
+	}
+	else if (redisDetailIsStream(d))
+	{
+		ret = redisDetailReadStreamPage(d, page, p);
+	}
+	else
+	{
+		redisReply* r = redisDetailReadReply(d);
+
+		if (r == NULL)
+		{
+			ret = -1;
+		}
+		else
+		{
+			if ((r->type == REDIS_REPLY_ARRAY) && (strcmp(d->type, "zset") == 0))
+			{
+				// member, score pairs
+				for (unsigned int i = 0; (i + 1 < r->elements) && (p->count < REDISDETAIL_PAGE_SIZE); i += 2)
+					redisDetailAddRow(p, r->element[i]->str, r->element[i+1]->str);
+			}
+			else if (r->type == REDIS_REPLY_ARRAY)
+			{
+				for (unsigned int i = 0; (i < r->elements) && (i < REDISDETAIL_PAGE_SIZE); i++)
+					redisDetailAddRow(p, r->element[i]->str, NULL);
+			}
+			else if (r->type == REDIS_REPLY_STRING)
+			{
+				redisDetailAddStringRows(d, page, p, r->str, r->len);
+			}
+
+			freeReplyObject(r);
+		}
+	}
+
+	if (ret != 0)
+	{
+		redisDetailClearPage(p);
+		return -1;
+	}
+
+	p->page = page;
+	p->lastUsed = ++d->clock;
+
+	redisDetailTrimCache(d, p);
+
+	return 0;
+}
+
+
+// Read in an outstanding read-ahead so the connection is free
+static void redisDetailCompletePrefetch(REDISDETAIL* d)
+{
+	if (d->prefetchPage < 0)
+		return;
+
+	long long page = d->prefetchPage;
+	d->prefetchPage = -1;
+
+	redisDetailReadPage(d, page);
+}
+
+
+// Whether page's start is known, so it can be requested directly
+static int redisDetailCanSend(REDISDETAIL* d, long long page)
+{
+	if (redisDetailIsScanned(d) || redisDetailIsStream(d))
+		return page < d->scanStartCount;
+
+	return 1;
+}
+
+
+static REDISDETAILPAGE* redisDetailLoadPage(REDISDETAIL* d, long long page)
+{
+	REDISDETAILPAGE* p = redisDetailFindPage(d, page);
+
+	if (p != NULL)
+	{
+		d->pageHits++;
+		p->lastUsed = ++d->clock;
+		return p;
+	}
+
+	d->pageMisses++;
+
+	if (d->prefetchPage == page)
+	{
+		d->prefetchPage = -1;
+
+		if (redisDetailReadPage(d, page) != 0)
+			return NULL;
+
+		return redisDetailFindPage(d, page);
+	}
+
+	redisDetailCompletePrefetch(d);
+
+	// A SCAN-backed or stream page is only reachable by walking the pages
+	// before it
+	while (!redisDetailCanSend(d, page))
+	{
+		if (d->scanComplete)
+			return NULL;
+
+		long long previous = d->scanStartCount - 1;
+
+		if (   (redisDetailSendPage(d, previous) != 0)
+			|| (redisDetailReadPage(d, previous) != 0))
+		{
+			return NULL;
+		}
+	}
+
+	if (   (redisDetailSendPage(d, page) != 0)
+		|| (redisDetailReadPage(d, page) != 0))
+	{
+		return NULL;
+	}
+
+	return redisDetailFindPage(d, page);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Interface
+
+REDISDETAIL* redisDetailCreate(REDIS* redis, const char* key)
+{
+	REDISDETAIL* d = malloc(sizeof(REDISDETAIL));
+
+	d->redis = redisSpyCreate();
+
+	strcpy(d->redis->host, redis->host);
+	d->redis->port = redis->port;
+	strcpy(d->redis->socketPath, redis->socketPath);
+
+	strncpy(d->key, key, sizeof(d->key) - 1);
+	d->key[sizeof(d->key) - 1] = '\0';
+	d->type[0] = '\0';
+	d->length = 0;
+
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+	{
+		d->pages[i].page = -1;
+		d->pages[i].count = 0;
+		d->pages[i].rows = NULL;
+		d->pages[i].lastUsed = 0;
+	}
+
+	d->clock = 0;
+
+	d->scanStarts = NULL;
+	d->scanStartCount = 0;
+	d->scanStartCapacity = 0;
+	d->scanComplete = 0;
+
+	strcpy(d->streamStart, "-");
+	d->streamReverse = 0;
+	d->streamTailCount = 0;
+
+	d->hexMode = 0;
+
+	d->prefetchPage = -1;
+
+	d->budget = (long long)redis->detailBudget;
+
+	d->pageHits = 0;
+	d->pageMisses = 0;
+	d->pageEvictions = 0;
+
+	redisDetailRefresh(d);
+
+	return d;
+}
+
+
+void redisDetailDelete(REDISDETAIL* d)
+{
+	redisDetailClearCache(d);
+	free(d->scanStarts);
+
+	// Any read-ahead still on the connection goes with it
+	redisSpyDelete(d->redis);
+
+	free(d);
+}
+
+
+// Re-read the type and element count and forget every cached page
+int redisDetailRefresh(REDISDETAIL* d)
+{
+	redisDetailCompletePrefetch(d);
+	redisDetailClearCache(d);
+
+	d->scanStartCount = 0;
+	d->scanComplete = 0;
+	d->streamTailCount = 0;
+
+	d->type[0] = '\0';
+	d->length = 0;
+
+	if (redisSpyEnsureConnected(d->redis) != 0)
+		return -1;
+
+	redisContext* c = d->redis->context;
+
+	redisReply* r = redisCommand(c, "TYPE %s", d->key);
+	if (r == NULL)
+	{
+		redisSpyCheckConnection(d->redis);
+		return -1;
+	}
+
+	if (r->type == REDIS_REPLY_STATUS)
+	{
+		strncpy(d->type, r->str, sizeof(d->type) - 1);
+		d->type[sizeof(d->type) - 1] = '\0';
+	}
+
+	freeReplyObject(r);
+
+	redisDetailAddScanStart(d, redisDetailIsStream(d) ? d->streamStart : "0", 0);
+
+	const char* lengthCommand = NULL;
+
+	if (strcmp(d->type, "list") == 0)
+		lengthCommand = "LLEN %s";
+	else if (strcmp(d->type, "set") == 0)
+		lengthCommand = "SCARD %s";
+	else if (strcmp(d->type, "hash") == 0)
+		lengthCommand = "HLEN %s";
+	else if (strcmp(d->type, "zset") == 0)
+		lengthCommand = "ZCARD %s";
+	else if (strcmp(d->type, "stream") == 0)
+		lengthCommand = "XLEN %s";
+	else if (strcmp(d->type, "string") == 0)
+		lengthCommand = "STRLEN %s";
+
+	if (lengthCommand == NULL)
+		return 0;
+
+	r = redisCommand(c, lengthCommand, d->key);
+	if (r == NULL)
+	{
+		redisSpyCheckConnection(d->redis);
+		return -1;
+	}
+
+	if (r->type == REDIS_REPLY_INTEGER)
+		d->length = r->integer;
+
+	freeReplyObject(r);
+
+	return 0;
+}
+
+
+unsigned int redisDetailRowCount(REDISDETAIL* d)
+{
+	if (redisDetailIsScanned(d) || redisDetailIsRanged(d))
+		return (unsigned int)d->length;
+
+	// Entries before streamStart are not counted, so the rows grow a
+	// page at a time as the stream is read, up to its length
+	if (redisDetailIsStream(d))
+	{
+		long long known = (long long)(d->scanStartCount - 1) * REDISDETAIL_PAGE_SIZE;
+
+		if (d->scanComplete)
+			return (unsigned int)(known + d->streamTailCount);
+
+		return (unsigned int)MIN(known + REDISDETAIL_PAGE_SIZE, d->length);
+	}
+
+	if (redisDetailIsString(d))
+	{
+		unsigned int rowBytes = redisDetailStringRowBytes(d);
+		return (unsigned int)MAX(1, (d->length + rowBytes - 1) / rowBytes);
+	}
+
+	// A message for anything else
+	return 1;
+}
+
+
+int redisDetailRowAtIndex(REDISDETAIL* d, unsigned int index, char* buffer, unsigned int size)
+{
+	buffer[0] = '\0';
+
+	if (strcmp(d->type, "none") == 0)
+	{
+		snprintf(buffer, size, "Key not found.");
+		return 0;
+	}
+
+	if (   !redisDetailIsScanned(d) && !redisDetailIsRanged(d)
+		&& !redisDetailIsStream(d) && !redisDetailIsString(d))
+	{
+		snprintf(buffer, size, "Unsupported Type.");
+		return 0;
+	}
+
+	REDISDETAILPAGE* p = redisDetailLoadPage(d, index / REDISDETAIL_PAGE_SIZE);
+
+	// The key may have shrunk since its length was read
+	if ((p == NULL) || (index % REDISDETAIL_PAGE_SIZE >= p->count))
+		return -1;
+
+	snprintf(buffer, size, "%s", p->rows[index % REDISDETAIL_PAGE_SIZE]);
+
+	return 0;
+}
+
+
+// Rank of member in a sorted set, or -1 if it is not there
+long long redisDetailRankOfMember(REDISDETAIL* d, const char* member)
+{
+	if (strcmp(d->type, "zset") != 0)
+		return -1;
+
+	// The read-ahead reply must come off the connection first
+	redisDetailCompletePrefetch(d);
+
+	if (redisSpyEnsureConnected(d->redis) != 0)
+		return -1;
+
+	redisReply* r = redisCommand(d->redis->context, "ZRANK %s %s", d->key, member);
+	if (r == NULL)
+	{
+		redisSpyCheckConnection(d->redis);
+		return -1;
+	}
+
+	long long rank = (r->type == REDIS_REPLY_INTEGER) ? r->integer : -1;
+
+	freeReplyObject(r);
+
+	return rank;
+}
+
+
+// Rank of the first member of a sorted set scoring at least score, or
+// -1 if none does. score is passed through, so "(5" and "-inf" work.
+long long redisDetailRankOfScore(REDISDETAIL* d, const char* score)
+{
+	if (strcmp(d->type, "zset") != 0)
+		return -1;
+
+	redisDetailCompletePrefetch(d);
+
+	if (redisSpyEnsureConnected(d->redis) != 0)
+		return -1;
+
+	redisReply* r = redisCommand(d->redis->context,
+						"ZRANGEBYSCORE %s %s +inf LIMIT 0 1", d->key, score);
+	if (r == NULL)
+	{
+		redisSpyCheckConnection(d->redis);
+		return -1;
+	}
+
+	char member[REDISSPY_MAX_VALUE_LEN];
+	member[0] = '\0';
+
+	int found = (r->type == REDIS_REPLY_ARRAY) && (r->elements > 0);
+
+	if (found)
+		snprintf(member, sizeof(member), "%s", r->element[0]->str);
+
+	freeReplyObject(r);
+
+	if (!found)
+		return -1;
+
+	return redisDetailRankOfMember(d, member);
+}
+
+
+// Called after the view moves. Requests the page just past whichever
+// end of the visible rows is within half a page of a page boundary.
+void redisDetailPrefetch(REDISDETAIL* d, unsigned int firstRow, unsigned int rowCount)
+{
+	if (   (d->prefetchPage >= 0)
+		|| !(   redisDetailIsScanned(d) || redisDetailIsRanged(d)
+			 || redisDetailIsStream(d) || redisDetailIsString(d)))
+	{
+		return;
+	}
+
+	long long candidates[2];
+	unsigned int n = 0;
+
+	unsigned long long ahead = (unsigned long long)firstRow + rowCount + REDISDETAIL_PAGE_SIZE / 2;
+
+	if (ahead < (unsigned long long)d->length)
+		candidates[n++] = ahead / REDISDETAIL_PAGE_SIZE;
+
+	if (firstRow >= REDISDETAIL_PAGE_SIZE / 2)
+		candidates[n++] = (firstRow - REDISDETAIL_PAGE_SIZE / 2) / REDISDETAIL_PAGE_SIZE;
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (   (redisDetailFindPage(d, candidates[i]) == NULL)
+			&& redisDetailCanSend(d, candidates[i]))
+		{
+			if (redisDetailSendPage(d, candidates[i]) == 0)
+				d->prefetchPage = candidates[i];
+
+			return;
+		}
+	}
+}
+
+
+// Read a stream from id ("-" or "+" for either end, or a millisecond
+// timestamp), oldest first or, with reverse, newest first.
+int redisDetailSetStreamStart(REDISDETAIL* d, const char* id, int reverse)
+{
+	if ((id == NULL) || (id[0] == '\0'))
+		id = reverse ? "+" : "-";
+
+	snprintf(d->streamStart, sizeof(d->streamStart), "%s", id);
+	d->streamReverse = reverse;
+
+	return redisDetailRefresh(d);
+}
+
+
+// Rows are formatted as they are read, so switching modes drops the cache
+int redisDetailSetHexMode(REDISDETAIL* d, int hexMode)
+{
+	d->hexMode = hexMode;
+
+	return redisDetailRefresh(d);
+}
+
+
+unsigned int redisDetailStringRowBytes(REDISDETAIL* d)
+{
+	return d->hexMode ? REDISDETAIL_HEX_ROW_BYTES : REDISDETAIL_TEXT_ROW_BYTES;
+}
+
+
+// Heap held by the cached pages
+long long redisDetailCachedBytes(REDISDETAIL* d)
+{
+	long long bytes = 0;
+
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+	{
+		REDISDETAILPAGE* p = &d->pages[i];
+
+		if (p->page < 0)
+			continue;
+
+		bytes += REDISDETAIL_PAGE_SIZE * sizeof(char*);
+
+		for (unsigned int j = 0; j < p->count; j++)
+			bytes += strlen(p->rows[j]) + 1;
+	}
+
+	return bytes;
+}
+
+
+unsigned int redisDetailCachedPages(REDISDETAIL* d)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < REDISDETAIL_CACHE_PAGES; i++)
+	{
+		if (d->pages[i].page >= 0)
+			n++;
+	}
+
+	return n;
+}
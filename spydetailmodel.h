@@ -0,0 +1,104 @@
+#ifndef _SPYDETAILMODEL_H_
+#define _SPYDETAILMODEL_H_
+
+#include "spymodel.h"
+
+// Windowed access to the elements of a single key, for the detail view.
+//
+// Elements are fetched a page at a time (LRANGE slices for lists,
+// ZRANGE WITHSCORES slices for sorted sets, SSCAN/HSCAN cursors for
+// sets and hashes, XRANGE/XREVRANGE COUNT windows for streams, GETRANGE
+// chunks for strings) and kept in a small LRU of pages, so opening a key with millions of elements costs
+// one page, not the whole collection. The next page can be requested
+// ahead of time; its reply is left on the detail connection until it is
+// needed.
+
+#define REDISDETAIL_PAGE_SIZE			256
+#define REDISDETAIL_CACHE_PAGES			16
+
+typedef struct _redis_detail_page
+{
+	long long		page;			// -1 if the slot is empty
+	unsigned int	count;
+	char**			rows;
+	unsigned int	lastUsed;
+} REDISDETAILPAGE;
+
+#define REDISDETAIL_MAX_STREAM_ID_LEN	48
+
+// Bytes of a string shown per row, as text or as a hex dump
+#define REDISDETAIL_TEXT_ROW_BYTES		64
+#define REDISDETAIL_HEX_ROW_BYTES		16
+
+// Where a SCAN-backed page starts: the cursor of the SCAN call that
+// returns its first element, and how many elements of that call's
+// batch belong to the previous page. For a stream, the ID to read from.
+typedef struct _redis_detail_scan_start
+{
+	char			cursor[REDISDETAIL_MAX_STREAM_ID_LEN];
+	unsigned int	skip;
+} REDISDETAILSCANSTART;
+
+typedef struct _redis_detail
+{
+	// Private connection, so a prefetched reply can wait on it
+	REDIS*			redis;
+
+	char			key[REDISSPY_MAX_KEY_LEN];
+	char			type[REDISSPY_MAX_TYPE_LEN];
+	long long		length;
+
+	REDISDETAILPAGE	pages[REDISDETAIL_CACHE_PAGES];
+	unsigned int	clock;
+
+	// SCAN-backed types can only be walked forwards. scanStarts[n] is
+	// known for every page up to scanStartCount - 1.
+	REDISDETAILSCANSTART*	scanStarts;
+	unsigned int			scanStartCount;
+	unsigned int			scanStartCapacity;
+	int						scanComplete;
+
+	// Streams are read from an ID, oldest first or newest first. Row 0
+	// is the first entry at or past streamStart.
+	char			streamStart[REDISDETAIL_MAX_STREAM_ID_LEN];
+	int				streamReverse;
+	unsigned int	streamTailCount;	// entries on the last page, once reached
+
+	// Strings are shown as text, or as offset, hex and ASCII columns
+	int				hexMode;
+
+	// Outstanding read-ahead, or -1
+	long long		prefetchPage;
+
+	// Bytes the cached pages may hold, the detail view's share of the -M
+	// budget, or 0 for just the page count. The page just read is kept
+	// even if it alone is over.
+	long long		budget;
+
+	// Instrumentation
+	unsigned int	pageHits;
+	unsigned int	pageMisses;
+	unsigned int	pageEvictions;
+} REDISDETAIL;
+
+
+REDISDETAIL* redisDetailCreate(REDIS* redis, const char* key);
+void redisDetailDelete(REDISDETAIL* d);
+
+int redisDetailRefresh(REDISDETAIL* d);
+
+unsigned int redisDetailRowCount(REDISDETAIL* d);
+int redisDetailRowAtIndex(REDISDETAIL* d, unsigned int index, char* buffer, unsigned int size);
+void redisDetailPrefetch(REDISDETAIL* d, unsigned int firstRow, unsigned int rowCount);
+
+long long redisDetailRankOfMember(REDISDETAIL* d, const char* member);
+long long redisDetailRankOfScore(REDISDETAIL* d, const char* score);
+
+int redisDetailSetStreamStart(REDISDETAIL* d, const char* id, int reverse);
+
+int redisDetailSetHexMode(REDISDETAIL* d, int hexMode);
+unsigned int redisDetailStringRowBytes(REDISDETAIL* d);
+unsigned int redisDetailCachedPages(REDISDETAIL* d);
+long long redisDetailCachedBytes(REDISDETAIL* d);
+
+#endif
@@ -0,0 +1,333 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hiredis.h"
+
+#include "spystats.h"
+#include "spyexport.h"
+
+
+////////////////////////////////////////////////////////////////////////
+// Streaming reply reader
+//
+// A set of redisReplyObjectFunctions that hand each element to the
+// callback instead of building a redisReply. hiredis already parses
+// incrementally and trims its input buffer as it goes, so with nothing
+// retained the reader only ever holds what is still unparsed.
+
+typedef struct _spy_export_reader
+{
+	SPY_EXPORT_CALLBACK		callback;
+	void*					context;
+} SPY_EXPORT_READER;
+
+
+static void* spyExportElement(const redisReadTask* task, int type,
+							  const char* str, size_t len, long long integer)
+{
+	SPY_EXPORT_READER* reader = task->privdata;
+	SPY_EXPORT_ELEMENT element;
+
+	element.type = type;
+	element.depth = 0;
+	element.index = task->idx;
+	element.str = str;
+	element.len = len;
+	element.integer = integer;
+
+	for (const redisReadTask* t = task->parent; t != NULL; t = t->parent)
+		element.depth++;
+
+	(*reader->callback)(reader->context, &element);
+
+	// Any non-NULL object will do. NULL means out of memory to hiredis.
+	return reader;
+}
+
+
+static void* spyExportCreateString(const redisReadTask* task, char* str, size_t len)
+{
+	return spyExportElement(task, task->type, str, len, 0);
+}
+
+
+static void* spyExportCreateArray(const redisReadTask* task, int elements)
+{
+	return spyExportElement(task, REDIS_REPLY_ARRAY, NULL, 0, elements);
+}
+
+
+static void* spyExportCreateInteger(const redisReadTask* task, long long value)
+{
+	return spyExportElement(task, REDIS_REPLY_INTEGER, NULL, 0, value);
+}
+
+
+static void* spyExportCreateNil(const redisReadTask* task)
+{
+	return spyExportElement(task, REDIS_REPLY_NIL, NULL, 0, 0);
+}
+
+
+static void spyExportFreeObject(void* UNUSED(reply))
+{
+	// Nothing was allocated
+}
+
+
+static redisReplyObjectFunctions g_spyExportFunctions =
+{
+	spyExportCreateString,
+	spyExportCreateArray,
+	spyExportCreateInteger,
+	spyExportCreateNil,
+	spyExportFreeObject
+};
+
+
+// Read the next reply on c, passing each element to callback as it is
+// parsed. Returns 0, or -1 if the connection failed.
+int spyExportReadReply(redisContext* c, SPY_EXPORT_CALLBACK callback, void* context)
+{
+	redisReader* r = c->reader;
+	redisReplyObjectFunctions* fn = r->fn;
+	void* privdata = r->privdata;
+	SPY_EXPORT_READER reader;
+	void* reply = NULL;
+
+	reader.callback = callback;
+	reader.context = context;
+
+	r->fn = &g_spyExportFunctions;
+	r->privdata = &reader;
+
+	int ret = redisGetReply(c, &reply);
+
+	// After a failed read the reader may still hold one of our objects,
+	// so keep our no-op freeObject until the context is dropped.
+	if (ret == REDIS_OK)
+		r->fn = fn;
+
+	r->privdata = privdata;
+
+	return (ret == REDIS_OK) ? 0 : -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Export
+//
+// One line per element: key, type, then the element. Hashes and sorted
+// sets add the value or score, streams the entry ID, field and value.
+
+typedef struct _spy_export_key
+{
+	REDISDATA*		data;
+	const char*		delimiter;
+	char			streamId[48];
+} SPY_EXPORT_KEY;
+
+
+static void spyExportBeginLine(SPY_EXPORT_KEY* k)
+{
+	printf("%s%s%s%s", k->data->key, k->delimiter, k->data->type, k->delimiter);
+}
+
+
+static void spyExportKeyElement(void* context, const SPY_EXPORT_ELEMENT* e)
+{
+	SPY_EXPORT_KEY* k = context;
+	const char* type = k->data->type;
+
+	if (e->type == REDIS_REPLY_ERROR)
+	{
+		fprintf(stderr, "%s: %.*s\n", k->data->key, (int)e->len, e->str);
+		return;
+	}
+
+	if ((e->type != REDIS_REPLY_STRING) && (e->type != REDIS_REPLY_STATUS))
+		return;
+
+	if (   (strcmp(type, "string") == 0)
+		|| (strcmp(type, "list") == 0)
+		|| (strcmp(type, "set") == 0))
+	{
+		spyExportBeginLine(k);
+		fwrite(e->str, 1, e->len, stdout);
+		putchar('\n');
+	}
+	else if ((strcmp(type, "hash") == 0) || (strcmp(type, "zset") == 0))
+	{
+		// field, value or member, score
+		if (e->index % 2 == 0)
+		{
+			spyExportBeginLine(k);
+			fwrite(e->str, 1, e->len, stdout);
+		}
+		else
+		{
+			fputs(k->delimiter, stdout);
+			fwrite(e->str, 1, e->len, stdout);
+			putchar('\n');
+		}
+	}
+	else if (strcmp(type, "stream") == 0)
+	{
+		// [[id, [field, value, ...]], ...]
+		if (e->depth == 2)
+		{
+			snprintf(k->streamId, sizeof(k->streamId), "%.*s", (int)e->len, e->str);
+		}
+		else if ((e->depth == 3) && (e->index % 2 == 0))
+		{
+			spyExportBeginLine(k);
+			printf("%s%s", k->streamId, k->delimiter);
+			fwrite(e->str, 1, e->len, stdout);
+		}
+		else if (e->depth == 3)
+		{
+			fputs(k->delimiter, stdout);
+			fwrite(e->str, 1, e->len, stdout);
+			putchar('\n');
+		}
+	}
+}
+
+
+static int spyExportAppendValueCommand(redisContext* c, REDISDATA* data)
+{
+	if (strcmp(data->type, "string") == 0)
+		redisAppendCommand(c, "GET %s", data->key);
+	else if (strcmp(data->type, "list") == 0)
+		redisAppendCommand(c, "LRANGE %s 0 -1", data->key);
+	else if (strcmp(data->type, "set") == 0)
+		redisAppendCommand(c, "SMEMBERS %s", data->key);
+	else if (strcmp(data->type, "hash") == 0)
+		redisAppendCommand(c, "HGETALL %s", data->key);
+	else if (strcmp(data->type, "zset") == 0)
+		redisAppendCommand(c, "ZRANGE %s 0 -1 WITHSCORES", data->key);
+	else if (strcmp(data->type, "stream") == 0)
+		redisAppendCommand(c, "XRANGE %s - +", data->key);
+	else
+		return 0;
+
+	return 1;
+}
+
+
+// Returns 0, or -1 if the server could not be reached
+int spyExportRun(REDIS* redis, const char* delimiter)
+{
+	if (redisSpyServerRefresh(redis) != 0)
+		return -1;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		SPY_EXPORT_KEY k;
+		REDISDATA data;
+
+		redisSpyGetRow(redis, i, &data);
+
+		k.data = &data;
+		k.delimiter = delimiter;
+		k.streamId[0] = '\0';
+
+		if (redisSpyEnsureConnected(redis) != 0)
+			return -1;
+
+		if (!spyExportAppendValueCommand(redis->context, k.data))
+			continue;
+
+		if (spyExportReadReply(redis->context, spyExportKeyElement, &k) != 0)
+		{
+			redisSpyCheckConnection(redis);
+			return -1;
+		}
+	}
+
+	fflush(stdout);
+
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Key templates
+
+static void spyExportSchemaReport(SPY_SCHEMA* s, long long keys)
+{
+	unsigned int count = spySchemaTemplateCount(s);
+	char schemaMemory[32];
+
+	printf("%-48s  %10s  %-24s  %-20s  %s\n",
+		   "Template", "Keys", "Types", "Length p50/p90/p99", "Memory p50/p90/p99");
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		SPY_SCHEMA_STATS* t = spySchemaTemplate(s, i);
+		char text[SPY_SCHEMA_MAX_TEMPLATE_LEN];
+		char types[64];
+		char length[64];
+		char memory[64];
+
+		spySchemaTemplateText(s, t, text, sizeof(text));
+		spySchemaFormatTypes(t, types, sizeof(types));
+		spySchemaFormatPercentiles(t->length, 0, length, sizeof(length));
+		spySchemaFormatPercentiles(t->memory, 1, memory, sizeof(memory));
+
+		printf("%-48s  %10lld  %-24s  %-20s  %s\n", text, t->keys, types, length, memory);
+	}
+
+	spyStatsFormatBytes((long long)spySchemaMemory(s), schemaMemory, sizeof(schemaMemory));
+
+	printf("\n%lld keys in %u templates (%s)\n", keys, count, schemaMemory);
+}
+
+
+// SCAN may return a key more than once; the report counts it each time.
+// Returns 0, or -1 if the server could not be reached.
+int spyExportSchemaRun(REDIS* redis)
+{
+	SPY_SCHEMA* s = spySchemaCreate();
+	long long keys = 0;
+	char cursor[32];
+
+	strcpy(cursor, "0");
+
+	do
+	{
+		if (   (redisSpyServerScan(redis, cursor, sizeof(cursor)) != 0)
+			|| (redisSpyServerRefreshRange(redis, 0, redis->keyCount) != 0))
+		{
+			spySchemaDelete(s);
+			return -1;
+		}
+
+		char key[REDISSPY_MAX_KEY_LEN];
+
+		for (unsigned int i = 0; i < redis->keyCount; i++)
+		{
+			const char* type = redisSpyRowType(redis, i);
+
+			// Gone since the SCAN
+			if (strcmp(type, "none") == 0)
+				continue;
+
+			spySchemaUpdate(s, redisSpyKeyAtIndex(redis, i, key), 1, type,
+							redisSpyRowLength(redis, i), redisSpyRowMemory(redis, i));
+			keys++;
+		}
+
+		redisSpyResetRows(redis);
+
+	} while (strcmp(cursor, "0") != 0);
+
+	spyExportSchemaReport(s, keys);
+	fflush(stdout);
+
+	spySchemaDelete(s);
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef _SPYEXPORT_H_
+#define _SPYEXPORT_H_
+
+#include "spymodel.h"
+
+// Full value export (-e). Every element of every matching key is written
+// out, including the values too large for the main view or the detail
+// cache. Replies are consumed as hiredis parses them: each element goes
+// to a callback and is dropped, so no reply tree is built and memory
+// stays flat however large a key is.
+
+typedef struct _spy_export_element
+{
+	int				type;			// REDIS_REPLY_STRING, REDIS_REPLY_ERROR, ...
+	int				depth;			// 0 for the reply itself
+	int				index;			// position in the enclosing array
+	const char*		str;			// not terminated, and only valid in the callback
+	size_t			len;
+	long long		integer;
+} SPY_EXPORT_ELEMENT;
+
+typedef void (*SPY_EXPORT_CALLBACK)(void* context, const SPY_EXPORT_ELEMENT* element);
+
+int spyExportReadReply(redisContext* c, SPY_EXPORT_CALLBACK callback, void* context);
+
+int spyExportRun(REDIS* redis, const char* delimiter);
+
+// Key template report (-P). The keyspace is read a SCAN batch at a time
+// and each batch is dropped once it is counted, so memory stays flat
+// however many keys there are.
+int spyExportSchemaRun(REDIS* redis);
+
+#endif
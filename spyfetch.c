@@ -0,0 +1,497 @@
+// pthread_sigmask and friends are POSIX, not C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include <signal.h>
+
+#include "spyfetch.h"
+#include "spysearch.h"
+
+
+static SPY_FETCH_RESULT* spyFetchResultCreate(int kind, int final)
+{
+	SPY_FETCH_RESULT* result = malloc(sizeof(SPY_FETCH_RESULT));
+
+	result->kind = kind;
+	result->final = final;
+
+	result->infoConnectedClients = 0;
+	result->infoUsedMemoryHuman[0] = '\0';
+
+	result->rows = NULL;
+	result->count = 0;
+
+	result->dbSize = 0;
+	result->progress = 0;
+
+	return result;
+}
+
+
+void spyFetchResultDelete(SPY_FETCH_RESULT* result)
+{
+	free(result->rows);
+	free(result);
+}
+
+
+SPY_FETCH_REQUEST* spyFetchRequestCreate(int kind, unsigned int count)
+{
+	SPY_FETCH_REQUEST* request = malloc(sizeof(SPY_FETCH_REQUEST));
+
+	request->kind = kind;
+	request->sequence = 0;
+
+	request->host[0] = '\0';
+	request->port = 0;
+	request->socketPath[0] = '\0';
+	request->pattern[0] = '\0';
+	request->scanType[0] = '\0';
+	request->search[0] = '\0';
+
+	request->rows = count ? calloc(count, sizeof(REDISDATA)) : NULL;
+	request->count = count;
+
+	return request;
+}
+
+
+void spyFetchRequestDelete(SPY_FETCH_REQUEST* request)
+{
+	free(request->rows);
+	free(request);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// Fetch thread
+//
+
+static void spyFetchPublish(SPY_FETCH* f, SPY_FETCH_RESULT* result)
+{
+	// If the UI has fallen behind, wait for it to drain the ring
+	while (spyQueuePush(f->results, result) != 0)
+	{
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 1000;
+
+		select(0, NULL, NULL, NULL, &tv);
+	}
+}
+
+
+static void spyFetchInfo(SPY_FETCH* f)
+{
+	if (redisSpyServerRefreshInfo(f->redis) != 0)
+	{
+		spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_ERROR, 1));
+		return;
+	}
+
+	SPY_FETCH_RESULT* result = spyFetchResultCreate(SPY_FETCH_RESULT_INFO, 1);
+
+	result->infoConnectedClients = f->redis->infoConnectedClients;
+	strcpy(result->infoUsedMemoryHuman, f->redis->infoUsedMemoryHuman);
+
+	spyFetchPublish(f, result);
+}
+
+
+static int spyFetchIsCancelled(SPY_FETCH* f, SPY_FETCH_REQUEST* request)
+{
+	return request->sequence < SPY_ATOMIC_LOAD(&f->cancelBefore);
+}
+
+
+static void spyFetchRows(SPY_FETCH* f, SPY_FETCH_REQUEST* request, int kind)
+{
+	// A cancelled refresh still answers with an empty result so the
+	// request is accounted for; its rows are simply not applied.
+	if (spyFetchIsCancelled(f, request))
+	{
+		spyFetchPublish(f, spyFetchResultCreate(kind, 1));
+		return;
+	}
+
+	if (redisSpyServerRefreshRows(f->redis, request->rows, request->count) != 0)
+	{
+		spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_ERROR, 1));
+		return;
+	}
+
+	SPY_FETCH_RESULT* result = spyFetchResultCreate(kind, 1);
+
+	if (spyFetchIsCancelled(f, request))
+	{
+		spyFetchPublish(f, result);
+		return;
+	}
+
+	// Hand the rows over to the result
+	result->rows = request->rows;
+	result->count = request->count;
+
+	request->rows = NULL;
+	request->count = 0;
+
+	spyFetchPublish(f, result);
+}
+
+
+// SCAN visits the hash table in reverse-binary cursor order, so the
+// bit-reversed cursor climbs steadily from 0 towards 2^64 as the scan
+// proceeds. Returns the fraction covered in tenths of a percent.
+static unsigned int spyFetchScanProgress(const char* cursor)
+{
+	unsigned long long v = strtoull(cursor, NULL, 10);
+	unsigned long long r = 0;
+
+	for (int i = 0; i < 64; i++)
+	{
+		r = (r << 1) | (v & 1);
+		v >>= 1;
+	}
+
+	return (unsigned int)(((r >> 32) * 1000) >> 32);
+}
+
+
+// Check a SCAN step's keys against the value search, a time slice at a
+// time, keeping the rows that match at the front. Returns 0, 1 if the
+// request was cancelled part way, or -1.
+static int spyFetchSearchStep(SPY_FETCH* f, SPY_FETCH_REQUEST* request,
+							  REDISDATA* rows, unsigned int* count)
+{
+	REDIS* redis = f->redis;
+	SPY_SEARCH search;
+	int r;
+
+	if (spySearchBegin(&search, request->search, rows, *count) != 0)
+		return -1;
+
+	while ((r = spySearchStep(redis, &search)) == 1)
+	{
+		if (spyFetchIsCancelled(f, request))
+			return 1;
+	}
+
+	if (r != 0)
+		return -1;
+
+	*count = spySearchEnd(&search);
+
+	return 0;
+}
+
+
+// Walk the keyspace one SCAN step at a time. The private model only
+// collects each step's key names; they are copied out into a ROWS_NEW
+// batch, read there and merged by the UI into its own model. With a
+// value search, only the keys that match go on to be read and published.
+static void spyFetchKeyspace(SPY_FETCH* f, SPY_FETCH_REQUEST* request)
+{
+	REDIS* redis = f->redis;
+
+	if (spyFetchIsCancelled(f, request))
+	{
+		spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_KEYSPACE_CANCELLED, 1));
+		return;
+	}
+
+	strcpy(redis->pattern, request->pattern);
+	strcpy(redis->scanType, request->scanType);
+
+	if (redisSpyEnsureConnected(redis) != 0)
+	{
+		spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_ERROR, 1));
+		return;
+	}
+
+	SPY_FETCH_RESULT* begin = spyFetchResultCreate(SPY_FETCH_RESULT_KEYSPACE_BEGIN, 0);
+	begin->dbSize = redisSpyServerDbSize(redis);
+
+	spyFetchPublish(f, begin);
+
+	char cursor[32];
+	strcpy(cursor, "0");
+
+	do
+	{
+		if (spyFetchIsCancelled(f, request))
+		{
+			spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_KEYSPACE_CANCELLED, 1));
+			return;
+		}
+
+		redisSpyResetRows(redis);
+
+		if (redisSpyServerScan(redis, cursor, sizeof(cursor)) != 0)
+		{
+			spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_ERROR, 1));
+			return;
+		}
+
+		// Publish even an empty step, so progress keeps moving
+		// when the pattern matches few keys.
+		SPY_FETCH_RESULT* result = spyFetchResultCreate(SPY_FETCH_RESULT_ROWS_NEW, 0);
+
+		result->progress = spyFetchScanProgress(cursor);
+		result->count = redis->keyCount;
+		result->rows = calloc(redis->keyCount + 1, sizeof(REDISDATA));
+
+		for (unsigned int i = 0; i < redis->keyCount; i++)
+			redisSpyKeyAtIndex(redis, i, result->rows[i].key);
+
+		int r = 0;
+
+		if (request->search[0] != '\0')
+			r = spyFetchSearchStep(f, request, result->rows, &result->count);
+
+		if ((r == 0) && (redisSpyServerRefreshRows(redis, result->rows, result->count) != 0))
+			r = -1;
+
+		if (r != 0)
+		{
+			spyFetchResultDelete(result);
+			spyFetchPublish(f, spyFetchResultCreate(
+				r == 1 ? SPY_FETCH_RESULT_KEYSPACE_CANCELLED : SPY_FETCH_RESULT_ERROR, 1));
+			return;
+		}
+
+		if (result->count == 0)
+		{
+			free(result->rows);
+			result->rows = NULL;
+		}
+
+		spyFetchPublish(f, result);
+
+	} while (strcmp(cursor, "0") != 0);
+
+	redisSpyResetRows(redis);
+
+	spyFetchPublish(f, spyFetchResultCreate(SPY_FETCH_RESULT_KEYSPACE_END, 1));
+}
+
+
+static void spyFetchConnect(SPY_FETCH* f, SPY_FETCH_REQUEST* request)
+{
+	int r;
+
+	if (request->socketPath[0] != '\0')
+		r = redisSpyConnectUnix(f->redis, request->socketPath);
+	else
+		r = redisSpyConnect(f->redis, request->host, request->port);
+
+	spyFetchPublish(f, spyFetchResultCreate(
+		r == 0 ? SPY_FETCH_RESULT_CONNECTED : SPY_FETCH_RESULT_ERROR, 1));
+}
+
+
+static void* spyFetchThread(void* arg)
+{
+	SPY_FETCH* f = (SPY_FETCH*)arg;
+
+	// The auto-refresh timer belongs to the UI thread
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	int done = 0;
+
+	while (!done)
+	{
+		SPY_FETCH_REQUEST* request = spyQueuePop(f->requests);
+
+		if (request == NULL)
+		{
+			char buffer[64];
+
+			if (read(f->wakeup[0], buffer, sizeof(buffer)) <= 0)
+				done = 1;
+
+			continue;
+		}
+
+		switch (request->kind)
+		{
+			case SPY_FETCH_REQUEST_QUIT:
+				done = 1;
+				break;
+
+			case SPY_FETCH_REQUEST_CONNECT:
+				spyFetchConnect(f, request);
+				break;
+
+			case SPY_FETCH_REQUEST_INFO:
+				spyFetchInfo(f);
+				break;
+
+			case SPY_FETCH_REQUEST_ROWS:
+				spyFetchRows(f, request, SPY_FETCH_RESULT_ROWS_UPDATED);
+				break;
+
+			case SPY_FETCH_REQUEST_TOUCHED:
+				spyFetchRows(f, request, SPY_FETCH_RESULT_ROWS_TOUCHED);
+				break;
+
+			case SPY_FETCH_REQUEST_KEYSPACE:
+				spyFetchKeyspace(f, request);
+				break;
+
+			default:
+				break;
+		}
+
+		spyFetchRequestDelete(request);
+	}
+
+	SPY_ATOMIC_STORE(&f->finished, 1);
+
+	return NULL;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//
+// UI thread interface
+//
+
+SPY_FETCH* spyFetchCreate(REDIS* redis)
+{
+	SPY_FETCH* f = malloc(sizeof(SPY_FETCH));
+
+	f->redis = redisSpyCreate();
+
+	strcpy(f->redis->host, redis->host);
+	f->redis->port = redis->port;
+	strcpy(f->redis->socketPath, redis->socketPath);
+	strcpy(f->redis->pattern, redis->pattern);
+	f->redis->probeMode = redis->probeMode;
+
+	f->requests = spyQueueCreate(SPY_FETCH_QUEUE_SIZE);
+	f->results = spyQueueCreate(SPY_FETCH_QUEUE_SIZE);
+
+	f->outstanding = 0;
+	f->nextSequence = 1;
+	f->cancelBefore = 0;
+	f->finished = 0;
+
+	if (pipe(f->wakeup) != 0)
+	{
+		spyQueueDelete(f->requests);
+		spyQueueDelete(f->results);
+		redisSpyDelete(f->redis);
+		free(f);
+		return NULL;
+	}
+
+	pthread_create(&f->thread, NULL, spyFetchThread, f);
+
+	return f;
+}
+
+
+static void spyFetchDrainResults(SPY_FETCH* f)
+{
+	SPY_FETCH_RESULT* result;
+
+	while ((result = spyFetchNextResult(f)) != NULL)
+		spyFetchResultDelete(result);
+}
+
+
+void spyFetchDelete(SPY_FETCH* f)
+{
+	spyFetchCancel(f);
+
+	// Keep draining results so the thread never blocks on a full
+	// ring while it works through to the quit request.
+	SPY_FETCH_REQUEST* quit = spyFetchRequestCreate(SPY_FETCH_REQUEST_QUIT, 0);
+
+	while (spyQueuePush(f->requests, quit) != 0)
+		spyFetchDrainResults(f);
+
+	close(f->wakeup[1]);
+
+	while (!SPY_ATOMIC_LOAD(&f->finished))
+	{
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 1000;
+
+		spyFetchDrainResults(f);
+		select(0, NULL, NULL, NULL, &tv);
+	}
+
+	pthread_join(f->thread, NULL);
+
+	spyFetchDrainResults(f);
+
+	close(f->wakeup[0]);
+
+	spyQueueDelete(f->requests);
+	spyQueueDelete(f->results);
+
+	redisSpyDelete(f->redis);
+
+	free(f);
+}
+
+
+// Takes ownership of the request. Returns -1 if the request
+// ring is full and the request was dropped.
+int spyFetchPost(SPY_FETCH* f, SPY_FETCH_REQUEST* request)
+{
+	request->sequence = f->nextSequence++;
+
+	if (spyQueuePush(f->requests, request) != 0)
+	{
+		spyFetchRequestDelete(request);
+		return -1;
+	}
+
+	f->outstanding++;
+
+	ssize_t n = write(f->wakeup[1], "", 1);
+	(void)n;
+
+	return 0;
+}
+
+
+SPY_FETCH_RESULT* spyFetchNextResult(SPY_FETCH* f)
+{
+	SPY_FETCH_RESULT* result = spyQueuePop(f->results);
+
+	if (result && result->final && f->outstanding > 0)
+		f->outstanding--;
+
+	return result;
+}
+
+
+int spyFetchIsBusy(SPY_FETCH* f)
+{
+	return f->outstanding > 0;
+}
+
+
+// Cancel every request posted so far. A keyspace scan in flight stops
+// after its current SCAN step, keeping the batches already published.
+// Row refreshes not yet run are skipped, and one in flight has its
+// rows dropped; both still publish an empty final result.
+void spyFetchCancel(SPY_FETCH* f)
+{
+	SPY_ATOMIC_STORE(&f->cancelBefore, f->nextSequence);
+}
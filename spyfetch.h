@@ -0,0 +1,126 @@
+#ifndef _SPYFETCH_H_
+#define _SPYFETCH_H_
+
+#include <pthread.h>
+
+#include "spymodel.h"
+#include "spyqueue.h"
+
+// The fetch engine owns its own connection and runs all refresh
+// traffic on a background thread. Requests go in on one SPSC ring
+// and result batches come back on another, so the UI thread never
+// waits on the network.
+
+#define SPY_FETCH_QUEUE_SIZE			256
+
+// Requests (UI thread -> fetch thread)
+#define SPY_FETCH_REQUEST_QUIT			0
+#define SPY_FETCH_REQUEST_CONNECT		1
+#define SPY_FETCH_REQUEST_INFO			2
+#define SPY_FETCH_REQUEST_ROWS			3
+#define SPY_FETCH_REQUEST_KEYSPACE		4
+#define SPY_FETCH_REQUEST_TOUCHED		5
+
+// Results (fetch thread -> UI thread)
+#define SPY_FETCH_RESULT_ERROR			0
+#define SPY_FETCH_RESULT_CONNECTED		1
+#define SPY_FETCH_RESULT_INFO			2
+#define SPY_FETCH_RESULT_ROWS_UPDATED	3
+#define SPY_FETCH_RESULT_KEYSPACE_BEGIN	4
+#define SPY_FETCH_RESULT_ROWS_NEW		5
+#define SPY_FETCH_RESULT_KEYSPACE_END	6
+#define SPY_FETCH_RESULT_KEYSPACE_CANCELLED	7
+#define SPY_FETCH_RESULT_ROWS_TOUCHED	8
+
+
+typedef struct _spy_fetch_request
+{
+	int				kind;
+
+	// Assigned by spyFetchPost; used to match cancellations
+	unsigned int	sequence;
+
+	// CONNECT: socketPath, if set, wins over host and port
+	char			host[REDISSPY_MAX_HOST_LEN];
+	unsigned int	port;
+	char			socketPath[REDISSPY_MAX_SOCKET_PATH_LEN];
+
+	// KEYSPACE. With scanType set, SCAN asks for that type only. With
+	// search set, only keys whose values match are kept.
+	char			pattern[REDISSPY_MAX_PATTERN_LEN];
+	char			scanType[REDISSPY_MAX_ENCODING_LEN];
+	char			search[REDISSPY_MAX_PATTERN_LEN];
+
+	// ROWS, TOUCHED: only the keys need to be filled in
+	REDISDATA*		rows;
+	unsigned int	count;
+
+} SPY_FETCH_REQUEST;
+
+
+typedef struct _spy_fetch_result
+{
+	int				kind;
+
+	// Set on the last result for a request
+	int				final;
+
+	// INFO
+	int				infoConnectedClients;
+	char			infoUsedMemoryHuman[32];
+
+	// ROWS_UPDATED, ROWS_NEW, ROWS_TOUCHED
+	REDISDATA*		rows;
+	unsigned int	count;
+
+	// KEYSPACE_BEGIN: DBSIZE when the scan started
+	long long		dbSize;
+
+	// ROWS_NEW: how far the scan has got, in tenths of a percent
+	unsigned int	progress;
+
+} SPY_FETCH_RESULT;
+
+
+typedef struct _spy_fetch
+{
+	pthread_t		thread;
+
+	// Private to the fetch thread
+	REDIS*			redis;
+
+	SPY_QUEUE*		requests;
+	SPY_QUEUE*		results;
+
+	// The fetch thread sleeps on this pipe while it has no requests
+	int				wakeup[2];
+
+	// UI thread only: requests posted but not yet finished
+	unsigned int	outstanding;
+	unsigned int	nextSequence;
+
+	// Requests with a lower sequence number are cancelled.
+	// Written by the UI thread, polled by the fetch thread.
+	unsigned int	cancelBefore;
+
+	// Set by the fetch thread when it exits
+	int				finished;
+
+} SPY_FETCH;
+
+
+SPY_FETCH* spyFetchCreate(REDIS* redis);
+void spyFetchDelete(SPY_FETCH* f);
+
+SPY_FETCH_REQUEST* spyFetchRequestCreate(int kind, unsigned int count);
+void spyFetchRequestDelete(SPY_FETCH_REQUEST* request);
+
+void spyFetchResultDelete(SPY_FETCH_RESULT* result);
+
+int spyFetchPost(SPY_FETCH* f, SPY_FETCH_REQUEST* request);
+SPY_FETCH_RESULT* spyFetchNextResult(SPY_FETCH* f);
+
+int spyFetchIsBusy(SPY_FETCH* f);
+void spyFetchCancel(SPY_FETCH* f);
+
+#endif
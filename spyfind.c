@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spyfind.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPY_FIND_X86	1
+#include <immintrin.h>
+#endif
+
+
+typedef long (*SPY_FIND_FN)(const char* haystack, size_t length, const char* needle, size_t needleLength);
+
+static SPY_FIND_FN g_spyFind;
+static const char* g_spyFindName;
+
+
+static long spyFindScalar(const char* haystack, size_t length, const char* needle, size_t needleLength)
+{
+	const char* p = haystack;
+	const char* end = haystack + length - needleLength + 1;
+
+	while ((p = memchr(p, needle[0], end - p)) != NULL)
+	{
+		if (memcmp(p + 1, needle + 1, needleLength - 1) == 0)
+			return p - haystack;
+
+		p++;
+	}
+
+	return -1;
+}
+
+
+#ifdef SPY_FIND_X86
+
+// Each bit of mask is a position whose first and last bytes both match.
+// Returns the first of them that matches in full, or -1.
+static long spyFindCandidates(const char* haystack, size_t i, unsigned int mask,
+							  const char* needle, size_t needleLength)
+{
+	while (mask)
+	{
+		size_t at = i + __builtin_ctz(mask);
+
+		if (memcmp(haystack + at + 1, needle + 1, needleLength - 2) == 0)
+			return at;
+
+		mask &= mask - 1;
+	}
+
+	return -1;
+}
+
+
+__attribute__((target("sse2")))
+static long spyFindSse2(const char* haystack, size_t length, const char* needle, size_t needleLength)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+	size_t i = 0;
+
+	for (; i + 16 + needleLength - 1 <= length; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(haystack + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1));
+		__m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(eq);
+
+		if (mask)
+		{
+			long at = spyFindCandidates(haystack, i, mask, needle, needleLength);
+			if (at >= 0)
+				return at;
+		}
+	}
+
+	long at = spyFindScalar(haystack + i, length - i, needle, needleLength);
+
+	return (at < 0) ? -1 : (long)i + at;
+}
+
+
+__attribute__((target("avx2")))
+static long spyFindAvx2(const char* haystack, size_t length, const char* needle, size_t needleLength)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+	size_t i = 0;
+
+	for (; i + 32 + needleLength - 1 <= length; i += 32)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(haystack + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(haystack + i + needleLength - 1));
+		__m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq);
+
+		if (mask)
+		{
+			long at = spyFindCandidates(haystack, i, mask, needle, needleLength);
+			if (at >= 0)
+				return at;
+		}
+	}
+
+	long at = spyFindScalar(haystack + i, length - i, needle, needleLength);
+
+	return (at < 0) ? -1 : (long)i + at;
+}
+
+#endif
+
+
+static void spyFindInit(void)
+{
+	g_spyFind = spyFindScalar;
+	g_spyFindName = "scalar";
+
+#ifdef SPY_FIND_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		g_spyFind = spyFindAvx2;
+		g_spyFindName = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		g_spyFind = spyFindSse2;
+		g_spyFindName = "sse2";
+	}
+#endif
+}
+
+
+long spyFindBytes(const char* haystack, size_t length, const char* needle, size_t needleLength)
+{
+	if (needleLength == 0)
+		return 0;
+
+	if (needleLength > length)
+		return -1;
+
+	if (needleLength == 1)
+	{
+		const char* p = memchr(haystack, needle[0], length);
+		return p ? p - haystack : -1;
+	}
+
+	if (g_spyFind == NULL)
+		spyFindInit();
+
+	return g_spyFind(haystack, length, needle, needleLength);
+}
+
+
+const char* spyFindImplementation(void)
+{
+	if (g_spyFind == NULL)
+		spyFindInit();
+
+	return g_spyFindName;
+}
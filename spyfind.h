@@ -0,0 +1,18 @@
+#ifndef _SPYFIND_H_
+#define _SPYFIND_H_
+
+#include <stddef.h>
+
+// Substring search for / in the key list. On x86 the candidate positions
+// are found 16 or 32 bytes at a time by comparing the needle's first and
+// last bytes at once (SSE2, or AVX2 where the CPU has it, picked at run
+// time); only those candidates are compared in full. Elsewhere it falls
+// back to memchr and memcmp.
+
+// Offset of the first occurrence of needle in haystack, or -1
+long spyFindBytes(const char* haystack, size_t length, const char* needle, size_t needleLength);
+
+// "avx2", "sse2" or "scalar"
+const char* spyFindImplementation(void);
+
+#endif
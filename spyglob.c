@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spyglob.h"
+
+
+static void spyGlobSetBit(SPY_GLOB_TOKEN* t, unsigned char c)
+{
+	t->set[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+
+static int spyGlobHasBit(const SPY_GLOB_TOKEN* t, unsigned char c)
+{
+	return (t->set[c >> 3] >> (c & 7)) & 1;
+}
+
+
+// Parse the class starting after '[' into t. Follows redis' stringmatch:
+// ^ negates, a-z is a range either way round, \ escapes and an
+// unterminated class runs to the end of the pattern. Returns the
+// character after the class.
+static const char* spyGlobCompileClass(SPY_GLOB_TOKEN* t, const char* p)
+{
+	int negate = 0;
+
+	memset(t->set, 0, sizeof(t->set));
+
+	if (*p == '^')
+	{
+		negate = 1;
+		p++;
+	}
+
+	while (*p && (*p != ']'))
+	{
+		if ((*p == '\\') && p[1])
+		{
+			p++;
+			spyGlobSetBit(t, (unsigned char)*p++);
+		}
+		else if ((p[1] == '-') && p[2] && (p[2] != ']'))
+		{
+			unsigned char start = (unsigned char)p[0];
+			unsigned char end = (unsigned char)p[2];
+
+			if (start > end)
+			{
+				unsigned char tmp = start;
+				start = end;
+				end = tmp;
+			}
+
+			for (unsigned int c = start; c <= end; c++)
+				spyGlobSetBit(t, (unsigned char)c);
+
+			p += 3;
+		}
+		else
+		{
+			spyGlobSetBit(t, (unsigned char)*p++);
+		}
+	}
+
+	if (negate)
+	{
+		for (unsigned int i = 0; i < sizeof(t->set); i++)
+			t->set[i] = (unsigned char)~t->set[i];
+	}
+
+	return *p ? p + 1 : p;
+}
+
+
+int spyGlobCompile(SPY_GLOB* g, const char* pattern)
+{
+	const char* p = pattern;
+
+	g->count = 0;
+	g->prefixLength = 0;
+
+	while (*p)
+	{
+		if (g->count == SPY_GLOB_MAX_TOKENS)
+			return -1;
+
+		SPY_GLOB_TOKEN* t = &g->tokens[g->count];
+
+		if (*p == '*')
+		{
+			// ** is the same as *
+			if ((g->count == 0) || (g->tokens[g->count - 1].kind != SPY_GLOB_STAR))
+			{
+				t->kind = SPY_GLOB_STAR;
+				g->count++;
+			}
+
+			p++;
+			continue;
+		}
+
+		if (*p == '?')
+		{
+			t->kind = SPY_GLOB_ANY;
+			p++;
+		}
+		else if (*p == '[')
+		{
+			t->kind = SPY_GLOB_CLASS;
+			p = spyGlobCompileClass(t, p + 1);
+		}
+		else
+		{
+			if ((*p == '\\') && p[1])
+				p++;
+
+			t->kind = SPY_GLOB_LITERAL;
+			t->c = (unsigned char)*p++;
+		}
+
+		g->count++;
+	}
+
+	while (   (g->prefixLength < g->count)
+		   && (g->tokens[g->prefixLength].kind == SPY_GLOB_LITERAL))
+	{
+		g->prefix[g->prefixLength] = (char)g->tokens[g->prefixLength].c;
+		g->prefixLength++;
+	}
+
+	return 0;
+}
+
+
+static int spyGlobTokenMatches(const SPY_GLOB_TOKEN* t, unsigned char c)
+{
+	switch (t->kind)
+	{
+		case SPY_GLOB_LITERAL:
+			return t->c == c;
+
+		case SPY_GLOB_ANY:
+			return 1;
+
+		case SPY_GLOB_CLASS:
+			return spyGlobHasBit(t, c);
+
+		default:
+			return 0;
+	}
+}
+
+
+int spyGlobMatch(const SPY_GLOB* g, const char* s)
+{
+	if (   (g->prefixLength > 0)
+		&& (strncmp(s, g->prefix, g->prefixLength) != 0))
+	{
+		return 0;
+	}
+
+	// On a mismatch, let the last * take one more character and retry
+	// from there. Earlier stars never need to give anything back.
+	unsigned int t = g->prefixLength;
+	const char* p = s + g->prefixLength;
+	int star = -1;
+	const char* starFrom = NULL;
+
+	while (*p)
+	{
+		if ((t < g->count) && (g->tokens[t].kind == SPY_GLOB_STAR))
+		{
+			star = t++;
+			starFrom = p;
+		}
+		else if ((t < g->count) && spyGlobTokenMatches(&g->tokens[t], (unsigned char)*p))
+		{
+			t++;
+			p++;
+		}
+		else if (star >= 0)
+		{
+			t = star + 1;
+			p = ++starFrom;
+		}
+		else
+		{
+			return 0;
+		}
+	}
+
+	while ((t < g->count) && (g->tokens[t].kind == SPY_GLOB_STAR))
+		t++;
+
+	return t == g->count;
+}
+
+
+// Does every character b's token can match also match a's?
+static int spyGlobTokenContains(const SPY_GLOB_TOKEN* a, const SPY_GLOB_TOKEN* b)
+{
+	unsigned int i;
+
+	switch (a->kind)
+	{
+		case SPY_GLOB_ANY:
+			return 1;
+
+		case SPY_GLOB_LITERAL:
+			if (b->kind == SPY_GLOB_LITERAL)
+				return a->c == b->c;
+
+			if (b->kind != SPY_GLOB_CLASS)
+				return 0;
+
+			for (i = 0; i < 256; i++)
+			{
+				if (spyGlobHasBit(b, (unsigned char)i) != (i == a->c))
+					return 0;
+			}
+
+			return 1;
+
+		case SPY_GLOB_CLASS:
+			if (b->kind == SPY_GLOB_LITERAL)
+				return spyGlobHasBit(a, b->c);
+
+			for (i = 0; i < sizeof(a->set); i++)
+			{
+				unsigned char bits = (b->kind == SPY_GLOB_ANY) ? 0xff : b->set[i];
+
+				if (bits & ~a->set[i])
+					return 0;
+			}
+
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+
+// a's tokens from i against b's from j. A * in a can swallow any run of
+// b's tokens, stars included; every other token of a has to cover one
+// single-character token of b.
+static int spyGlobContainsFrom(const SPY_GLOB* a, unsigned int i,
+							   const SPY_GLOB* b, unsigned int j,
+							   unsigned char memo[SPY_GLOB_MAX_TOKENS + 1][SPY_GLOB_MAX_TOKENS + 1])
+{
+	if (memo[i][j])
+		return memo[i][j] == 1;
+
+	int result;
+
+	if (i == a->count)
+	{
+		result = (j == b->count);
+	}
+	else if (a->tokens[i].kind == SPY_GLOB_STAR)
+	{
+		result =    spyGlobContainsFrom(a, i + 1, b, j, memo)
+				 || ((j < b->count) && spyGlobContainsFrom(a, i, b, j + 1, memo));
+	}
+	else if ((j == b->count) || (b->tokens[j].kind == SPY_GLOB_STAR))
+	{
+		result = 0;
+	}
+	else
+	{
+		result =    spyGlobTokenContains(&a->tokens[i], &b->tokens[j])
+				 && spyGlobContainsFrom(a, i + 1, b, j + 1, memo);
+	}
+
+	memo[i][j] = result ? 1 : 2;
+
+	return result;
+}
+
+
+int spyGlobContains(const SPY_GLOB* a, const SPY_GLOB* b)
+{
+	unsigned char memo[SPY_GLOB_MAX_TOKENS + 1][SPY_GLOB_MAX_TOKENS + 1];
+
+	memset(memo, 0, sizeof(memo));
+
+	return spyGlobContainsFrom(a, 0, b, 0, memo);
+}
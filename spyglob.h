@@ -0,0 +1,41 @@
+#ifndef _SPYGLOB_H_
+#define _SPYGLOB_H_
+
+// Redis-style glob patterns (*, ?, [abc], [^a-z], \x) compiled once into
+// a token list, for filtering loaded keys locally. The literal prefix is
+// kept aside so most keys are rejected with one memcmp.
+
+#define SPY_GLOB_MAX_TOKENS		64
+
+#define SPY_GLOB_LITERAL		0
+#define SPY_GLOB_ANY			1		// ?
+#define SPY_GLOB_STAR			2		// *
+#define SPY_GLOB_CLASS			3		// [...]
+
+typedef struct _spy_glob_token
+{
+	unsigned char	kind;
+	unsigned char	c;			// LITERAL
+	unsigned char	set[32];	// CLASS: bit per byte value
+} SPY_GLOB_TOKEN;
+
+typedef struct _spy_glob
+{
+	SPY_GLOB_TOKEN	tokens[SPY_GLOB_MAX_TOKENS];
+	unsigned int	count;
+
+	char			prefix[SPY_GLOB_MAX_TOKENS];
+	unsigned int	prefixLength;
+} SPY_GLOB;
+
+
+// Returns -1 if the pattern has too many tokens
+int spyGlobCompile(SPY_GLOB* g, const char* pattern);
+
+int spyGlobMatch(const SPY_GLOB* g, const char* s);
+
+// 1 if every string b matches also matches a, so the keys matching b can
+// be found among those already matching a. 0 means not known to.
+int spyGlobContains(const SPY_GLOB* a, const SPY_GLOB* b);
+
+#endif
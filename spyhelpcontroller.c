@@ -193,6 +193,10 @@ int spyHelpWindowDelegateValueForRow(void* UNUSED(delegate), int row, char* buff
 		snprintf(keybinding, sizeof(keybinding), "^%c",
 				 'a' + key - 1);
 	}
+	else if (key == 27)
+	{
+		strcpy(keybinding, "<esc>");
+	}
 	else if (key == KEY_RESIZE)
 	{
 		strcpy(keybinding, "<resize>");
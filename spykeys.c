@@ -0,0 +1,269 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spykeys.h"
+
+
+SPY_KEYS* spyKeysCreate(void)
+{
+	SPY_KEYS* k = malloc(sizeof(SPY_KEYS));
+
+	memset(k, 0, sizeof(SPY_KEYS));
+
+	return k;
+}
+
+
+void spyKeysClear(SPY_KEYS* k)
+{
+	free(k->data);
+	free(k->blocks);
+
+	memset(k, 0, sizeof(SPY_KEYS));
+}
+
+
+void spyKeysDelete(SPY_KEYS* k)
+{
+	if (k == NULL)
+		return;
+
+	spyKeysClear(k);
+	free(k);
+}
+
+
+static unsigned char* spyKeysReserve(SPY_KEYS* k, size_t length)
+{
+	if (k->length + length > k->capacity)
+	{
+		k->capacity = MAX(2 * k->capacity, k->length + length + 4096);
+		k->data = realloc(k->data, k->capacity);
+	}
+
+	unsigned char* p = k->data + k->length;
+
+	k->length += length;
+
+	return p;
+}
+
+
+unsigned int spyKeysAppend(SPY_KEYS* k, const char* key)
+{
+	unsigned int length = 0;
+
+	while ((length < SPY_KEYS_MAX_KEY_LEN - 1) && (key[length] != '\0'))
+		length++;
+
+	if (   (k->count > 0)
+		&& (length == k->lastLength)
+		&& (memcmp(k->last, key, length) == 0))
+	{
+		return k->count - 1;
+	}
+
+	if (k->count % SPY_KEYS_BLOCK == 0)
+	{
+		if (k->blockCount == k->blockCapacity)
+		{
+			k->blockCapacity = k->blockCapacity ? 2 * k->blockCapacity : 256;
+			k->blocks = realloc(k->blocks, k->blockCapacity * sizeof(unsigned int));
+		}
+
+		k->blocks[k->blockCount++] = k->length;
+
+		unsigned char* p = spyKeysReserve(k, length + 1);
+
+		memcpy(p, key, length);
+		p[length] = '\0';
+	}
+	else
+	{
+		unsigned int shared = 0;
+
+		while ((shared < length) && (shared < k->lastLength) && (k->last[shared] == key[shared]))
+			shared++;
+
+		unsigned char* p = spyKeysReserve(k, 2 + length - shared);
+
+		p[0] = shared;
+		p[1] = length - shared;
+		memcpy(p + 2, key + shared, length - shared);
+	}
+
+	memcpy(k->last, key, length);
+	k->lastLength = length;
+
+	return k->count++;
+}
+
+
+// Decode keys [block head, id] into buffer. Bytes past size - 1 are
+// dropped; a key shares at most what the one before it had, so those
+// left are still right.
+const char* spyKeysGet(const SPY_KEYS* k, unsigned int id, char* buffer, unsigned int size)
+{
+	const unsigned char* p = k->data + k->blocks[id / SPY_KEYS_BLOCK];
+	unsigned int length = strlen((const char*)p);
+	unsigned int limit = size - 1;
+
+	memcpy(buffer, p, MIN(length, limit));
+	p += length + 1;
+
+	for (unsigned int n = id % SPY_KEYS_BLOCK; n > 0; n--)
+	{
+		unsigned int shared = p[0];
+		unsigned int suffix = p[1];
+
+		if (shared < limit)
+			memcpy(buffer + shared, p + 2, MIN(suffix, limit - shared));
+
+		length = shared + suffix;
+		p += 2 + suffix;
+	}
+
+	buffer[MIN(length, limit)] = '\0';
+
+	return buffer;
+}
+
+
+void spyKeysStep(const SPY_KEYS* k, SPY_KEYS_CURSOR* c)
+{
+	unsigned int id = c->id + 1;
+
+	if (id % SPY_KEYS_BLOCK == 0)
+	{
+		const unsigned char* p = k->data + k->blocks[id / SPY_KEYS_BLOCK];
+		unsigned int length = strlen((const char*)p);
+
+		memcpy(c->key, p, length + 1);
+		c->next = p + length + 1;
+	}
+	else
+	{
+		unsigned int shared = c->next[0];
+		unsigned int suffix = c->next[1];
+
+		memcpy(c->key + shared, c->next + 2, suffix);
+		c->key[shared + suffix] = '\0';
+		c->next += 2 + suffix;
+	}
+
+	c->id = id;
+}
+
+
+void spyKeysSeek(const SPY_KEYS* k, SPY_KEYS_CURSOR* c, unsigned int id)
+{
+	unsigned int head = id - id % SPY_KEYS_BLOCK;
+
+	// Step onto the block head from the id before it
+	c->id = head - 1;
+	spyKeysStep(k, c);
+
+	while (c->id < id)
+		spyKeysStep(k, c);
+}
+
+
+void spyKeysTrim(SPY_KEYS* k)
+{
+	if (k->count == 0)
+		return;
+
+	k->data = realloc(k->data, k->length);
+	k->capacity = k->length;
+
+	k->blocks = realloc(k->blocks, k->blockCount * sizeof(unsigned int));
+	k->blockCapacity = k->blockCount;
+}
+
+
+unsigned int spyKeysLowerBound(const SPY_KEYS* k, const char* key)
+{
+	if (k->count == 0)
+		return 0;
+
+	// The last block whose head is not greater than key
+	unsigned int lo = 0;
+	unsigned int hi = k->blockCount;
+
+	while (lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (strcmp((const char*)k->data + k->blocks[mid], key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return 0;
+
+	// Decode along the block until a key is not less than key
+	SPY_KEYS_CURSOR c;
+	unsigned int first = (lo - 1) * SPY_KEYS_BLOCK;
+	unsigned int end = MIN(first + SPY_KEYS_BLOCK, k->count);
+
+	spyKeysSeek(k, &c, first);
+
+	while (strcmp(c.key, key) < 0)
+	{
+		if (c.id + 1 == end)
+			return end;
+
+		spyKeysStep(k, &c);
+	}
+
+	return c.id;
+}
+
+
+void spyKeysPrefixRange(const SPY_KEYS* k, const char* prefix, unsigned int length,
+						unsigned int* first, unsigned int* end)
+{
+	char bound[SPY_KEYS_MAX_KEY_LEN];
+
+	length = MIN(length, SPY_KEYS_MAX_KEY_LEN - 1);
+
+	memcpy(bound, prefix, length);
+	bound[length] = '\0';
+
+	*first = spyKeysLowerBound(k, bound);
+
+	// The keys with the prefix end before the first key greater than
+	// every one of them: the prefix with its last byte incremented,
+	// after dropping any 0xff bytes that can't be
+	while ((length > 0) && ((unsigned char)bound[length - 1] == 0xff))
+		length--;
+
+	if (length == 0)
+	{
+		*end = k->count;
+		return;
+	}
+
+	bound[length - 1] = (char)((unsigned char)bound[length - 1] + 1);
+	bound[length] = '\0';
+
+	*end = spyKeysLowerBound(k, bound);
+}
+
+
+unsigned int spyKeysCount(const SPY_KEYS* k)
+{
+	return k->count;
+}
+
+
+size_t spyKeysMemory(const SPY_KEYS* k)
+{
+	return   sizeof(SPY_KEYS)
+		   + k->capacity
+		   + k->blockCapacity * sizeof(unsigned int);
+}
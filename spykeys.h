@@ -0,0 +1,78 @@
+#ifndef _SPYKEYS_H_
+#define _SPYKEYS_H_
+
+#include <stddef.h>
+
+// Front-coded store of sorted key names. Keys are appended in order and
+// numbered from 0, so comparing ids compares keys. They are grouped in
+// blocks of SPY_KEYS_BLOCK: the first key of a block is stored whole,
+// and each of the others as the length of the prefix it shares with
+// the key before it and the rest of its bytes. Keys that share long
+// prefixes (user:1234:session:...) take a few bytes each.
+//
+// Reading a key decodes at most one block. Lookups binary search the
+// whole keys at the block heads, then decode one block.
+
+#define SPY_KEYS_BLOCK			16
+
+// Longer keys are cut
+#define SPY_KEYS_MAX_KEY_LEN	256
+
+typedef struct _spy_keys
+{
+	// Per block: the head key and its NUL, then for each other key a
+	// shared-prefix length byte, a suffix length byte and the suffix
+	unsigned char*	data;
+	size_t			length;
+	size_t			capacity;
+
+	unsigned int*	blocks;		// offset of each block in data
+	unsigned int	blockCount;
+	unsigned int	blockCapacity;
+
+	unsigned int	count;
+
+	// The last key appended, to front-code the next against
+	char			last[SPY_KEYS_MAX_KEY_LEN];
+	unsigned int	lastLength;
+} SPY_KEYS;
+
+// Reads keys in id order, decoding each entry once
+typedef struct _spy_keys_cursor
+{
+	unsigned int			id;
+	char					key[SPY_KEYS_MAX_KEY_LEN];
+	const unsigned char*	next;	// the entry after id
+} SPY_KEYS_CURSOR;
+
+
+SPY_KEYS* spyKeysCreate(void);
+void spyKeysDelete(SPY_KEYS* k);
+void spyKeysClear(SPY_KEYS* k);
+
+// Append a key no less than the last one and return its id. A key equal
+// to the last one gets the same id.
+unsigned int spyKeysAppend(SPY_KEYS* k, const char* key);
+
+// Key id into buffer, cut to size - 1 bytes. Returns buffer.
+const char* spyKeysGet(const SPY_KEYS* k, unsigned int id, char* buffer, unsigned int size);
+
+// Put the cursor on key id, or step it on to the next one. There must
+// be one.
+void spyKeysSeek(const SPY_KEYS* k, SPY_KEYS_CURSOR* c, unsigned int id);
+void spyKeysStep(const SPY_KEYS* k, SPY_KEYS_CURSOR* c);
+
+// Give back the room kept for more keys
+void spyKeysTrim(SPY_KEYS* k);
+
+// The first id whose key is not less than key, or the count if none
+unsigned int spyKeysLowerBound(const SPY_KEYS* k, const char* key);
+
+// Ids [*first, *end) of the keys starting with the length bytes of prefix
+void spyKeysPrefixRange(const SPY_KEYS* k, const char* prefix, unsigned int length,
+						unsigned int* first, unsigned int* end);
+
+unsigned int spyKeysCount(const SPY_KEYS* k);
+size_t spyKeysMemory(const SPY_KEYS* k);
+
+#endif
@@ -10,26 +10,116 @@
 #include "hiredis.h"
 
 #include "spymodel.h"
+#include "spyfind.h"
 
-REDIS* redisSpyCreate()
+static void redisSpyInitRows(REDIS* r)
 {
-	REDIS* r = malloc(sizeof(REDIS));
+	r->keyStore = spyKeysCreate();
+	r->keyStoreRows = 0;
+	r->keyTail = NULL;
+	r->keyTailLength = 0;
+	r->keyTailCapacity = 0;
+	r->keyRefs = NULL;
+	r->types = NULL;
+	r->lengths = NULL;
+	r->ttls = NULL;
+	r->memory = NULL;
+	r->encodings = NULL;
+	r->values = NULL;
+	r->matches = NULL;
+	r->generations = NULL;
+	r->valueUsed = NULL;
+	r->valueStates = NULL;
+	r->valueBytes = 0;
+
+	// Rows start at 0, a pass before the first one
+	r->memoryBudget = 0;
+	r->valueBudget = 0;
+	r->detailBudget = 0;
+	r->valueClock = 1;
+	r->valueHits = 0;
+	r->valueMisses = 0;
+	r->valueEvictions = 0;
 
-	r->data = NULL;
 	r->keyCount = 0;
+	r->keyCapacity = 0;
 	r->longestKeyLength = 0;
 
+	r->sortedRows = 0;
+	r->sortDirty = 0;
+	r->sortAfter = 0;
+}
+
+
+REDIS* redisSpyCreate()
+{
+	REDIS* r = malloc(sizeof(REDIS));
+
+	redisSpyInitRows(r);
+
+	memset(&r->typeNames, 0, sizeof(r->typeNames));
+	strcpy(r->typeNames.names[REDISSPY_TYPE_NONE], "none");
+	r->typeNames.count = 2;
+
+	memset(&r->encodingNames, 0, sizeof(r->encodingNames));
+	r->encodingNames.count = 1;
+
+	memset(r->typeCounts, 0, sizeof(r->typeCounts));
+
+	r->keyIndex = NULL;
+	r->keyIndexSize = 0;
+	r->keyIndexValid = 0;
+
+	r->typeFilter[0] = '\0';
+	r->scanType[0] = '\0';
+	r->scanTypeUnsupported = 0;
+
+	r->filter[0] = '\0';
+	r->query = NULL;
+	r->view = NULL;
+	r->viewIndex = NULL;
+	r->viewCount = 0;
+	r->viewCapacity = 0;
+	r->viewValid = 0;
+	r->viewDropped = 0;
+
+	r->trigrams = NULL;
+
+	r->tree = NULL;
+	strcpy(r->treeDelimiter, ":");
+
+	r->schema = NULL;
+
+	r->generation = 0;
+
+	r->keyPattern[0] = '\0';
 	r->pattern[0] = '\0';
 	r->infoConnectedClients = 0;
 	r->infoUsedMemoryHuman[0] = '\0';
 
+	r->scanInProgress = 0;
+	r->scanProgress = 0;
+	r->scanDbSize = 0;
+
 	r->sortBy = 0;
 	r->sortReverse = 0;
 
-	r->refreshInterval = r->refreshInterval;
+	r->refreshInterval = 0;
 
 	r->host[0] = '\0';
 	r->port = 0;
+	r->socketPath[0] = '\0';
+	r->context = NULL;
+
+	r->connectFailures = 0;
+	r->connectRetryAt = 0;
+
+	r->probeMode = REDISSPY_PROBE_PIPELINE;
+	r->probeSha[0] = '\0';
+	r->scriptingDisabled = 0;
+
+	r->search[0] = '\0';
+	r->searchSha[0] = '\0';
 
 	return r;
 }
@@ -37,6 +127,16 @@ REDIS* redisSpyCreate()
 
 void redisSpyDelete(REDIS* r)
 {
+	redisSpyServerClearCache(r);
+
+	spyTrigramDelete(r->trigrams);
+	spyTreeDelete(r->tree);
+	spySchemaDelete(r->schema);
+	spyQueryDelete(r->query);
+
+	if (r->context)
+		redisFree(r->context);
+
 	free(r);
 }
 
@@ -53,368 +153,2713 @@ unsigned int redisSpyLongestKeyLength(REDIS* r)
 	return r->longestKeyLength;
 }
 
-char* redisSpyKeyAtIndex(REDIS* r, unsigned int index)
+// Rows are not range checked past this point; row numbers come from
+// the view or the key index.
+
+// Keys in the tail are returned where they are; keys in the store are
+// decoded into buffer, which holds REDISSPY_MAX_KEY_LEN
+static const char* redisSpyRowKey(REDIS* r, unsigned int row, char* buffer)
+{
+	unsigned int ref = r->keyRefs[row];
+
+	if (ref & REDISSPY_KEY_TAIL)
+		return r->keyTail + (ref & ~REDISSPY_KEY_TAIL);
+
+	return spyKeysGet(r->keyStore, ref, buffer, REDISSPY_MAX_KEY_LEN);
+}
+
+const char* redisSpyKeyAtIndex(REDIS* r, unsigned int index, char* buffer)
 {
 	if (index >= r->keyCount)
 		return NULL;
 
-	return r->data[index].key;
+	unsigned int ref = r->keyRefs[index];
+
+	if (ref & REDISSPY_KEY_TAIL)
+		return strcpy(buffer, r->keyTail + (ref & ~REDISSPY_KEY_TAIL));
+
+	return spyKeysGet(r->keyStore, ref, buffer, REDISSPY_MAX_KEY_LEN);
 }
 
+const char* redisSpyRowType(REDIS* r, unsigned int row)
+{
+	return r->typeNames.names[r->types[row]];
+}
 
-// Redis functions
-int redisSpyConnect(REDIS* r, char* host, unsigned int port)
+int redisSpyRowLength(REDIS* r, unsigned int row)
 {
-	if (   (strncmp(r->host, host, sizeof(r->host)) == 0)
-		&& (r->port == port)
-		&& (r->context != NULL))
+	return r->lengths[row];
+}
+
+long long redisSpyRowTtl(REDIS* r, unsigned int row)
+{
+	return r->ttls[row];
+}
+
+long long redisSpyRowMemory(REDIS* r, unsigned int row)
+{
+	return r->memory[row];
+}
+
+const char* redisSpyRowEncoding(REDIS* r, unsigned int row)
+{
+	return r->encodingNames.names[r->encodings[row]];
+}
+
+const char* redisSpyRowValue(REDIS* r, unsigned int row)
+{
+	return r->values[row] ? r->values[row] : "";
+}
+
+// The preview was dropped to stay under the budget and has not been read
+// again, so the row's value is not known
+int redisSpyRowValueDropped(REDIS* r, unsigned int row)
+{
+	return r->valueStates[row] != REDISSPY_VALUE_LOADED;
+}
+
+unsigned int redisSpyDroppedValueCount(REDIS* r)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < r->keyCount; i++)
+		n += (r->valueStates[i] != REDISSPY_VALUE_LOADED);
+
+	return n;
+}
+
+const char* redisSpyRowMatch(REDIS* r, unsigned int row)
+{
+	return r->matches[row] ? r->matches[row] : "";
+}
+
+
+void redisSpyGetRow(REDIS* r, unsigned int row, REDISDATA* data)
+{
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	snprintf(data->key, sizeof(data->key), "%s", redisSpyRowKey(r, row, key));
+	snprintf(data->type, sizeof(data->type), "%s", redisSpyRowType(r, row));
+	data->length = r->lengths[row];
+	snprintf(data->value, sizeof(data->value), "%s", redisSpyRowValue(r, row));
+	data->ttl = r->ttls[row];
+	snprintf(data->encoding, sizeof(data->encoding), "%s", redisSpyRowEncoding(r, row));
+	data->memory = r->memory[row];
+	snprintf(data->match, sizeof(data->match), "%s", redisSpyRowMatch(r, row));
+	data->generation = r->generations[row];
+}
+
+
+// Bytes per row across the fixed-width columns
+#define REDISSPY_ROW_COLUMN_BYTES \
+	(  sizeof(unsigned int) + sizeof(unsigned char) + sizeof(int) + 2 * sizeof(long long) \
+	 + sizeof(unsigned char) + 2 * sizeof(char*) + 2 * sizeof(unsigned int) + sizeof(unsigned char))
+
+size_t redisSpyKeyMemory(REDIS* r)
+{
+	return   (size_t)r->keyCapacity * sizeof(unsigned int)
+		   + spyKeysMemory(r->keyStore)
+		   + r->keyTailCapacity;
+}
+
+size_t redisSpyRowStoreMemory(REDIS* r)
+{
+	return   (size_t)r->keyCapacity * (REDISSPY_ROW_COLUMN_BYTES - sizeof(unsigned int))
+		   + redisSpyKeyMemory(r)
+		   + r->valueBytes;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Local filter
+//
+// Narrows the loaded rows without asking the server. The filter is a
+// glob compiled once; while it only gets narrower (each keystroke of a
+// longer pattern, say) the current view is filtered rather than every
+// loaded row. A query is run over the columns first, and the filter
+// checked only on the rows it matches.
+
+static int redisSpyViewIsFiltered(REDIS* redis)
+{
+	return (redis->filter[0] != '\0') || (redis->query != NULL);
+}
+
+
+static const char* redisSpyQueryRowKey(void* context, unsigned int row, char* buffer)
+{
+	return redisSpyRowKey((REDIS*)context, row, buffer);
+}
+
+
+static void redisSpyQueryRows(REDIS* redis, SPY_QUERY_ROWS* rows)
+{
+	rows->count = redis->keyCount;
+	rows->key = redisSpyQueryRowKey;
+	rows->keyContext = redis;
+	rows->values = redis->values;
+	rows->types = redis->types;
+	rows->encodings = redis->encodings;
+	rows->lengths = redis->lengths;
+	rows->ttls = redis->ttls;
+	rows->memory = redis->memory;
+
+	rows->typeNameCount = MIN(redis->typeNames.count, SPY_QUERY_MAX_NAMES);
+	for (unsigned int i = 0; i < rows->typeNameCount; i++)
+		rows->typeNames[i] = redis->typeNames.names[i];
+
+	rows->encodingNameCount = MIN(redis->encodingNames.count, SPY_QUERY_MAX_NAMES);
+	for (unsigned int i = 0; i < rows->encodingNameCount; i++)
+		rows->encodingNames[i] = redis->encodingNames.names[i];
+}
+
+
+static void redisSpyRebuildView(REDIS* redis)
+{
+	unsigned char* match = NULL;
+
+	if (redis->viewCapacity < redis->keyCount)
+	{
+		redis->viewCapacity = MAX(redis->keyCount, 256);
+		redis->view = realloc(redis->view, redis->viewCapacity * sizeof(unsigned int));
+		redis->viewIndex = realloc(redis->viewIndex, redis->viewCapacity * sizeof(int));
+	}
+
+	if (redis->query && (redis->keyCount > 0))
+	{
+		SPY_QUERY_ROWS rows;
+
+		redisSpyQueryRows(redis, &rows);
+
+		match = malloc(redis->keyCount);
+		spyQueryEvaluate(redis->query, &rows, match);
+	}
+
+	// A query on values can't say whether a row that lost its preview
+	// matches; leave it out and count it
+	redis->viewDropped = 0;
+
+	if (match && spyQueryReadsValues(redis->query))
+	{
+		for (unsigned int i = 0; i < redis->keyCount; i++)
+		{
+			if (redis->valueStates[i] != REDISSPY_VALUE_LOADED)
+			{
+				match[i] = 0;
+				redis->viewDropped++;
+			}
+		}
+	}
+
+	// Keys in the store that can match the filter are a range of ids:
+	// those starting with its literal prefix. user:* needs nothing more;
+	// otherwise the keys in the range are matched once each, in id
+	// order, which decodes each of them once.
+	const SPY_GLOB* glob = &redis->filterGlob;
+	unsigned int first = 0;
+	unsigned int end = 0;
+	unsigned char* idMatch = NULL;
+
+	if (redis->filter[0] != '\0')
+	{
+		int prefixOnly =    (glob->prefixLength + 1 == glob->count)
+						 && (glob->tokens[glob->prefixLength].kind == SPY_GLOB_STAR);
+
+		spyKeysPrefixRange(redis->keyStore, glob->prefix, glob->prefixLength, &first, &end);
+
+		if (!prefixOnly && (first < end))
+		{
+			SPY_KEYS_CURSOR cursor;
+
+			idMatch = malloc(end - first);
+			spyKeysSeek(redis->keyStore, &cursor, first);
+
+			for (unsigned int id = first; id < end; id++)
+			{
+				if (id > first)
+					spyKeysStep(redis->keyStore, &cursor);
+
+				idMatch[id - first] = spyGlobMatch(glob, cursor.key);
+			}
+		}
+	}
+
+	redis->viewCount = 0;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
 	{
-		// Have a connection. Make sure it is still alive.
-		redisReply* reply = redisCommand(r->context, "PING");
+		redis->viewIndex[i] = -1;
+
+		if (match && !match[i])
+			continue;
 
-		if (   reply
-			&& reply->type == REDIS_REPLY_STATUS
-			&& (strcasecmp(reply->str, "pong") == 0))
+		if (redis->filter[0] != '\0')
 		{
-			// Good to go with cached connection
-			freeReplyObject(reply);
-			return 0;
+			unsigned int ref = redis->keyRefs[i];
+
+			if (ref & REDISSPY_KEY_TAIL)
+			{
+				if (!spyGlobMatch(glob, redis->keyTail + (ref & ~REDISSPY_KEY_TAIL)))
+					continue;
+			}
+			else if ((ref < first) || (ref >= end) || (idMatch && !idMatch[ref - first]))
+			{
+				redis->viewIndex[i] = -1;
+				continue;
+			}
 		}
 
-		if (reply)
-			freeReplyObject(reply);
+		redis->viewIndex[i] = redis->viewCount;
+		redis->view[redis->viewCount++] = i;
 	}
 
-	// Create a new connection
-	redisContext* context = redisConnect(host, port);
+	free(idMatch);
+	free(match);
 
-	strncpy(r->host, host, sizeof(r->host));
-	r->port = port;
+	redis->viewValid = 1;
+}
 
-	if (context->err)
+
+// An empty filter shows every loaded row. Returns -1 if the pattern is
+// too long to compile.
+int redisSpySetFilter(REDIS* redis, const char* filter)
+{
+	SPY_GLOB glob;
+
+	if ((filter == NULL) || (filter[0] == '\0'))
 	{
-		r->context = NULL;
-		redisFree(context);
+		redis->filter[0] = '\0';
+		redis->viewValid = 0;
+		return 0;
+	}
+
+	if (spyGlobCompile(&glob, filter) != 0)
 		return -1;
+
+	int narrower =    redis->viewValid
+				   && (redis->filter[0] != '\0')
+				   && spyGlobContains(&redis->filterGlob, &glob);
+
+	snprintf(redis->filter, sizeof(redis->filter), "%s", filter);
+	redis->filterGlob = glob;
+
+	if (!narrower)
+	{
+		redisSpyRebuildView(redis);
+		return 0;
+	}
+
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < redis->viewCount; i++)
+	{
+		unsigned int row = redis->view[i];
+		char key[REDISSPY_MAX_KEY_LEN];
+
+		redis->viewIndex[row] = -1;
+
+		if (spyGlobMatch(&glob, redisSpyRowKey(redis, row, key)))
+		{
+			redis->viewIndex[row] = n;
+			redis->view[n++] = row;
+		}
+	}
+
+	redis->viewCount = n;
+
+	return 0;
+}
+
+
+// Whether every key the filter matches is among the loaded rows: the
+// scan pattern covers it and the scan has finished.
+int redisSpyFilterIsLoaded(REDIS* redis, const char* filter)
+{
+	SPY_GLOB pattern;
+	SPY_GLOB glob;
+
+	if (redis->scanInProgress)
+		return 0;
+
+	if ((spyGlobCompile(&pattern, redis->pattern) != 0) || (spyGlobCompile(&glob, filter) != 0))
+		return 0;
+
+	return spyGlobContains(&pattern, &glob);
+}
+
+
+// Show only the rows the query matches, or every row for NULL. The model
+// takes the query over.
+void redisSpySetQuery(REDIS* redis, SPY_QUERY* query)
+{
+	spyQueryDelete(redis->query);
+
+	redis->query = query;
+	redis->viewValid = 0;
+}
+
+
+unsigned int redisSpyViewCount(REDIS* redis)
+{
+	if (!redisSpyViewIsFiltered(redis))
+		return redis->keyCount;
+
+	if (!redis->viewValid)
+		redisSpyRebuildView(redis);
+
+	return redis->viewCount;
+}
+
+
+int redisSpyViewRow(REDIS* redis, unsigned int index)
+{
+	if (!redisSpyViewIsFiltered(redis))
+		return (index < redis->keyCount) ? (int)index : -1;
+
+	if (!redis->viewValid)
+		redisSpyRebuildView(redis);
+
+	return (index < redis->viewCount) ? (int)redis->view[index] : -1;
+}
+
+
+// Where the row is shown, or -1 if the filter hides it
+int redisSpyViewIndexOfRow(REDIS* redis, unsigned int row)
+{
+	if (!redisSpyViewIsFiltered(redis))
+		return (row < redis->keyCount) ? (int)row : -1;
+
+	if (!redis->viewValid)
+		redisSpyRebuildView(redis);
+
+	return (row < redis->keyCount) ? redis->viewIndex[row] : -1;
+}
+
+
+// Keys in the store are searched once each, in id order, so each block
+// is decoded once instead of once per row. Keys still in the tail and
+// previews are searched per row.
+void redisSpyFindText(REDIS* redis, const char* text, unsigned char* found)
+{
+	size_t length = strlen(text);
+	unsigned int ids = spyKeysCount(redis->keyStore);
+	unsigned char* idHas = malloc(ids + 1);
+
+	if (ids > 0)
+	{
+		SPY_KEYS_CURSOR cursor;
+
+		spyKeysSeek(redis->keyStore, &cursor, 0);
+
+		for (unsigned int id = 0; id < ids; id++)
+		{
+			if (id > 0)
+				spyKeysStep(redis->keyStore, &cursor);
+
+			idHas[id] = (spyFindBytes(cursor.key, strlen(cursor.key), text, length) >= 0);
+		}
+	}
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		unsigned int ref = redis->keyRefs[i];
+		int has;
+
+		if (ref & REDISSPY_KEY_TAIL)
+		{
+			const char* key = redis->keyTail + (ref & ~REDISSPY_KEY_TAIL);
+			has = (spyFindBytes(key, strlen(key), text, length) >= 0);
+		}
+		else
+		{
+			has = idHas[ref];
+		}
+
+		if (has)
+		{
+			found[i] = REDISSPY_FIND_HIT;
+		}
+		else if (redis->valueStates[i] != REDISSPY_VALUE_LOADED)
+		{
+			found[i] = REDISSPY_FIND_DROPPED;
+		}
+		else
+		{
+			const char* value = redisSpyRowValue(redis, i);
+			found[i] = (spyFindBytes(value, strlen(value), text, length) >= 0)
+					   ? REDISSPY_FIND_HIT : REDISSPY_FIND_MISS;
+		}
+	}
+
+	free(idHas);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Key name index
+//
+// Keys go into the trigram index as they are appended. Removed keys
+// stay in it until it holds twice as many names as there are rows, at
+// which point it starts over from the current rows.
+
+void redisSpyEnableKeyIndex(REDIS* redis)
+{
+	if (redis->trigrams)
+		return;
+
+	redis->trigrams = spyTrigramCreate();
+
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+		spyTrigramAdd(redis->trigrams, redisSpyRowKey(redis, i, key));
+}
+
+
+// Post pending keys for up to budgetMs. Returns 1 if some are left.
+int redisSpyIndexKeys(REDIS* redis, unsigned int budgetMs)
+{
+	SPY_TRIGRAM* t = redis->trigrams;
+
+	if (t == NULL)
+		return 0;
+
+	if (spyTrigramCount(t) > 2 * redis->keyCount + 1024)
+	{
+		char key[REDISSPY_MAX_KEY_LEN];
+
+		spyTrigramClear(t);
+
+		for (unsigned int i = 0; i < redis->keyCount; i++)
+			spyTrigramAdd(t, redisSpyRowKey(redis, i, key));
+	}
+
+	return spyTrigramIndexStep(t, budgetMs);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Type counts, namespace tree and key templates
+
+// Add a row to the type counts, tree and templates (sign 1) or take it
+// away (-1). Deleted rows are not counted.
+static void redisSpyAggregateRow(REDIS* redis, unsigned int row, int sign)
+{
+	if (redis->types[row] == REDISSPY_TYPE_NONE)
+		return;
+
+	redis->typeCounts[redis->types[row]] += sign;
+
+	if ((redis->tree == NULL) && (redis->schema == NULL))
+		return;
+
+	char buffer[REDISSPY_MAX_KEY_LEN];
+	const char* key = redisSpyRowKey(redis, row, buffer);
+
+	if (redis->tree)
+		spyTreeUpdate(redis->tree, key, sign, redis->lengths[row], redis->memory[row]);
+
+	if (redis->schema)
+	{
+		spySchemaUpdate(redis->schema, key, sign, redisSpyRowType(redis, row),
+						redis->lengths[row], redis->memory[row]);
+	}
+}
+
+
+void redisSpyEnableTree(REDIS* redis)
+{
+	if (redis->tree)
+		return;
+
+	redis->tree = spyTreeCreate(redis->treeDelimiter);
+
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		if (redis->types[i] != REDISSPY_TYPE_NONE)
+			spyTreeUpdate(redis->tree, redisSpyRowKey(redis, i, key), 1, redis->lengths[i], redis->memory[i]);
 	}
+}
+
+
+void redisSpyEnableSchema(REDIS* redis)
+{
+	if (redis->schema)
+		return;
+
+	redis->schema = spySchemaCreate();
+
+	char key[REDISSPY_MAX_KEY_LEN];
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		if (redis->types[i] != REDISSPY_TYPE_NONE)
+		{
+			spySchemaUpdate(redis->schema, redisSpyRowKey(redis, i, key), 1, redisSpyRowType(redis, i),
+							redis->lengths[i], redis->memory[i]);
+		}
+	}
+}
+
+
+void redisSpyFormatTypeCounts(REDIS* redis, char* buffer, unsigned int size)
+{
+	int len = 0;
+
+	buffer[0] = '\0';
+
+	for (unsigned int i = 0; i < redis->typeNames.count; i++)
+	{
+		if ((i == REDISSPY_TYPE_NONE) || (redis->typeCounts[i] == 0) || (len >= (int)size))
+			continue;
+
+		len += snprintf(buffer + len, size - len, "%s%s %u",
+						len ? ", " : "",
+						(i == REDISSPY_TYPE_UNKNOWN) ? "unread" : redis->typeNames.names[i],
+						redis->typeCounts[i]);
+	}
+}
+
+
+// Regroups the loaded rows if the tree is already built
+void redisSpySetTreeDelimiter(REDIS* redis, const char* delimiter)
+{
+	snprintf(redis->treeDelimiter, sizeof(redis->treeDelimiter), "%s", delimiter);
+
+	if (redis->tree == NULL)
+		return;
+
+	int sortBy = redis->tree->sortBy;
+
+	spyTreeDelete(redis->tree);
+	redis->tree = NULL;
+
+	redisSpyEnableTree(redis);
+	spyTreeSort(redis->tree, sortBy);
+}
+
+
+// Connection management
+//
+// A cached connection is trusted until a command on it fails; there is
+// no PING before each use. hiredis leaves a context unusable after an
+// I/O or protocol error, so the failing call drops it and the next one
+// reconnects, subject to backoff.
+static long long redisSpyNowMs(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+static int redisSpyOpenConnection(REDIS* r)
+{
+	struct timeval timeout;
+	timeout.tv_sec = REDISSPY_CONNECT_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (REDISSPY_CONNECT_TIMEOUT_MS % 1000) * 1000;
+
+	redisContext* context;
+
+	if (r->socketPath[0] != '\0')
+		context = redisConnectUnixWithTimeout(r->socketPath, timeout);
+	else
+		context = redisConnectWithTimeout(r->host, r->port, timeout);
+
+	if ((context == NULL) || context->err)
+	{
+		if (context)
+			redisFree(context);
+
+		// Back off 250ms, 500ms, 1s, ... up to the maximum
+		unsigned int delay = REDISSPY_RECONNECT_MIN_MS << MIN(r->connectFailures, 5);
+
+		r->connectFailures++;
+		r->connectRetryAt = redisSpyNowMs() + MIN(delay, REDISSPY_RECONNECT_MAX_MS);
+
+		return -1;
+	}
+
+	timeout.tv_sec = REDISSPY_COMMAND_TIMEOUT_MS / 1000;
+	timeout.tv_usec = (REDISSPY_COMMAND_TIMEOUT_MS % 1000) * 1000;
+
+	redisSetTimeout(context, timeout);
+
+	// Keepalive is a TCP option
+	if (r->socketPath[0] == '\0')
+		redisEnableKeepAlive(context);
+
+	r->context = context;
+	r->connectFailures = 0;
+	r->connectRetryAt = 0;
+
+	// The script cache is per server and may have been flushed
+	r->probeSha[0] = '\0';
+	r->scriptingDisabled = 0;
+	r->searchSha[0] = '\0';
+
+	return 0;
+}
+
+
+static void redisSpyDropConnection(REDIS* r)
+{
+	if (r->context)
+	{
+		redisFree(r->context);
+		r->context = NULL;
+	}
+}
+
+
+// Call after a command: drops the connection if it failed at the I/O level
+void redisSpyCheckConnection(REDIS* r)
+{
+	if ((r->context != NULL) && r->context->err)
+		redisSpyDropConnection(r);
+}
+
+
+// Connect to host:port now, reusing the current connection if it is
+// already to that server.
+int redisSpyConnect(REDIS* r, char* host, unsigned int port)
+{
+	if (   (strncmp(r->host, host, sizeof(r->host)) == 0)
+		&& (r->port == port)
+		&& (r->socketPath[0] == '\0')
+		&& (r->context != NULL))
+	{
+		return 0;
+	}
+
+	redisSpyDropConnection(r);
+
+	if (host != r->host)
+	{
+		strncpy(r->host, host, sizeof(r->host) - 1);
+		r->host[sizeof(r->host) - 1] = '\0';
+	}
+
+	r->port = port;
+	r->socketPath[0] = '\0';
+
+	// An explicit connect doesn't wait out the backoff
+	r->connectFailures = 0;
+
+	return redisSpyOpenConnection(r);
+}
+
+
+// Same for a server on this machine listening on a Unix domain socket,
+// which saves the TCP loopback overhead on every round trip.
+int redisSpyConnectUnix(REDIS* r, char* path)
+{
+	if (   (strncmp(r->socketPath, path, sizeof(r->socketPath)) == 0)
+		&& (r->context != NULL))
+	{
+		return 0;
+	}
+
+	redisSpyDropConnection(r);
+
+	if (path != r->socketPath)
+	{
+		strncpy(r->socketPath, path, sizeof(r->socketPath) - 1);
+		r->socketPath[sizeof(r->socketPath) - 1] = '\0';
+	}
+
+	r->connectFailures = 0;
+
+	return redisSpyOpenConnection(r);
+}
+
+
+// host:port, or the socket path
+void redisSpyServerAddress(REDIS* r, char* buffer, unsigned int size)
+{
+	if (r->socketPath[0] != '\0')
+		snprintf(buffer, size, "%s", r->socketPath);
+	else
+		snprintf(buffer, size, "%s:%d", r->host, r->port);
+}
+
+
+// The lazy path used before every command. Costs nothing while the
+// connection is up.
+int redisSpyEnsureConnected(REDIS* r)
+{
+	if (r->context != NULL)
+		return 0;
+
+	if (redisSpyNowMs() < r->connectRetryAt)
+		return -1;
+
+	return redisSpyOpenConnection(r);
+}
+
+
+int redisSpyServerClearCache(REDIS* redis)
+{
+	if (redis == NULL)
+		return -1;
+
+	free(redis->keyIndex);
+	redis->keyIndex = NULL;
+	redis->keyIndexSize = 0;
+	redis->keyIndexValid = 0;
+
+	free(redis->view);
+	redis->view = NULL;
+	free(redis->viewIndex);
+	redis->viewIndex = NULL;
+	redis->viewCount = 0;
+	redis->viewCapacity = 0;
+	redis->viewValid = 0;
+
+	redisSpyResetRows(redis);
+
+	spyKeysDelete(redis->keyStore);
+	free(redis->keyTail);
+	free(redis->keyRefs);
+	free(redis->types);
+	free(redis->lengths);
+	free(redis->ttls);
+	free(redis->memory);
+	free(redis->encodings);
+	free(redis->values);
+	free(redis->valueUsed);
+	free(redis->valueStates);
+	free(redis->matches);
+	free(redis->generations);
+
+	redisSpyInitRows(redis);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Row reader
+//
+// Refresh replies are parsed with our own redisReplyObjectFunctions.
+// Rather than hiredis building a redisReply tree that is then copied
+// into the row, each element is written straight into the REDISDATA
+// being refreshed as it is parsed. Nothing is allocated per element.
+//
+// The preview reply is LRANGE/ZRANGE (flat array of members), SSCAN/
+// HSCAN ([cursor, [members]]), GETRANGE (one string) or XINFO STREAM
+// (name, value pairs, where first-entry and last-entry are [id, fields]).
+//
+// The probe script's reply covers a whole batch: one
+// [type, length, pttl, encoding, [preview], memory] array per key.
+
+#define REDISSPY_ROW_READ_TYPE		1
+#define REDISSPY_ROW_READ_LENGTH	2
+#define REDISSPY_ROW_READ_PREVIEW	3
+#define REDISSPY_ROW_READ_TTL		4
+#define REDISSPY_ROW_READ_ENCODING	5
+#define REDISSPY_ROW_READ_PROBE		6
+#define REDISSPY_ROW_READ_MEMORY	7
+
+typedef struct _redis_row_reader
+{
+	REDISDATA*		data;
+	int				target;
+	int				error;
+	char			errorText[64];
+
+	// Probe: the rows of the batch, in KEYS order
+	REDISDATA*		rows;
+	unsigned int	count;
+
+	unsigned int	used;		// bytes of data->value filled
+	unsigned int	members;	// preview members appended so far
+
+	// XINFO STREAM: which entry the current value belongs to
+	char*			entryId;
+	char			firstId[48];
+	char			lastId[48];
+} REDISROWREADER;
+
+
+static int redisSpyRowReaderDepth(const redisReadTask* task)
+{
+	int depth = 0;
+
+	while (task->parent != NULL)
+	{
+		task = task->parent;
+		depth++;
+	}
+
+	return depth;
+}
+
+
+// Bounded append to the row's value, like safestrcat without the strlen
+static void redisSpyRowReaderAppend(REDISROWREADER* reader, const char* str, size_t len)
+{
+	REDISDATA* data = reader->data;
+	size_t room = sizeof(data->value) - 1 - reader->used;
+
+	if (len > room)
+		len = room;
+
+	memcpy(data->value + reader->used, str, len);
+	reader->used += len;
+	data->value[reader->used] = '\0';
+}
+
+
+static void redisSpyRowReaderAddMember(REDISROWREADER* reader, const char* str, size_t len)
+{
+	const char* separator = " ";
+
+	// Hash members alternate field, value
+	if ((strcmp(reader->data->type, "hash") == 0) && (reader->members % 2 == 1))
+		separator = "->";
+
+	if (reader->members > 0)
+		redisSpyRowReaderAppend(reader, separator, strlen(separator));
+
+	redisSpyRowReaderAppend(reader, str, len);
+	reader->members++;
+}
+
+
+static void redisSpyRowReaderAddPreview(REDISROWREADER* reader, const redisReadTask* task,
+										const char* str, size_t len)
+{
+	const char* type = reader->data->type;
+	int depth = redisSpyRowReaderDepth(task);
+
+	if (strcmp(type, "string") == 0)
+	{
+		if (depth == 0)
+			redisSpyRowReaderAppend(reader, str, len);
+	}
+	else if (strcmp(type, "stream") == 0)
+	{
+		if ((depth == 1) && (task->idx % 2 == 0))
+		{
+			// str points into the read buffer and is not terminated
+			if ((len == 11) && (memcmp(str, "first-entry", len) == 0))
+				reader->entryId = reader->firstId;
+			else if ((len == 10) && (memcmp(str, "last-entry", len) == 0))
+				reader->entryId = reader->lastId;
+			else
+				reader->entryId = NULL;
+		}
+		else if ((depth == 2) && (task->idx == 0) && (reader->entryId != NULL))
+		{
+			snprintf(reader->entryId, sizeof(reader->firstId), "%.*s", (int)len, str);
+			reader->entryId = NULL;
+		}
+	}
+	else if ((strcmp(type, "set") == 0) || (strcmp(type, "hash") == 0))
+	{
+		// Members are the second element of the SCAN reply
+		if ((depth == 2) && (task->parent->idx == 1))
+			redisSpyRowReaderAddMember(reader, str, len);
+	}
+	else if (depth == 1)
+	{
+		// list and zset
+		redisSpyRowReaderAddMember(reader, str, len);
+	}
+}
+
+
+static void redisSpyRowReaderBeginProbeRow(REDISROWREADER* reader, unsigned int row)
+{
+	REDISDATA* data = &reader->rows[row];
+
+	data->type[0] = '\0';
+	data->length = 0;
+	data->value[0] = '\0';
+	data->ttl = -1;
+	data->encoding[0] = '\0';
+	data->memory = -1;
+
+	reader->data = data;
+	reader->used = 0;
+	reader->members = 0;
+}
+
+
+// [type, length, pttl, encoding, [preview], memory] at depth 2, preview
+// at 3.
+// The script has already reduced the preview to members, or to a
+// single string for strings and streams.
+static void redisSpyRowReaderAddProbeString(REDISROWREADER* reader, const redisReadTask* task,
+											const char* str, size_t len)
+{
+	REDISDATA* data = reader->data;
+	int depth = redisSpyRowReaderDepth(task);
+
+	if (data == NULL)
+		return;
+
+	if ((depth == 2) && (task->idx == 0))
+		snprintf(data->type, sizeof(data->type), "%.*s", (int)len, str);
+	else if ((depth == 2) && (task->idx == 3))
+		snprintf(data->encoding, sizeof(data->encoding), "%.*s", (int)len, str);
+	else if ((depth == 3) && ((strcmp(data->type, "string") == 0) || (strcmp(data->type, "stream") == 0)))
+		redisSpyRowReaderAppend(reader, str, len);
+	else if (depth == 3)
+		redisSpyRowReaderAddMember(reader, str, len);
+}
+
+
+static void* redisSpyRowReaderCreateString(const redisReadTask* task, char* str, size_t len)
+{
+	REDISROWREADER* reader = task->privdata;
+
+	if (task->type == REDIS_REPLY_ERROR)
+	{
+		reader->error = 1;
+		snprintf(reader->errorText, sizeof(reader->errorText), "%.*s", (int)len, str);
+	}
+	else if (reader->target == REDISSPY_ROW_READ_TYPE)
+	{
+		if (task->parent == NULL)
+			snprintf(reader->data->type, sizeof(reader->data->type), "%.*s", (int)len, str);
+	}
+	else if (reader->target == REDISSPY_ROW_READ_ENCODING)
+	{
+		if (task->parent == NULL)
+			snprintf(reader->data->encoding, sizeof(reader->data->encoding), "%.*s", (int)len, str);
+	}
+	else if (reader->target == REDISSPY_ROW_READ_PREVIEW)
+	{
+		redisSpyRowReaderAddPreview(reader, task, str, len);
+	}
+	else if (reader->target == REDISSPY_ROW_READ_PROBE)
+	{
+		redisSpyRowReaderAddProbeString(reader, task, str, len);
+	}
+
+	// Any non-NULL object will do. NULL means out of memory to hiredis.
+	return reader;
+}
+
+
+static void* redisSpyRowReaderCreateInteger(const redisReadTask* task, long long value)
+{
+	REDISROWREADER* reader = task->privdata;
+
+	if ((reader->target == REDISSPY_ROW_READ_LENGTH) && (task->parent == NULL))
+	{
+		reader->data->length = value;
+	}
+	else if ((reader->target == REDISSPY_ROW_READ_TTL) && (task->parent == NULL))
+	{
+		reader->data->ttl = value;
+	}
+	else if ((reader->target == REDISSPY_ROW_READ_MEMORY) && (task->parent == NULL))
+	{
+		reader->data->memory = value;
+	}
+	else if ((reader->target == REDISSPY_ROW_READ_PROBE) && (reader->data != NULL))
+	{
+		if ((redisSpyRowReaderDepth(task) == 2) && (task->idx == 1))
+			reader->data->length = value;
+		else if ((redisSpyRowReaderDepth(task) == 2) && (task->idx == 2))
+			reader->data->ttl = value;
+		else if ((redisSpyRowReaderDepth(task) == 2) && (task->idx == 5))
+			reader->data->memory = value;
+	}
+
+	return reader;
+}
+
+
+static void* redisSpyRowReaderCreateArray(const redisReadTask* task, int UNUSED(elements))
+{
+	REDISROWREADER* reader = task->privdata;
+
+	// Each key's array starts a new row
+	if (   (reader->target == REDISSPY_ROW_READ_PROBE)
+		&& (redisSpyRowReaderDepth(task) == 1)
+		&& ((unsigned int)task->idx < reader->count))
+	{
+		redisSpyRowReaderBeginProbeRow(reader, task->idx);
+	}
+
+	return reader;
+}
+
+
+static void* redisSpyRowReaderCreateNil(const redisReadTask* task)
+{
+	return task->privdata;
+}
+
+
+static void redisSpyRowReaderFreeObject(void* UNUSED(reply))
+{
+	// Nothing was allocated
+}
+
+
+static redisReplyObjectFunctions g_redisSpyRowReaderFunctions =
+{
+	redisSpyRowReaderCreateString,
+	redisSpyRowReaderCreateArray,
+	redisSpyRowReaderCreateInteger,
+	redisSpyRowReaderCreateNil,
+	redisSpyRowReaderFreeObject
+};
+
+
+// Read the next reply on c into data as target
+static int redisSpyRowReaderRead(REDISROWREADER* reader, redisContext* c, REDISDATA* data, int target)
+{
+	void* reply = NULL;
+
+	reader->data = data;
+	reader->target = target;
+	reader->error = 0;
+	reader->errorText[0] = '\0';
+
+	return redisGetReply(c, &reply);
+}
+
+
+static int redisSpyReadRowType(REDISROWREADER* reader, redisContext* c, REDISDATA* data)
+{
+	data->type[0] = '\0';
+
+	if (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_TYPE) != REDIS_OK)
+		return -1;
+
+	if (reader->error || (data->type[0] == '\0'))
+		strcpy(data->type, "none");
+
+	return 0;
+}
+
+
+// Read the length, preview, PTTL, OBJECT ENCODING and MEMORY USAGE
+// replies
+static int redisSpyReadRowValue(REDISROWREADER* reader, redisContext* c, REDISDATA* data)
+{
+	data->length = 0;
+	data->value[0] = '\0';
+	data->ttl = -1;
+	data->encoding[0] = '\0';
+	data->memory = -1;
+
+	reader->used = 0;
+	reader->members = 0;
+	reader->entryId = NULL;
+	strcpy(reader->firstId, "-");
+	strcpy(reader->lastId, "-");
+
+	if (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_LENGTH) != REDIS_OK)
+		return -1;
+
+	if (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_PREVIEW) != REDIS_OK)
+		return -1;
+
+	if (reader->error)
+	{
+		// e.g. the key changed type in between
+		data->value[0] = '\0';
+	}
+	else if (strcmp(data->type, "stream") == 0)
+	{
+		snprintf(data->value, sizeof(data->value), "first=%s last=%s",
+				 reader->firstId, reader->lastId);
+	}
+
+	// MEMORY USAGE fails before redis 4.0; memory stays unknown
+	if (   (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_TTL) != REDIS_OK)
+		|| (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_ENCODING) != REDIS_OK)
+		|| (redisSpyRowReaderRead(reader, c, data, REDISSPY_ROW_READ_MEMORY) != REDIS_OK))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Queue the length, preview, TTL, encoding and memory commands for a
+// row. Returns the number of replies to read back.
+static int redisSpyAppendValueCommand(redisContext* c, REDISDATA* data)
+{
+	int n = REDISSPY_PREVIEW_ELEMENTS;
+
+	if (strcmp(data->type, "string") == 0)
+	{
+		redisAppendCommand(c, "STRLEN %s", data->key);
+		redisAppendCommand(c, "GETRANGE %s 0 %d", data->key, REDISSPY_MAX_VALUE_LEN - 2);
+	}
+	else if (strcmp(data->type, "list") == 0)
+	{
+		redisAppendCommand(c, "LLEN %s", data->key);
+		redisAppendCommand(c, "LRANGE %s 0 %d", data->key, n - 1);
+	}
+	else if (strcmp(data->type, "hash") == 0)
+	{
+		redisAppendCommand(c, "HLEN %s", data->key);
+		redisAppendCommand(c, "HSCAN %s 0 COUNT %d", data->key, n);
+	}
+	else if (strcmp(data->type, "set") == 0)
+	{
+		redisAppendCommand(c, "SCARD %s", data->key);
+		redisAppendCommand(c, "SSCAN %s 0 COUNT %d", data->key, n);
+	}
+	else if (strcmp(data->type, "zset") == 0)
+	{
+		redisAppendCommand(c, "ZCARD %s", data->key);
+		redisAppendCommand(c, "ZRANGE %s 0 %d", data->key, n - 1);
+	}
+	else if (strcmp(data->type, "stream") == 0)
+	{
+		redisAppendCommand(c, "XLEN %s", data->key);
+		redisAppendCommand(c, "XINFO STREAM %s", data->key);
+	}
+	else
+	{
+		return 0;
+	}
+
+	redisAppendCommand(c, "PTTL %s", data->key);
+	redisAppendCommand(c, "OBJECT ENCODING %s", data->key);
+	redisAppendCommand(c, "MEMORY USAGE %s", data->key);
+
+	return 5;
+}
+
+
+// A batch of rows costs two round trips: TYPE, then length, preview,
+// TTL, encoding and memory, instead of several per key.
+static int redisSpyPipelineBatch(REDIS* redis, REDISROWREADER* reader,
+								 REDISDATA* batch, unsigned int n)
+{
+	redisContext* c = redis->context;
+	int pending[REDISSPY_PIPELINE_BATCH_SIZE];
+
+	for (unsigned int i = 0; i < n; i++)
+		redisAppendCommand(c, "TYPE %s", batch[i].key);
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (redisSpyReadRowType(reader, c, &batch[i]) != 0)
+			return -1;
+	}
+
+	for (unsigned int i = 0; i < n; i++)
+		pending[i] = redisSpyAppendValueCommand(c, &batch[i]);
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int keyLength = strlen(batch[i].key);
+		if (keyLength > redis->longestKeyLength)
+			redis->longestKeyLength = keyLength;
+
+		if (!pending[i])
+		{
+			batch[i].length = 0;
+			batch[i].value[0] = '\0';
+			batch[i].ttl = -1;
+			batch[i].encoding[0] = '\0';
+			batch[i].memory = -1;
+			continue;
+		}
+
+		if (redisSpyReadRowValue(reader, c, &batch[i]) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//
+// Script probe
+//
+// The same per-row reads done server side, one EVALSHA per batch. KEYS
+// are the batch's keys, ARGV the preview element count and string
+// bytes. Each key returns {type, length, pttl, encoding, {preview},
+// memory}, with the preview already reduced to members (or one string
+// for strings and streams). A batch is REDISSPY_PIPELINE_BATCH_SIZE keys
+// of bounded work, so the script never holds the server for long.
+
+static const char* g_redisSpyProbeScript =
+	"local n = tonumber(ARGV[1]) "
+	"local bytes = tonumber(ARGV[2]) "
+	"local out = {} "
+	"for i, key in ipairs(KEYS) do "
+	"  local t = redis.call('TYPE', key)['ok'] "
+	"  local len, preview, enc = 0, {}, '' "
+	"  if t == 'string' then "
+	"    len = redis.call('STRLEN', key) "
+	"    preview = {redis.call('GETRANGE', key, 0, bytes - 1)} "
+	"  elseif t == 'list' then "
+	"    len = redis.call('LLEN', key) "
+	"    preview = redis.call('LRANGE', key, 0, n - 1) "
+	"  elseif t == 'set' then "
+	"    len = redis.call('SCARD', key) "
+	"    preview = redis.call('SSCAN', key, 0, 'COUNT', n)[2] "
+	"  elseif t == 'hash' then "
+	"    len = redis.call('HLEN', key) "
+	"    preview = redis.call('HSCAN', key, 0, 'COUNT', n)[2] "
+	"  elseif t == 'zset' then "
+	"    len = redis.call('ZCARD', key) "
+	"    preview = redis.call('ZRANGE', key, 0, n - 1) "
+	"  elseif t == 'stream' then "
+	"    len = redis.call('XLEN', key) "
+	"    local info = redis.call('XINFO', 'STREAM', key) "
+	"    local first, last = '-', '-' "
+	"    for j = 1, #info, 2 do "
+	"      if info[j] == 'first-entry' and info[j + 1] then first = info[j + 1][1] end "
+	"      if info[j] == 'last-entry' and info[j + 1] then last = info[j + 1][1] end "
+	"    end "
+	"    preview = {'first=' .. first .. ' last=' .. last} "
+	"  end "
+	"  local mem = -1 "
+	"  if t ~= 'none' then "
+	"    enc = redis.call('OBJECT', 'ENCODING', key) "
+	"    mem = redis.pcall('MEMORY', 'USAGE', key) "
+	"    if type(mem) ~= 'number' then mem = -1 end "
+	"  end "
+	"  out[i] = {t, len, redis.call('PTTL', key), enc, preview, mem} "
+	"end "
+	"return out";
+
+
+// SCRIPT LOAD with the default reply functions. A server that refuses
+// (scripting disabled, or the command renamed away) is not asked again
+// on this connection. Returns -1 on connection errors.
+static int redisSpyLoadProbeScript(REDIS* redis)
+{
+	redisReply* reply = redisCommand(redis->context, "SCRIPT LOAD %s", g_redisSpyProbeScript);
+	if (reply == NULL)
+		return -1;
+
+	if ((reply->type == REDIS_REPLY_STRING) && (reply->len < sizeof(redis->probeSha)))
+		snprintf(redis->probeSha, sizeof(redis->probeSha), "%s", reply->str);
+	else
+		redis->scriptingDisabled = 1;
+
+	freeReplyObject(reply);
+
+	return 0;
+}
+
+
+static int redisSpyUseProbeScript(REDIS* redis)
+{
+	return    (redis->probeMode == REDISSPY_PROBE_SCRIPT)
+		   && !redis->scriptingDisabled
+		   && (redis->probeSha[0] != '\0');
+}
+
+
+// Returns 0 if the batch was read, 1 if the script could not run and the
+// batch should be read with pipelined commands instead, -1 on
+// connection errors.
+static int redisSpyProbeBatch(REDIS* redis, REDISROWREADER* reader,
+							  REDISDATA* batch, unsigned int n)
+{
+	const char* argv[REDISSPY_PIPELINE_BATCH_SIZE + 5];
+	size_t argvlen[REDISSPY_PIPELINE_BATCH_SIZE + 5];
+	char keyCount[16];
+	char elements[16];
+	char bytes[16];
+	int argc = 0;
+
+	snprintf(keyCount, sizeof(keyCount), "%u", n);
+	snprintf(elements, sizeof(elements), "%d", REDISSPY_PREVIEW_ELEMENTS);
+	snprintf(bytes, sizeof(bytes), "%d", REDISSPY_MAX_VALUE_LEN - 1);
+
+	argv[argc++] = "EVALSHA";
+	argv[argc++] = redis->probeSha;
+	argv[argc++] = keyCount;
+
+	for (unsigned int i = 0; i < n; i++)
+		argv[argc++] = batch[i].key;
+
+	argv[argc++] = elements;
+	argv[argc++] = bytes;
+
+	for (int i = 0; i < argc; i++)
+		argvlen[i] = strlen(argv[i]);
+
+	redisAppendCommandArgv(redis->context, argc, argv, argvlen);
+
+	// Rows not covered by the reply read as deleted
+	for (unsigned int i = 0; i < n; i++)
+		batch[i].type[0] = '\0';
+
+	reader->rows = batch;
+	reader->count = n;
+	reader->used = 0;
+	reader->members = 0;
+
+	if (redisSpyRowReaderRead(reader, redis->context, NULL, REDISSPY_ROW_READ_PROBE) != REDIS_OK)
+		return -1;
+
+	if (reader->error)
+	{
+		// NOSCRIPT after SCRIPT FLUSH or a failover: reload on the next
+		// refresh. Anything else means the script cannot run here.
+		if (strncmp(reader->errorText, "NOSCRIPT", 8) == 0)
+			redis->probeSha[0] = '\0';
+		else
+			redis->scriptingDisabled = 1;
+
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int keyLength = strlen(batch[i].key);
+		if (keyLength > redis->longestKeyLength)
+			redis->longestKeyLength = keyLength;
+
+		if (batch[i].type[0] == '\0')
+			strcpy(batch[i].type, "none");
+	}
+
+	return 0;
+}
+
+
+// Refresh type and value for an array of rows, in batches of
+// REDISSPY_PIPELINE_BATCH_SIZE keys.
+static int redisSpyRefreshBatches(REDIS* redis, REDISROWREADER* reader,
+								  REDISDATA* rows, unsigned int count)
+{
+	for (unsigned int first = 0; first < count; first += REDISSPY_PIPELINE_BATCH_SIZE)
+	{
+		unsigned int n = MIN(REDISSPY_PIPELINE_BATCH_SIZE, count - first);
+		REDISDATA* batch = &rows[first];
+
+		if (redisSpyUseProbeScript(redis))
+		{
+			int ret = redisSpyProbeBatch(redis, reader, batch, n);
+
+			if (ret < 0)
+				return -1;
+			else if (ret == 0)
+				continue;
+		}
+
+		if (redisSpyPipelineBatch(redis, reader, batch, n) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int redisSpyRefreshRows(REDIS* redis, REDISDATA* rows, unsigned int count)
+{
+	if (   (redis->probeMode == REDISSPY_PROBE_SCRIPT)
+		&& !redis->scriptingDisabled
+		&& (redis->probeSha[0] == '\0'))
+	{
+		if (redisSpyLoadProbeScript(redis) != 0)
+			return -1;
+	}
+
+	redisReader* r = redis->context->reader;
+	redisReplyObjectFunctions* fn = r->fn;
+	void* privdata = r->privdata;
+	REDISROWREADER reader;
+
+	r->fn = &g_redisSpyRowReaderFunctions;
+	r->privdata = &reader;
+
+	int ret = redisSpyRefreshBatches(redis, &reader, rows, count);
+
+	// After a failed read the reader may still hold one of our objects,
+	// so keep our no-op freeObject until the context is dropped.
+	if (ret == 0)
+		r->fn = fn;
+
+	r->privdata = privdata;
+
+	return ret;
+}
+
+
+static void redisSpyStoreRow(REDIS* redis, unsigned int row, const REDISDATA* src);
+
+// Refresh loaded rows, copying them out to a batch of REDISDATA for the
+// reader and back into the columns
+static int redisSpyRefreshStoredRows(REDIS* redis, unsigned int first, unsigned int count)
+{
+	REDISDATA* batch = malloc(REDISSPY_PIPELINE_BATCH_SIZE * sizeof(REDISDATA));
+	int ret = 0;
+
+	for (unsigned int done = 0; (done < count) && (ret == 0); done += REDISSPY_PIPELINE_BATCH_SIZE)
+	{
+		unsigned int n = MIN(REDISSPY_PIPELINE_BATCH_SIZE, count - done);
+
+		for (unsigned int i = 0; i < n; i++)
+		{
+			unsigned int row = first + done + i;
+			char key[REDISSPY_MAX_KEY_LEN];
+
+			snprintf(batch[i].key, sizeof(batch[i].key), "%s", redisSpyRowKey(redis, row, key));
+			snprintf(batch[i].match, sizeof(batch[i].match), "%s", redisSpyRowMatch(redis, row));
+		}
+
+		ret = redisSpyRefreshRows(redis, batch, n);
+
+		if (ret == 0)
+		{
+			for (unsigned int i = 0; i < n; i++)
+				redisSpyStoreRow(redis, first + done + i, &batch[i]);
+		}
+	}
+
+	free(batch);
+
+	return ret;
+}
+
+
+int redisSpyServerRefreshKey(REDIS* redis, REDISDATA* data)
+{
+	int ret = redisSpyEnsureConnected(redis);
+	if (ret)
+	{
+		return -1;
+	}
+
+	ret = redisSpyRefreshRows(redis, data, 1);
+	redisSpyCheckConnection(redis);
+
+	return ret;
+}
+
+
+int redisSpyServerRefreshRows(REDIS* redis, REDISDATA* rows, unsigned int count)
+{
+	int ret = redisSpyEnsureConnected(redis);
+	if (ret)
+	{
+		return -1;
+	}
+
+	ret = redisSpyRefreshRows(redis, rows, count);
+	redisSpyCheckConnection(redis);
+
+	return ret;
+}
+
+
+int redisSpyServerRefreshRange(REDIS* redis, unsigned int first, unsigned int count)
+{
+	if ((first >= redis->keyCount) || (count == 0))
+		return 0;
+
+	count = MIN(count, redis->keyCount - first);
+
+	int ret = redisSpyEnsureConnected(redis);
+	if (ret)
+	{
+		return -1;
+	}
+
+	ret = redisSpyRefreshStoredRows(redis, first, count);
+	redisSpyCheckConnection(redis);
+
+	return ret;
+}
+
+
+static int redisSpyRefreshInfo(REDIS* redis)
+{
+	redisReply* r = redisCommand(redis->context, "INFO");
+	if (r == NULL)
+		return -1;
+
+	redis->infoConnectedClients = 0;
+	redis->infoUsedMemoryHuman[0] = '\0';
+
+	if (r->type == REDIS_REPLY_STRING)
+	{
+		char*	c = strstr(r->str, "connected_clients");
+		char*	m = strstr(r->str, "used_memory_human");
+		char*	t = NULL;
+
+		if (c)
+		{
+			t = strtok(c, ":\r\n");
+			t = strtok(NULL, ":\r\n");
+
+			if (t)
+				redis->infoConnectedClients = atoi(t);
+		}
+
+		if (m)
+		{
+			t = strtok(m, ":\r\n");
+			t = strtok(NULL, ":\r\n");
+
+			if (t)
+				strcpy(redis->infoUsedMemoryHuman, t);
+		}
+	}
+
+	freeReplyObject(r);
+
+	return 0;
+}
+
+
+int redisSpyServerRefreshInfo(REDIS* redis)
+{
+	int ret = redisSpyEnsureConnected(redis);
+	if (ret)
+	{
+		return -1;
+	}
+
+	ret = redisSpyRefreshInfo(redis);
+	redisSpyCheckConnection(redis);
+
+	return ret;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Key index
+//
+static unsigned int redisSpyHashKey(const char* key)
+{
+	// FNV-1a
+	unsigned int h = 2166136261u;
+
+	while (*key)
+	{
+		h ^= (unsigned char)*key++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+static void redisSpyKeyIndexInsert(REDIS* redis, unsigned int row)
+{
+	char key[REDISSPY_MAX_KEY_LEN];
+	unsigned int mask = redis->keyIndexSize - 1;
+	unsigned int slot = redisSpyHashKey(redisSpyRowKey(redis, row, key)) & mask;
+
+	while (redis->keyIndex[slot] != 0)
+		slot = (slot + 1) & mask;
+
+	redis->keyIndex[slot] = row + 1;
+}
+
+
+static void redisSpyRebuildKeyIndex(REDIS* redis)
+{
+	// Keep the load factor at or below one half
+	unsigned int size = 1024;
+	while (size < 2 * redis->keyCount)
+		size <<= 1;
+
+	if (size != redis->keyIndexSize)
+	{
+		free(redis->keyIndex);
+		redis->keyIndex = malloc(size * sizeof(unsigned int));
+		redis->keyIndexSize = size;
+	}
+
+	memset(redis->keyIndex, 0, size * sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+		redisSpyKeyIndexInsert(redis, i);
+
+	redis->keyIndexValid = 1;
+}
+
+
+int redisSpyFindKey(REDIS* redis, const char* key)
+{
+	if (!redis->keyIndexValid)
+		redisSpyRebuildKeyIndex(redis);
+
+	unsigned int mask = redis->keyIndexSize - 1;
+	unsigned int slot = redisSpyHashKey(key) & mask;
+	char buffer[REDISSPY_MAX_KEY_LEN];
+
+	while (redis->keyIndex[slot] != 0)
+	{
+		unsigned int row = redis->keyIndex[slot] - 1;
+
+		if (strcmp(redisSpyRowKey(redis, row, buffer), key) == 0)
+			return row;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Row store
+//
+// Rows are kept as columns (see REDIS). Code that moves whole rows
+// around goes through REDISSPY_FOR_EACH_COLUMN so that no column is
+// missed; everything else reads or writes just the columns it needs.
+
+#define REDISSPY_FOR_EACH_COLUMN(X) \
+	X(unsigned int, keyRefs) \
+	X(unsigned char, types) \
+	X(int, lengths) \
+	X(long long, ttls) \
+	X(long long, memory) \
+	X(unsigned char, encodings) \
+	X(char*, values) \
+	X(unsigned int, valueUsed) \
+	X(unsigned char, valueStates) \
+	X(char*, matches) \
+	X(unsigned int, generations)
+
+
+static void redisSpyGrowRows(REDIS* redis)
+{
+	unsigned int capacity = redis->keyCapacity ? redis->keyCapacity * 2 : 256;
+
+#define REDISSPY_GROW_COLUMN(type, column) \
+	redis->column = realloc(redis->column, capacity * sizeof(type));
+
+	REDISSPY_FOR_EACH_COLUMN(REDISSPY_GROW_COLUMN)
+
+#undef REDISSPY_GROW_COLUMN
+
+	redis->keyCapacity = capacity;
+}
+
+
+// Type and encoding names are few, so rows hold an index into a table
+// of them. A name that doesn't fit in the table reads as "".
+static unsigned char redisSpyInternName(REDISNAMES* names, const char* name)
+{
+	for (unsigned int i = 0; i < names->count; i++)
+	{
+		if (strcmp(names->names[i], name) == 0)
+			return i;
+	}
+
+	if (names->count == REDISSPY_MAX_NAMES)
+		return 0;
+
+	snprintf(names->names[names->count], sizeof(names->names[0]), "%s", name);
+
+	return names->count++;
+}
+
+
+// Replace a value or match string. Empty strings are stored as NULL.
+static void redisSpySetString(REDIS* redis, char** column, const char* s)
+{
+	if (*column)
+	{
+		redis->valueBytes -= strlen(*column) + 1;
+		free(*column);
+		*column = NULL;
+	}
+
+	if (s[0] != '\0')
+	{
+		size_t length = strlen(s) + 1;
+
+		*column = malloc(length);
+		memcpy(*column, s, length);
+		redis->valueBytes += length;
+	}
+}
+
+
+// Add a key to the tail and return its reference
+static unsigned int redisSpyAddTailKey(REDIS* redis, const char* key)
+{
+	size_t length = 0;
+
+	// Names are cut to what a REDISDATA can carry
+	while ((length < REDISSPY_MAX_KEY_LEN - 1) && (key[length] != '\0'))
+		length++;
+
+	if (redis->keyTailLength + length + 1 > redis->keyTailCapacity)
+	{
+		redis->keyTailCapacity = MAX(2 * redis->keyTailCapacity, redis->keyTailLength + length + 65536);
+		redis->keyTail = realloc(redis->keyTail, redis->keyTailCapacity);
+	}
+
+	size_t offset = redis->keyTailLength;
+
+	memcpy(redis->keyTail + offset, key, length);
+	redis->keyTail[offset + length] = '\0';
+
+	redis->keyTailLength += length + 1;
+
+	return REDISSPY_KEY_TAIL | (unsigned int)offset;
+}
+
+
+// Two keys in the store compare as their ids do. Others are compared
+// as strings.
+static int redisSpyCompareRowKeys(REDIS* redis, unsigned int a, unsigned int b)
+{
+	unsigned int x = redis->keyRefs[a];
+	unsigned int y = redis->keyRefs[b];
+
+	if (((x | y) & REDISSPY_KEY_TAIL) == 0)
+		return (x > y) - (x < y);
+
+	char s[REDISSPY_MAX_KEY_LEN];
+	char t[REDISSPY_MAX_KEY_LEN];
+
+	return strcmp(redisSpyRowKey(redis, a, s), redisSpyRowKey(redis, b, t));
+}
+
+
+static DECLARE_COMPARE_FN(compareRowKeys, thunk, a, b)
+{
+	return redisSpyCompareRowKeys((REDIS*)thunk, *(const unsigned int*)a, *(const unsigned int*)b);
+}
+
+
+static void redisSpySortRows(REDIS* redis, unsigned int* rows, unsigned int count, COMPARE_FN compare);
+
+// Merge the rows' keys into a new store and empty the tail. Rows whose
+// keys are in the store are put in id order by a counting sort and read
+// with a cursor; only the tail's keys are sorted as strings. Keys of
+// removed rows are left behind. A row's reference is replaced after its
+// key is read, and no other row's is read from it.
+static void redisSpyRebuildKeyStore(REDIS* redis)
+{
+	SPY_KEYS* old = redis->keyStore;
+	unsigned int n = redis->keyCount;
+	unsigned int ids = spyKeysCount(old);
+	unsigned int* rows = malloc((n + 1) * sizeof(unsigned int));
+	unsigned int* start = calloc(ids + 1, sizeof(unsigned int));
+	unsigned int tail = n;
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int ref = redis->keyRefs[i];
+
+		if (ref & REDISSPY_KEY_TAIL)
+			rows[--tail] = i;
+		else
+			start[ref + 1]++;
+	}
+
+	for (unsigned int id = 0; id < ids; id++)
+		start[id + 1] += start[id];
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int ref = redis->keyRefs[i];
+
+		if (!(ref & REDISSPY_KEY_TAIL))
+			rows[start[ref]++] = i;
+	}
+
+	free(start);
+
+	redisSpySortRows(redis, rows + tail, n - tail, compareRowKeys);
+
+	SPY_KEYS* keys = spyKeysCreate();
+	SPY_KEYS_CURSOR cursor;
+	unsigned int i = 0;
+	unsigned int j = tail;
+
+	if (tail > 0)
+		spyKeysSeek(old, &cursor, redis->keyRefs[rows[0]]);
+
+	while ((i < tail) || (j < n))
+	{
+		const char* key = NULL;
+
+		if (j < n)
+			key = redis->keyTail + (redis->keyRefs[rows[j]] & ~REDISSPY_KEY_TAIL);
+
+		if (i < tail)
+		{
+			unsigned int id = redis->keyRefs[rows[i]];
+
+			// Past the keys of removed rows
+			if (id - cursor.id > SPY_KEYS_BLOCK)
+				spyKeysSeek(old, &cursor, id);
+
+			while (cursor.id < id)
+				spyKeysStep(old, &cursor);
+
+			if ((key == NULL) || (strcmp(cursor.key, key) <= 0))
+			{
+				redis->keyRefs[rows[i++]] = spyKeysAppend(keys, cursor.key);
+				continue;
+			}
+		}
+
+		redis->keyRefs[rows[j++]] = spyKeysAppend(keys, key);
+	}
+
+	free(rows);
+
+	spyKeysTrim(keys);
+	spyKeysDelete(old);
+
+	redis->keyStore = keys;
+	redis->keyStoreRows = n;
+
+	free(redis->keyTail);
+	redis->keyTail = NULL;
+	redis->keyTailLength = 0;
+	redis->keyTailCapacity = 0;
+}
+
+
+// Once keys stop arriving, fold the tail into the store if it's worth
+// the sort
+static void redisSpySettleKeyStore(REDIS* redis)
+{
+	if (redis->keyTailLength > spyKeysMemory(redis->keyStore) / 8)
+		redisSpyRebuildKeyStore(redis);
+}
+
+
+static void redisSpyAppendKey(REDIS* redis, const char* key)
+{
+	if (redis->keyCount == redis->keyCapacity)
+		redisSpyGrowRows(redis);
+
+	unsigned int row = redis->keyCount++;
+
+	redis->keyRefs[row] = redisSpyAddTailKey(redis, key);
+	redis->types[row] = REDISSPY_TYPE_UNKNOWN;
+	redis->lengths[row] = 0;
+	redis->ttls[row] = -1;
+	redis->memory[row] = -1;
+	redis->encodings[row] = 0;
+	redis->values[row] = NULL;
+	redis->valueUsed[row] = 0;
+	redis->valueStates[row] = REDISSPY_VALUE_LOADED;
+	redis->matches[row] = NULL;
+	redis->generations[row] = redis->generation;
+
+	redis->viewValid = 0;
+
+	if (redis->trigrams)
+		spyTrigramAdd(redis->trigrams, redis->keyTail + (redis->keyRefs[row] & ~REDISSPY_KEY_TAIL));
+
+	redisSpyAggregateRow(redis, row, 1);
+
+	if (redis->keyIndexValid)
+	{
+		if (2 * redis->keyCount > redis->keyIndexSize)
+			redisSpyRebuildKeyIndex(redis);
+		else
+			redisSpyKeyIndexInsert(redis, row);
+	}
+
+	// Letting the tail grow to twice the store keeps the merges to a
+	// few per doubling of the keys
+	if (redis->keyTailLength > 2 * spyKeysMemory(redis->keyStore) + 65536)
+		redisSpyRebuildKeyStore(redis);
+}
+
+
+// Drop the rows marked in remove, keeping the others in order
+static void redisSpyRemoveRows(REDIS* redis, const unsigned char* remove)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		if (remove[i])
+		{
+			redisSpyAggregateRow(redis, i, -1);
+			redisSpySetString(redis, &redis->values[i], "");
+			redisSpySetString(redis, &redis->matches[i], "");
+			redis->keyStoreRows -= !(redis->keyRefs[i] & REDISSPY_KEY_TAIL);
+		}
+	}
+
+	unsigned int sorted = 0;
+
+	for (unsigned int i = 0; i < redis->sortedRows; i++)
+		sorted += !remove[i];
+
+	redis->sortedRows = sorted;
+
+#define REDISSPY_COMPACT_COLUMN(type, column) \
+	n = 0; \
+	for (unsigned int i = 0; i < redis->keyCount; i++) \
+	{ \
+		redis->column[n] = redis->column[i]; \
+		n += !remove[i]; \
+	}
+
+	REDISSPY_FOR_EACH_COLUMN(REDISSPY_COMPACT_COLUMN)
+
+#undef REDISSPY_COMPACT_COLUMN
+
+	if (n != redis->keyCount)
+	{
+		redis->keyCount = n;
+		redis->keyIndexValid = 0;
+		redis->viewValid = 0;
+	}
+
+	if (spyKeysCount(redis->keyStore) > 2 * redis->keyStoreRows + 4096)
+		redisSpyRebuildKeyStore(redis);
+}
+
+
+// Mark the rows to drop in one pass over a column, then drop them
+static void redisSpyRemoveDeletedRows(REDIS* redis)
+{
+	unsigned char* remove = malloc(redis->keyCount + 1);
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		remove[i] = (redis->types[i] == REDISSPY_TYPE_NONE);
+		n += remove[i];
+	}
+
+	if (n > 0)
+		redisSpyRemoveRows(redis, remove);
+
+	free(remove);
+}
+
+
+static void redisSpyRemoveStaleRows(REDIS* redis)
+{
+	unsigned char* remove = malloc(redis->keyCount + 1);
+	unsigned int generation = redis->generation;
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		remove[i] = (redis->generations[i] != generation);
+		n += remove[i];
+	}
+
+	if (n > 0)
+		redisSpyRemoveRows(redis, remove);
+
+	free(remove);
+}
+
+
+// A deleted row is taken out of the aggregates at once and dropped from
+// the columns later, along with any others
+static void redisSpyMarkDeleted(REDIS* redis, unsigned int row)
+{
+	redisSpyAggregateRow(redis, row, -1);
+	redis->types[row] = REDISSPY_TYPE_NONE;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Preview cache
+//
+// Previews are read for every loaded row, but only a screenful is looked
+// at. With a budget set, previews of rows off screen are dropped once
+// they take more than it, and read again when their rows come back.
+
+static DECLARE_COMPARE_FN(compareValueUsed, thunk, a, b)
+{
+	REDIS* redis = (REDIS*)thunk;
+	unsigned int x = redis->valueUsed[*(const unsigned int*)a];
+	unsigned int y = redis->valueUsed[*(const unsigned int*)b];
+
+	return (x > y) - (x < y);
+}
+
+
+// Drop previews, least recently on screen first, until they take seven
+// eighths of the budget. Dropping more than needed keeps this to once
+// per eighth of the budget read in.
+static void redisSpyEvictValues(REDIS* redis)
+{
+	size_t target = redis->valueBudget - redis->valueBudget / 8;
+	unsigned int* rows = malloc((redis->keyCount + 1) * sizeof(unsigned int));
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		if (redis->values[i] && (redis->valueUsed[i] != redis->valueClock))
+			rows[n++] = i;
+	}
+
+	redisSpySortRows(redis, rows, n, compareValueUsed);
+
+	unsigned int dropped = 0;
+
+	for (; (dropped < n) && (redis->valueBytes > target); dropped++)
+	{
+		redisSpySetString(redis, &redis->values[rows[dropped]], "");
+		redis->valueStates[rows[dropped]] = REDISSPY_VALUE_EVICTED;
+		redis->valueEvictions++;
+	}
+
+	// Sorted by value, rows that lost their previews belong at the end
+	if ((dropped > 0) && (redis->sortBy == sortByValue))
+		redis->sortDirty = 1;
+
+	free(rows);
+}
+
+
+void redisSpySetValueBudget(REDIS* redis, size_t bytes)
+{
+	redis->memoryBudget = bytes ? MAX(bytes, REDISSPY_MIN_VALUE_BUDGET) : 0;
+	redis->detailBudget = redis->memoryBudget / REDISSPY_DETAIL_BUDGET_SHARE;
+	redis->valueBudget = redis->memoryBudget - redis->detailBudget;
+
+	if (redis->valueBudget && (redis->valueBytes > redis->valueBudget))
+		redisSpyEvictValues(redis);
+}
+
+
+unsigned int redisSpyTouchRows(REDIS* redis, const unsigned int* rows, unsigned int count,
+							   unsigned int* evicted)
+{
+	unsigned int clock = ++redis->valueClock;
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int row = rows[i];
+
+		// Not on screen in the pass before this one
+		int arrived = (redis->valueUsed[row] + 1 != clock);
+		unsigned char state = redis->valueStates[row];
+
+		if (arrived)
+		{
+			if (state == REDISSPY_VALUE_LOADED)
+				redis->valueHits++;
+			else
+				redis->valueMisses++;
+		}
+
+		redis->valueUsed[row] = clock;
+
+		// A read already asked for is asked for again if the row left
+		// the screen in between, in case the reply was lost
+		if ((state == REDISSPY_VALUE_EVICTED) || (arrived && (state == REDISSPY_VALUE_REQUESTED)))
+		{
+			redis->valueStates[row] = REDISSPY_VALUE_REQUESTED;
+			evicted[n++] = row;
+		}
+	}
+
+	return n;
+}
+
+
+static void redisSpyStoreRow(REDIS* redis, unsigned int row, const REDISDATA* src)
+{
+	redisSpyAggregateRow(redis, row, -1);
+
+	redis->types[row] = redisSpyInternName(&redis->typeNames, src->type);
+	redis->lengths[row] = src->length;
+	redis->ttls[row] = src->ttl;
+	redis->memory[row] = src->memory;
+	redis->encodings[row] = redisSpyInternName(&redis->encodingNames, src->encoding);
+	redisSpySetString(redis, &redis->values[row], src->value);
+	redis->valueStates[row] = REDISSPY_VALUE_LOADED;
+	redisSpySetString(redis, &redis->matches[row], src->match);
+	redis->generations[row] = redis->generation;
+
+	redisSpyAggregateRow(redis, row, 1);
+
+	if (redis->valueBudget && (redis->valueBytes > redis->valueBudget))
+		redisSpyEvictValues(redis);
+
+	unsigned int keyLength = strlen(src->key);
+	if (keyLength > redis->longestKeyLength)
+		redis->longestKeyLength = keyLength;
+}
+
+
+// Empty every row but keep the columns' memory
+void redisSpyResetRows(REDIS* redis)
+{
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+	{
+		free(redis->values[i]);
+		free(redis->matches[i]);
+	}
+
+	redis->keyCount = 0;
+	spyKeysClear(redis->keyStore);
+	redis->keyStoreRows = 0;
+	redis->keyTailLength = 0;
+	redis->valueBytes = 0;
+	memset(redis->typeCounts, 0, sizeof(redis->typeCounts));
+	redis->longestKeyLength = 0;
+	redis->keyIndexValid = 0;
+	redis->viewValid = 0;
+
+	if (redis->trigrams)
+		spyTrigramClear(redis->trigrams);
+
+	if (redis->tree)
+		spyTreeClear(redis->tree);
+
+	if (redis->schema)
+		spySchemaClear(redis->schema);
+}
+
+
+// Rows of another type than SCAN TYPE asked for come from servers
+// without it, or from keys that have since changed type
+static int redisSpyIsScanType(REDIS* redis, const char* type)
+{
+	return (redis->scanType[0] == '\0') || (strcmp(type, redis->scanType) == 0);
+}
+
+
+static COMPARE_FN redisSpyCompareFunction(REDIS* redis);
+static void redisSpyPlaceRow(REDIS* redis, unsigned int row, COMPARE_FN compare);
+static int redisSpyRowInPlace(REDIS* redis, unsigned int row, COMPARE_FN compare);
+
+// Merge rows read on another connection into the model. Known keys are
+// updated in place and unknown keys appended if insert is set. Keys that
+// no longer exist, or are not of the scan type, are dropped.
+//
+// Appended rows wait for redisSpySortNewRows. An updated row that is
+// now out of order is moved back into place, except during a scan
+// (insert), which can change any number of them: that leaves the next
+// redisSpySortNewRows to sort everything.
+void redisSpyMergeRows(REDIS* redis, REDISDATA* rows, unsigned int count, int insert)
+{
+	COMPARE_FN compare = redisSpyCompareFunction(redis);
+	int removed = 0;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		REDISDATA* src = &rows[i];
+		int row = redisSpyFindKey(redis, src->key);
+
+		if ((strcmp(src->type, "none") == 0) || !redisSpyIsScanType(redis, src->type))
+		{
+			if (row >= 0)
+			{
+				redisSpyMarkDeleted(redis, row);
+				removed = 1;
+			}
+
+			continue;
+		}
+
+		if (row < 0)
+		{
+			if (!insert)
+				continue;
+
+			redisSpyAppendKey(redis, src->key);
+			row = redis->keyCount - 1;
+		}
+
+		// Row updates don't know why the row is listed
+		if (!insert)
+			snprintf(src->match, sizeof(src->match), "%s", redisSpyRowMatch(redis, row));
+
+		redisSpyStoreRow(redis, row, src);
+
+		if (!insert)
+			redisSpyPlaceRow(redis, row, compare);
+		else if (   (compare != NULL) && !redis->sortDirty && ((unsigned int)row < redis->sortedRows)
+				 && !redisSpyRowInPlace(redis, row, compare))
+			redis->sortDirty = 1;
+	}
+
+	if (removed)
+		redisSpyRemoveDeletedRows(redis);
+}
+
+
+// A keyspace scan merges its rows under a new generation. Once it has
+// completed, rows it did not see are gone from the server.
+unsigned int redisSpyBeginGeneration(REDIS* redis)
+{
+	return ++redis->generation;
+}
+
+
+void redisSpyEndGeneration(REDIS* redis)
+{
+	redisSpyRemoveStaleRows(redis);
+	redisSpySettleKeyStore(redis);
+}
+
+
+// Whether a key created by a command belongs in the list: the same
+// Redis glob rules SCAN MATCH applies. A pattern too long to compile
+// lets the key in; the next scan drops it if it doesn't belong.
+int redisSpyKeyMatchesPattern(REDIS* redis, const char* key)
+{
+	SPY_GLOB glob;
+
+	if (spyGlobCompile(&glob, redis->pattern) != 0)
+		return 1;
+
+	return spyGlobMatch(&glob, key);
+}
+
+
+// The key index slot holding row
+static unsigned int redisSpyKeyIndexSlot(REDIS* redis, unsigned int row)
+{
+	char key[REDISSPY_MAX_KEY_LEN];
+	unsigned int mask = redis->keyIndexSize - 1;
+	unsigned int slot = redisSpyHashKey(redisSpyRowKey(redis, row, key)) & mask;
+
+	while (redis->keyIndex[slot] != row + 1)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+
+// Move a row, shifting the rows in between by one. The key index is
+// renumbered in place instead of being rebuilt: through the index
+// itself for a short move, or in one pass over it for a long one, where
+// looking up each key would cost more.
+static void redisSpyMoveRow(REDIS* redis, unsigned int from, unsigned int to)
+{
+	if (from == to)
+		return;
+
+	// Index entries are row + 1
+	unsigned int first = MIN(from, to);
+	unsigned int count = MAX(from, to) - first + 1;
+	unsigned int* slots = NULL;
+
+	if (redis->keyIndexValid && (64 * count < redis->keyIndexSize))
+	{
+		// Find the rows' entries by their keys before they move
+		slots = malloc(count * sizeof(unsigned int));
+
+		for (unsigned int i = 0; i < count; i++)
+			slots[i] = redisSpyKeyIndexSlot(redis, first + i);
+	}
+
+#define REDISSPY_MOVE_COLUMN(type, column) \
+	{ \
+		type moving = redis->column[from]; \
+		if (from < to) \
+			memmove(&redis->column[from], &redis->column[from + 1], (to - from) * sizeof(type)); \
+		else \
+			memmove(&redis->column[to + 1], &redis->column[to], (from - to) * sizeof(type)); \
+		redis->column[to] = moving; \
+	}
+
+	REDISSPY_FOR_EACH_COLUMN(REDISSPY_MOVE_COLUMN)
+
+#undef REDISSPY_MOVE_COLUMN
+
+	redis->viewValid = 0;
+
+	if (slots != NULL)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned int row = first + i;
+
+			if (row == from)
+				row = to;
+			else
+				row = (from < to) ? row - 1 : row + 1;
+
+			redis->keyIndex[slots[i]] = row + 1;
+		}
+
+		free(slots);
+	}
+	else if (redis->keyIndexValid)
+	{
+		for (unsigned int i = 0; i < redis->keyIndexSize; i++)
+		{
+			unsigned int entry = redis->keyIndex[i];
+
+			if (entry == from + 1)
+				redis->keyIndex[i] = to + 1;
+			else if ((entry >= first + 1) && (entry <= first + count))
+				redis->keyIndex[i] = (from < to) ? entry - 1 : entry + 1;
+		}
+	}
+}
+
+
+// Binary search for where row belongs among the sorted rows, treating
+// them as if that row had been taken out.
+static unsigned int redisSpySortedPosition(REDIS* redis, unsigned int row, COMPARE_FN compare)
+{
+	unsigned int lo = 0;
+	unsigned int hi = redis->sortedRows - (row < redis->sortedRows);
+
+	while (lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+		unsigned int probe = (mid < row) ? mid : mid + 1;
 
-	r->context = context;
+		if (CALL_COMPARE_FN(compare, redis, &probe, &row) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return 0;
+	return lo;
 }
 
 
-int redisSpyServerClearCache(REDIS* redis)
+// Whether a sorted row is still in order with the sorted rows either
+// side of it
+static int redisSpyRowInPlace(REDIS* redis, unsigned int row, COMPARE_FN compare)
 {
-	if (redis == NULL)
-		return -1;
-
-	free(redis->data);
-	redis->data = NULL;
+	unsigned int before = row - 1;
+	unsigned int after = row + 1;
 
-	redis->keyCount = 0;
-	redis->longestKeyLength = 0;
-
-	return 0;
+	return    ((row == 0) || (CALL_COMPARE_FN(compare, redis, &before, &row) <= 0))
+		   && ((after >= redis->sortedRows) || (CALL_COMPARE_FN(compare, redis, &row, &after) <= 0));
 }
 
-#if 0
-int redisSpyServerRefreshKey(REDIS* redis, REDISDATA* data)
+
+// Move one row to its place in the order. A row past the sorted ones
+// joins them. Nothing moves while a full sort is due anyway.
+static void redisSpyPlaceRow(REDIS* redis, unsigned int row, COMPARE_FN compare)
 {
-	redisReply* r = NULL;
+	if ((compare == NULL) || redis->sortDirty)
+		return;
 
-	if (data->reply)
+	if (row >= redis->sortedRows)
 	{
-		freeReplyObject(data->reply);
-		data->reply = NULL;
+		redisSpyMoveRow(redis, row, redisSpySortedPosition(redis, row, compare));
+		redis->sortedRows++;
 	}
+	else if (!redisSpyRowInPlace(redis, row, compare))
+	{
+		redisSpyMoveRow(redis, row, redisSpySortedPosition(redis, row, compare));
+	}
+}
 
-	char serverCommand[REDISSPY_MAX_COMMAND_LEN];
 
-	if (strcmp(data->type, "string") == 0)
-	{
-		snprintf(serverCommand, REDISSPY_MAX_COMMAND_LEN,
-				"GET %s", data->key);
+// Merge rows refreshed after a command changed them. Unlike
+// redisSpyMergeRows this also puts new keys in order as they go in: a
+// changed row moves to its new place, a new key matching the filter is
+// inserted in order and a deleted key is dropped.
+void redisSpySpliceRows(REDIS* redis, REDISDATA* rows, unsigned int count)
+{
+	COMPARE_FN compare = redisSpyCompareFunction(redis);
+	int removed = 0;
 
-		r = redisSpyGetServerResponse(redis, serverCommand);
-	}
-	else if (   (strcmp(data->type, "list") == 0)
-			 || (strcmp(data->type, "set") == 0)
-			 || (strcmp(data->type, "zset") == 0))
+	for (unsigned int i = 0; i < count; i++)
 	{
-		if (strcmp(data->type, "list") == 0)
-		{
-			snprintf(serverCommand, REDISSPY_MAX_COMMAND_LEN,
-					"LRANGE %s 0 -1", data->key);
-		}
-		else if (strcmp(data->type, "set") == 0)
+		REDISDATA* src = &rows[i];
+		int row = redisSpyFindKey(redis, src->key);
+
+		if ((strcmp(src->type, "none") == 0) || !redisSpyIsScanType(redis, src->type))
 		{
-			snprintf(serverCommand, REDISSPY_MAX_COMMAND_LEN,
-					"SMEMBERS %s", data->key);
+			if (row >= 0)
+			{
+				redisSpyMarkDeleted(redis, row);
+				removed = 1;
+			}
+
+			continue;
 		}
-		else if (strcmp(data->type, "zset") == 0)
+
+		if (row < 0)
 		{
-			snprintf(serverCommand, REDISSPY_MAX_COMMAND_LEN,
-					"ZRANGE %s 0 -1", data->key);
+			if (!redisSpyKeyMatchesPattern(redis, src->key))
+				continue;
+
+			redisSpyAppendKey(redis, src->key);
+			row = redis->keyCount - 1;
 		}
 
-		r = redisSpyGetServerResponse(redis, serverCommand);
+		redisSpyStoreRow(redis, row, src);
+		redisSpyPlaceRow(redis, row, compare);
 	}
-	else if (strcmp(data->type, "hash") == 0)
-	{
-		snprintf(serverCommand, REDISSPY_MAX_COMMAND_LEN,
-				 "HGETALL %s", data->key);
 
-		r = redisSpyGetServerResponse(redis, serverCommand);
-	}
-	else
+	if (removed)
+		redisSpyRemoveDeletedRows(redis);
+}
+
+
+// Servers older than 2.8 have no SCAN
+static int redisSpyIsUnknownCommand(const redisReply* r)
+{
+	return (r->type == REDIS_REPLY_ERROR) && (strncmp(r->str, "ERR unknown command", 19) == 0);
+}
+
+
+// Fallback for servers older than 2.8, which have no SCAN. KEYS returns
+// every key at once, so it only stands in for a scan from the start.
+static int redisSpyScanWithKeys(REDIS* redis, char* cursor)
+{
+	if (strcmp(cursor, "0") != 0)
+		return -1;
+
+	redisReply* r = redisCommand(redis->context, "KEYS %s", redis->pattern);
+	if (r == NULL)
+		return -1;
+
+	if (r->type != REDIS_REPLY_ARRAY)
 	{
-		// Unsupported type...
+		freeReplyObject(r);
+		return -1;
 	}
 
-	data->reply = r;
+	for (unsigned i = 0; i < r->elements; i++)
+		redisSpyAppendKey(redis, r->element[i]->str);
+
+	freeReplyObject(r);
+
+	strcpy(cursor, "0");
 
 	return 0;
 }
-#endif
 
-int redisSpyDetailElementCount(REDISDATA* data)
+
+// Run one SCAN step from cursor and append the keys it returns.
+// cursor is updated in place and is "0" once the scan is complete.
+// Only key names are read; types and values are left to
+// redisSpyServerRefreshRows.
+int redisSpyServerScan(REDIS* redis, char* cursor, unsigned int cursorSize)
 {
-    if (strcmp(data->type, "string") == 0)
-	{
-		return 1;
-	}
-	else if (   (strcmp(data->type, "list") == 0)
-	         || (strcmp(data->type, "set") == 0)
-	         || (strcmp(data->type, "zset") == 0))
+	if (redis->pattern[0] == '\0')
 	{
-		return data->reply->elements;
+		strcpy(redis->pattern, "*");
 	}
-	else if (strcmp(data->type, "hash") == 0)
+
+	if (redisSpyEnsureConnected(redis) != 0)
+		return -1;
+
+	redisReply* r;
+
+	if ((redis->scanType[0] != '\0') && !redis->scanTypeUnsupported)
 	{
-		return data->reply->elements/2;
+		r = redisCommand(redis->context, "SCAN %s MATCH %s COUNT %d TYPE %s",
+						 cursor, redis->pattern, REDISSPY_SCAN_COUNT, redis->scanType);
+
+		// Before 6.0, TYPE is a syntax error. Carry on without it; rows
+		// of other types are then filtered out locally. Other errors
+		// are handled as for any SCAN.
+		if (   r && (r->type == REDIS_REPLY_ERROR)
+			&& (strncmp(r->str, "ERR syntax error", 16) == 0))
+		{
+			freeReplyObject(r);
+			redis->scanTypeUnsupported = 1;
+
+			return redisSpyServerScan(redis, cursor, cursorSize);
+		}
 	}
 	else
 	{
-		return 1;
+		r = redisCommand(redis->context, "SCAN %s MATCH %s COUNT %d",
+						 cursor, redis->pattern, REDISSPY_SCAN_COUNT);
 	}
-}
 
-int redisSpyDetailElementAtIndex(REDISDATA* data, unsigned int index, char* buffer, unsigned int size)
-{
-    if (strcmp(data->type, "string") == 0)
+	if (r == NULL)
 	{
-		strncpy(buffer, data->reply->str, size);
+		redisSpyCheckConnection(redis);
+		return -1;
 	}
-	else if (   (strcmp(data->type, "list") == 0)
-	         || (strcmp(data->type, "set") == 0)
-	         || (strcmp(data->type, "zset") == 0))
+
+	if (redisSpyIsUnknownCommand(r))
 	{
-		strncpy(buffer, data->reply->element[index]->str, size);
+		freeReplyObject(r);
+
+		int ret = redisSpyScanWithKeys(redis, cursor);
+		redisSpyCheckConnection(redis);
+
+		return ret;
 	}
-	else if (strcmp(data->type, "hash") == 0)
+
+	// LOADING, BUSY, NOPERM, ... fail this scan; KEYS would only block
+	// the server where SCAN could not run
+	if (r->type == REDIS_REPLY_ERROR)
 	{
-		snprintf(buffer, size, "%s  ->  %s",
-				 data->reply->element[2*index]->str,
-				 data->reply->element[2*index+1]->str);
+		freeReplyObject(r);
+		return -1;
 	}
-	else
+
+	if ((r->type != REDIS_REPLY_ARRAY) || (r->elements != 2))
 	{
-		strncpy(buffer, data->reply->str, size);
+		freeReplyObject(r);
+		return -1;
 	}
 
-	return 0;
-}
+	strncpy(cursor, r->element[0]->str, cursorSize - 1);
+	cursor[cursorSize - 1] = '\0';
 
+	redisReply* keys = r->element[1];
 
-int redisSpyServerRefreshKey(REDIS* redis, REDISDATA* data)
-{
-	data->length = 0;
-	data->value[0] = '\0';
+	for (unsigned i = 0; i < keys->elements; i++)
+		redisSpyAppendKey(redis, keys->element[i]->str);
 
-	unsigned int keyLength = strlen(data->key);
-	if (keyLength > redis->longestKeyLength)
-		redis->longestKeyLength = keyLength;
+	freeReplyObject(r);
+
+	return 0;
+}
 
-	redisReply* t = redisCommand(redis->context, "TYPE %s", 
-	                             data->key);
 
-	strncpy(data->type, t->str, sizeof(data->type) - 1);
+long long redisSpyServerDbSize(REDIS* redis)
+{
+	long long size = 0;
 
-	redisReply* v = NULL;
+	if (redisSpyEnsureConnected(redis) != 0)
+		return 0;
 
-	if (strcmp(t->str, "string") == 0)
+	redisReply* r = redisCommand(redis->context, "DBSIZE");
+	if (r == NULL)
 	{
-		v = redisCommand(redis->context, "GET %s", data->key);
-
-		strncpy(data->value, v->str, sizeof(data->value) - 1);
-		data->length = strlen(v->str);
+		redisSpyCheckConnection(redis);
+		return 0;
 	}
-	else if (strcmp(t->str, "list") == 0)
-	{
-		v = redisCommand(redis->context, "LRANGE %s 0 -1", data->key);
 
-		data->length = v->elements;
+	if (r->type == REDIS_REPLY_INTEGER)
+		size = r->integer;
 
-		for (unsigned j = 0; j < v->elements; j++)
-		{
-			if (j > 0)
-				safestrcat(data->value, " ");
+	freeReplyObject(r);
 
-			safestrcat(data->value, v->element[j]->str);
-		}
-	}
-	else if (strcmp(t->str, "hash") == 0)
-	{
-		v = redisCommand(redis->context, "HGETALL %s", data->key);
+	return size;
+}
 
-		data->length = v->elements >> 1;
 
-		for (unsigned j = 0; j < v->elements; j+=2)
-		{
-			if (j > 0)
-				safestrcat(data->value, " ");
+// Ask the server which keys a command touches (COMMAND GETKEYS, 2.8.13
+// and later). Returns the number of keys, or -1 if the server can't say
+// or there are more than maxKeys, and the caller should refresh it all.
+int redisSpyServerCommandKeys(REDIS* redis, char* command,
+							  char keys[][REDISSPY_MAX_KEY_LEN], unsigned int maxKeys)
+{
+	char getKeys[REDISSPY_MAX_COMMAND_LEN + 32];
+	int count = -1;
 
-			safestrcat(data->value, data->key);
-			safestrcat(data->value, "->");
-			safestrcat(data->value, v->element[j+1]->str);
-		}
-	}
-	else if (strcmp(t->str, "set") == 0)
-	{
-		v = redisCommand(redis->context, "SMEMBERS %s", data->key);
-		data->length = v->elements;
+	// Split the same way redisSpySendCommandToServer does
+	snprintf(getKeys, sizeof(getKeys), "COMMAND GETKEYS %s", command);
 
-		for (unsigned j = 0; j < v->elements; j++)
-		{
-			if (j > 0)
-				safestrcat(data->value, " ");
+	redisReply* r = redisSpyGetServerResponse(redis, getKeys);
+	if (r == NULL)
+		return -1;
 
-			safestrcat(data->value, v->element[j]->str);
-		}
-	}
-	else if (strcmp(t->str, "zset") == 0)
+	if ((r->type == REDIS_REPLY_ARRAY) && (r->elements <= maxKeys))
 	{
-		v = redisCommand(redis->context, "ZRANGE %s 0 -1", data->key);
-		data->length = v->elements;
+		count = r->elements;
 
-		for (unsigned j = 0; j < v->elements; j++)
+		for (unsigned int i = 0; i < r->elements; i++)
 		{
-			if (j > 0)
-				safestrcat(data->value, " ");
-
-			safestrcat(data->value, v->element[j]->str);
+			strncpy(keys[i], r->element[i]->str, REDISSPY_MAX_KEY_LEN - 1);
+			keys[i][REDISSPY_MAX_KEY_LEN - 1] = '\0';
 		}
 	}
 
-	data->reply = v;
-
-	// freeReplyObject(v);
-	freeReplyObject(t);
+	freeReplyObject(r);
 
-	return 0;
+	return count;
 }
 
 
-int redisSpyServerRefresh(REDIS* redis)
+static void redisSpyApplyOrder(REDIS* redis, const unsigned int* order);
+static unsigned int* redisSpySortedOrder(REDIS* redis, COMPARE_FN compare);
+
+// Rebuild the whole key list with an incremental SCAN
+static int redisSpyRefreshKeyList(REDIS* redis)
 {
-	redisReply* r = NULL;
+	redisSpyResetRows(redis);
 
-	int ret = redisSpyConnect(redis, redis->host, redis->port);
-	if (ret)
+	char cursor[32];
+	strcpy(cursor, "0");
+
+	do
 	{
-		return -1;
-	}
+		if (redisSpyServerScan(redis, cursor, sizeof(cursor)) != 0)
+			return -1;
 
-	redis->infoConnectedClients = 0;
-	redis->infoUsedMemoryHuman[0] = '\0';
+	} while (strcmp(cursor, "0") != 0);
 
-	for (unsigned i = 0; i < redis->keyCount; i++)
-	{
-		if (redis->data[i].reply)
-		{
-			freeReplyObject(redis->data[i].reply);
-			redis->data[i].reply = NULL;
-		}
-	}
+	redisSpySettleKeyStore(redis);
 
-	r = redisCommand(redis->context, "INFO");
-	if (r->type == REDIS_REPLY_STRING)
+	// SCAN may return a key more than once. Drop the duplicates, which
+	// share an id in the store.
+	if (redis->keyCount > 1)
 	{
-		char*	c = strstr(r->str, "connected_clients");
-		char*	m = strstr(r->str, "used_memory_human");
-		char*	t = NULL;
+		unsigned int* order = redisSpySortedOrder(redis, compareKeys);
 
-		if (c)
-		{
-			t = strtok(c, ":\r\n");
-			t = strtok(NULL, ":\r\n");
+		redisSpyApplyOrder(redis, order);
+		free(order);
 
-			if (t)
-				redis->infoConnectedClients = atoi(t);
-		}
+		unsigned char* remove = malloc(redis->keyCount);
+		unsigned int n = 0;
 
-		if (m)
-		{
-			t = strtok(m, ":\r\n");
-			t = strtok(NULL, ":\r\n");
+		remove[0] = 0;
 
-			if (t)
-				strcpy(redis->infoUsedMemoryHuman, t);
+		for (unsigned int i = 1; i < redis->keyCount; i++)
+		{
+			remove[i] = (redisSpyCompareRowKeys(redis, i, i - 1) == 0);
+			n += remove[i];
 		}
-	}
-
-	freeReplyObject(r);
 
+		if (n > 0)
+			redisSpyRemoveRows(redis, remove);
 
-	if (redis->pattern[0] == '\0')
-	{
-		strcpy(redis->pattern, "*");
+		free(remove);
 	}
 
-	r = redisCommand(redis->context, "KEYS %s", redis->pattern);
-	if (r->type == REDIS_REPLY_ARRAY)
-	{
-		// If our current buffer is big enough, don't bother
-		// freeing and mallocing a new one every time.
-		if (redis->data && (r->elements > redis->keyCount))
-		{
-			free(redis->data);
-			redis->data = NULL;
-		}
-
-		if (redis->data == NULL)
-			redis->data = malloc(r->elements * sizeof(REDISDATA));
-
-		redis->keyCount = r->elements;
-		redis->longestKeyLength = 0;
+	return 0;
+}
 
-		for (unsigned i = 0; i < r->elements; i++)
-		{
-			strncpy(redis->data[i].key, r->element[i]->str, sizeof(redis->data[i].key) - 1);
 
-			redisSpyServerRefreshKey(redis, &redis->data[i]);
-		}
+int redisSpyServerRefresh(REDIS* redis)
+{
+	int ret = redisSpyEnsureConnected(redis);
+	if (ret)
+	{
+		return -1;
 	}
 
-	freeReplyObject(r);
+	redisSpyRefreshInfo(redis);
 
-	return 0;
+	if (redisSpyRefreshKeyList(redis) != 0)
+		return -1;
+
+	return redisSpyRefreshStoredRows(redis, 0, redis->keyCount);
 }
 
 
+#define ROW(p)	(*(const unsigned int*)(p))
+
 DECLARE_COMPARE_FN(compareKeys, thunk, a, b)
 {
 	SWAPIFREVERSESORT(thunk, a, b);
 
-	return strcmp(((REDISDATA*)a)->key, ((REDISDATA*)b)->key);
+	return redisSpyCompareRowKeys((REDIS*)thunk, ROW(a), ROW(b));
 }
 
 DECLARE_COMPARE_FN(compareTypes, thunk, a, b)
 {
 	SWAPIFREVERSESORT(thunk, a, b);
 
-	int r = strcmp(((REDISDATA*)a)->type, ((REDISDATA*)b)->type);
+	REDIS* redis = (REDIS*)thunk;
+	unsigned char x = redis->types[ROW(a)];
+	unsigned char y = redis->types[ROW(b)];
+
+	int r = (x == y) ? 0 : strcmp(redis->typeNames.names[x], redis->typeNames.names[y]);
 
 	if (r == 0)
 		return CALL_COMPARE_FN(compareKeys, thunk, a, b);
@@ -426,7 +2871,9 @@ DECLARE_COMPARE_FN(compareLengths, thunk, a, b)
 {
 	SWAPIFREVERSESORT(thunk, a, b);
 
-	int r = ((REDISDATA*)b)->length - ((REDISDATA*)a)->length;
+	REDIS* redis = (REDIS*)thunk;
+
+	int r = redis->lengths[ROW(b)] - redis->lengths[ROW(a)];
 
 	if (r == 0)
 		return CALL_COMPARE_FN(compareKeys, thunk, a, b);
@@ -434,11 +2881,23 @@ DECLARE_COMPARE_FN(compareLengths, thunk, a, b)
 	return r;
 }
 
+// Rows whose previews were dropped have no value to compare. They go
+// last, in key order, whichever way the sort runs.
 DECLARE_COMPARE_FN(compareValues, thunk, a, b)
 {
+	REDIS* redis = (REDIS*)thunk;
+	int droppedA = redisSpyRowValueDropped(redis, ROW(a));
+	int droppedB = redisSpyRowValueDropped(redis, ROW(b));
+
+	if (droppedA != droppedB)
+		return droppedA - droppedB;
+
+	if (droppedA)
+		return redisSpyCompareRowKeys(redis, ROW(a), ROW(b));
+
 	SWAPIFREVERSESORT(thunk, a, b);
 
-	int r = strcmp(((REDISDATA*)a)->value, ((REDISDATA*)b)->value);
+	int r = strcmp(redisSpyRowValue(redis, ROW(a)), redisSpyRowValue(redis, ROW(b)));
 
 	if (r == 0)
 		return CALL_COMPARE_FN(compareKeys, thunk, a, b);
@@ -446,6 +2905,30 @@ DECLARE_COMPARE_FN(compareValues, thunk, a, b)
 	return r;
 }
 
+#undef ROW
+
+
+static COMPARE_FN redisSpyCompareFunction(REDIS* redis)
+{
+	switch (redis->sortBy)
+	{
+		case sortByKey:
+			return compareKeys;
+
+		case sortByType:
+			return compareTypes;
+
+		case sortByLength:
+			return compareLengths;
+
+		case sortByValue:
+			return compareValues;
+
+		default:
+			return NULL;
+	}
+}
+
 
 void redisSpySort(REDIS* redis, int newSortBy)
 {
@@ -461,38 +2944,142 @@ void redisSpySort(REDIS* redis, int newSortBy)
 		}
 	}
 
-	COMPARE_FN compareFunction = NULL;
+	COMPARE_FN compareFunction = redisSpyCompareFunction(redis);
 
-	switch (redis->sortBy)
+	if ((compareFunction != NULL) && (redis->keyCount > 1))
 	{
-		case sortByKey:
-			compareFunction = compareKeys;
-			break;
+		unsigned int* order = redisSpySortedOrder(redis, compareFunction);
 
-		case sortByType:
-			compareFunction = compareTypes;
-			break;
+		redisSpyApplyOrder(redis, order);
+		free(order);
+	}
 
-		case sortByLength:
-			compareFunction = compareLengths;
-			break;
+	redis->sortedRows = redis->keyCount;
+	redis->sortDirty = 0;
+}
 
-		case sortByValue:
-			compareFunction = compareValues;
-			break;
 
-		default:
-			break;
-	}
+// Sort the rows appended since the last call into place: sort just
+// those, then merge them with the rows already in order. Unless forced,
+// this waits until eight times as long as the last one took has passed,
+// so a long scan spends at most about a ninth of its time on it.
+void redisSpySortNewRows(REDIS* redis, int force)
+{
+	unsigned int sorted = redis->sortedRows;
+	unsigned int n = redis->keyCount;
+
+	if ((sorted == n) && !redis->sortDirty)
+		return;
+
+	long long start = redisSpyNowMs();
+
+	if (!force && (start < redis->sortAfter))
+		return;
 
-	if (compareFunction != NULL)
+	COMPARE_FN compare = redisSpyCompareFunction(redis);
+
+	if ((compare == NULL) || redis->sortDirty)
+	{
+		redisSpySort(redis, 0);
+	}
+	else
 	{
+		unsigned int* added = malloc((n - sorted + 1) * sizeof(unsigned int));
+
+		for (unsigned int i = sorted; i < n; i++)
+			added[i - sorted] = i;
+
+		redisSpySortRows(redis, added, n - sorted, compare);
+
+		unsigned int* merged = malloc((n + 1) * sizeof(unsigned int));
+		unsigned int a = 0;
+		unsigned int b = 0;
+
+		for (unsigned int k = 0; k < n; k++)
+		{
+			if (   (b == n - sorted)
+				|| ((a < sorted) && (CALL_COMPARE_FN(compare, redis, &a, &added[b]) <= 0)))
+				merged[k] = a++;
+			else
+				merged[k] = added[b++];
+		}
+
+		redisSpyApplyOrder(redis, merged);
+		free(merged);
+		free(added);
+
+		redis->sortedRows = n;
+	}
+
+	long long end = redisSpyNowMs();
+
+	redis->sortAfter = end + 8 * (end - start);
+}
+
+
+// Row numbers in the order compare puts them. Only the compared
+// columns are read.
+static void redisSpySortRows(REDIS* redis, unsigned int* rows, unsigned int count, COMPARE_FN compare)
+{
 #if defined(DARWIN) || defined(BSD)
-		qsort_r(redis->data, redis->keyCount, sizeof(REDISDATA), redis, compareFunction);
+	qsort_r(rows, count, sizeof(unsigned int), redis, compare);
 #else
-		qsort_r(redis->data, redis->keyCount, sizeof(REDISDATA), compareFunction, redis);
+	qsort_r(rows, count, sizeof(unsigned int), compare, redis);
 #endif
+}
+
+
+static unsigned int* redisSpySortedOrder(REDIS* redis, COMPARE_FN compare)
+{
+	unsigned int* order = malloc((redis->keyCount + 1) * sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < redis->keyCount; i++)
+		order[i] = i;
+
+	redisSpySortRows(redis, order, redis->keyCount, compare);
+
+	return order;
+}
+
+
+// Permute the rows so that row i is what was row order[i], one column
+// at a time. Keys stay where they are in the store and the tail.
+static void redisSpyApplyOrder(REDIS* redis, const unsigned int* order)
+{
+	unsigned int n = redis->keyCount;
+	size_t widest = MAX(sizeof(long long), sizeof(char*));
+	void* scratch = malloc(n * widest + 1);
+
+#define REDISSPY_GATHER_COLUMN(type, column) \
+	{ \
+		type* gathered = scratch; \
+		for (unsigned int i = 0; i < n; i++) \
+			gathered[i] = redis->column[order[i]]; \
+		memcpy(redis->column, gathered, n * sizeof(type)); \
+	}
+
+	REDISSPY_FOR_EACH_COLUMN(REDISSPY_GATHER_COLUMN)
+
+#undef REDISSPY_GATHER_COLUMN
+
+	// Renumber the key index instead of hashing every key again
+	if (redis->keyIndexValid)
+	{
+		unsigned int* moved = scratch;
+
+		for (unsigned int i = 0; i < n; i++)
+			moved[order[i]] = i;
+
+		for (unsigned int i = 0; i < redis->keyIndexSize; i++)
+		{
+			if (redis->keyIndex[i] != 0)
+				redis->keyIndex[i] = moved[redis->keyIndex[i] - 1] + 1;
+		}
 	}
+
+	free(scratch);
+
+	redis->viewValid = 0;
 }
 
 
@@ -502,7 +3089,7 @@ redisReply* redisSpyGetServerResponse(REDIS* redis, char* command)
 
 	void (*oldHandler)(int) = signal(SIGALRM, SIG_IGN);
 
-	int ret = redisSpyConnect(redis, redis->host, redis->port);
+	int ret = redisSpyEnsureConnected(redis);
 
 	if (ret)
 	{
@@ -511,6 +3098,9 @@ redisReply* redisSpyGetServerResponse(REDIS* redis, char* command)
 
 	r = redisCommand(redis->context, command);
 
+	if (r == NULL)
+		redisSpyCheckConnection(redis);
+
 	if (redis->refreshInterval)
 		signal(SIGALRM, oldHandler);
 
@@ -523,10 +3113,10 @@ int redisSpySendCommandToServer(REDIS* redis, char* command, char* reply, int ma
 
 	void (*oldHandler)(int) = signal(SIGALRM, SIG_IGN);
 
-	int ret = redisSpyConnect(redis, redis->host, redis->port);
+	int ret = redisSpyEnsureConnected(redis);
 	if (ret)
 	{
-		strncpy(reply, "Could connect to server.", maxReplyLen - 1);
+		strncpy(reply, "Could not connect to server.", maxReplyLen - 1);
 
 		if (redis->refreshInterval)
 			signal(SIGALRM, oldHandler);
@@ -560,6 +3150,12 @@ int redisSpySendCommandToServer(REDIS* redis, char* command, char* reply, int ma
 
 		freeReplyObject(r);
 	}
+	else
+	{
+		// The next command will reconnect
+		strncpy(reply, "Connection lost.", maxReplyLen - 1);
+		redisSpyCheckConnection(redis);
+	}
 
 	if (redis->refreshInterval)
 		signal(SIGALRM, oldHandler);
@@ -574,31 +3170,35 @@ void redisSpyDump(REDIS* redis, char* delimiter, int unaligned)
 
 	if (r != 0)
 	{
-		fprintf(stderr, "Could not connect to redis server: %s:%d",
-				redis->host, redis->port);
+		char address[REDISSPY_MAX_HOST_LEN + 16];
+		redisSpyServerAddress(redis, address, sizeof(address));
+
+		fprintf(stderr, "Could not connect to redis server: %s", address);
 		return;
 	}
 
+	char key[REDISSPY_MAX_KEY_LEN];
+
 	for (unsigned int i = 0; i < redis->keyCount; i++)
 	{
 		if (unaligned)
 		{
 			printf("%s%s%s%s%d%s%s\n",
-					redis->data[i].key,
+					redisSpyKeyAtIndex(redis, i, key),
 					delimiter,
-					redis->data[i].type,
+					redisSpyRowType(redis, i),
 					delimiter,
-					redis->data[i].length,
+					redisSpyRowLength(redis, i),
 					delimiter,
-					redis->data[i].value);
+					redisSpyRowValue(redis, i));
 		}
 		else
 		{
 			printf("%-20s  %-6s  %5d  %s\n",
-					redis->data[i].key,
-					redis->data[i].type,
-					redis->data[i].length,
-					redis->data[i].value);
+					redisSpyKeyAtIndex(redis, i, key),
+					redisSpyRowType(redis, i),
+					redisSpyRowLength(redis, i),
+					redisSpyRowValue(redis, i));
 		}
 	}
 }
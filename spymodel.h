@@ -1,9 +1,21 @@
+#ifndef _SPYMODEL_H_
+#define _SPYMODEL_H_
+
 #include "hiredis.h"
 #include "spyutils.h"
+#include "spyglob.h"
+#include "spytrigram.h"
+#include "spytree.h"
+#include "spyschema.h"
+#include "spyquery.h"
+#include "spykeys.h"
 
 // Max values for string buffers
 #define REDISSPY_MAX_HOST_LEN			128
+#define REDISSPY_MAX_SOCKET_PATH_LEN	108		// sizeof(sun_path) on Linux
 #define REDISSPY_MAX_TYPE_LEN			8
+#define REDISSPY_MAX_ENCODING_LEN		16
+#define REDISSPY_MAX_MATCH_LEN			32
 #define REDISSPY_MAX_KEY_LEN			64
 #define REDISSPY_MAX_PATTERN_LEN		REDISSPY_MAX_KEY_LEN
 #define REDISSPY_MAX_VALUE_LEN			2048
@@ -15,12 +27,61 @@
 #define REDISSPY_DEFAULT_PORT			6379
 #define REDISSPY_DEFAULT_FILTER_PATTERN	"*"
 
+// Refresh batching
+#define REDISSPY_PIPELINE_BATCH_SIZE	64
+#define REDISSPY_SCAN_COUNT				1000
+
+// Members read per row for the value column. The detail view pages
+// through the rest.
+#define REDISSPY_PREVIEW_ELEMENTS		32
+
+// Connection management. A dropped connection is retried lazily on the
+// next command, backing off exponentially while the server stays away.
+#define REDISSPY_CONNECT_TIMEOUT_MS		2000
+#define REDISSPY_COMMAND_TIMEOUT_MS		5000
+#define REDISSPY_RECONNECT_MIN_MS		250
+#define REDISSPY_RECONNECT_MAX_MS		8000
+
+// Most keys a command can touch before a full refresh is cheaper
+#define REDISSPY_MAX_TOUCHED_KEYS		64
+
+// How row metadata is collected. The script probe reads type, length,
+// TTL, encoding and preview for a whole batch in one EVALSHA; pipelined
+// commands are the default and the fallback when scripting is off.
+#define REDISSPY_PROBE_PIPELINE			0
+#define REDISSPY_PROBE_SCRIPT			1
+
+// Preview cache. Previews can be dropped to stay under a memory budget;
+// a dropped preview is read again when its row is next on screen.
+#define REDISSPY_VALUE_LOADED			0
+#define REDISSPY_VALUE_EVICTED			1
+#define REDISSPY_VALUE_REQUESTED		2
+
+// The -M budget covers previews and detail view pages together. The
+// detail view gets this fraction of it, the previews the rest.
+// Comfortably more than a screen of previews.
+#define REDISSPY_MIN_VALUE_BUDGET		(1024 * 1024)
+#define REDISSPY_DEFAULT_VALUE_BUDGET_MB	64
+#define REDISSPY_DETAIL_BUDGET_SHARE	4
+
+// Row types and encodings are kept as indexes into small tables of the
+// names seen so far. Index 0 is "" (not read yet); 1 is "none" (gone).
+#define REDISSPY_MAX_NAMES				64
+#define REDISSPY_TYPE_UNKNOWN			0
+#define REDISSPY_TYPE_NONE				1
+
+// A row's key is an id in the front-coded key store, or this bit and
+// an offset into the tail of keys added since the store was built
+#define REDISSPY_KEY_TAIL				0x80000000u
+
 #define sortByKey		1
 #define sortByType		2
 #define sortByLength	3
 #define sortByValue		4
 
 
+// One row as it is read from the server, in batches. The model keeps its
+// rows as columns instead; see REDIS.
 typedef struct
 {
 	char	type[REDISSPY_MAX_TYPE_LEN];
@@ -28,31 +89,166 @@ typedef struct
 	int		length;
 	char	value[REDISSPY_MAX_VALUE_LEN];
 
-	// For detail items
-	redisReply*	reply;
+	long long	ttl;		// PTTL in ms, or -1 if the key does not expire
+	char		encoding[REDISSPY_MAX_ENCODING_LEN];
+	long long	memory;		// MEMORY USAGE in bytes, or -1 if unknown
+
+	// Where the value search matched, if one is active
+	char		match[REDISSPY_MAX_MATCH_LEN];
+
+	// Keyspace scan that last saw this key
+	unsigned int	generation;
 
 } REDISDATA;
 
 
 typedef struct
 {
-	REDISDATA*		data;
+	char			names[REDISSPY_MAX_NAMES][REDISSPY_MAX_ENCODING_LEN];
+	unsigned int	count;
+} REDISNAMES;
+
+
+typedef struct
+{
+	// Loaded rows, a column per field, so a pass over one field (a
+	// filter, a sort, a count) reads only that field.
+	//
+	// Keys are front-coded in sorted order in keyStore. Keys added since
+	// go in keyTail as they are; once the tail outgrows the store, or
+	// most of the store belongs to removed rows, the rows' keys are
+	// merged into a new store. Row i's key is keyRefs[i] (see
+	// REDISSPY_KEY_TAIL). Comparing two store ids compares the keys.
+	SPY_KEYS*		keyStore;
+	unsigned int	keyStoreRows;	// rows whose key is in the store
+	char*			keyTail;
+	size_t			keyTailLength;
+	size_t			keyTailCapacity;
+	unsigned int*	keyRefs;
+	unsigned char*	types;			// into typeNames
+	int*			lengths;
+	long long*		ttls;
+	long long*		memory;
+	unsigned char*	encodings;		// into encodingNames
+	char**			values;			// NULL for an empty preview
+	unsigned int*	valueUsed;		// pass the row was last on screen, 0 if never
+	unsigned char*	valueStates;	// REDISSPY_VALUE_*
+	char**			matches;		// NULL unless the value search matched
+	unsigned int*	generations;
+	size_t			valueBytes;
+
+	// Preview cache. Once valueBytes passes valueBudget (0 for no cap),
+	// previews are dropped, least recently on screen first and never
+	// shown before that, until it is back under seven eighths of it.
+	// Rows on screen in the latest pass (valueClock) keep theirs.
+	// valueBudget and detailBudget are memoryBudget's two shares.
+	size_t			memoryBudget;
+	size_t			valueBudget;
+	size_t			detailBudget;
+	unsigned int	valueClock;
+	unsigned int	valueHits;		// rows coming on screen with a preview
+	unsigned int	valueMisses;	// ... and with a dropped one
+	unsigned int	valueEvictions;
+
+	REDISNAMES		typeNames;
+	REDISNAMES		encodingNames;
+
+	// Loaded rows of each type, by index into typeNames, kept up to
+	// date as rows are stored and removed
+	unsigned int	typeCounts[REDISSPY_MAX_NAMES];
+
 	unsigned int	keyCount;
+	unsigned int	keyCapacity;
 	unsigned int	longestKeyLength;
 
+	// Open-addressed hash of key -> row + 1. Sorting and removing
+	// rows invalidate it; it is rebuilt on the next lookup.
+	unsigned int*	keyIndex;
+	unsigned int	keyIndexSize;
+	int				keyIndexValid;
+
+	unsigned int	generation;
+
+	// SCAN ... MATCH. keyPattern is the one asked for (-k, p); pattern
+	// is what is scanned: keyPattern, or the query's key glob where that
+	// only narrows it.
+	char			keyPattern[REDISSPY_MAX_PATTERN_LEN];
 	char			pattern[REDISSPY_MAX_PATTERN_LEN];
 
+	// SCAN ... TYPE, or empty for every type: typeFilter if it is set,
+	// otherwise a type the query needs. Servers before 6.0 reject TYPE;
+	// after that scans leave it out and rows of other types are dropped
+	// as they are merged.
+	char			typeFilter[REDISSPY_MAX_ENCODING_LEN];
+	char			scanType[REDISSPY_MAX_ENCODING_LEN];
+	int				scanTypeUnsupported;
+
+	// Local filter over the loaded rows. While it or the query is set
+	// the window shows view[0..viewCount), row numbers in display order.
+	// Adding, removing or moving rows invalidates the view; it is rebuilt
+	// on the next access.
+	char			filter[REDISSPY_MAX_PATTERN_LEN];
+	SPY_GLOB		filterGlob;
+	SPY_QUERY*		query;
+	unsigned int*	view;
+	int*			viewIndex;		// row -> index in view, -1 if hidden
+	unsigned int	viewCount;
+	unsigned int	viewCapacity;
+	int				viewValid;
+	unsigned int	viewDropped;	// left out: the query reads values they lost
+
+	// Trigram index of the loaded key names for the goto prompt, or
+	// NULL until it is first wanted. Loaded keys are added as they
+	// arrive and posted by redisSpyIndexKeys between keystrokes.
+	SPY_TRIGRAM*	trigrams;
+
+	// Namespace tree over the loaded rows, or NULL until the tree view
+	// is first opened. Rows are added to and taken from it as they are
+	// appended, updated and removed.
+	SPY_TREE*		tree;
+	char			treeDelimiter[SPY_TREE_MAX_DELIMITER_LEN];
+
+	// Key templates over the loaded rows, or NULL until the template
+	// view is first opened. Kept up to date the same way as the tree.
+	SPY_SCHEMA*		schema;
+
+	// Value search. Keyspace scans keep only keys whose values match.
+	char			search[REDISSPY_MAX_PATTERN_LEN];
+	char			searchSha[48];
+
 	int				infoConnectedClients;
 	char			infoUsedMemoryHuman[32];
 
+	// Keyspace scan in flight, if any
+	int				scanInProgress;
+	unsigned int	scanProgress;	// tenths of a percent
+	long long		scanDbSize;
+
 	int				sortBy;
 	int				sortReverse;
 
+	// Rows [0, sortedRows) are in order. Rows a scan merges are appended
+	// after them and sorted in later, a batch at a time; sortDirty means
+	// a scan also changed rows already in order.
+	unsigned int	sortedRows;
+	int				sortDirty;
+	long long		sortAfter;		// ms since the epoch
+
 	int				refreshInterval;
 
 	char			host[REDISSPY_MAX_HOST_LEN];
 	unsigned int	port;
+	char			socketPath[REDISSPY_MAX_SOCKET_PATH_LEN];	// set for a Unix socket
 	redisContext*	context;
+
+	// Reconnect backoff
+	unsigned int	connectFailures;
+	long long		connectRetryAt;		// ms since the epoch
+
+	// Row probe. The script is loaded once per connection.
+	int				probeMode;
+	char			probeSha[48];
+	int				scriptingDisabled;
 } REDIS;
 
 
@@ -67,6 +263,7 @@ typedef struct
 	} 
 
 
+// Row comparisons. thunk is the REDIS and a and b point at row numbers.
 DECLARE_COMPARE_FN(compareKeys, thunk, a, b);
 DECLARE_COMPARE_FN(compareTypes, thunk, a, b);
 DECLARE_COMPARE_FN(compareLengths, thunk, a, b);
@@ -78,9 +275,29 @@ REDIS* redisSpyCreate();
 void redisSpyDelete(REDIS* r);
 
 int redisSpyConnect(REDIS* r, char* host, unsigned int port);
+int redisSpyConnectUnix(REDIS* r, char* path);
+int redisSpyEnsureConnected(REDIS* r);
+void redisSpyCheckConnection(REDIS* r);
+void redisSpyServerAddress(REDIS* r, char* buffer, unsigned int size);
 int redisSpyServerClearCache(REDIS* redis);
 int redisSpyServerRefresh(REDIS* redis);
+int redisSpyServerRefreshInfo(REDIS* redis);
+int redisSpyServerRefreshRange(REDIS* redis, unsigned int first, unsigned int count);
+int redisSpyServerRefreshRows(REDIS* redis, REDISDATA* rows, unsigned int count);
+int redisSpyServerScan(REDIS* redis, char* cursor, unsigned int cursorSize);
+long long redisSpyServerDbSize(REDIS* redis);
+int redisSpyServerCommandKeys(REDIS* redis, char* command,
+							  char keys[][REDISSPY_MAX_KEY_LEN], unsigned int maxKeys);
+
+// Merging rows fetched elsewhere
+int redisSpyFindKey(REDIS* redis, const char* key);
+void redisSpyMergeRows(REDIS* redis, REDISDATA* rows, unsigned int count, int insert);
+void redisSpySpliceRows(REDIS* redis, REDISDATA* rows, unsigned int count);
+int redisSpyKeyMatchesPattern(REDIS* redis, const char* key);
+unsigned int redisSpyBeginGeneration(REDIS* redis);
+void redisSpyEndGeneration(REDIS* redis);
 void redisSpySort(REDIS* redis, int newSortBy);
+void redisSpySortNewRows(REDIS* redis, int force);
 int redisSpyServerRefreshKey(REDIS* redis, REDISDATA* data);
 
 redisReply* redisSpyGetServerResponse(REDIS* redis, char* command);
@@ -90,9 +307,61 @@ void redisSpyDump(REDIS* redis, char* delimiter, int unaligned);
 
 unsigned int redisSpyKeyCount(REDIS* redis);
 unsigned int redisSpyLongestKeyLength(REDIS* redis);
-char* redisSpyKeyAtIndex(REDIS* redis, unsigned int index);
+// Copy a key into buffer, which holds REDISSPY_MAX_KEY_LEN. Returns buffer.
+const char* redisSpyKeyAtIndex(REDIS* redis, unsigned int index, char* buffer);
+
+// Row columns, by row number
+const char* redisSpyRowType(REDIS* redis, unsigned int row);
+int redisSpyRowLength(REDIS* redis, unsigned int row);
+long long redisSpyRowTtl(REDIS* redis, unsigned int row);
+long long redisSpyRowMemory(REDIS* redis, unsigned int row);
+const char* redisSpyRowEncoding(REDIS* redis, unsigned int row);
+const char* redisSpyRowValue(REDIS* redis, unsigned int row);
+int redisSpyRowValueDropped(REDIS* redis, unsigned int row);
+unsigned int redisSpyDroppedValueCount(REDIS* redis);
+const char* redisSpyRowMatch(REDIS* redis, unsigned int row);
+void redisSpyGetRow(REDIS* redis, unsigned int row, REDISDATA* data);
+
+// Drop the loaded rows but keep their storage
+void redisSpyResetRows(REDIS* redis);
+
+// Bytes held by the loaded rows, and by their key names alone
+size_t redisSpyRowStoreMemory(REDIS* redis);
+size_t redisSpyKeyMemory(REDIS* redis);
+
+// Preview cache. Touching the rows on screen marks them used and
+// returns those whose previews were dropped, into evicted, to be read
+// again; it counts hits and misses for rows that just came on screen.
+void redisSpySetValueBudget(REDIS* redis, size_t bytes);
+unsigned int redisSpyTouchRows(REDIS* redis, const unsigned int* rows, unsigned int count,
+							   unsigned int* evicted);
+
+// Local filter
+int redisSpySetFilter(REDIS* redis, const char* filter);
+int redisSpyFilterIsLoaded(REDIS* redis, const char* filter);
+void redisSpySetQuery(REDIS* redis, SPY_QUERY* query);
+
+// "hash 12, list 3", the loaded keys of each type
+void redisSpyFormatTypeCounts(REDIS* redis, char* buffer, unsigned int size);
+unsigned int redisSpyViewCount(REDIS* redis);
+int redisSpyViewRow(REDIS* redis, unsigned int index);
+int redisSpyViewIndexOfRow(REDIS* redis, unsigned int row);
+
+// Find text (/) in every row's key and preview: found[row] is one of
+#define REDISSPY_FIND_MISS				0
+#define REDISSPY_FIND_HIT				1
+#define REDISSPY_FIND_DROPPED			2	// not in the key; preview dropped
+void redisSpyFindText(REDIS* redis, const char* text, unsigned char* found);
+
+// Key name index
+void redisSpyEnableKeyIndex(REDIS* redis);
+int redisSpyIndexKeys(REDIS* redis, unsigned int budgetMs);
+
+// Namespace tree
+void redisSpyEnableTree(REDIS* redis);
+void redisSpySetTreeDelimiter(REDIS* redis, const char* delimiter);
 
-int redisSpyDetailElementCount(REDISDATA* data);
-int redisSpyDetailElementAtIndex(REDISDATA* data, unsigned int index, char* buffer, unsigned int size);
+void redisSpyEnableSchema(REDIS* redis);
 
 
+#endif
@@ -0,0 +1,715 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "spyquery.h"
+
+// Rows per pass of the program, and when to split the rows across threads
+#define SPY_QUERY_BLOCK				1024
+#define SPY_QUERY_PARALLEL_ROWS		65536
+#define SPY_QUERY_THREADS			4
+
+
+////////////////////////////////////////////////////////////////////////
+// Parser
+//
+//   or         := and ( "||" and )*
+//   and        := not ( "&&" not )*
+//   not        := "!" not | "(" or ")" | comparison
+//   comparison := field op value
+
+typedef struct _spy_query_parser
+{
+	SPY_QUERY*		q;
+	const char*		p;
+	unsigned int	depth;		// of the evaluation stack so far
+	char*			error;
+	unsigned int	errorSize;
+	int				failed;
+} SPY_QUERY_PARSER;
+
+
+static const struct
+{
+	const char*		name;
+	unsigned char	field;
+} g_spyQueryFields[] =
+{
+	{ "key",		SPY_QUERY_FIELD_KEY },
+	{ "value",		SPY_QUERY_FIELD_VALUE },
+	{ "type",		SPY_QUERY_FIELD_TYPE },
+	{ "enc",		SPY_QUERY_FIELD_ENCODING },
+	{ "encoding",	SPY_QUERY_FIELD_ENCODING },
+	{ "len",		SPY_QUERY_FIELD_LENGTH },
+	{ "length",		SPY_QUERY_FIELD_LENGTH },
+	{ "ttl",		SPY_QUERY_FIELD_TTL },
+	{ "mem",		SPY_QUERY_FIELD_MEMORY },
+	{ "memory",		SPY_QUERY_FIELD_MEMORY }
+};
+
+// Longest first, so "<=" is not read as "<"
+static const struct
+{
+	const char*		text;
+	unsigned char	compare;
+} g_spyQueryOperators[] =
+{
+	{ "==",	SPY_QUERY_EQ },
+	{ "!=",	SPY_QUERY_NE },
+	{ "<=",	SPY_QUERY_LE },
+	{ ">=",	SPY_QUERY_GE },
+	{ "!~",	SPY_QUERY_NO_MATCH },
+	{ "=",	SPY_QUERY_EQ },
+	{ "<",	SPY_QUERY_LT },
+	{ ">",	SPY_QUERY_GT },
+	{ "~",	SPY_QUERY_MATCH }
+};
+
+
+static void spyQueryFail(SPY_QUERY_PARSER* parser, const char* message)
+{
+	if (parser->failed)
+		return;
+
+	parser->failed = 1;
+
+	snprintf(parser->error, parser->errorSize, "%s at column %d.",
+			 message, (int)(parser->p - parser->q->text) + 1);
+}
+
+
+static void spyQuerySkipSpace(SPY_QUERY_PARSER* parser)
+{
+	while (isspace((unsigned char)*parser->p))
+		parser->p++;
+}
+
+
+// Skip the token if it is next
+static int spyQueryAccept(SPY_QUERY_PARSER* parser, const char* token)
+{
+	size_t length = strlen(token);
+
+	spyQuerySkipSpace(parser);
+
+	if (strncmp(parser->p, token, length) != 0)
+		return 0;
+
+	parser->p += length;
+
+	return 1;
+}
+
+
+static SPY_QUERY_OP* spyQueryEmit(SPY_QUERY_PARSER* parser, unsigned char code)
+{
+	SPY_QUERY* q = parser->q;
+
+	if (q->opCount == SPY_QUERY_MAX_OPS)
+	{
+		spyQueryFail(parser, "Query too long");
+		return NULL;
+	}
+
+	if (code == SPY_QUERY_OP_TEST)
+		parser->depth++;
+	else if (code != SPY_QUERY_OP_NOT)
+		parser->depth--;
+
+	if (parser->depth > SPY_QUERY_MAX_DEPTH)
+	{
+		spyQueryFail(parser, "Query nested too deeply");
+		return NULL;
+	}
+
+	SPY_QUERY_OP* op = &q->ops[q->opCount++];
+
+	memset(op, 0, sizeof(SPY_QUERY_OP));
+	op->code = code;
+
+	return op;
+}
+
+
+// A quoted string, or a bare word up to a space, paren, & or |
+static int spyQueryParseString(SPY_QUERY_PARSER* parser, char* buffer, unsigned int size)
+{
+	unsigned int length = 0;
+	int quoted = (*parser->p == '"');
+
+	if (quoted)
+		parser->p++;
+
+	while (*parser->p)
+	{
+		char c = *parser->p;
+
+		if (quoted)
+		{
+			if (c == '"')
+				break;
+
+			if ((c == '\\') && (parser->p[1] != '\0'))
+				c = *++parser->p;
+		}
+		else if (isspace((unsigned char)c) || strchr("()&|\"", c))
+		{
+			break;
+		}
+
+		if (length + 1 == size)
+		{
+			spyQueryFail(parser, "String too long");
+			return -1;
+		}
+
+		buffer[length++] = c;
+		parser->p++;
+	}
+
+	buffer[length] = '\0';
+
+	if (quoted)
+	{
+		if (*parser->p != '"')
+		{
+			spyQueryFail(parser, "Missing closing quote");
+			return -1;
+		}
+
+		parser->p++;
+	}
+	else if (length == 0)
+	{
+		spyQueryFail(parser, "Expected a value");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int spyQueryParseNumber(SPY_QUERY_PARSER* parser, long long* number)
+{
+	char* end;
+
+	*number = strtoll(parser->p, &end, 10);
+
+	if (end == parser->p)
+	{
+		spyQueryFail(parser, "Expected a number");
+		return -1;
+	}
+
+	parser->p = end;
+
+	switch (*parser->p)
+	{
+		case 'g': case 'G': *number *= 1024;	// fall through
+		case 'm': case 'M': *number *= 1024;	// fall through
+		case 'k': case 'K': *number *= 1024;
+			parser->p++;
+			break;
+	}
+
+	return 0;
+}
+
+
+static void spyQueryParseOr(SPY_QUERY_PARSER* parser);
+
+static void spyQueryParseComparison(SPY_QUERY_PARSER* parser)
+{
+	SPY_QUERY* q = parser->q;
+	const char* start;
+	int field = -1;
+	int compare = -1;
+
+	spyQuerySkipSpace(parser);
+	start = parser->p;
+
+	while (isalpha((unsigned char)*parser->p))
+		parser->p++;
+
+	for (unsigned int i = 0; i < sizeof(g_spyQueryFields) / sizeof(g_spyQueryFields[0]); i++)
+	{
+		if (   (strlen(g_spyQueryFields[i].name) == (size_t)(parser->p - start))
+			&& (strncmp(g_spyQueryFields[i].name, start, parser->p - start) == 0))
+		{
+			field = g_spyQueryFields[i].field;
+		}
+	}
+
+	if (field < 0)
+	{
+		parser->p = start;
+		spyQueryFail(parser, "Expected key, value, type, enc, len, ttl or mem");
+		return;
+	}
+
+	for (unsigned int i = 0; i < sizeof(g_spyQueryOperators) / sizeof(g_spyQueryOperators[0]); i++)
+	{
+		if (spyQueryAccept(parser, g_spyQueryOperators[i].text))
+		{
+			compare = g_spyQueryOperators[i].compare;
+			break;
+		}
+	}
+
+	if (compare < 0)
+	{
+		spyQueryFail(parser, "Expected a comparison");
+		return;
+	}
+
+	int numeric = (field >= SPY_QUERY_FIELD_LENGTH);
+	int names = (field == SPY_QUERY_FIELD_TYPE) || (field == SPY_QUERY_FIELD_ENCODING);
+
+	if (   (numeric && (compare >= SPY_QUERY_MATCH))
+		|| (!numeric && (compare != SPY_QUERY_EQ) && (compare != SPY_QUERY_NE) && (compare < SPY_QUERY_MATCH))
+		|| (names && (compare >= SPY_QUERY_MATCH)))
+	{
+		spyQueryFail(parser, "Comparison doesn't apply to the field");
+		return;
+	}
+
+	SPY_QUERY_OP* op = spyQueryEmit(parser, SPY_QUERY_OP_TEST);
+
+	if (op == NULL)
+		return;
+
+	op->field = field;
+	op->compare = compare;
+
+	spyQuerySkipSpace(parser);
+
+	if (numeric)
+	{
+		if (spyQueryParseNumber(parser, &op->number) != 0)
+			return;
+
+		// Seconds, and any negative value means "does not expire"
+		if (field == SPY_QUERY_FIELD_TTL)
+			op->number = (op->number < 0) ? -1 : op->number * 1000;
+
+		return;
+	}
+
+	if (spyQueryParseString(parser, op->text, sizeof(op->text)) != 0)
+		return;
+
+	if (compare >= SPY_QUERY_MATCH)
+	{
+		if (q->globCount == SPY_QUERY_MAX_GLOBS)
+		{
+			spyQueryFail(parser, "Too many patterns");
+			return;
+		}
+
+		if (spyGlobCompile(&q->globs[q->globCount], op->text) != 0)
+		{
+			spyQueryFail(parser, "Pattern too long");
+			return;
+		}
+
+		op->glob = q->globCount++;
+	}
+}
+
+
+static void spyQueryParseNot(SPY_QUERY_PARSER* parser)
+{
+	if (parser->failed)
+		return;
+
+	if (spyQueryAccept(parser, "!"))
+	{
+		spyQueryParseNot(parser);
+		spyQueryEmit(parser, SPY_QUERY_OP_NOT);
+	}
+	else if (spyQueryAccept(parser, "("))
+	{
+		spyQueryParseOr(parser);
+
+		if (!parser->failed && !spyQueryAccept(parser, ")"))
+			spyQueryFail(parser, "Expected )");
+	}
+	else
+	{
+		spyQueryParseComparison(parser);
+	}
+}
+
+
+static void spyQueryParseAnd(SPY_QUERY_PARSER* parser)
+{
+	spyQueryParseNot(parser);
+
+	while (!parser->failed && spyQueryAccept(parser, "&&"))
+	{
+		spyQueryParseNot(parser);
+		spyQueryEmit(parser, SPY_QUERY_OP_AND);
+	}
+}
+
+
+static void spyQueryParseOr(SPY_QUERY_PARSER* parser)
+{
+	spyQueryParseAnd(parser);
+
+	while (!parser->failed && spyQueryAccept(parser, "||"))
+	{
+		spyQueryParseAnd(parser);
+		spyQueryEmit(parser, SPY_QUERY_OP_OR);
+	}
+}
+
+
+// A comparison that must hold for every match is one reached from the
+// root through && alone
+static void spyQueryFindPushDown(SPY_QUERY* q)
+{
+	int parent[SPY_QUERY_MAX_OPS];
+	unsigned int stack[SPY_QUERY_MAX_DEPTH];
+	unsigned int top = 0;
+
+	for (unsigned int i = 0; i < q->opCount; i++)
+	{
+		parent[i] = -1;
+
+		switch (q->ops[i].code)
+		{
+			case SPY_QUERY_OP_NOT:
+				parent[stack[top - 1]] = i;
+				stack[top - 1] = i;
+				break;
+
+			case SPY_QUERY_OP_AND:
+			case SPY_QUERY_OP_OR:
+				parent[stack[--top]] = i;
+				parent[stack[top - 1]] = i;
+				stack[top - 1] = i;
+				break;
+
+			default:
+				stack[top++] = i;
+				break;
+		}
+	}
+
+	for (unsigned int i = 0; i < q->opCount; i++)
+	{
+		SPY_QUERY_OP* op = &q->ops[i];
+		int p = parent[i];
+
+		if (op->code != SPY_QUERY_OP_TEST)
+			continue;
+
+		while ((p >= 0) && (q->ops[p].code == SPY_QUERY_OP_AND))
+			p = parent[p];
+
+		if (p >= 0)
+			continue;
+
+		if (   (op->field == SPY_QUERY_FIELD_KEY) && (op->compare == SPY_QUERY_MATCH)
+			&& (q->pattern[0] == '\0'))
+		{
+			snprintf(q->pattern, sizeof(q->pattern), "%s", op->text);
+		}
+		else if (   (op->field == SPY_QUERY_FIELD_TYPE) && (op->compare == SPY_QUERY_EQ)
+				 && (q->type[0] == '\0'))
+		{
+			snprintf(q->type, sizeof(q->type), "%s", op->text);
+		}
+	}
+}
+
+
+SPY_QUERY* spyQueryCompile(const char* text, char* error, unsigned int errorSize)
+{
+	SPY_QUERY* q = calloc(1, sizeof(SPY_QUERY));
+	SPY_QUERY_PARSER parser;
+
+	snprintf(q->text, sizeof(q->text), "%s", text);
+
+	memset(&parser, 0, sizeof(parser));
+	parser.q = q;
+	parser.p = q->text;
+	parser.error = error;
+	parser.errorSize = errorSize;
+
+	spyQueryParseOr(&parser);
+	spyQuerySkipSpace(&parser);
+
+	if (!parser.failed && (*parser.p != '\0'))
+		spyQueryFail(&parser, "Expected && or ||");
+
+	if (parser.failed)
+	{
+		free(q);
+		return NULL;
+	}
+
+	spyQueryFindPushDown(q);
+
+	return q;
+}
+
+
+void spyQueryDelete(SPY_QUERY* q)
+{
+	free(q);
+}
+
+
+int spyQueryReadsValues(const SPY_QUERY* q)
+{
+	for (unsigned int k = 0; k < q->opCount; k++)
+	{
+		if ((q->ops[k].code == SPY_QUERY_OP_TEST) && (q->ops[k].field == SPY_QUERY_FIELD_VALUE))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Evaluation
+
+#define SPY_QUERY_COMPARE_COLUMN(column, value, compare, n, out) \
+	switch (compare) \
+	{ \
+		case SPY_QUERY_EQ: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] == value); break; \
+		case SPY_QUERY_NE: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] != value); break; \
+		case SPY_QUERY_LT: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] <  value); break; \
+		case SPY_QUERY_LE: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] <= value); break; \
+		case SPY_QUERY_GT: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] >  value); break; \
+		case SPY_QUERY_GE: for (unsigned int i = 0; i < n; i++) out[i] = (column[i] >= value); break; \
+	}
+
+
+// name is the index of the op's type or encoding in the rows' table,
+// or -1 if no row has it
+static void spyQueryTest(const SPY_QUERY* q, const SPY_QUERY_OP* op, int name,
+						 const SPY_QUERY_ROWS* rows, unsigned int first, unsigned int n,
+						 unsigned char* out)
+{
+	switch (op->field)
+	{
+		case SPY_QUERY_FIELD_LENGTH:
+		{
+			const int* column = rows->lengths + first;
+			SPY_QUERY_COMPARE_COLUMN(column, op->number, op->compare, n, out);
+			break;
+		}
+
+		case SPY_QUERY_FIELD_TTL:
+		{
+			const long long* column = rows->ttls + first;
+			SPY_QUERY_COMPARE_COLUMN(column, op->number, op->compare, n, out);
+			break;
+		}
+
+		case SPY_QUERY_FIELD_MEMORY:
+		{
+			const long long* column = rows->memory + first;
+			SPY_QUERY_COMPARE_COLUMN(column, op->number, op->compare, n, out);
+			break;
+		}
+
+		case SPY_QUERY_FIELD_TYPE:
+		case SPY_QUERY_FIELD_ENCODING:
+		{
+			const unsigned char* column = (op->field == SPY_QUERY_FIELD_TYPE)
+										  ? rows->types + first
+										  : rows->encodings + first;
+
+			if (name < 0)
+				memset(out, op->compare == SPY_QUERY_NE, n);
+			else
+				SPY_QUERY_COMPARE_COLUMN(column, name, op->compare, n, out);
+
+			break;
+		}
+
+		default:
+		{
+			const SPY_GLOB* glob = &q->globs[op->glob];
+			char key[SPY_QUERY_MAX_KEY_LEN];
+
+			for (unsigned int i = 0; i < n; i++)
+			{
+				const char* s;
+
+				if (op->field == SPY_QUERY_FIELD_KEY)
+					s = rows->key(rows->keyContext, first + i, key);
+				else
+					s = rows->values[first + i] ? rows->values[first + i] : "";
+
+				switch (op->compare)
+				{
+					case SPY_QUERY_EQ:			out[i] = (strcmp(s, op->text) == 0); break;
+					case SPY_QUERY_NE:			out[i] = (strcmp(s, op->text) != 0); break;
+					case SPY_QUERY_MATCH:		out[i] = spyGlobMatch(glob, s); break;
+					case SPY_QUERY_NO_MATCH:	out[i] = !spyGlobMatch(glob, s); break;
+				}
+			}
+
+			break;
+		}
+	}
+}
+
+
+static void spyQueryRunBlock(const SPY_QUERY* q, const int* names, const SPY_QUERY_ROWS* rows,
+							 unsigned int first, unsigned int n, unsigned char* match)
+{
+	unsigned char stack[SPY_QUERY_MAX_DEPTH][SPY_QUERY_BLOCK];
+	unsigned int top = 0;
+
+	for (unsigned int k = 0; k < q->opCount; k++)
+	{
+		const SPY_QUERY_OP* op = &q->ops[k];
+
+		if (op->code == SPY_QUERY_OP_TEST)
+		{
+			spyQueryTest(q, op, names[k], rows, first, n, stack[top++]);
+			continue;
+		}
+
+		if (op->code != SPY_QUERY_OP_NOT)
+			top--;
+
+		unsigned char* a = stack[top - 1];
+		unsigned char* b = stack[top];
+
+		switch (op->code)
+		{
+			case SPY_QUERY_OP_AND:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] &= b[i];
+				break;
+
+			case SPY_QUERY_OP_OR:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] |= b[i];
+				break;
+
+			case SPY_QUERY_OP_NOT:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] ^= 1;
+				break;
+		}
+	}
+
+	memcpy(match + first, stack[0], n);
+}
+
+
+typedef struct _spy_query_task
+{
+	const SPY_QUERY*		q;
+	const int*				names;
+	const SPY_QUERY_ROWS*	rows;
+	unsigned int			first;
+	unsigned int			last;
+	unsigned char*			match;
+	pthread_t				thread;
+	int						started;
+} SPY_QUERY_TASK;
+
+
+static void* spyQueryRunTask(void* arg)
+{
+	SPY_QUERY_TASK* t = (SPY_QUERY_TASK*)arg;
+
+	for (unsigned int first = t->first; first < t->last; first += SPY_QUERY_BLOCK)
+	{
+		unsigned int n = t->last - first;
+
+		if (n > SPY_QUERY_BLOCK)
+			n = SPY_QUERY_BLOCK;
+
+		spyQueryRunBlock(t->q, t->names, t->rows, first, n, t->match);
+	}
+
+	return NULL;
+}
+
+
+static int spyQueryFindName(const char* const* table, unsigned int count, const char* name)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (strcmp(table[i], name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+
+void spyQueryEvaluate(const SPY_QUERY* q, const SPY_QUERY_ROWS* rows, unsigned char* match)
+{
+	SPY_QUERY_TASK tasks[SPY_QUERY_THREADS];
+	int names[SPY_QUERY_MAX_OPS];
+	unsigned int taskCount = 1;
+
+	// Look up each type and encoding once rather than per row
+	for (unsigned int k = 0; k < q->opCount; k++)
+	{
+		const SPY_QUERY_OP* op = &q->ops[k];
+
+		names[k] = -1;
+
+		if ((op->code == SPY_QUERY_OP_TEST) && (op->field == SPY_QUERY_FIELD_TYPE))
+			names[k] = spyQueryFindName(rows->typeNames, rows->typeNameCount, op->text);
+		else if ((op->code == SPY_QUERY_OP_TEST) && (op->field == SPY_QUERY_FIELD_ENCODING))
+			names[k] = spyQueryFindName(rows->encodingNames, rows->encodingNameCount, op->text);
+	}
+
+	if (rows->count >= SPY_QUERY_PARALLEL_ROWS)
+		taskCount = SPY_QUERY_THREADS;
+
+	// Whole blocks per task
+	unsigned int blocks = (rows->count + SPY_QUERY_BLOCK - 1) / SPY_QUERY_BLOCK;
+	unsigned int perTask = (blocks + taskCount - 1) / taskCount * SPY_QUERY_BLOCK;
+
+	for (unsigned int i = 0; i < taskCount; i++)
+	{
+		SPY_QUERY_TASK* t = &tasks[i];
+
+		t->q = q;
+		t->names = names;
+		t->rows = rows;
+		t->first = i * perTask;
+		t->last = (i + 1) * perTask;
+		t->match = match;
+		t->started = 0;
+
+		if (t->first > rows->count)
+			t->first = rows->count;
+
+		if (t->last > rows->count)
+			t->last = rows->count;
+
+		if (i > 0)
+			t->started = (pthread_create(&t->thread, NULL, spyQueryRunTask, t) == 0);
+	}
+
+	// The first task, and any whose thread didn't start, run here
+	for (unsigned int i = 0; i < taskCount; i++)
+	{
+		if (!tasks[i].started)
+			spyQueryRunTask(&tasks[i]);
+	}
+
+	for (unsigned int i = 1; i < taskCount; i++)
+	{
+		if (tasks[i].started)
+			pthread_join(tasks[i].thread, NULL);
+	}
+}
@@ -0,0 +1,115 @@
+#ifndef _SPYQUERY_H_
+#define _SPYQUERY_H_
+
+#include <stddef.h>
+
+#include "spyglob.h"
+
+// Queries over the loaded rows, such as
+//
+//     type==hash && len>10000 && ttl<0 && key~"cache:*"
+//
+// compiled once into postfix bytecode. Evaluation runs the program over
+// a block of rows at a time: each comparison is one tight loop over one
+// column, leaving a byte per row, and &&, || and ! combine those. Large
+// row counts are split across threads.
+//
+// Fields: key, value (the preview), type, enc[oding], len[gth], ttl
+// (seconds, -1 if the key does not expire) and mem[ory] (bytes, -1 if
+// unknown). Numbers take a K, M or G suffix (powers of 1024). Strings
+// are quoted or bare; ~ and !~ match a glob.
+//
+// Comparisons that the server can answer itself are noted for the
+// caller: a key glob or a type that every match must have.
+
+#define SPY_QUERY_MAX_OPS			64
+#define SPY_QUERY_MAX_DEPTH			16
+#define SPY_QUERY_MAX_GLOBS			8
+#define SPY_QUERY_MAX_STRING		64
+#define SPY_QUERY_MAX_TEXT			256
+#define SPY_QUERY_MAX_NAMES			64
+#define SPY_QUERY_MAX_KEY_LEN		256
+
+#define SPY_QUERY_OP_TEST			0
+#define SPY_QUERY_OP_AND			1
+#define SPY_QUERY_OP_OR				2
+#define SPY_QUERY_OP_NOT			3
+
+#define SPY_QUERY_FIELD_KEY			0
+#define SPY_QUERY_FIELD_VALUE		1
+#define SPY_QUERY_FIELD_TYPE		2
+#define SPY_QUERY_FIELD_ENCODING	3
+#define SPY_QUERY_FIELD_LENGTH		4
+#define SPY_QUERY_FIELD_TTL			5
+#define SPY_QUERY_FIELD_MEMORY		6
+
+#define SPY_QUERY_EQ				0
+#define SPY_QUERY_NE				1
+#define SPY_QUERY_LT				2
+#define SPY_QUERY_LE				3
+#define SPY_QUERY_GT				4
+#define SPY_QUERY_GE				5
+#define SPY_QUERY_MATCH				6
+#define SPY_QUERY_NO_MATCH			7
+
+typedef struct _spy_query_op
+{
+	unsigned char	code;
+	unsigned char	field;
+	unsigned char	compare;
+	unsigned char	glob;		// into globs, for MATCH and NO_MATCH
+	long long		number;
+	char			text[SPY_QUERY_MAX_STRING];
+} SPY_QUERY_OP;
+
+typedef struct _spy_query
+{
+	char			text[SPY_QUERY_MAX_TEXT];
+
+	SPY_QUERY_OP	ops[SPY_QUERY_MAX_OPS];
+	unsigned int	opCount;
+
+	SPY_GLOB		globs[SPY_QUERY_MAX_GLOBS];
+	unsigned int	globCount;
+
+	// For the server: every matching key matches pattern and has type.
+	// Empty if the query doesn't say.
+	char			pattern[SPY_QUERY_MAX_STRING];
+	char			type[SPY_QUERY_MAX_STRING];
+} SPY_QUERY;
+
+// The rows to evaluate over, as columns. Types and encodings are
+// indexes into the name tables.
+typedef struct _spy_query_rows
+{
+	unsigned int			count;
+
+	// Row i's key, copied into buffer (SPY_QUERY_MAX_KEY_LEN bytes) or
+	// not. Called from several threads at once.
+	const char*				(*key)(void* context, unsigned int row, char* buffer);
+	void*					keyContext;
+	char* const*			values;		// NULL entries read as ""
+	const unsigned char*	types;
+	const unsigned char*	encodings;
+	const int*				lengths;
+	const long long*		ttls;		// ms
+	const long long*		memory;
+
+	const char*				typeNames[SPY_QUERY_MAX_NAMES];
+	unsigned int			typeNameCount;
+	const char*				encodingNames[SPY_QUERY_MAX_NAMES];
+	unsigned int			encodingNameCount;
+} SPY_QUERY_ROWS;
+
+
+// Returns NULL and describes the problem in error if text doesn't parse
+SPY_QUERY* spyQueryCompile(const char* text, char* error, unsigned int errorSize);
+void spyQueryDelete(SPY_QUERY* q);
+
+// Whether any test is on the value column
+int spyQueryReadsValues(const SPY_QUERY* q);
+
+// Set match[i] to 1 for each row the query matches, 0 for the others
+void spyQueryEvaluate(const SPY_QUERY* q, const SPY_QUERY_ROWS* rows, unsigned char* match);
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "spyqueue.h"
+
+SPY_QUEUE* spyQueueCreate(unsigned int size)
+{
+	SPY_QUEUE* q = malloc(sizeof(SPY_QUEUE));
+
+	// Round up to a power of two so indexes wrap with a mask
+	unsigned int capacity = 2;
+	while (capacity < size)
+		capacity <<= 1;
+
+	q->slots = calloc(capacity, sizeof(void*));
+	q->mask = capacity - 1;
+	q->head = 0;
+	q->tail = 0;
+
+	return q;
+}
+
+
+void spyQueueDelete(SPY_QUEUE* q)
+{
+	free(q->slots);
+	free(q);
+}
+
+
+// Producer side. Returns -1 if the ring is full.
+int spyQueuePush(SPY_QUEUE* q, void* item)
+{
+	unsigned int tail = SPY_ATOMIC_LOAD_RELAXED(&q->tail);
+	unsigned int head = SPY_ATOMIC_LOAD(&q->head);
+
+	if (tail - head > q->mask)
+		return -1;
+
+	q->slots[tail & q->mask] = item;
+
+	// Publish the slot before the new tail
+	SPY_ATOMIC_STORE(&q->tail, tail + 1);
+
+	return 0;
+}
+
+
+// Consumer side. Returns NULL if the ring is empty.
+void* spyQueuePop(SPY_QUEUE* q)
+{
+	unsigned int head = SPY_ATOMIC_LOAD_RELAXED(&q->head);
+	unsigned int tail = SPY_ATOMIC_LOAD(&q->tail);
+
+	if (head == tail)
+		return NULL;
+
+	void* item = q->slots[head & q->mask];
+
+	// Release the slot back to the producer
+	SPY_ATOMIC_STORE(&q->head, head + 1);
+
+	return item;
+}
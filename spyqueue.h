@@ -0,0 +1,33 @@
+#ifndef _SPYQUEUE_H_
+#define _SPYQUEUE_H_
+
+#include "spyutils.h"
+
+// Lock-free single-producer/single-consumer ring of pointers.
+// Exactly one thread may push and exactly one other thread may pop.
+// head and tail sit on separate cache lines so the two threads
+// do not false-share.
+
+#define SPY_QUEUE_CACHE_LINE	64
+
+typedef struct _spy_queue
+{
+	void**			slots;
+	unsigned int	mask;
+
+	char			pad0[SPY_QUEUE_CACHE_LINE];
+	unsigned int	head;	// next slot to pop, written by the consumer
+	char			pad1[SPY_QUEUE_CACHE_LINE];
+	unsigned int	tail;	// next slot to push, written by the producer
+	char			pad2[SPY_QUEUE_CACHE_LINE];
+
+} SPY_QUEUE;
+
+
+SPY_QUEUE* spyQueueCreate(unsigned int size);
+void spyQueueDelete(SPY_QUEUE* q);
+
+int spyQueuePush(SPY_QUEUE* q, void* item);
+void* spyQueuePop(SPY_QUEUE* q);
+
+#endif
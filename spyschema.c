@@ -0,0 +1,700 @@
+#include <sys/param.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spyutils.h"
+#include "spystats.h"
+#include "spyschema.h"
+
+
+static const char* g_spySchemaClassNames[] =
+{
+	"", "{int}", "{hex}", "{uuid}", "{date}", "{id}", "{str}"
+};
+
+static const char* g_spySchemaTypeNames[] =
+{
+	"string", "list", "set", "zset", "hash", "stream", "other"
+};
+
+
+static void spySchemaInit(SPY_SCHEMA* s)
+{
+	s->nodeCapacity = 256;
+	s->nodes = calloc(s->nodeCapacity, sizeof(SPY_SCHEMA_NODE));
+	s->nodeCount = 1;
+	s->nodes[0].stats = -1;
+
+	s->childrenSize = 512;
+	s->children = calloc(s->childrenSize, sizeof(unsigned int));
+
+	s->statsCapacity = 16;
+	s->stats = calloc(s->statsCapacity, sizeof(SPY_SCHEMA_STATS));
+	s->statsCount = 1;
+}
+
+
+SPY_SCHEMA* spySchemaCreate(void)
+{
+	SPY_SCHEMA* s = malloc(sizeof(SPY_SCHEMA));
+
+	memset(s, 0, sizeof(SPY_SCHEMA));
+
+	spySchemaInit(s);
+
+	return s;
+}
+
+
+void spySchemaClear(SPY_SCHEMA* s)
+{
+	free(s->nodes);
+	free(s->children);
+	free(s->stats);
+	free(s->order);
+
+	s->order = NULL;
+	s->orderCount = 0;
+	s->orderValid = 0;
+
+	spySchemaInit(s);
+}
+
+
+void spySchemaDelete(SPY_SCHEMA* s)
+{
+	if (s == NULL)
+		return;
+
+	free(s->nodes);
+	free(s->children);
+	free(s->stats);
+	free(s->order);
+	free(s);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Segments
+
+static int spySchemaIsHex(char c)
+{
+	return isxdigit((unsigned char)c);
+}
+
+
+static int spySchemaAllDigits(const char* p, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		if (!isdigit((unsigned char)p[i]))
+			return 0;
+	}
+
+	return length > 0;
+}
+
+
+// 8-4-4-4-12 hex digits
+static int spySchemaIsUuid(const char* p, size_t length)
+{
+	if (length != 36)
+		return 0;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		if ((i == 8) || (i == 13) || (i == 18) || (i == 23))
+		{
+			if (p[i] != '-')
+				return 0;
+		}
+		else if (!spySchemaIsHex(p[i]))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+// YYYY-MM or YYYY-MM-DD, maybe followed by a time after T or a space
+static int spySchemaIsDate(const char* p, size_t length)
+{
+	if (   (length < 7)
+		|| !spySchemaAllDigits(p, 4) || (p[4] != '-') || !spySchemaAllDigits(p + 5, 2))
+	{
+		return 0;
+	}
+
+	size_t i = 7;
+
+	if ((length >= 10) && (p[7] == '-') && spySchemaAllDigits(p + 8, 2))
+		i = 10;
+
+	return (i == length) || (p[i] == 'T') || (p[i] == ' ');
+}
+
+
+static int spySchemaClassify(const char* p, size_t length)
+{
+	int letters = 0;
+	int digits = 0;
+	int hex = 1;
+	int word = 1;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char c = (unsigned char)p[i];
+
+		if (isdigit(c))
+			digits++;
+		else if (isalpha(c))
+			letters++;
+		else if ((c != '-') && (c != '_'))
+			word = 0;
+
+		if (!isxdigit(c))
+			hex = 0;
+	}
+
+	if ((length > 0) && (digits == (int)length))
+		return SPY_SCHEMA_INT;
+
+	if (spySchemaIsUuid(p, length))
+		return SPY_SCHEMA_UUID;
+
+	if (spySchemaIsDate(p, length))
+		return SPY_SCHEMA_DATE;
+
+	// Digests: md5, sha1, object ids
+	if (hex && (length >= 8))
+		return SPY_SCHEMA_HEX;
+
+	// Session tokens and other generated ids
+	if (word && (length >= 16) && letters && digits)
+		return SPY_SCHEMA_ID;
+
+	if (length > SPY_SCHEMA_MAX_LITERAL_LEN)
+		return SPY_SCHEMA_STR;
+
+	return SPY_SCHEMA_LITERAL;
+}
+
+
+static int spySchemaTypeIndex(const char* type)
+{
+	for (int i = 0; i < SPY_SCHEMA_TYPE_OTHER; i++)
+	{
+		if (strcmp(type, g_spySchemaTypeNames[i]) == 0)
+			return i;
+	}
+
+	return SPY_SCHEMA_TYPE_OTHER;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Child lookup
+
+static unsigned int spySchemaHash(unsigned int parent, char separator, int kind,
+								  const char* literal, size_t length)
+{
+	// FNV-1a, seeded with the parent
+	unsigned int h = 2166136261u ^ (parent * 16777619u);
+
+	h = (h ^ (unsigned char)separator) * 16777619u;
+	h = (h ^ (unsigned char)kind) * 16777619u;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		h ^= (unsigned char)literal[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+static int spySchemaIsChild(SPY_SCHEMA* s, unsigned int node, unsigned int parent, char separator,
+							int kind, const char* literal, size_t length)
+{
+	SPY_SCHEMA_NODE* n = &s->nodes[node];
+
+	return    (n->parent == parent)
+		   && (n->separator == separator)
+		   && (n->kind == kind)
+		   && (n->literalLength == length)
+		   && (memcmp(n->literal, literal, length) == 0);
+}
+
+
+// The slot holding the child, or the free slot it would go in
+static unsigned int spySchemaSlot(SPY_SCHEMA* s, unsigned int parent, char separator,
+								  int kind, const char* literal, size_t length)
+{
+	unsigned int mask = s->childrenSize - 1;
+	unsigned int slot = spySchemaHash(parent, separator, kind, literal, length) & mask;
+
+	while (   s->children[slot]
+		   && !spySchemaIsChild(s, s->children[slot], parent, separator, kind, literal, length))
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+
+static void spySchemaGrowChildren(SPY_SCHEMA* s)
+{
+	free(s->children);
+
+	s->childrenSize *= 2;
+	s->children = calloc(s->childrenSize, sizeof(unsigned int));
+
+	for (unsigned int i = 1; i < s->nodeCount; i++)
+	{
+		SPY_SCHEMA_NODE* n = &s->nodes[i];
+		unsigned int slot = spySchemaSlot(s, n->parent, n->separator, n->kind,
+										  n->literal, n->literalLength);
+
+		s->children[slot] = i;
+	}
+}
+
+
+static unsigned int spySchemaAddNode(SPY_SCHEMA* s, unsigned int parent, char separator,
+									 int kind, const char* literal, size_t length)
+{
+	if (s->nodeCount == SPY_SCHEMA_MAX_NODES)
+		return 0;
+
+	if (s->nodeCount == s->nodeCapacity)
+	{
+		s->nodeCapacity *= 2;
+		s->nodes = realloc(s->nodes, s->nodeCapacity * sizeof(SPY_SCHEMA_NODE));
+	}
+
+	unsigned int node = s->nodeCount++;
+	SPY_SCHEMA_NODE* n = &s->nodes[node];
+
+	memset(n, 0, sizeof(SPY_SCHEMA_NODE));
+
+	n->parent = parent;
+	n->separator = separator;
+	n->kind = (unsigned char)kind;
+	n->literalLength = (unsigned char)length;
+	n->stats = -1;
+	memcpy(n->literal, literal, length);
+
+	if (kind == SPY_SCHEMA_LITERAL)
+		s->nodes[parent].literals++;
+
+	if (2 * s->nodeCount > s->childrenSize)
+		spySchemaGrowChildren(s);
+	else
+		s->children[spySchemaSlot(s, parent, separator, kind, literal, length)] = node;
+
+	return node;
+}
+
+
+// The child for a segment, made if create is set. A node that already has
+// its fill of literals sends new ones to its {str} child. 0 if there is
+// no child and none can be made.
+static unsigned int spySchemaChild(SPY_SCHEMA* s, unsigned int parent, char separator,
+								   int kind, const char* segment, size_t length, int create)
+{
+	const char* literal = (kind == SPY_SCHEMA_LITERAL) ? segment : "";
+	size_t literalLength = (kind == SPY_SCHEMA_LITERAL) ? length : 0;
+
+	unsigned int child = s->children[spySchemaSlot(s, parent, separator, kind, literal, literalLength)];
+
+	if (child)
+		return child;
+
+	if ((kind == SPY_SCHEMA_LITERAL) && (s->nodes[parent].literals >= SPY_SCHEMA_MAX_LITERALS))
+		return spySchemaChild(s, parent, separator, SPY_SCHEMA_STR, "", 0, create);
+
+	return create ? spySchemaAddNode(s, parent, separator, kind, literal, literalLength) : 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Statistics
+
+static unsigned int spySchemaBucket(long long value)
+{
+	if (value < 4)
+		return (value < 0) ? 0 : (unsigned int)value;
+
+	unsigned int octave = 2;
+
+	while ((octave < 62) && (value >> (octave + 1)))
+		octave++;
+	unsigned int sub = (unsigned int)(value >> (octave - 2)) & 3;
+	unsigned int bucket = 4 + (octave - 2) * 4 + sub;
+
+	return MIN(bucket, SPY_SCHEMA_BUCKETS - 1);
+}
+
+
+// Middle of a bucket's range
+static long long spySchemaBucketValue(unsigned int bucket)
+{
+	if (bucket < 4)
+		return bucket;
+
+	unsigned int octave = (bucket - 4) / 4 + 2;
+	unsigned int sub = (bucket - 4) % 4;
+	long long width = 1LL << (octave - 2);
+
+	return (4 + sub) * width + width / 2;
+}
+
+
+static void spySchemaCount(unsigned int* counter, int sign)
+{
+	if (sign > 0)
+		(*counter)++;
+	else if (*counter > 0)
+		(*counter)--;
+}
+
+
+static SPY_SCHEMA_STATS* spySchemaStatsFor(SPY_SCHEMA* s, unsigned int node, int create)
+{
+	if (node == 0)
+		return &s->stats[0];
+
+	SPY_SCHEMA_NODE* n = &s->nodes[node];
+
+	if (n->stats >= 0)
+		return &s->stats[n->stats];
+
+	if (!create || (s->statsCount == SPY_SCHEMA_MAX_TEMPLATES + 1))
+		return &s->stats[0];
+
+	if (s->statsCount == s->statsCapacity)
+	{
+		s->statsCapacity *= 2;
+		s->stats = realloc(s->stats, s->statsCapacity * sizeof(SPY_SCHEMA_STATS));
+	}
+
+	n->stats = (int)s->statsCount++;
+
+	SPY_SCHEMA_STATS* t = &s->stats[n->stats];
+
+	memset(t, 0, sizeof(SPY_SCHEMA_STATS));
+	t->node = node;
+
+	return t;
+}
+
+
+void spySchemaUpdate(SPY_SCHEMA* s, const char* key, int sign,
+					 const char* type, long long length, long long memory)
+{
+	int create = (sign > 0);
+	unsigned int node = 0;
+	char separator = 0;
+	const char* p = key;
+
+	while (1)
+	{
+		size_t segmentLength = strcspn(p, SPY_SCHEMA_SEPARATORS);
+		int kind = spySchemaClassify(p, segmentLength);
+
+		// session42 is session{int}
+		size_t digits = 0;
+
+		while ((digits < segmentLength) && isdigit((unsigned char)p[segmentLength - digits - 1]))
+			digits++;
+
+		if ((kind == SPY_SCHEMA_LITERAL) && (digits > 0) && (digits < segmentLength))
+		{
+			node = spySchemaChild(s, node, separator, SPY_SCHEMA_LITERAL,
+								  p, segmentLength - digits, create);
+
+			if (node)
+				node = spySchemaChild(s, node, 0, SPY_SCHEMA_INT, "", 0, create);
+		}
+		else
+		{
+			node = spySchemaChild(s, node, separator, kind, p, segmentLength, create);
+		}
+
+		// Out of room: (other)
+		if ((node == 0) || (p[segmentLength] == '\0'))
+			break;
+
+		separator = p[segmentLength];
+		p += segmentLength + 1;
+	}
+
+	SPY_SCHEMA_STATS* t = spySchemaStatsFor(s, node, create);
+
+	t->keys += sign;
+
+	spySchemaCount(&t->types[spySchemaTypeIndex(type)], sign);
+	spySchemaCount(&t->length[spySchemaBucket(length)], sign);
+
+	if (memory >= 0)
+	{
+		spySchemaCount(&t->memory[spySchemaBucket(memory)], sign);
+	}
+
+	s->orderValid = 0;
+}
+
+
+long long spySchemaPercentile(const unsigned int* histogram, double p)
+{
+	long long total = 0;
+
+	for (unsigned int i = 0; i < SPY_SCHEMA_BUCKETS; i++)
+		total += histogram[i];
+
+	if (total == 0)
+		return -1;
+
+	long long rank = (long long)(p * total);
+	long long seen = 0;
+
+	for (unsigned int i = 0; i < SPY_SCHEMA_BUCKETS; i++)
+	{
+		seen += histogram[i];
+
+		if (seen > rank)
+			return spySchemaBucketValue(i);
+	}
+
+	return spySchemaBucketValue(SPY_SCHEMA_BUCKETS - 1);
+}
+
+
+void spySchemaFormatPercentiles(const unsigned int* histogram, int bytes, char* buffer, unsigned int size)
+{
+	static const double percentiles[] = { 0.5, 0.9, 0.99 };
+	int len = 0;
+
+	buffer[0] = '\0';
+
+	if (spySchemaPercentile(histogram, 0.5) < 0)
+	{
+		snprintf(buffer, size, "-");
+		return;
+	}
+
+	for (unsigned int i = 0; (i < 3) && (len < (int)size); i++)
+	{
+		long long value = spySchemaPercentile(histogram, percentiles[i]);
+		char text[32];
+
+		if (bytes)
+			spyStatsFormatBytes(value, text, sizeof(text));
+		else
+			snprintf(text, sizeof(text), "%lld", value);
+
+		len += snprintf(buffer + len, size - len, "%s%s", i ? "/" : "", text);
+	}
+}
+
+
+void spySchemaFormatTypes(const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size)
+{
+	int shown[SPY_SCHEMA_TYPES];
+	long long total = 0;
+	int len = 0;
+
+	memset(shown, 0, sizeof(shown));
+	buffer[0] = '\0';
+
+	for (int i = 0; i < SPY_SCHEMA_TYPES; i++)
+		total += t->types[i];
+
+	while ((total > 0) && (len < (int)size))
+	{
+		int best = -1;
+
+		for (int i = 0; i < SPY_SCHEMA_TYPES; i++)
+		{
+			if (!shown[i] && t->types[i] && ((best < 0) || (t->types[i] > t->types[best])))
+				best = i;
+		}
+
+		if (best < 0)
+			break;
+
+		shown[best] = 1;
+
+		len += snprintf(buffer + len, size - len, "%s%s %lld%%",
+						len ? " " : "",
+						g_spySchemaTypeNames[best],
+						(long long)t->types[best] * 100 / total);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Templates
+
+static DECLARE_COMPARE_FN(spySchemaCompare, thunk, a, b)
+{
+	SPY_SCHEMA* s = (SPY_SCHEMA*)thunk;
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+
+	// Most keys first, (other) last
+	if ((x == 0) || (y == 0))
+		return (x == 0) - (y == 0);
+
+	if (s->stats[x].keys != s->stats[y].keys)
+		return (s->stats[x].keys > s->stats[y].keys) ? -1 : 1;
+
+	return (x > y) - (x < y);
+}
+
+
+static void spySchemaBuildOrder(SPY_SCHEMA* s)
+{
+	s->order = realloc(s->order, s->statsCount * sizeof(unsigned int));
+	s->orderCount = 0;
+
+	for (unsigned int i = 0; i < s->statsCount; i++)
+	{
+		if (s->stats[i].keys > 0)
+			s->order[s->orderCount++] = i;
+	}
+
+#if defined(DARWIN) || defined(BSD)
+	qsort_r(s->order, s->orderCount, sizeof(unsigned int), s, spySchemaCompare);
+#else
+	qsort_r(s->order, s->orderCount, sizeof(unsigned int), spySchemaCompare, s);
+#endif
+
+	s->orderValid = 1;
+}
+
+
+unsigned int spySchemaTemplateCount(SPY_SCHEMA* s)
+{
+	if (!s->orderValid)
+		spySchemaBuildOrder(s);
+
+	return s->orderCount;
+}
+
+
+SPY_SCHEMA_STATS* spySchemaTemplate(SPY_SCHEMA* s, unsigned int i)
+{
+	if (!s->orderValid)
+		spySchemaBuildOrder(s);
+
+	return (i < s->orderCount) ? &s->stats[s->order[i]] : NULL;
+}
+
+
+// Nodes from the root down to node into path. Returns the count.
+static unsigned int spySchemaPath(SPY_SCHEMA* s, unsigned int node, unsigned int* path, unsigned int max)
+{
+	unsigned int depth = 0;
+
+	for (unsigned int n = node; n && (depth < max); n = s->nodes[n].parent)
+		depth++;
+
+	unsigned int i = depth;
+
+	for (unsigned int n = node; n && (i > 0); n = s->nodes[n].parent)
+		path[--i] = n;
+
+	return depth;
+}
+
+
+void spySchemaTemplateText(SPY_SCHEMA* s, const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size)
+{
+	unsigned int path[SPY_SCHEMA_MAX_TEMPLATE_LEN];
+	unsigned int depth = spySchemaPath(s, t->node, path, SPY_SCHEMA_MAX_TEMPLATE_LEN);
+	int len = 0;
+
+	buffer[0] = '\0';
+
+	if (t->node == 0)
+	{
+		snprintf(buffer, size, "(other)");
+		return;
+	}
+
+	for (unsigned int i = 0; (i < depth) && (len < (int)size); i++)
+	{
+		SPY_SCHEMA_NODE* n = &s->nodes[path[i]];
+
+		if (n->separator && (len < (int)size))
+			buffer[len++] = n->separator;
+
+		if (n->kind == SPY_SCHEMA_LITERAL)
+		{
+			len += snprintf(buffer + len, size - len, "%.*s", (int)n->literalLength, n->literal);
+		}
+		else
+		{
+			len += snprintf(buffer + len, size - len, "%s", g_spySchemaClassNames[n->kind]);
+		}
+	}
+
+	buffer[MIN(len, (int)size - 1)] = '\0';
+}
+
+
+int spySchemaTemplateGlob(SPY_SCHEMA* s, const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size)
+{
+	unsigned int path[SPY_SCHEMA_MAX_TEMPLATE_LEN];
+	unsigned int depth = spySchemaPath(s, t->node, path, SPY_SCHEMA_MAX_TEMPLATE_LEN);
+	unsigned int len = 0;
+
+	if (t->node == 0)
+		return -1;
+
+	for (unsigned int i = 0; i < depth; i++)
+	{
+		SPY_SCHEMA_NODE* n = &s->nodes[path[i]];
+
+		if (n->separator && (len + 1 < size))
+			buffer[len++] = n->separator;
+
+		if (n->kind != SPY_SCHEMA_LITERAL)
+		{
+			if (len + 1 < size)
+				buffer[len++] = '*';
+
+			continue;
+		}
+
+		for (unsigned int j = 0; j < n->literalLength; j++)
+		{
+			if (strchr("*?[]\\", n->literal[j]) && (len + 1 < size))
+				buffer[len++] = '\\';
+
+			if (len + 1 < size)
+				buffer[len++] = n->literal[j];
+		}
+	}
+
+	buffer[len] = '\0';
+
+	return (len + 1 < size) ? 0 : -1;
+}
+
+
+size_t spySchemaMemory(SPY_SCHEMA* s)
+{
+	return   sizeof(SPY_SCHEMA)
+		   + (size_t)s->nodeCapacity * sizeof(SPY_SCHEMA_NODE)
+		   + (size_t)s->childrenSize * sizeof(unsigned int)
+		   + (size_t)s->statsCapacity * sizeof(SPY_SCHEMA_STATS)
+		   + (size_t)(s->order ? s->statsCount : 0) * sizeof(unsigned int);
+}
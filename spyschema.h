@@ -0,0 +1,121 @@
+#ifndef _SPYSCHEMA_H_
+#define _SPYSCHEMA_H_
+
+#include <stddef.h>
+
+// Key templates inferred from key names, such as user:{int}:session:{uuid}.
+// Keys are split into segments on SPY_SCHEMA_SEPARATORS and segments that
+// look like values (numbers, UUIDs, hex digests, dates, random ids) are
+// replaced by their class. Templates are paths in a tree of segments;
+// each carries the key count, the type mix and histograms of length and
+// memory to read percentiles from.
+//
+// Memory is bounded however many keys go through. A node takes at most
+// SPY_SCHEMA_MAX_LITERALS distinct literal segments; further ones share
+// a {str} child. Once SPY_SCHEMA_MAX_NODES nodes or SPY_SCHEMA_MAX_TEMPLATES
+// templates exist, keys that would need a new one are counted under
+// "(other)". Nothing is ever freed before a clear, so a key is filed the
+// same way when it is taken away as when it was added.
+
+#define SPY_SCHEMA_SEPARATORS		":/|#"
+#define SPY_SCHEMA_MAX_NODES		16384
+#define SPY_SCHEMA_MAX_TEMPLATES	2048
+#define SPY_SCHEMA_MAX_LITERALS		32
+#define SPY_SCHEMA_MAX_LITERAL_LEN	32
+#define SPY_SCHEMA_MAX_TEMPLATE_LEN	256
+
+// Segment classes
+#define SPY_SCHEMA_LITERAL			0
+#define SPY_SCHEMA_INT				1
+#define SPY_SCHEMA_HEX				2
+#define SPY_SCHEMA_UUID				3
+#define SPY_SCHEMA_DATE				4
+#define SPY_SCHEMA_ID				5
+#define SPY_SCHEMA_STR				6
+
+// Type mix
+#define SPY_SCHEMA_TYPE_STRING		0
+#define SPY_SCHEMA_TYPE_LIST		1
+#define SPY_SCHEMA_TYPE_SET			2
+#define SPY_SCHEMA_TYPE_ZSET		3
+#define SPY_SCHEMA_TYPE_HASH		4
+#define SPY_SCHEMA_TYPE_STREAM		5
+#define SPY_SCHEMA_TYPE_OTHER		6	// including not read yet
+#define SPY_SCHEMA_TYPES			7
+
+// Log-linear histogram: exact below 4, then four buckets per power of two
+#define SPY_SCHEMA_BUCKETS			188
+
+typedef struct _spy_schema_stats
+{
+	unsigned int	node;			// the template's last segment, 0 for (other)
+	long long		keys;
+	unsigned int	types[SPY_SCHEMA_TYPES];
+	unsigned int	length[SPY_SCHEMA_BUCKETS];
+	unsigned int	memory[SPY_SCHEMA_BUCKETS];	// keys with known memory only
+} SPY_SCHEMA_STATS;
+
+typedef struct _spy_schema_node
+{
+	unsigned int	parent;
+	char			separator;		// before the segment, or 0
+	unsigned char	kind;
+	unsigned char	literals;		// distinct literal children
+	unsigned char	literalLength;
+	char			literal[SPY_SCHEMA_MAX_LITERAL_LEN];
+	int				stats;			// keys ending here, or -1
+} SPY_SCHEMA_NODE;
+
+typedef struct _spy_schema
+{
+	SPY_SCHEMA_NODE*	nodes;		// node 0 is the root
+	unsigned int		nodeCount;
+	unsigned int		nodeCapacity;
+
+	// Open-addressed (parent, separator, kind, literal) -> node. 0 marks
+	// a free slot.
+	unsigned int*		children;
+	unsigned int		childrenSize;
+
+	// stats[0] is (other)
+	SPY_SCHEMA_STATS*	stats;
+	unsigned int		statsCount;
+	unsigned int		statsCapacity;
+
+	// Templates with keys, most keys first
+	unsigned int*		order;
+	unsigned int		orderCount;
+	int					orderValid;
+} SPY_SCHEMA;
+
+
+SPY_SCHEMA* spySchemaCreate(void);
+void spySchemaDelete(SPY_SCHEMA* s);
+void spySchemaClear(SPY_SCHEMA* s);
+
+// Add (sign 1) or take away (sign -1) a key. Unknown memory (< 0) is
+// left out of the memory percentiles.
+void spySchemaUpdate(SPY_SCHEMA* s, const char* key, int sign,
+					 const char* type, long long length, long long memory);
+
+unsigned int spySchemaTemplateCount(SPY_SCHEMA* s);
+SPY_SCHEMA_STATS* spySchemaTemplate(SPY_SCHEMA* s, unsigned int i);
+
+// The template as text, user:{int}:name, or as a glob for the key filter,
+// user:*:name. (other) has no glob; that returns -1.
+void spySchemaTemplateText(SPY_SCHEMA* s, const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size);
+int spySchemaTemplateGlob(SPY_SCHEMA* s, const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size);
+
+// Largest types first, "hash 90% string 10%"
+void spySchemaFormatTypes(const SPY_SCHEMA_STATS* t, char* buffer, unsigned int size);
+
+// Approximate value at fraction p (0.5 for the median) of the keys in
+// a histogram, or -1 if it is empty
+long long spySchemaPercentile(const unsigned int* histogram, double p);
+
+// p50/p90/p99 as "480/960/1.2K", or "-" for an empty histogram
+void spySchemaFormatPercentiles(const unsigned int* histogram, int bytes, char* buffer, unsigned int size);
+
+size_t spySchemaMemory(SPY_SCHEMA* s);
+
+#endif
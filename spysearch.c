@@ -0,0 +1,328 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hiredis.h"
+
+#include "spysearch.h"
+
+
+////////////////////////////////////////////////////////////////////////
+// Search script
+//
+// KEYS are a batch of keys. ARGV is the pattern, 'plain' or 'pattern',
+// the time budget in ms, the 1-based key to start at, the position to
+// resume from inside it and the elements to read per step. Returns
+// {next key, position, {key index, where, ...}}; next key is past the
+// end once the batch is done. where is @offset for a string, [index]
+// for a list or zset, the member or field for a set or hash and the
+// entry ID for a stream.
+
+static const char* g_spySearchScript =
+	"local needle, mode = ARGV[1], ARGV[2] "
+	"local budget = tonumber(ARGV[3]) * 1000 "
+	"local i = tonumber(ARGV[4]) "
+	"local pos = ARGV[5] "
+	"local chunk = tonumber(ARGV[6]) "
+	"local function now() "
+	"  local t = redis.call('TIME') "
+	"  return tonumber(t[1]) * 1000000 + tonumber(t[2]) "
+	"end "
+	"local function hit(s) return string.find(s, needle, 1, mode == 'plain') end "
+	"local start = now() "
+	"local found = {} "
+	"while i <= #KEYS do "
+	"  local key = KEYS[i] "
+	"  local t = redis.call('TYPE', key)['ok'] "
+	"  local where, done = nil, true "
+	"  if t == 'string' then "
+	"    local p = hit(redis.call('GET', key)) "
+	"    if p then where = '@' .. (p - 1) end "
+	"  elseif t == 'list' or t == 'zset' then "
+	"    local first = tonumber(pos) or 0 "
+	"    local items = redis.call(t == 'list' and 'LRANGE' or 'ZRANGE', key, first, first + chunk - 1) "
+	"    for j, v in ipairs(items) do "
+	"      if hit(v) then where = '[' .. (first + j - 1) .. ']' break end "
+	"    end "
+	"    if not where and #items == chunk then pos = tostring(first + chunk) done = false end "
+	"  elseif t == 'set' or t == 'hash' then "
+	"    local r = redis.call(t == 'set' and 'SSCAN' or 'HSCAN', key, pos ~= '' and pos or '0', 'COUNT', chunk) "
+	"    local items = r[2] "
+	"    for j, v in ipairs(items) do "
+	"      if hit(v) then "
+	"        if t == 'hash' and j % 2 == 0 then where = items[j - 1] else where = v end "
+	"        break "
+	"      end "
+	"    end "
+	"    if not where and r[1] ~= '0' then pos = r[1] done = false end "
+	"  elseif t == 'stream' then "
+	"    local entries = redis.call('XRANGE', key, pos ~= '' and pos or '-', '+', 'COUNT', chunk + 1) "
+	"    local last = nil "
+	"    for _, e in ipairs(entries) do "
+	"      if e[1] ~= pos then "
+	"        last = e[1] "
+	"        for _, v in ipairs(e[2]) do "
+	"          if hit(v) then where = e[1] break end "
+	"        end "
+	"        if where then break end "
+	"      end "
+	"    end "
+	"    if not where and last then pos = last done = false end "
+	"  end "
+	"  if where then found[#found + 1] = i found[#found + 1] = where end "
+	"  if done then i = i + 1 pos = '' end "
+	"  if now() - start >= budget then break end "
+	"end "
+	"return {i, pos, found}";
+
+
+// Redis-style glob to an anchored Lua pattern. * and ? become .* and .,
+// [...] classes carry over ([!...] and [^...] negate), \x escapes x and
+// Lua's magic characters are escaped. Returns -1 for an unterminated or
+// empty class.
+static int spySearchGlobToPattern(const char* glob, char* pattern, unsigned int size)
+{
+	unsigned int n = 0;
+
+	// Every character takes at most two, plus the anchors
+	if (2 * strlen(glob) + 3 > size)
+		return -1;
+
+	pattern[n++] = '^';
+
+	for (const char* p = glob; *p; p++)
+	{
+		if (*p == '*')
+		{
+			pattern[n++] = '.';
+			pattern[n++] = '*';
+		}
+		else if (*p == '?')
+		{
+			pattern[n++] = '.';
+		}
+		else if (*p == '[')
+		{
+			pattern[n++] = '[';
+			p++;
+
+			if ((*p == '!') || (*p == '^'))
+			{
+				pattern[n++] = '^';
+				p++;
+			}
+
+			if ((*p == ']') || (*p == '\0'))
+				return -1;
+
+			while (*p != ']')
+			{
+				if ((*p == '\\') && p[1])
+					p++;
+
+				if (*p == '\0')
+					return -1;
+
+				if (!isalnum((unsigned char)*p) && (*p != '-'))
+					pattern[n++] = '%';
+
+				pattern[n++] = *p++;
+			}
+
+			pattern[n++] = ']';
+		}
+		else
+		{
+			if ((*p == '\\') && p[1])
+				p++;
+
+			if (!isalnum((unsigned char)*p))
+				pattern[n++] = '%';
+
+			pattern[n++] = *p;
+		}
+	}
+
+	pattern[n++] = '$';
+	pattern[n] = '\0';
+
+	return 0;
+}
+
+
+int spySearchBegin(SPY_SEARCH* s, const char* needle, REDISDATA* rows, unsigned int count)
+{
+	s->glob = (strpbrk(needle, "*?[") != NULL);
+
+	if (s->glob)
+	{
+		if (spySearchGlobToPattern(needle, s->pattern, sizeof(s->pattern)) != 0)
+			return -1;
+	}
+	else
+	{
+		snprintf(s->pattern, sizeof(s->pattern), "%s", needle);
+	}
+
+	s->rows = rows;
+	s->count = count;
+	s->next = 0;
+	s->position[0] = '\0';
+
+	for (unsigned int i = 0; i < count; i++)
+		rows[i].match[0] = '\0';
+
+	return 0;
+}
+
+
+static int spySearchLoadScript(REDIS* redis)
+{
+	redisReply* reply = redisCommand(redis->context, "SCRIPT LOAD %s", g_spySearchScript);
+	if (reply == NULL)
+		return -1;
+
+	int ret = -1;
+
+	if ((reply->type == REDIS_REPLY_STRING) && (reply->len < sizeof(redis->searchSha)))
+	{
+		snprintf(redis->searchSha, sizeof(redis->searchSha), "%s", reply->str);
+		ret = 0;
+	}
+
+	freeReplyObject(reply);
+
+	return ret;
+}
+
+
+static redisReply* spySearchCall(REDIS* redis, SPY_SEARCH* s, unsigned int n)
+{
+	const char* argv[REDISSPY_PIPELINE_BATCH_SIZE + 9];
+	size_t argvlen[REDISSPY_PIPELINE_BATCH_SIZE + 9];
+	char keyCount[16];
+	char budget[16];
+	char chunk[16];
+	int argc = 0;
+
+	snprintf(keyCount, sizeof(keyCount), "%u", n);
+	snprintf(budget, sizeof(budget), "%d", SPY_SEARCH_SLICE_MS);
+	snprintf(chunk, sizeof(chunk), "%d", SPY_SEARCH_CHUNK);
+
+	argv[argc++] = "EVALSHA";
+	argv[argc++] = redis->searchSha;
+	argv[argc++] = keyCount;
+
+	for (unsigned int i = 0; i < n; i++)
+		argv[argc++] = s->rows[s->next + i].key;
+
+	argv[argc++] = s->pattern;
+	argv[argc++] = s->glob ? "pattern" : "plain";
+	argv[argc++] = budget;
+	argv[argc++] = "1";
+	argv[argc++] = s->position;
+	argv[argc++] = chunk;
+
+	for (int i = 0; i < argc; i++)
+		argvlen[i] = strlen(argv[i]);
+
+	return redisCommandArgv(redis->context, argc, argv, argvlen);
+}
+
+
+int spySearchStep(REDIS* redis, SPY_SEARCH* s)
+{
+	if (s->next >= s->count)
+		return 0;
+
+	if (redisSpyEnsureConnected(redis) != 0)
+		return -1;
+
+	// The script starts at KEYS[1], so each call sends the keys from
+	// where the last one stopped.
+	unsigned int n = MIN(REDISSPY_PIPELINE_BATCH_SIZE, s->count - s->next);
+	redisReply* reply = NULL;
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if ((redis->searchSha[0] == '\0') && (spySearchLoadScript(redis) != 0))
+			break;
+
+		reply = spySearchCall(redis, s, n);
+
+		// NOSCRIPT after SCRIPT FLUSH or a failover: load it again
+		if (   (reply != NULL)
+			&& (reply->type == REDIS_REPLY_ERROR)
+			&& (strncmp(reply->str, "NOSCRIPT", 8) == 0))
+		{
+			freeReplyObject(reply);
+			reply = NULL;
+			redis->searchSha[0] = '\0';
+			continue;
+		}
+
+		break;
+	}
+
+	redisSpyCheckConnection(redis);
+
+	if (   (reply == NULL)
+		|| (reply->type != REDIS_REPLY_ARRAY)
+		|| (reply->elements != 3)
+		|| (reply->element[0]->type != REDIS_REPLY_INTEGER)
+		|| (reply->element[1]->type != REDIS_REPLY_STRING)
+		|| (reply->element[2]->type != REDIS_REPLY_ARRAY))
+	{
+		if (reply)
+			freeReplyObject(reply);
+
+		return -1;
+	}
+
+	redisReply* found = reply->element[2];
+
+	for (size_t i = 0; i + 1 < found->elements; i += 2)
+	{
+		long long index = found->element[i]->integer;
+		redisReply* where = found->element[i + 1];
+
+		if ((index < 1) || (index > (long long)n) || (where->type != REDIS_REPLY_STRING))
+			continue;
+
+		REDISDATA* row = &s->rows[s->next + index - 1];
+
+		// An empty match would read as no match
+		if (where->len == 0)
+			strcpy(row->match, "\"\"");
+		else
+			snprintf(row->match, sizeof(row->match), "%.*s", (int)where->len, where->str);
+	}
+
+	s->next += (unsigned int)MIN(reply->element[0]->integer - 1, (long long)n);
+	snprintf(s->position, sizeof(s->position), "%s", reply->element[1]->str);
+
+	freeReplyObject(reply);
+
+	return (s->next < s->count) ? 1 : 0;
+}
+
+
+unsigned int spySearchEnd(SPY_SEARCH* s)
+{
+	unsigned int kept = 0;
+
+	for (unsigned int i = 0; i < s->count; i++)
+	{
+		if (s->rows[i].match[0] == '\0')
+			continue;
+
+		if (kept != i)
+			s->rows[kept] = s->rows[i];
+
+		kept++;
+	}
+
+	return kept;
+}
@@ -0,0 +1,45 @@
+#ifndef _SPYSEARCH_H_
+#define _SPYSEARCH_H_
+
+#include "spymodel.h"
+
+// Server-side value search. A Lua script checks the values of a batch of
+// keys against a substring, or against a glob when the needle contains
+// *, ? or [, and returns only the keys that match and where. Each call
+// stops after SPY_SEARCH_SLICE_MS, between keys or part way through a
+// collection, and the next call resumes from there, so a big key never
+// holds the server for long and a search can be cancelled between steps.
+
+#define SPY_SEARCH_SLICE_MS			20
+#define SPY_SEARCH_CHUNK			256		// elements read per collection step
+#define SPY_SEARCH_MAX_POSITION_LEN	64
+
+typedef struct _spy_search
+{
+	// Lua pattern for a glob, or the needle itself for a substring
+	char			pattern[2 * REDISSPY_MAX_PATTERN_LEN + 3];
+	int				glob;
+
+	REDISDATA*		rows;
+	unsigned int	count;
+
+	// rows[0..next) are finished. position is where the script stopped
+	// inside rows[next]: a list or zset index, a SCAN cursor or a
+	// stream ID. Empty to start from the beginning.
+	unsigned int	next;
+	char			position[SPY_SEARCH_MAX_POSITION_LEN];
+} SPY_SEARCH;
+
+
+// Returns -1 if the needle is not a valid glob. rows may be NULL to just
+// check the needle.
+int spySearchBegin(SPY_SEARCH* s, const char* needle, REDISDATA* rows, unsigned int count);
+
+// Runs one time slice. Returns 1 while there is more to do, 0 once every
+// row has been checked, -1 on errors (including scripting being off).
+int spySearchStep(REDIS* redis, SPY_SEARCH* s);
+
+// Moves the matching rows to the front. Returns how many there are.
+unsigned int spySearchEnd(SPY_SEARCH* s);
+
+#endif
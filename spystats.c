@@ -0,0 +1,87 @@
+// getrusage and sysconf are POSIX, not C99
+#if !defined(__APPLE__)
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#include "spystats.h"
+
+
+long long spyStatsResidentBytes(void)
+{
+#if defined(__APPLE__)
+	struct mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+				  (task_info_t)&info, &count) != KERN_SUCCESS)
+	{
+		return -1;
+	}
+
+	return info.resident_size;
+#else
+	// Second field of statm is resident pages
+	FILE* f = fopen("/proc/self/statm", "r");
+	long long size = 0;
+	long long resident = 0;
+
+	if (f == NULL)
+		return -1;
+
+	int n = fscanf(f, "%lld %lld", &size, &resident);
+	fclose(f);
+
+	if (n != 2)
+		return -1;
+
+	return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+long long spyStatsPeakResidentBytes(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+#if defined(__APPLE__)
+	return usage.ru_maxrss;
+#else
+	// Kilobytes everywhere else
+	return usage.ru_maxrss * 1024LL;
+#endif
+}
+
+
+void spyStatsFormatBytes(long long bytes, char* buffer, unsigned int size)
+{
+	const char* units = "BKMGT";
+	double value = bytes;
+
+	if (bytes < 0)
+	{
+		snprintf(buffer, size, "?");
+		return;
+	}
+
+	while ((value >= 1024) && (units[1] != '\0'))
+	{
+		value /= 1024;
+		units++;
+	}
+
+	if (*units == 'B')
+		snprintf(buffer, size, "%lldB", bytes);
+	else
+		snprintf(buffer, size, "%.2f%c", value, *units);
+}
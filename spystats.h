@@ -0,0 +1,14 @@
+#ifndef _SPYSTATS_H_
+#define _SPYSTATS_H_
+
+// Client-side instrumentation: how much memory redisspy itself is using,
+// as opposed to the server figures on the status line.
+
+// Current and peak resident set size in bytes, or -1 if unknown
+long long spyStatsResidentBytes(void);
+long long spyStatsPeakResidentBytes(void);
+
+// 1536 -> "1.50K", as redis formats used_memory_human
+void spyStatsFormatBytes(long long bytes, char* buffer, unsigned int size);
+
+#endif
@@ -0,0 +1,411 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spyutils.h"
+#include "spytree.h"
+
+#define SPY_TREE_DEFAULT_DELIMITER	":"
+
+
+static void spyTreeInit(SPY_TREE* t)
+{
+	t->nodeCapacity = 256;
+	t->nodes = calloc(t->nodeCapacity, sizeof(SPY_TREE_NODE));
+	t->nodeCount = 1;
+
+	// The root is always open
+	t->nodes[0].expanded = 1;
+
+	t->childrenSize = 512;
+	t->children = calloc(t->childrenSize, sizeof(unsigned int));
+}
+
+
+SPY_TREE* spyTreeCreate(const char* delimiter)
+{
+	SPY_TREE* t = malloc(sizeof(SPY_TREE));
+
+	memset(t, 0, sizeof(SPY_TREE));
+
+	if ((delimiter == NULL) || (delimiter[0] == '\0'))
+		delimiter = SPY_TREE_DEFAULT_DELIMITER;
+
+	snprintf(t->delimiter, sizeof(t->delimiter), "%s", delimiter);
+	t->sortBy = SPY_TREE_SORT_NAME;
+
+	spyTreeInit(t);
+
+	return t;
+}
+
+
+void spyTreeClear(SPY_TREE* t)
+{
+	free(t->nodes);
+	free(t->names);
+	free(t->children);
+	free(t->rows);
+
+	t->nodes = NULL;
+	t->names = NULL;
+	t->namesLength = 0;
+	t->namesCapacity = 0;
+	t->children = NULL;
+	t->rows = NULL;
+	t->rowCount = 0;
+	t->rowCapacity = 0;
+	t->rowsValid = 0;
+
+	spyTreeInit(t);
+}
+
+
+void spyTreeDelete(SPY_TREE* t)
+{
+	if (t == NULL)
+		return;
+
+	free(t->nodes);
+	free(t->names);
+	free(t->children);
+	free(t->rows);
+	free(t);
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Child lookup
+
+static unsigned int spyTreeHash(unsigned int parent, const char* name, size_t length)
+{
+	// FNV-1a, seeded with the parent
+	unsigned int h = 2166136261u ^ (parent * 16777619u);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+
+static int spyTreeIsChild(SPY_TREE* t, unsigned int node, unsigned int parent,
+						  const char* name, size_t length)
+{
+	SPY_TREE_NODE* n = &t->nodes[node];
+
+	return    (n->parent == parent)
+		   && (n->nameLength == length)
+		   && (memcmp(t->names + n->name, name, length) == 0);
+}
+
+
+// The slot holding the child, or the free slot it would go in
+static unsigned int spyTreeSlot(SPY_TREE* t, unsigned int parent, const char* name, size_t length)
+{
+	unsigned int mask = t->childrenSize - 1;
+	unsigned int slot = spyTreeHash(parent, name, length) & mask;
+
+	while (t->children[slot] && !spyTreeIsChild(t, t->children[slot], parent, name, length))
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+
+static void spyTreeGrowChildren(SPY_TREE* t)
+{
+	free(t->children);
+
+	t->childrenSize *= 2;
+	t->children = calloc(t->childrenSize, sizeof(unsigned int));
+
+	for (unsigned int i = 1; i < t->nodeCount; i++)
+	{
+		SPY_TREE_NODE* n = &t->nodes[i];
+		unsigned int slot = spyTreeSlot(t, n->parent, t->names + n->name, n->nameLength);
+
+		t->children[slot] = i;
+	}
+}
+
+
+static unsigned int spyTreeAddNode(SPY_TREE* t, unsigned int parent, const char* name, size_t length)
+{
+	if (t->nodeCount == t->nodeCapacity)
+	{
+		t->nodeCapacity *= 2;
+		t->nodes = realloc(t->nodes, t->nodeCapacity * sizeof(SPY_TREE_NODE));
+	}
+
+	if (t->namesLength + length > t->namesCapacity)
+	{
+		t->namesCapacity = MAX(2 * t->namesCapacity, t->namesLength + length + 4096);
+		t->names = realloc(t->names, t->namesCapacity);
+	}
+
+	unsigned int node = t->nodeCount++;
+	SPY_TREE_NODE* n = &t->nodes[node];
+
+	memset(n, 0, sizeof(SPY_TREE_NODE));
+
+	n->parent = parent;
+	n->name = t->namesLength;
+	n->nameLength = length;
+	n->depth = parent ? t->nodes[parent].depth + 1 : 0;
+
+	memcpy(t->names + t->namesLength, name, length);
+	t->namesLength += length;
+
+	n->nextSibling = t->nodes[parent].firstChild;
+	t->nodes[parent].firstChild = node;
+
+	if (2 * t->nodeCount > t->childrenSize)
+		spyTreeGrowChildren(t);
+	else
+		t->children[spyTreeSlot(t, parent, name, length)] = node;
+
+	return node;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Aggregates
+
+static void spyTreeApply(SPY_TREE_NODE* n, int sign, long long length, long long memory)
+{
+	n->keys += sign;
+	n->length += sign * length;
+	n->memory += sign * memory;
+}
+
+
+void spyTreeUpdate(SPY_TREE* t, const char* key, int sign, long long length, long long memory)
+{
+	size_t delimiterLength = strlen(t->delimiter);
+	unsigned int node = 0;
+	const char* p = key;
+
+	if (memory < 0)
+		memory = 0;
+
+	spyTreeApply(&t->nodes[0], sign, length, memory);
+
+	while (1)
+	{
+		const char* end = strstr(p, t->delimiter);
+		size_t nameLength = end ? (size_t)(end - p) : strlen(p);
+
+		unsigned int child = t->children[spyTreeSlot(t, node, p, nameLength)];
+
+		if (child == 0)
+		{
+			// Taking away a key that was never added
+			if (sign < 0)
+				break;
+
+			child = spyTreeAddNode(t, node, p, nameLength);
+		}
+
+		spyTreeApply(&t->nodes[child], sign, length, memory);
+		node = child;
+
+		if (end == NULL)
+		{
+			t->nodes[node].keysHere += sign;
+			break;
+		}
+
+		p = end + delimiterLength;
+	}
+
+	t->rowsValid = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Visible rows
+
+static DECLARE_COMPARE_FN(spyTreeCompare, thunk, a, b)
+{
+	SPY_TREE* t = (SPY_TREE*)thunk;
+	const SPY_TREE_NODE* x = &t->nodes[*(const unsigned int*)a];
+	const SPY_TREE_NODE* y = &t->nodes[*(const unsigned int*)b];
+
+	// Biggest first
+	long long r = 0;
+
+	if (t->sortBy == SPY_TREE_SORT_KEYS)
+		r = y->keys - x->keys;
+	else if (t->sortBy == SPY_TREE_SORT_LENGTH)
+		r = y->length - x->length;
+	else if (t->sortBy == SPY_TREE_SORT_MEMORY)
+		r = y->memory - x->memory;
+
+	if (r != 0)
+		return (r > 0) ? 1 : -1;
+
+	int c = memcmp(t->names + x->name, t->names + y->name, MIN(x->nameLength, y->nameLength));
+
+	if (c != 0)
+		return c;
+
+	return (int)x->nameLength - (int)y->nameLength;
+}
+
+
+static void spyTreeAddRow(SPY_TREE* t, unsigned int node)
+{
+	if (t->rowCount == t->rowCapacity)
+	{
+		t->rowCapacity = t->rowCapacity ? 2 * t->rowCapacity : 256;
+		t->rows = realloc(t->rows, t->rowCapacity * sizeof(unsigned int));
+	}
+
+	t->rows[t->rowCount++] = node;
+}
+
+
+// Nodes whose keys have all gone are left in place but not shown
+static void spyTreeAddChildRows(SPY_TREE* t, unsigned int node)
+{
+	unsigned int n = 0;
+
+	for (unsigned int c = t->nodes[node].firstChild; c; c = t->nodes[c].nextSibling)
+	{
+		if (t->nodes[c].keys > 0)
+			n++;
+	}
+
+	if (n == 0)
+		return;
+
+	unsigned int* children = malloc(n * sizeof(unsigned int));
+	unsigned int i = 0;
+
+	for (unsigned int c = t->nodes[node].firstChild; c; c = t->nodes[c].nextSibling)
+	{
+		if (t->nodes[c].keys > 0)
+			children[i++] = c;
+	}
+
+#if defined(DARWIN) || defined(BSD)
+	qsort_r(children, n, sizeof(unsigned int), t, spyTreeCompare);
+#else
+	qsort_r(children, n, sizeof(unsigned int), spyTreeCompare, t);
+#endif
+
+	for (i = 0; i < n; i++)
+	{
+		spyTreeAddRow(t, children[i]);
+
+		if (t->nodes[children[i]].expanded)
+			spyTreeAddChildRows(t, children[i]);
+	}
+
+	free(children);
+}
+
+
+static void spyTreeBuildRows(SPY_TREE* t)
+{
+	t->rowCount = 0;
+
+	spyTreeAddChildRows(t, 0);
+
+	t->rowsValid = 1;
+}
+
+
+void spyTreeSort(SPY_TREE* t, int sortBy)
+{
+	t->sortBy = sortBy;
+	t->rowsValid = 0;
+}
+
+
+int spyTreeToggle(SPY_TREE* t, unsigned int node)
+{
+	if ((node == 0) || (node >= t->nodeCount) || (t->nodes[node].firstChild == 0))
+		return -1;
+
+	t->nodes[node].expanded = !t->nodes[node].expanded;
+	t->rowsValid = 0;
+
+	return 0;
+}
+
+
+unsigned int spyTreeRowCount(SPY_TREE* t)
+{
+	if (!t->rowsValid)
+		spyTreeBuildRows(t);
+
+	return t->rowCount;
+}
+
+
+unsigned int spyTreeRowNode(SPY_TREE* t, unsigned int row)
+{
+	if (!t->rowsValid)
+		spyTreeBuildRows(t);
+
+	return (row < t->rowCount) ? t->rows[row] : 0;
+}
+
+
+SPY_TREE_NODE* spyTreeRow(SPY_TREE* t, unsigned int row)
+{
+	unsigned int node = spyTreeRowNode(t, row);
+
+	return node ? &t->nodes[node] : NULL;
+}
+
+
+const char* spyTreeName(SPY_TREE* t, const SPY_TREE_NODE* node, unsigned int* length)
+{
+	*length = node->nameLength;
+
+	return t->names + node->name;
+}
+
+
+int spyTreePath(SPY_TREE* t, unsigned int node, char* buffer, unsigned int size)
+{
+	unsigned int path[256];
+	unsigned int depth = 0;
+	int len = 0;
+
+	for (unsigned int n = node; n && (depth < sizeof(path) / sizeof(path[0])); n = t->nodes[n].parent)
+		path[depth++] = n;
+
+	buffer[0] = '\0';
+
+	while (depth > 0)
+	{
+		SPY_TREE_NODE* n = &t->nodes[path[--depth]];
+
+		if (len < (int)size)
+		{
+			len += snprintf(buffer + len, size - len, "%.*s%s",
+							(int)n->nameLength, t->names + n->name,
+							depth ? t->delimiter : "");
+		}
+	}
+
+	return (len < (int)size) ? 0 : -1;
+}
+
+
+size_t spyTreeMemory(SPY_TREE* t)
+{
+	return   sizeof(SPY_TREE)
+		   + (size_t)t->nodeCapacity * sizeof(SPY_TREE_NODE)
+		   + t->namesCapacity
+		   + (size_t)t->childrenSize * sizeof(unsigned int)
+		   + (size_t)t->rowCapacity * sizeof(unsigned int);
+}
@@ -0,0 +1,87 @@
+#ifndef _SPYTREE_H_
+#define _SPYTREE_H_
+
+// Key namespaces as a prefix tree. Keys are split on a delimiter
+// (service:entity:id:field under ':') and every node carries the number
+// of keys at or below it, their summed length and their summed memory.
+// Aggregates are kept up to date by adding and subtracting rows as they
+// change, never by walking the keys again. The visible rows are the
+// root's children and the children of expanded nodes, rebuilt when
+// asked for after a change.
+
+#define SPY_TREE_MAX_DELIMITER_LEN	8
+
+#define SPY_TREE_SORT_NAME			0
+#define SPY_TREE_SORT_KEYS			1
+#define SPY_TREE_SORT_LENGTH		2
+#define SPY_TREE_SORT_MEMORY		3
+
+typedef struct _spy_tree_node
+{
+	unsigned int	parent;
+	unsigned int	firstChild;		// 0 if none; the root is node 0
+	unsigned int	nextSibling;
+
+	size_t			name;			// offset into names
+	unsigned int	nameLength;
+	unsigned int	depth;			// 0 for the root's children
+
+	int				expanded;
+	unsigned int	keysHere;		// keys ending at this node
+
+	long long		keys;			// keys at or below this node
+	long long		length;
+	long long		memory;
+} SPY_TREE_NODE;
+
+typedef struct _spy_tree
+{
+	char			delimiter[SPY_TREE_MAX_DELIMITER_LEN];
+
+	SPY_TREE_NODE*	nodes;
+	unsigned int	nodeCount;
+	unsigned int	nodeCapacity;
+
+	char*			names;
+	size_t			namesLength;
+	size_t			namesCapacity;
+
+	// Open-addressed (parent, name) -> node. 0 marks a free slot.
+	unsigned int*	children;
+	unsigned int	childrenSize;
+
+	// Visible rows, as node numbers
+	unsigned int*	rows;
+	unsigned int	rowCount;
+	unsigned int	rowCapacity;
+	int				rowsValid;
+
+	int				sortBy;
+} SPY_TREE;
+
+
+SPY_TREE* spyTreeCreate(const char* delimiter);
+void spyTreeDelete(SPY_TREE* t);
+void spyTreeClear(SPY_TREE* t);
+
+// Add (sign 1) or take away (sign -1) a key's count, length and memory.
+// Unknown memory (< 0) counts as 0.
+void spyTreeUpdate(SPY_TREE* t, const char* key, int sign, long long length, long long memory);
+
+void spyTreeSort(SPY_TREE* t, int sortBy);
+
+// Expand a collapsed node or collapse an expanded one. Returns -1 for a
+// node without children.
+int spyTreeToggle(SPY_TREE* t, unsigned int node);
+
+unsigned int spyTreeRowCount(SPY_TREE* t);
+SPY_TREE_NODE* spyTreeRow(SPY_TREE* t, unsigned int row);
+unsigned int spyTreeRowNode(SPY_TREE* t, unsigned int row);
+
+// The node's name, delimited path from the root up to and including it
+int spyTreePath(SPY_TREE* t, unsigned int node, char* buffer, unsigned int size);
+const char* spyTreeName(SPY_TREE* t, const SPY_TREE_NODE* node, unsigned int* length);
+
+size_t spyTreeMemory(SPY_TREE* t);
+
+#endif
@@ -0,0 +1,462 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "spytrigram.h"
+
+// Keys posted between checks of the clock
+#define SPY_TRIGRAM_STEP_KEYS		1024
+
+#define SPY_TRIGRAM_MAX_QUERY_GRAMS	256
+
+// ASCII only, and much cheaper than tolower in the lookup scans
+#define SPY_TRIGRAM_LOWER(c)	((((c) >= 'A') && ((c) <= 'Z')) ? (c) + ('a' - 'A') : (c))
+
+
+SPY_TRIGRAM* spyTrigramCreate(void)
+{
+	SPY_TRIGRAM* t = malloc(sizeof(SPY_TRIGRAM));
+
+	memset(t, 0, sizeof(SPY_TRIGRAM));
+
+	return t;
+}
+
+
+void spyTrigramClear(SPY_TRIGRAM* t)
+{
+	for (unsigned int i = 0; i < t->tableSize; i++)
+		free(t->postings[i].ids);
+
+	free(t->names);
+	free(t->offsets);
+	free(t->grams);
+	free(t->postings);
+	free(t->scores);
+	free(t->touched);
+
+	memset(t, 0, sizeof(SPY_TRIGRAM));
+}
+
+
+void spyTrigramDelete(SPY_TRIGRAM* t)
+{
+	if (t == NULL)
+		return;
+
+	spyTrigramClear(t);
+	free(t);
+}
+
+
+void spyTrigramAdd(SPY_TRIGRAM* t, const char* key)
+{
+	size_t length = strlen(key) + 1;
+
+	if (t->namesLength + length > t->namesCapacity)
+	{
+		t->namesCapacity = MAX(2 * t->namesCapacity, t->namesLength + length + 4096);
+		t->names = realloc(t->names, t->namesCapacity);
+	}
+
+	if (t->count == t->capacity)
+	{
+		unsigned int capacity = t->capacity ? 2 * t->capacity : 256;
+
+		t->offsets = realloc(t->offsets, capacity * sizeof(size_t));
+		t->scores = realloc(t->scores, capacity);
+		t->touched = realloc(t->touched, capacity * sizeof(unsigned int));
+
+		memset(t->scores + t->capacity, 0, capacity - t->capacity);
+		t->capacity = capacity;
+	}
+
+	memcpy(t->names + t->namesLength, key, length);
+	t->offsets[t->count++] = t->namesLength;
+	t->namesLength += length;
+}
+
+
+unsigned int spyTrigramCount(SPY_TRIGRAM* t)
+{
+	return t->count;
+}
+
+
+unsigned int spyTrigramPending(SPY_TRIGRAM* t)
+{
+	return t->count - t->indexed;
+}
+
+
+const char* spyTrigramKey(SPY_TRIGRAM* t, unsigned int id)
+{
+	return (id < t->count) ? t->names + t->offsets[id] : NULL;
+}
+
+
+static unsigned int spyTrigramPack(const char* s)
+{
+	const unsigned char* u = (const unsigned char*)s;
+
+	return   ((unsigned int)SPY_TRIGRAM_LOWER(u[0]) << 16)
+		   | ((unsigned int)SPY_TRIGRAM_LOWER(u[1]) << 8)
+		   |  (unsigned int)SPY_TRIGRAM_LOWER(u[2]);
+}
+
+
+static unsigned int spyTrigramSlot(SPY_TRIGRAM* t, unsigned int gram)
+{
+	unsigned int mask = t->tableSize - 1;
+	unsigned int slot = (gram * 2654435761u) & mask;
+
+	while (t->grams[slot] && (t->grams[slot] != gram))
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+
+static void spyTrigramGrow(SPY_TRIGRAM* t)
+{
+	unsigned int* grams = t->grams;
+	SPY_TRIGRAM_POSTING* postings = t->postings;
+	unsigned int size = t->tableSize;
+
+	t->tableSize = size ? 2 * size : 4096;
+	t->grams = calloc(t->tableSize, sizeof(unsigned int));
+	t->postings = calloc(t->tableSize, sizeof(SPY_TRIGRAM_POSTING));
+
+	for (unsigned int i = 0; i < size; i++)
+	{
+		if (grams[i] == 0)
+			continue;
+
+		unsigned int slot = spyTrigramSlot(t, grams[i]);
+
+		t->grams[slot] = grams[i];
+		t->postings[slot] = postings[i];
+	}
+
+	free(grams);
+	free(postings);
+}
+
+
+static SPY_TRIGRAM_POSTING* spyTrigramFind(SPY_TRIGRAM* t, unsigned int gram)
+{
+	if (t->tableSize == 0)
+		return NULL;
+
+	unsigned int slot = spyTrigramSlot(t, gram);
+
+	return t->grams[slot] ? &t->postings[slot] : NULL;
+}
+
+
+static void spyTrigramPost(SPY_TRIGRAM* t, unsigned int id)
+{
+	const char* key = t->names + t->offsets[id];
+	size_t length = strlen(key);
+
+	for (size_t i = 0; i + 3 <= length; i++)
+	{
+		if (2 * (t->gramCount + 1) > t->tableSize)
+			spyTrigramGrow(t);
+
+		unsigned int gram = spyTrigramPack(key + i);
+		unsigned int slot = spyTrigramSlot(t, gram);
+		SPY_TRIGRAM_POSTING* p = &t->postings[slot];
+
+		if (t->grams[slot] == 0)
+		{
+			t->grams[slot] = gram;
+			t->gramCount++;
+		}
+
+		// A trigram the key has twice is posted once
+		if (p->count && (p->ids[p->count - 1] == id))
+			continue;
+
+		if (p->count == p->capacity)
+		{
+			p->capacity = p->capacity ? 2 * p->capacity : 4;
+			p->ids = realloc(p->ids, p->capacity * sizeof(unsigned int));
+		}
+
+		p->ids[p->count++] = id;
+	}
+}
+
+
+static double spyTrigramElapsedMs(const struct timeval* start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_usec - start->tv_usec) / 1e3;
+}
+
+
+int spyTrigramIndexStep(SPY_TRIGRAM* t, unsigned int budgetMs)
+{
+	struct timeval start;
+	gettimeofday(&start, NULL);
+
+	while (t->indexed < t->count)
+	{
+		spyTrigramPost(t, t->indexed++);
+
+		if (   ((t->indexed % SPY_TRIGRAM_STEP_KEYS) == 0)
+			&& (spyTrigramElapsedMs(&start) >= budgetMs))
+		{
+			break;
+		}
+	}
+
+	return t->indexed < t->count;
+}
+
+
+////////////////////////////////////////////////////////////////////////
+// Lookup
+
+typedef struct
+{
+	unsigned int	id;
+	unsigned int	shared;
+	int				substring;
+	int				prefix;
+	size_t			length;
+} SPY_TRIGRAM_HIT;
+
+
+// Offset of query in key ignoring case, or -1
+static long spyTrigramFindText(const char* key, const char* query, size_t queryLength)
+{
+	const unsigned char* k = (const unsigned char*)key;
+	const unsigned char* q = (const unsigned char*)query;
+	unsigned char first = SPY_TRIGRAM_LOWER(q[0]);
+
+	for (; *k; k++)
+	{
+		if (SPY_TRIGRAM_LOWER(*k) != first)
+			continue;
+
+		size_t i = 1;
+
+		while ((i < queryLength) && k[i] && (SPY_TRIGRAM_LOWER(k[i]) == SPY_TRIGRAM_LOWER(q[i])))
+			i++;
+
+		if (i == queryLength)
+			return (const char*)k - key;
+	}
+
+	return -1;
+}
+
+
+static int spyTrigramHasId(const SPY_TRIGRAM_POSTING* p, unsigned int id)
+{
+	unsigned int lo = 0;
+	unsigned int hi = p->count;
+
+	while (lo < hi)
+	{
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (p->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo < p->count) && (p->ids[lo] == id);
+}
+
+
+static int spyTrigramBetter(const SPY_TRIGRAM_HIT* a, const SPY_TRIGRAM_HIT* b)
+{
+	if (a->shared != b->shared)
+		return a->shared > b->shared;
+
+	if (a->substring != b->substring)
+		return a->substring > b->substring;
+
+	if (a->prefix != b->prefix)
+		return a->prefix > b->prefix;
+
+	if (a->length != b->length)
+		return a->length < b->length;
+
+	return a->id < b->id;
+}
+
+
+// Insert into the best-first hits[0..*count), keeping at most max
+static void spyTrigramRank(SPY_TRIGRAM* t, SPY_TRIGRAM_HIT* hits, unsigned int* count,
+						   unsigned int max, unsigned int id, unsigned int shared,
+						   const char* query, size_t queryLength)
+{
+	const char* key = t->names + t->offsets[id];
+	long at = spyTrigramFindText(key, query, queryLength);
+
+	SPY_TRIGRAM_HIT hit;
+	hit.id = id;
+	hit.shared = shared;
+	hit.substring = (at >= 0);
+	hit.prefix = (at == 0);
+	hit.length = strlen(key);
+
+	if ((*count == max) && !spyTrigramBetter(&hit, &hits[max - 1]))
+		return;
+
+	unsigned int i = (*count < max) ? (*count)++ : max - 1;
+
+	while ((i > 0) && spyTrigramBetter(&hit, &hits[i - 1]))
+	{
+		hits[i] = hits[i - 1];
+		i--;
+	}
+
+	hits[i] = hit;
+}
+
+
+unsigned int spyTrigramLookup(SPY_TRIGRAM* t, const char* query,
+							  unsigned int* ids, unsigned int max)
+{
+	size_t queryLength = strlen(query);
+	unsigned int found = 0;
+
+	if ((max == 0) || (queryLength == 0))
+		return 0;
+
+	SPY_TRIGRAM_HIT* hits = malloc(max * sizeof(SPY_TRIGRAM_HIT));
+
+	if (queryLength < 3)
+	{
+		// Too short for a trigram; scan the names instead
+		for (unsigned int id = 0; id < t->count; id++)
+		{
+			if (spyTrigramFindText(t->names + t->offsets[id], query, queryLength) >= 0)
+				spyTrigramRank(t, hits, &found, max, id, 0, query, queryLength);
+		}
+	}
+	else
+	{
+		unsigned int grams[SPY_TRIGRAM_MAX_QUERY_GRAMS];
+		SPY_TRIGRAM_POSTING* lists[SPY_TRIGRAM_MAX_QUERY_GRAMS];
+		unsigned int gramCount = 0;
+		unsigned int touched = 0;
+
+		for (size_t i = 0; (i + 3 <= queryLength) && (gramCount < SPY_TRIGRAM_MAX_QUERY_GRAMS); i++)
+		{
+			unsigned int gram = spyTrigramPack(query + i);
+			unsigned int j = 0;
+
+			while ((j < gramCount) && (grams[j] != gram))
+				j++;
+
+			if (j == gramCount)
+				grams[gramCount++] = gram;
+		}
+
+		// Rarest first. A trigram no key has sorts first, with nothing.
+		for (unsigned int g = 0; g < gramCount; g++)
+		{
+			SPY_TRIGRAM_POSTING* p = spyTrigramFind(t, grams[g]);
+			unsigned int size = p ? p->count : 0;
+			unsigned int j = g;
+
+			while ((j > 0) && ((lists[j - 1] ? lists[j - 1]->count : 0) > size))
+			{
+				lists[j] = lists[j - 1];
+				j--;
+			}
+
+			lists[j] = p;
+		}
+
+		// A key sharing threshold of the trigrams has at least one of the
+		// gramCount - threshold + 1 rarest, so only those lists are walked
+		// for candidates. The common ones are then probed per candidate,
+		// or walked if that would be cheaper.
+		unsigned int threshold = (gramCount + 1) / 2;
+		unsigned int seeds = gramCount - threshold + 1;
+
+		for (unsigned int g = 0; g < gramCount; g++)
+		{
+			SPY_TRIGRAM_POSTING* p = lists[g];
+			if (p == NULL)
+				continue;
+
+			if (g < seeds)
+			{
+				for (unsigned int i = 0; i < p->count; i++)
+				{
+					unsigned int id = p->ids[i];
+
+					if (t->scores[id] == 0)
+						t->touched[touched++] = id;
+
+					if (t->scores[id] < 255)
+						t->scores[id]++;
+				}
+			}
+			else if ((unsigned long long)touched * 20 < p->count)
+			{
+				for (unsigned int i = 0; i < touched; i++)
+				{
+					unsigned int id = t->touched[i];
+
+					if ((t->scores[id] < 255) && spyTrigramHasId(p, id))
+						t->scores[id]++;
+				}
+			}
+			else
+			{
+				for (unsigned int i = 0; i < p->count; i++)
+				{
+					unsigned int id = p->ids[i];
+
+					if (t->scores[id] && (t->scores[id] < 255))
+						t->scores[id]++;
+				}
+			}
+		}
+
+		for (unsigned int i = 0; i < touched; i++)
+		{
+			unsigned int id = t->touched[i];
+
+			if (t->scores[id] >= threshold)
+				spyTrigramRank(t, hits, &found, max, id, t->scores[id], query, queryLength);
+
+			t->scores[id] = 0;
+		}
+	}
+
+	for (unsigned int i = 0; i < found; i++)
+		ids[i] = hits[i].id;
+
+	free(hits);
+
+	return found;
+}
+
+
+size_t spyTrigramMemory(SPY_TRIGRAM* t)
+{
+	size_t bytes = sizeof(SPY_TRIGRAM) + t->namesCapacity;
+
+	bytes += (size_t)t->capacity * (sizeof(size_t) + 1 + sizeof(unsigned int));
+	bytes += (size_t)t->tableSize * (sizeof(unsigned int) + sizeof(SPY_TRIGRAM_POSTING));
+
+	for (unsigned int i = 0; i < t->tableSize; i++)
+		bytes += (size_t)t->postings[i].capacity * sizeof(unsigned int);
+
+	return bytes;
+}
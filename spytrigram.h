@@ -0,0 +1,68 @@
+#ifndef _SPYTRIGRAM_H_
+#define _SPYTRIGRAM_H_
+
+#include <stddef.h>
+
+// Trigram index over key names for the fuzzy goto prompt. Keys are added
+// as they are loaded, which only copies the name; their trigrams are
+// posted later in time-boxed steps so a large refresh doesn't stall the
+// UI. Ids are never reused and removed keys are not taken out: callers
+// check the keys a lookup returns and rebuild once too many are stale.
+// Matching ignores case.
+
+typedef struct _spy_trigram_posting
+{
+	unsigned int*	ids;		// ascending
+	unsigned int	count;
+	unsigned int	capacity;
+} SPY_TRIGRAM_POSTING;
+
+typedef struct _spy_trigram
+{
+	// Key names by id, back to back with their NULs
+	char*			names;
+	size_t			namesLength;
+	size_t			namesCapacity;
+	size_t*			offsets;
+	unsigned int	count;
+	unsigned int	capacity;
+
+	// Ids [0, indexed) are in the postings
+	unsigned int	indexed;
+
+	// Open-addressed table of trigram -> posting. 0 marks a free slot;
+	// key bytes are never 0, so neither is a packed trigram.
+	unsigned int*			grams;
+	SPY_TRIGRAM_POSTING*	postings;
+	unsigned int			tableSize;
+	unsigned int			gramCount;
+
+	// Lookup scratch: shared trigrams per id, and the ids touched
+	unsigned char*	scores;
+	unsigned int*	touched;
+} SPY_TRIGRAM;
+
+
+SPY_TRIGRAM* spyTrigramCreate(void);
+void spyTrigramDelete(SPY_TRIGRAM* t);
+void spyTrigramClear(SPY_TRIGRAM* t);
+
+void spyTrigramAdd(SPY_TRIGRAM* t, const char* key);
+
+// Post pending keys for up to budgetMs. Returns 1 if some are left.
+int spyTrigramIndexStep(SPY_TRIGRAM* t, unsigned int budgetMs);
+
+unsigned int spyTrigramCount(SPY_TRIGRAM* t);
+unsigned int spyTrigramPending(SPY_TRIGRAM* t);
+const char* spyTrigramKey(SPY_TRIGRAM* t, unsigned int id);
+
+// Best matches for query, best first, into ids[0..max). Keys sharing
+// at least half the query's trigrams are ranked by how many they share,
+// then whole-substring matches, then shorter keys. Queries under three
+// characters are matched as substrings by a scan. Returns the count.
+unsigned int spyTrigramLookup(SPY_TRIGRAM* t, const char* query,
+							  unsigned int* ids, unsigned int max);
+
+size_t spyTrigramMemory(SPY_TRIGRAM* t);
+
+#endif
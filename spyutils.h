@@ -17,7 +17,12 @@
 #define CTRL(char) (char - 'a' + 1)
 
 #define safestrcat(d, s) \
-	strncat(d, s, sizeof(d) - strlen(s) - 1);
+	strncat(d, s, sizeof(d) - strlen(d) - 1);
+
+// C99 has no atomics, so use the GCC/clang builtins
+#define SPY_ATOMIC_LOAD(p)			__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SPY_ATOMIC_LOAD_RELAXED(p)	__atomic_load_n(p, __ATOMIC_RELAXED)
+#define SPY_ATOMIC_STORE(p, v)		__atomic_store_n(p, v, __ATOMIC_RELEASE)
 
 // qsort_r differs in calling conventions between
 // // Linux and DARWIN/BSD.
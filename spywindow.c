@@ -77,6 +77,12 @@ void spyWindowSetHeaderLineText(SPY_WINDOW* w, const char* text)
 
 void spyWindowSetCommandLineText(SPY_WINDOW* w, const char* text)
 {
+	if (text != w->commandText)
+	{
+		strncpy(w->commandText, text, sizeof(w->commandText) - 1);
+		w->commandText[sizeof(w->commandText) - 1] = '\0';
+	}
+
 	spyWindowSetRowText(w, w->commandRow, 0, text);
 	wmove(w->window, w->currentRow, w->currentColumn);
 }
@@ -119,6 +125,15 @@ int spyWindowDraw(SPY_WINDOW* w)
 		w->delegate->fpValueForRow(w->delegate, redisIndex, line, MIN(SPY_WINDOW_MAX_SCREEN_COLS, w->cols));
 
 		mvwaddstr(w->window, i + SPY_WINDOW_HEADER_ROWS, 0, line); // skip the header row
+
+		if (w->highlight[0])
+		{
+			size_t length = strlen(w->highlight);
+
+			for (char* p = strstr(line, w->highlight); p; p = strstr(p + length, w->highlight))
+				mvwchgat(w->window, i + SPY_WINDOW_HEADER_ROWS, p - line, length, A_REVERSE, 0, NULL);
+		}
+
 		++i;
 		++redisIndex;
 	}
@@ -128,10 +143,16 @@ int spyWindowDraw(SPY_WINDOW* w)
 	if (w->currentRow > i)
 		w->currentRow = i;
 
+	// ...or above it, if the data set was empty on the last draw.
+	if ((w->currentRow < SPY_WINDOW_HEADER_ROWS) && (i > 0))
+		w->currentRow = SPY_WINDOW_HEADER_ROWS;
+
 	w->delegate->fpStatusText(w->delegate, status, MIN(SPY_WINDOW_MAX_SCREEN_COLS, w->cols), redisIndex);
 
 	spyWindowSetStatusLineText(w, status);
 
+	spyWindowSetRowText(w, w->commandRow, 0, w->commandText);
+
 	wmove(w->window, w->currentRow, w->currentColumn);
 
 	wrefresh(w->window);
@@ -150,12 +171,20 @@ SPY_WINDOW* spyWindowCreate(SPY_WINDOW* parent)
 		w->window = initscr();
 		cbreak();
 		noecho();
+
+		// Esc is a command on its own, so don't sit on it for long
+		// waiting to see if it starts an escape sequence.
+		set_escdelay(SPY_WINDOW_ESC_DELAY_MS);
 	}
 	else
 	{
 		w->window = newwin(parent->rows, parent->cols, 0, 0);
 	}
 
+	// Decode arrow keys rather than passing them through as
+	// Esc-prefixed sequences.
+	keypad(w->window, TRUE);
+
 	getmaxyx(w->window, w->rows, w->cols);
 
 	w->displayRows = w->rows - 3; // Header, Status, Command
@@ -170,6 +199,8 @@ SPY_WINDOW* spyWindowCreate(SPY_WINDOW* parent)
 	w->currentColumn = 0;
 
 	w->lastCommand[0] = '\0';
+	w->commandText[0] = '\0';
+	w->highlight[0] = '\0';
 
 	clear();
 	wrefresh(w->window);
@@ -335,6 +366,40 @@ int spyWindowMoveToBottom(SPY_WINDOW* w)
 }
 
 
+// Put the cursor on row index, scrolling so it is on screen. Keeps a
+// full page of rows visible when index is near the end.
+int spyWindowMoveToIndex(SPY_WINDOW* w, unsigned int index)
+{
+	unsigned int rowCount = w->delegate->fpRowCount(w->delegate);
+
+	if (index >= rowCount)
+	{
+		beep();
+		return 0;
+	}
+
+	unsigned int start = index;
+
+	if (start + w->displayRows > rowCount)
+		start = (rowCount > w->displayRows) ? rowCount - w->displayRows : 0;
+
+	w->startIndex = start;
+	w->currentRow = index - start + SPY_WINDOW_HEADER_ROWS;
+	w->currentColumn = 0;
+
+	spyWindowDraw(w);
+
+	return 0;
+}
+
+
+void spyWindowSetHighlight(SPY_WINDOW* w, const char* text)
+{
+	strncpy(w->highlight, text, sizeof(w->highlight) - 1);
+	w->highlight[sizeof(w->highlight) - 1] = '\0';
+}
+
+
 void spyWindowResetCursor(SPY_WINDOW* w)
 {
 	w->startIndex = 0;
@@ -360,6 +425,14 @@ int spyWindowGetLastCommand(SPY_WINDOW* w, char* command, int commandLength)
 
 
 int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* str, int max)
+{
+	return spyWindowGetCommandLive(w, prompt, str, max, NULL, NULL);
+}
+
+
+// onEdit may redraw the window; the prompt and text are put back after.
+int spyWindowGetCommandLive(SPY_WINDOW* w, const char* prompt, char* str, int max,
+							SPY_WINDOW_EDIT_FN onEdit, void* context)
 {
 	char	command[SPY_WINDOW_MAX_COMMAND_LEN];
 
@@ -382,16 +455,21 @@ int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* str, int max)
 
 	while (!done && !cancelled)
 	{
-		char c = wgetch(w->window);
+		int c = wgetch(w->window);
+		int edited = 0;
 
 		switch (c)
 		{
+			case ERR: // Poll timeout
+				break;
+
 			case 27: // Escape
 				cancelled = 1;
 				beep();
 				break;
 
 			case 127: // Delete
+			case KEY_BACKSPACE:
 				if (idx > 0)
 				{
 					col--;
@@ -399,6 +477,7 @@ int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* str, int max)
 					command[idx] = 0;
 					wmove(w->window, row, col);
 					wdelch(w->window);
+					edited = 1;
 				}
 				break;
 
@@ -418,12 +497,13 @@ int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* str, int max)
 				break;
 
 			default:
-				if (isprint(c) && (idx < SPY_WINDOW_MAX_COMMAND_LEN))
+				if ((c < 256) && isprint(c) && (idx < SPY_WINDOW_MAX_COMMAND_LEN - 1))
 				{
 					winsch(w->window, c);
 
 					col++;
 					command[idx++] = c;
+					edited = 1;
 
 					wmove(w->window, row, col);
 					wrefresh(w->window);
@@ -434,6 +514,16 @@ int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* str, int max)
 				}
 				break;
 		}
+
+		if (edited && onEdit)
+		{
+			onEdit(w, command, context);
+
+			spyWindowSetRowText(w, row, 0, prompt);
+			mvwaddstr(w->window, row, startCol, command);
+			wmove(w->window, row, col);
+			wrefresh(w->window);
+		}
 	}
 
 	spyWindowSetCommandLineText(w, "");
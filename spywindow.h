@@ -22,6 +22,8 @@
 
 #define SPY_WINDOW_MIN_KEY_FIELD_WIDTH	16
 
+#define SPY_WINDOW_ESC_DELAY_MS		25
+
 
 typedef struct _spy_window_delegate
 {
@@ -33,6 +35,11 @@ typedef struct _spy_window_delegate
 } SPY_WINDOW_DELEGATE;
 
 
+struct _spy_window;
+
+// Called by spyWindowGetCommandLive after each edit to the command line
+typedef void (*SPY_WINDOW_EDIT_FN)(struct _spy_window* w, const char* text, void* context);
+
 typedef struct _spy_window
 {
 	WINDOW*			window;
@@ -53,6 +60,12 @@ typedef struct _spy_window
 
 	char			lastCommand[SPY_WINDOW_MAX_COMMAND_LEN];
 
+	// Kept so redraws between keystrokes don't wipe it
+	char			commandText[SPY_WINDOW_MAX_SCREEN_COLS];
+
+	// Shown in reverse video wherever it appears in a row
+	char			highlight[SPY_WINDOW_MAX_COMMAND_LEN];
+
 	SPY_WINDOW_DELEGATE*	delegate;
 
 } SPY_WINDOW;
@@ -80,12 +93,15 @@ void spyWindowSetCommandLineText(SPY_WINDOW* w, const char* text);
 void spyWindowSetStatusLineText(SPY_WINDOW* w, const char* text);
 
 int spyWindowGetCommand(SPY_WINDOW* w, const char* prompt, char* command, int max);
+int spyWindowGetCommandLive(SPY_WINDOW* w, const char* prompt, char* command, int max,
+							SPY_WINDOW_EDIT_FN onEdit, void* context);
 int spyWindowGetLastCommand(SPY_WINDOW* w, char* command, int max);
 
 int spyWindowDraw(SPY_WINDOW* w);
 
 void spyWindowDeleteChild(SPY_WINDOW* w);
 void spyWindowHighlightCurrentRow(SPY_WINDOW* w, char* key);
+void spyWindowSetHighlight(SPY_WINDOW* w, const char* text);
 
 int spyWindowMoveDown(SPY_WINDOW* w);
 int spyWindowMoveUp(SPY_WINDOW* w);
@@ -95,6 +111,7 @@ int spyWindowPageUp(SPY_WINDOW* w);
 
 int spyWindowMoveToTop(SPY_WINDOW* w);
 int spyWindowMoveToBottom(SPY_WINDOW* w);
+int spyWindowMoveToIndex(SPY_WINDOW* w, unsigned int index);
 
 void spyWindowResetCursor(SPY_WINDOW* w);
 void spyWindowRestoreCursor(SPY_WINDOW* w);